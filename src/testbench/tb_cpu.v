@@ -10,6 +10,10 @@
 
     TEST:       Test to be run (dir. under '../../sw'). Defaults to 'cputest'.
     TIMEOUT:    Timeout in clock cycles. Defaults to 80000.
+    SWDIR:      Root dir of the SW tests, as a string with a trailing slash.
+                Defaults to "../../sw/".
+    COSIM:      If defined, run ion32sim in lockstep with the RTL instead of 
+                writing an execution log. Needs VPI module ion32sim.vpi.
 
 
     # Simulated environment
@@ -25,10 +29,22 @@
     just mirrored all over the memory space(s) but those are the addresses that 
     should be used in the link file.)
 
-    Two I/O registers are simulated on the data bus:
+    Three I/O registers are simulated on the data bus:
 
     0xffff8000      Console output. 
     0xffff8018      Test outcome. Write anything to end test.
+    0xffff8030      Mark. Displays the value written and the cycle count, 
+                    for cycle counts of parts of a program (see sw/bench).
+
+
+    # Lockstep co-simulation
+    ~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    With macro COSIM defined, every event that would go to the execution log
+    (register write-back, memory read or memory write) is instead passed to 
+    the ISS through system function $ion32sim_check, which steps the ISS up 
+    to its next log event and compares both. The simulation is stopped at the
+    first mismatch. The ISS loads the same test as the TB, from software.bin.
 
 
     TODO Interrupt simulation register missing. Interrupts not simulated at all.
@@ -51,16 +67,28 @@
 `define TIMEOUT 80000
 `endif
 
+// Directory of the SW tests, with trailing slash. Absolute when the TB is run
+// from outside sim/iv, e.g. from the work dirs of the regression runner.
+`ifndef SWDIR
+`define SWDIR "../../sw/"
+`endif
+
 
 // Non-overrideable test configuration stuff.
-`define SWDIR "../../sw/"
 `define STRINGIFY(x) `"x`"
 `define TEST_STR `STRINGIFY(`TEST)
 
+// Kinds of execution log event, as in ion32sim's exec_log.h.
+`define LOG_REG             0
+`define LOG_RD              1
+`define LOG_WR              3
+
 // Address of concole output register.
 `define IO_CON_OUT          32'hffff8000
 // Address of test termination register.
 `define IO_TERMINATE        32'hffff8018
+// Address of mark register.
+`define IO_MARK             32'hffff8030
 // Size of simulated memory in bytes.
 `define RAM_SIZE_BYTES      (128*1024)
 // I'll have to clean this up eventually and do a real memory interface. 
@@ -173,9 +201,14 @@ module testbench;
         // does not 'happen' on the writeback stage.
         if (uut.s4_en & uut.s34r_wb_en & ~uut.s4_st & uut.s34r_load_en) begin
             if (~mem_log_done) begin 
+`ifdef COSIM
+                cosim_check_task(`LOG_RD, 
+                    s34r_pc, mem_log_addr, 2**mem_log_size, mem_log_rdata);
+`else
                 $fwrite(logfile,
                     "(%08h) [%08h] <%1d>=%08h RD\n", 
                     s34r_pc, mem_log_addr, 2**mem_log_size, mem_log_rdata);   
+`endif
                 mem_log_done = 1'b1;
             end 
         end
@@ -183,15 +216,25 @@ module testbench;
         if (uut.s4_en & uut.s34r_wb_en & ~uut.s4_st) begin
             if ((uut.s34r_rd_index != 0) && 
                 (uut.s42r_rbank[uut.s34r_rd_index] !== uut.s4_wb_data)) begin
+`ifdef COSIM
+                cosim_check_task(`LOG_REG, 
+                    s34r_pc, uut.s34r_rd_index, 0, uut.s4_wb_data);
+`else
                 $fwrite(logfile,
                     "(%08H) [%02h]=%08h\n", s34r_pc, uut.s34r_rd_index, uut.s4_wb_data); 
+`endif
             end   
         end
         // Log change to COP0 CSR caused by writeback, if any.
         if (uut.s4_en & uut.s34r_wb_csr_en & ~uut.s4_st) begin
             if ((uut.s34r_csr_xindex != 4'hf)) begin
+`ifdef COSIM
+                cosim_check_task(`LOG_REG, 
+                    0, uut.s34r_csr_xindex, 0, uut.s34r_alu_res);
+`else
                 $fwrite(logfile,
                     "(%08H) [%02h]=%08h\n", 0, uut.s34r_csr_xindex, uut.s34r_alu_res); 
+`endif
             end   
         end 
         if (~uut.s2_st) s23r_pc <= uut.s12r_pc;
@@ -357,6 +400,11 @@ module testbench;
                     $write("%c", data_wdata[31:24]);
                     $fflush();
                 end
+                // Simulated mark register.
+                if (data_waddr == `IO_MARK) begin
+                    $display("Mark %08h at cycle %0d", data_wdata, 
+                             cycle_counter);
+                end
                 // Simulated test outcome register.
                 if (data_waddr == `IO_TERMINATE) begin
                     $display("Simulation terminated by SW command.");
@@ -400,12 +448,28 @@ module testbench;
     integer i;
     integer logfile;
     integer confile;
+    reg dump_waves;
     initial begin
+`ifdef COSIM
+        if (!$ion32sim_init({"--bram=", `SWDIR, `TEST_STR, "/software.bin"})) begin
+            $display("Could not start ion32sim for co-simulation.");
+            $finish;
+        end
+`else
         logfile = $fopen("rtl_sim_log.txt","w");
+`endif
         confile = $fopen("console_log.txt","w");
-        $dumpfile("testbench.vcd");
-        $dumpvars(0, testbench);
-        for (i=1; i<32; i = i + 1) $dumpvars(0, testbench.uut.s42r_rbank[i]);
+        // Co-simulation runs may be long, dump waveforms only if asked to.
+`ifdef COSIM
+        dump_waves = $test$plusargs("vcd");
+`else
+        dump_waves = 1;
+`endif
+        if (dump_waves) begin
+            $dumpfile("testbench.vcd");
+            $dumpvars(0, testbench);
+            for (i=1; i<32; i = i + 1) $dumpvars(0, testbench.uut.s42r_rbank[i]);
+        end
         
         // Assert reset for a long while...
         reset <= 1'b1;    
@@ -442,6 +506,16 @@ module testbench;
     end 
     endtask
 
+    task cosim_check_task([7:0] kind, [31:0] pc, [31:0] addr, [31:0] size, 
+                          [31:0] value);
+    begin
+        if (!$ion32sim_check(kind, pc, addr, size, value)) begin
+            $display("Co-simulation stopped at first mismatch.");
+            $finish;
+        end
+    end
+    endtask
+
     task write_data_task([31:0] addr, [1:0] size, [31:0] data);
     reg [31:0] wdata;
     begin
@@ -469,8 +543,12 @@ module testbench;
         4'b0100: wdata[31:16] = data[31:16];
         default: wdata        = data;
         endcase
+`ifdef COSIM
+        cosim_check_task(`LOG_WR, mem_op_pc, addr, 2**size, wdata);
+`else
         $fwrite(logfile,
             "(%08h) [%08h] <%1d>=%08h WR\n", mem_op_pc, addr, 2**size, wdata);
+`endif
     end
     endtask
 
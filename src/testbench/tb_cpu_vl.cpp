@@ -0,0 +1,484 @@
+/**
+    @file tb_cpu_vl.cpp
+    @brief Verilator test bench for the bare CPU entity in project ION.
+
+    C++ version of tb_cpu.v for fast RTL simulation with Verilator. It models
+    the same environment cycle by cycle -- a 128KB memory block mirrored all
+    over the code and data buses, the console output, test termination and
+    mark registers, code bus wait states -- and writes the same execution log
+    (rtl_sim_log.txt) and console log (console_log.txt). So it can be used
+    instead of Icarus Verilog in the test flow of sim/iv.
+
+    Each *_edge function below reproduces one or more always blocks of
+    tb_cpu.v. They compute the TB registers from the values they had right
+    before the clock edge, as nonblocking assignments do, and the CPU inputs
+    driven by them are applied after the edge.
+
+    Usage:
+        Vtb_cpu_vl [--waits=<n>] [--timeout=<cycles>] [--nolog] <software.hex>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "verilated.h"
+#include "Vtb_cpu_vl.h"
+
+
+/*---- Local macros ----------------------------------------------------------*/
+
+/** Address of console output register */
+#define IO_CON_OUT          (0xffff8000)
+/** Address of test termination register */
+#define IO_TERMINATE        (0xffff8018)
+/** Address of mark register: prints value and cycle count */
+#define IO_MARK             (0xffff8030)
+/** Size of simulated memory in bytes */
+#define RAM_SIZE_BYTES      (128*1024)
+/** Memory block is mirrored all over the memory space */
+#define RAM_BLOCK_ADDR_MASK (0x0001ffff)
+/** tb_cpu.v uses a wider mask for writes; out of range writes are lost */
+#define RAM_WRITE_ADDR_MASK (0x0003ffff)
+/** Number of clock cycles reset is asserted for */
+#define RESET_CYCLES        (10)
+/** Default test timeout in clock cycles */
+#define DEFAULT_TIMEOUT     (80000)
+/** Data bus wait states; only 0 works with the RTL, as in tb_cpu.v */
+#define DATA_WAIT_STATES    (0)
+
+/** Size of the log file buffer */
+#define LOG_BUFFER_SIZE     (1024*1024)
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+/** CPU outputs sampled right before a clock edge */
+typedef struct s_bus {
+    uint32_t code_addr;
+    uint32_t code_trans;
+    uint32_t data_addr;
+    uint32_t data_trans;
+    uint32_t data_size;
+    uint32_t data_wdata;
+    bool data_write;
+} t_bus;
+
+/** Test bench registers; same names as in tb_cpu.v */
+typedef struct s_regs {
+    /* Code bus read port */
+    uint32_t code_wstate_ctr;
+    uint32_t code_addr_reg;
+    bool code_rpending;
+    bool code_ready;
+    uint32_t code_rdata;
+    /* Data bus read/write port */
+    uint32_t data_wstate_ctr;
+    bool data_ready;
+    bool data_wpending;
+    bool data_rpending;
+    bool data_write_valid;
+    uint32_t data_rdata;
+    uint32_t data_waddr;
+    uint32_t data_wsize;
+    uint32_t mem_op_pc;
+    /* Execution log */
+    uint32_t s23r_pc;
+    uint32_t s34r_pc;
+    uint32_t mem_log_addr;
+    uint32_t mem_log_rdata;
+    uint32_t mem_log_size;
+    bool mem_log_done;
+} t_regs;
+
+/** Test bench */
+typedef struct s_tb {
+    Vtb_cpu_vl *uut;
+    t_regs r;                               /**< registers after clock edge */
+    uint32_t memory[RAM_SIZE_BYTES/4];
+    uint32_t code_wait_states;
+    FILE *logfile;                          /**< NULL with --nolog */
+    FILE *confile;
+    uint64_t cycle;                         /**< clock cycles since reset */
+    bool finished;                          /**< $finish was called */
+} t_tb;
+
+
+/*---- Static data -----------------------------------------------------------*/
+
+/** The test bench, too big for the stack */
+static t_tb tb;
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+static void usage(FILE *out){
+    fprintf(out,"Usage:\n");
+    fprintf(out,"    Vtb_cpu_vl [options] <software.hex>\n");
+    fprintf(out,"Options:\n");
+    fprintf(out,"--waits=<n>         : Wait states in code bus cycles (default 0)\n");
+    fprintf(out,"--timeout=<cycles>  : Test timeout in clock cycles (default %d)\n",
+            DEFAULT_TIMEOUT);
+    fprintf(out,"--nolog             : Don't write the execution log\n");
+}
+
+/** Load memory from a file in $readmemh format. */
+static bool load_hex(t_tb *tb, const char *name){
+    FILE *f;
+    char token[64];
+    uint32_t addr = 0;
+    int c;
+
+    f = fopen(name, "r");
+    if(f==NULL){
+        fprintf(stderr, "Can't open file '%s'\n", name);
+        return false;
+    }
+    while(fscanf(f, "%63s", token)==1){
+        if(token[0]=='/' && token[1]=='/'){
+            /* Comment, skip rest of line */
+            while((c = getc(f))!=EOF && c!='\n');
+        }
+        else if(token[0]=='@'){
+            addr = strtoul(token+1, NULL, 16);
+        }
+        else if(addr < RAM_SIZE_BYTES/4){
+            tb->memory[addr++] = strtoul(token, NULL, 16);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/** Byte lanes of a data bus access; size is log2 of the access size. */
+static uint32_t lane_mask(uint32_t addr, uint32_t size){
+    switch(((size & 3) << 2) | (addr & 3)){
+    case 0x3: return 0x000000ff;
+    case 0x2: return 0x0000ff00;
+    case 0x1: return 0x00ff0000;
+    case 0x0: return 0xff000000;
+    case 0x6: return 0x0000ffff;
+    case 0x4: return 0xffff0000;
+    default:  return 0xffffffff;
+    }
+}
+
+/** Task log_read_data_task: save read data to be logged at the WB stage. */
+static void log_read_data(t_regs *r, uint32_t addr, uint32_t size,
+                          uint32_t rdata){
+    uint32_t mask = lane_mask(addr, size);
+
+    /* In the log file, only the byte lanes affected by the load, moved to
+       the LSBs */
+    r->mem_log_rdata = rdata & mask;
+    while(mask!=0 && (mask & 1)==0){
+        mask >>= 1;
+        r->mem_log_rdata >>= 1;
+    }
+    r->mem_log_addr = addr;
+    r->mem_log_size = size & 3;
+    r->mem_log_done = false;
+}
+
+/** Task write_data_task: write memory and log the write. */
+static void write_data(t_tb *tb, const t_regs *old, uint32_t addr,
+                       uint32_t size, uint32_t data){
+    uint32_t mask = lane_mask(addr, size);
+    uint32_t index = (addr & RAM_WRITE_ADDR_MASK) >> 2;
+
+    if(index < RAM_SIZE_BYTES/4){
+        tb->memory[index] = (tb->memory[index] & ~mask) | (data & mask);
+    }
+    if(tb->logfile!=NULL){
+        fprintf(tb->logfile, "(%08x) [%08x] <%d>=%08x WR\n",
+                old->mem_op_pc, addr, 1 << (size & 3), data & mask);
+    }
+}
+
+/** Code bus: wait state counter, address register. */
+static void code_port_edge(t_tb *tb, const t_regs *old, const t_bus *bus,
+                           bool reset){
+    t_regs *r = &(tb->r);
+
+    if(reset){
+        r->code_wstate_ctr = 0;
+        r->code_addr_reg = 0;
+        r->code_rpending = false;
+        return;
+    }
+    if(bus->code_trans==2 && old->code_wstate_ctr==0){
+        r->code_wstate_ctr = tb->code_wait_states;
+        r->code_addr_reg = bus->code_addr;
+        r->code_rpending = true;
+    }
+    else{
+        r->code_wstate_ctr = (old->code_wstate_ctr > 0)?
+                             old->code_wstate_ctr - 1 : 0;
+        if(bus->code_trans==0 && old->code_wstate_ctr==0){
+            r->code_rpending = false;
+        }
+    }
+}
+
+/** Code bus read port, right after the clock edge: drive read data. */
+static void code_read_port(t_tb *tb){
+    t_regs *r = &(tb->r);
+
+    r->code_ready = r->code_rpending && (r->code_wstate_ctr == 0);
+    r->code_rdata = r->code_ready?
+        tb->memory[(r->code_addr_reg & RAM_BLOCK_ADDR_MASK) >> 2] : 0;
+}
+
+/** Data bus read port and wait state counter. */
+static void data_port_edge(t_tb *tb, const t_regs *old, const t_bus *bus,
+                           bool reset){
+    t_regs *r = &(tb->r);
+    bool start = (bus->data_trans==2) && old->data_ready;
+
+    if(reset){
+        r->mem_op_pc = 0;
+        r->data_ready = true;
+        r->data_wpending = false;
+        r->data_rpending = false;
+        r->data_rdata = 0;
+        r->data_wstate_ctr = 0;
+        return;
+    }
+
+    if(start){
+        r->mem_op_pc = bus->data_write? old->s34r_pc : old->s23r_pc;
+        r->data_wpending = (DATA_WAIT_STATES != 0) && bus->data_write;
+        r->data_rpending = (DATA_WAIT_STATES != 0) && !bus->data_write;
+        r->data_waddr = bus->data_addr;
+        r->data_wsize = bus->data_size & 3;
+        r->data_ready = (DATA_WAIT_STATES == 0);
+        if(DATA_WAIT_STATES == 0 && !bus->data_write){
+            if(old->data_write_valid && old->data_waddr==bus->data_addr){
+                /* Word about to be written by the previous write cycle */
+                r->data_rdata = bus->data_wdata;
+            }
+            else{
+                r->data_rdata =
+                    tb->memory[(bus->data_addr & RAM_BLOCK_ADDR_MASK) >> 2];
+            }
+            log_read_data(r, bus->data_addr, bus->data_size, r->data_rdata);
+        }
+    }
+    else if(old->data_wstate_ctr == 1){
+        /* Last clock cycle of wait */
+        r->data_ready = true;
+        r->data_wpending = false;
+        r->data_rpending = false;
+        if(old->data_rpending){
+            r->data_rdata =
+                tb->memory[(old->data_waddr & RAM_BLOCK_ADDR_MASK) >> 2];
+            log_read_data(r, old->data_waddr, old->data_wsize, r->data_rdata);
+        }
+    }
+    else{
+        r->data_rdata = 0;
+    }
+
+    if(start){
+        r->data_wstate_ctr = DATA_WAIT_STATES;
+    }
+    else if(old->data_wstate_ctr > 0){
+        r->data_wstate_ctr = old->data_wstate_ctr - 1;
+    }
+}
+
+/** Data bus write port, console output, test termination and mark registers.
+    Must come after data_port_edge: memory is written after it's read. */
+static void write_port_edge(t_tb *tb, const t_regs *old, const t_bus *bus,
+                            bool reset){
+    t_regs *r = &(tb->r);
+    char c;
+
+    if(reset){
+        r->data_write_valid = false;
+        return;
+    }
+    r->data_write_valid = (bus->data_trans==2 && old->data_ready)?
+                          bus->data_write : false;
+
+    if(old->data_write_valid){
+        write_data(tb, old, old->data_waddr, old->data_wsize, bus->data_wdata);
+
+        if(old->data_waddr == IO_CON_OUT){
+            c = (char)(bus->data_wdata >> 24);
+            fputc(c, tb->confile);
+            putchar(c);
+            fflush(stdout);
+        }
+        if(old->data_waddr == IO_MARK){
+            printf("Mark %08x at cycle %llu\n", bus->data_wdata,
+                   (unsigned long long)tb->cycle);
+        }
+        if(old->data_waddr == IO_TERMINATE){
+            printf("Simulation terminated by SW command.\n");
+            tb->finished = true;
+        }
+    }
+}
+
+/** Execution log block, a little after the clock edge. */
+static void log_edge(t_tb *tb){
+    Vtb_cpu_vl *uut = tb->uut;
+    t_regs *r = &(tb->r);
+    uint32_t s23r_pc = r->s23r_pc;
+
+    /* Memory read cycle, logged when the load reaches the WB stage */
+    if(uut->LOG_WB_O && uut->LOG_LOAD_O && !r->mem_log_done){
+        fprintf(tb->logfile, "(%08x) [%08x] <%d>=%08x RD\n",
+                r->s34r_pc, r->mem_log_addr, 1 << r->mem_log_size,
+                r->mem_log_rdata);
+        r->mem_log_done = true;
+    }
+    /* Change to reg bank caused by writeback, if any */
+    if(uut->LOG_WB_O && uut->LOG_RD_INDEX_O!=0 && uut->LOG_RD_CHANGED_O){
+        fprintf(tb->logfile, "(%08x) [%02x]=%08x\n",
+                r->s34r_pc, (uint32_t)uut->LOG_RD_INDEX_O,
+                (uint32_t)uut->LOG_WB_DATA_O);
+    }
+    /* Change to COP0 CSR caused by writeback, if any */
+    if(uut->LOG_CSR_WB_O && uut->LOG_CSR_INDEX_O!=0xf){
+        fprintf(tb->logfile, "(%08x) [%02x]=%08x\n",
+                0, (uint32_t)uut->LOG_CSR_INDEX_O,
+                (uint32_t)uut->LOG_CSR_DATA_O);
+    }
+    if(!uut->LOG_S2_ST_O) r->s23r_pc = uut->LOG_S12_PC_O;
+    if(!uut->LOG_S3_ST_O) r->s34r_pc = s23r_pc;
+}
+
+/** Drive CPU inputs from the TB registers. */
+static void drive_inputs(t_tb *tb, bool reset){
+    Vtb_cpu_vl *uut = tb->uut;
+
+    uut->RESET_I = reset;
+    uut->CREADY_I = tb->r.code_ready;
+    uut->CRDATA_I = tb->r.code_rdata;
+    uut->CRESP_I = 0;
+    uut->DREADY_I = tb->r.data_ready;
+    uut->DRDATA_I = tb->r.data_rdata;
+    uut->DRESP_I = 0;
+    /* HW interrupts not simulated */
+    uut->HWIRQ_I = 0;
+}
+
+/** Sample CPU outputs. */
+static void sample_bus(t_tb *tb, t_bus *bus){
+    Vtb_cpu_vl *uut = tb->uut;
+
+    bus->code_addr = uut->CADDR_O;
+    bus->code_trans = uut->CTRANS_O;
+    bus->data_addr = uut->DADDR_O;
+    bus->data_trans = uut->DTRANS_O;
+    bus->data_size = uut->DSIZE_O;
+    bus->data_wdata = uut->DWDATA_O;
+    bus->data_write = uut->DWRITE_O;
+}
+
+
+/*---- Main function ---------------------------------------------------------*/
+
+int main(int argc, char **argv){
+    const char *hex_name = NULL;
+    uint32_t timeout = DEFAULT_TIMEOUT;
+    bool nolog = false;
+    uint64_t cycle;
+    t_regs old;
+    t_bus bus;
+    bool reset;
+    int i;
+
+    Verilated::commandArgs(argc, argv);
+
+    for(i=1;i<argc;i++){
+        if(strncmp(argv[i],"--waits=", strlen("--waits="))==0){
+            tb.code_wait_states = strtoul(argv[i]+strlen("--waits="), NULL, 0);
+        }
+        else if(strncmp(argv[i],"--timeout=", strlen("--timeout="))==0){
+            timeout = strtoul(argv[i]+strlen("--timeout="), NULL, 0);
+        }
+        else if(strcmp(argv[i],"--nolog")==0){
+            nolog = true;
+        }
+        else if((strcmp(argv[i],"--help")==0)||(strcmp(argv[i],"-h")==0)){
+            usage(stdout);
+            exit(0);
+        }
+        else if(argv[i][0]=='+'){
+            /* Verilator runtime option */
+        }
+        else if(hex_name==NULL && argv[i][0]!='-'){
+            hex_name = argv[i];
+        }
+        else{
+            fprintf(stderr,"unknown argument '%s'\n\n",argv[i]);
+            usage(stderr);
+            exit(64);
+        }
+    }
+    if(hex_name==NULL){
+        usage(stderr);
+        exit(64);
+    }
+
+    if(!load_hex(&tb, hex_name)){
+        exit(66);
+    }
+    tb.logfile = nolog? NULL : fopen("rtl_sim_log.txt", "w");
+    tb.confile = fopen("console_log.txt", "w");
+    if((tb.logfile==NULL && !nolog) || tb.confile==NULL){
+        fprintf(stderr, "Trouble opening log files\n");
+        exit(2);
+    }
+    if(tb.logfile!=NULL){
+        setvbuf(tb.logfile, NULL, _IOFBF, LOG_BUFFER_SIZE);
+    }
+
+    tb.uut = new Vtb_cpu_vl;
+    tb.uut->CLK = 1;
+    drive_inputs(&tb, true);
+    tb.uut->eval();
+
+    /* Reset for a while, then run until the test terminates itself by
+       writing to the test control register, or times out */
+    for(cycle=1;!tb.finished;cycle++){
+        if(cycle == RESET_CYCLES + (uint64_t)timeout){
+            printf("TIMEOUT\n");
+            break;
+        }
+        reset = (cycle <= RESET_CYCLES);
+        tb.cycle = reset? 0 : cycle - RESET_CYCLES;
+
+        tb.uut->CLK = 0;
+        tb.uut->eval();
+        sample_bus(&tb, &bus);
+        old = tb.r;
+
+        tb.uut->CLK = 1;
+        tb.uut->eval();
+
+        data_port_edge(&tb, &old, &bus, reset);
+        write_port_edge(&tb, &old, &bus, reset);
+        code_port_edge(&tb, &old, &bus, reset);
+        if(tb.finished) break;
+
+        code_read_port(&tb);
+        drive_inputs(&tb, cycle < RESET_CYCLES);
+        tb.uut->eval();
+        if(tb.logfile!=NULL){
+            log_edge(&tb);
+        }
+    }
+
+    tb.uut->final();
+    delete tb.uut;
+    if(tb.logfile!=NULL){
+        fclose(tb.logfile);
+    }
+    fclose(tb.confile);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/**
+    tb_cpu_vl.v -- Verilator top level for the bare CPU entity in project ION.
+
+    The test bench proper -- memory, console output, test termination and
+    execution log -- is the C++ harness in tb_cpu_vl.cpp, which reproduces
+    tb_cpu.v cycle by cycle.
+
+    This module only wraps the CPU, ties off the inputs tb_cpu.v leaves
+    unconnected and brings out the internal signals the execution log is made
+    of, so that the harness does not depend on the way Verilator names
+    internal signals.
+*/
+
+module tb_cpu_vl (
+    input               CLK,
+    input               RESET_I,
+
+    /* Code and data buses, straight from the CPU. */
+    output      [31:0]  CADDR_O,
+    output      [1:0]   CTRANS_O,
+    input       [31:0]  CRDATA_I,
+    input               CREADY_I,
+    input       [1:0]   CRESP_I,
+
+    output      [31:0]  DADDR_O,
+    output      [1:0]   DTRANS_O,
+    output      [2:0]   DSIZE_O,
+    input       [31:0]  DRDATA_I,
+    output      [31:0]  DWDATA_O,
+    output              DWRITE_O,
+    input               DREADY_I,
+    input       [1:0]   DRESP_I,
+
+    input       [4:0]   HWIRQ_I,
+
+    /* Execution log probes; see the log block in tb_cpu.v. */
+    output              LOG_WB_O,           // Reg bank writeback in WB stage.
+    output              LOG_LOAD_O,         // ...and it is a MEM load.
+    output      [4:0]   LOG_RD_INDEX_O,     // Writeback register index.
+    output              LOG_RD_CHANGED_O,   // Writeback changes the register.
+    output      [31:0]  LOG_WB_DATA_O,      // Writeback data.
+    output              LOG_CSR_WB_O,       // CSR writeback in WB stage.
+    output      [3:0]   LOG_CSR_INDEX_O,    // CSR WB target.
+    output      [31:0]  LOG_CSR_DATA_O,     // CSR WB data.
+    output              LOG_S2_ST_O,        // Stage 2 stalled.
+    output              LOG_S3_ST_O,        // Stage 3 stalled.
+    output      [31:0]  LOG_S12_PC_O        // PC of instruction in DE stage.
+);
+
+    cpu #(
+
+    )
+    uut (
+        .CLK            (CLK),
+        .RESET_I        (RESET_I),
+
+        .CADDR_O        (CADDR_O),
+        .CTRANS_O       (CTRANS_O),
+        .CRDATA_I       (CRDATA_I),
+        .CREADY_I       (CREADY_I),
+        .CRESP_I        (CRESP_I),
+
+        .DADDR_O        (DADDR_O),
+        .DTRANS_O       (DTRANS_O),
+        .DSIZE_O        (DSIZE_O),
+        .DRDATA_I       (DRDATA_I),
+        .DWDATA_O       (DWDATA_O),
+        .DWRITE_O       (DWRITE_O),
+        .DREADY_I       (DREADY_I),
+        .DRESP_I        (DRESP_I),
+
+        .HWIRQ_I        (HWIRQ_I),
+        .STALL_I        (1'b0)
+    );
+
+    assign LOG_WB_O = uut.s4_en & uut.s34r_wb_en & ~uut.s4_st;
+    assign LOG_LOAD_O = uut.s34r_load_en;
+    assign LOG_RD_INDEX_O = uut.s34r_rd_index;
+    assign LOG_RD_CHANGED_O =
+        (uut.s42r_rbank[uut.s34r_rd_index] != uut.s4_wb_data);
+    assign LOG_WB_DATA_O = uut.s4_wb_data;
+    assign LOG_CSR_WB_O = uut.s4_en & uut.s34r_wb_csr_en & ~uut.s4_st;
+    assign LOG_CSR_INDEX_O = uut.s34r_csr_xindex;
+    assign LOG_CSR_DATA_O = uut.s34r_alu_res;
+    assign LOG_S2_ST_O = uut.s2_st;
+    assign LOG_S3_ST_O = uut.s3_st;
+    assign LOG_S12_PC_O = uut.s12r_pc;
+
+endmodule
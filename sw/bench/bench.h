@@ -0,0 +1,75 @@
+/**
+    @file bench.h
+    @brief Benchmark suite for the ION core: kernels and support functions.
+
+    Each kernel runs a fixed amount of work and returns a checksum of its
+    results, which main() checks against the expected value. The kernels are
+    plain C and don't touch the TB registers, so they can be built and run
+    on any host too.
+
+    The core has no multiplier, divider or JALR yet (see the Makefile), so
+    the kernels use no '*', '/' or '%' and no function pointers.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*---- TB registers ----------------------------------------------------------*/
+
+/* Only present in ion32sim and the RTL TBs, not on real hardware. */
+
+/** Console output; byte writes */
+#define TB_UART_TX          (0xffff8000)
+/** Writes print the value with the instruction (ISS) or cycle (RTL) count */
+#define TB_MARK             (0xffff8030)
+
+/** Write a word to a TB register */
+#define TB_WRITE(reg, v)    (*(volatile uint32_t *)(reg) = (uint32_t)(v))
+
+
+/*---- Support functions -----------------------------------------------------*/
+
+/** Small xorshift PRNG; 'state' must not be 0. */
+static inline uint32_t bench_rand(uint32_t *state){
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Mix a word into a running checksum. */
+static inline uint32_t bench_mix(uint32_t sum, uint32_t x){
+    sum ^= x;
+    return (sum << 7) + (sum >> 25) + x;
+}
+
+/* Our own, as the compiler may call them for struct copies (string.c) */
+void *memcpy(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+
+
+/*---- Kernels ---------------------------------------------------------------*/
+
+/** Dhrystone-style records, strings and procedure calls (dhry.c) */
+uint32_t bench_dhry(void);
+/** CoreMark-style list processing and state machine (coremark.c) */
+uint32_t bench_coremark(void);
+/** Block copies of assorted sizes and alignments (memops.c) */
+uint32_t bench_memcpy(void);
+/** Block fills of assorted sizes and alignments (memops.c) */
+uint32_t bench_memset(void);
+/** Table driven CRC-32 of a buffer (crc32.c) */
+uint32_t bench_crc32(void);
+/** Quicksort of an array of words (sort.c) */
+uint32_t bench_sort(void);
+/** Bytecode interpreter running a small program (interp.c) */
+uint32_t bench_interp(void);
+
+#endif // BENCH_H
@@ -0,0 +1,360 @@
+/**
+    @file coremark.c
+    @brief CoreMark-style kernel.
+
+    The list processing and state machine parts of CoreMark, with its CRC-16
+    over all the results: finding, reversing and merge sorting a linked list,
+    and splitting a string into numbers with a state machine.
+
+    Not CoreMark proper: the matrix part is left out as the core has no
+    multiplier, and the list is sorted by one of two keys selected with a
+    flag instead of a compare function, as the core has no JALR.
+*/
+
+#include "bench.h"
+
+
+/** Iterations of the kernel */
+#define CM_ITERATIONS       (12)
+/** Nodes in the list */
+#define LIST_SIZE           (64)
+/** Size of the input of the state machine */
+#define STATE_INPUT_SIZE    (512)
+
+
+typedef struct s_data {
+    int16_t data16;
+    int16_t idx;
+} t_data;
+
+typedef struct s_node {
+    struct s_node *next;
+    t_data *info;
+} t_node;
+
+typedef enum {
+    S_START, S_INVALID, S_S1, S_S2, S_INT, S_FLOAT, S_EXPONENT, S_SCIENTIFIC,
+    NUM_STATES
+} t_state;
+
+
+static t_node nodes[LIST_SIZE];
+static t_data node_data[LIST_SIZE];
+static char state_input[STATE_INPUT_SIZE];
+
+/** Numbers of each kind the input of the state machine is made of */
+static const char *const number_patterns[] = {
+    "5012", "1234", "-874", "+122", "35.54", ".1234", "-110.7", "+0.64",
+    "5.500e+3", "-.123e-2", "-87e+832", "+0.6e-12", "T0.3e-1F", "-T.T++Tq",
+    "1T3.4e4z", "34.0e-T^"
+};
+
+
+static uint16_t crcu8(uint8_t data, uint16_t crc){
+    uint32_t i, x16, carry;
+
+    for(i=0;i<8;i++){
+        x16 = (data & 1) ^ (crc & 1);
+        data >>= 1;
+        if(x16==1){
+            crc ^= 0x4002;
+            carry = 1;
+        }
+        else{
+            carry = 0;
+        }
+        crc >>= 1;
+        if(carry){
+            crc |= 0x8000;
+        }
+        else{
+            crc &= 0x7fff;
+        }
+    }
+    return crc;
+}
+
+static uint16_t crcu16(uint16_t v, uint16_t crc){
+    crc = crcu8((uint8_t)v, crc);
+    return crcu8((uint8_t)(v >> 8), crc);
+}
+
+static uint16_t crc32u(uint32_t v, uint16_t crc){
+    crc = crcu16((uint16_t)v, crc);
+    return crcu16((uint16_t)(v >> 16), crc);
+}
+
+
+/*---- List processing -------------------------------------------------------*/
+
+static t_node *list_init(uint32_t seed){
+    uint32_t i;
+
+    for(i=0;i<LIST_SIZE;i++){
+        node_data[i].data16 = (int16_t)(bench_rand(&seed) & 0x7fff);
+        node_data[i].idx = (int16_t)i;
+        nodes[i].info = &node_data[i];
+        nodes[i].next = (i+1<LIST_SIZE)? &nodes[i+1] : NULL;
+    }
+    return &nodes[0];
+}
+
+static t_node *list_find(t_node *list, int16_t data16){
+    while(list!=NULL && list->info->data16!=data16){
+        list = list->next;
+    }
+    return list;
+}
+
+static t_node *list_reverse(t_node *list){
+    t_node *next, *prev = NULL;
+
+    while(list!=NULL){
+        next = list->next;
+        list->next = prev;
+        prev = list;
+        list = next;
+    }
+    return prev;
+}
+
+/** Compare two nodes by value or, if 'by_idx', by original position. */
+static int32_t node_cmp(const t_node *a, const t_node *b, int by_idx){
+    if(by_idx){
+        return a->info->idx - b->info->idx;
+    }
+    return a->info->data16 - b->info->data16;
+}
+
+/** Bottom-up merge sort of a list, as in CoreMark. */
+static t_node *list_mergesort(t_node *list, int by_idx){
+    t_node *p, *q, *e, *tail;
+    int32_t insize = 1, nmerges, psize, qsize, i;
+
+    for(;;){
+        p = list;
+        list = NULL;
+        tail = NULL;
+        nmerges = 0;
+        while(p!=NULL){
+            nmerges++;
+            q = p;
+            psize = 0;
+            for(i=0;i<insize;i++){
+                psize++;
+                q = q->next;
+                if(q==NULL) break;
+            }
+            qsize = insize;
+            while(psize>0 || (qsize>0 && q!=NULL)){
+                if(psize==0){
+                    e = q;
+                    q = q->next;
+                    qsize--;
+                }
+                else if(qsize==0 || q==NULL || node_cmp(p, q, by_idx)<=0){
+                    e = p;
+                    p = p->next;
+                    psize--;
+                }
+                else{
+                    e = q;
+                    q = q->next;
+                    qsize--;
+                }
+                if(tail!=NULL){
+                    tail->next = e;
+                }
+                else{
+                    list = e;
+                }
+                tail = e;
+            }
+            p = q;
+        }
+        tail->next = NULL;
+        if(nmerges<=1){
+            return list;
+        }
+        insize <<= 1;
+    }
+}
+
+static uint16_t bench_list(t_node *list, int16_t key, uint16_t crc){
+    t_node *found;
+    int32_t i, found_count = 0, missed = 0;
+
+    for(i=0;i<8;i++){
+        found = list_find(list, (int16_t)((key + (i << 9)) & 0x7fff));
+        list = list_reverse(list);
+        if(found!=NULL){
+            found_count++;
+            crc = crcu16((uint16_t)found->info->idx, crc);
+        }
+        else{
+            missed++;
+            crc = crcu16((uint16_t)list->info->data16, crc);
+        }
+    }
+    /* Sort by value, check the order, then restore the original order */
+    list = list_mergesort(list, 0);
+    for(found=list;found->next!=NULL;found=found->next){
+        if(node_cmp(found, found->next, 0)>0){
+            missed += 100;
+        }
+        crc = crcu16((uint16_t)found->info->data16, crc);
+    }
+    list = list_mergesort(list, 1);
+    crc = crcu16((uint16_t)list->info->idx, crc);
+    crc = crcu16((uint16_t)found_count, crc);
+    return crcu16((uint16_t)missed, crc);
+}
+
+
+/*---- State machine ---------------------------------------------------------*/
+
+static void state_init(uint32_t seed){
+    const char *p;
+    uint32_t n = 0, i;
+
+    for(;;){
+        p = number_patterns[bench_rand(&seed) & 15];
+        for(i=0;p[i]!=0;i++);
+        if(n + i + 1 >= STATE_INPUT_SIZE) break;
+        while(*p!=0){
+            state_input[n++] = *p++;
+        }
+        state_input[n++] = ',';
+    }
+    while(n<STATE_INPUT_SIZE){
+        state_input[n++] = 0;
+    }
+}
+
+static int is_digit(char c){
+    return c>='0' && c<='9';
+}
+
+/** Scan one number; returns its final state and moves the input pointer. */
+static t_state state_transition(const char **instr, uint32_t *transitions){
+    const char *str = *instr;
+    t_state state = S_START;
+    char c;
+
+    for(;*str!=0 && state!=S_INVALID;str++){
+        c = *str;
+        if(c==','){
+            str++;
+            break;
+        }
+        switch(state){
+        case S_START:
+            if(is_digit(c)) state = S_INT;
+            else if(c=='+' || c=='-') state = S_S1;
+            else if(c=='.') state = S_FLOAT;
+            else{
+                state = S_INVALID;
+                transitions[S_INVALID]++;
+            }
+            transitions[S_START]++;
+            break;
+        case S_S1:
+            if(is_digit(c)){
+                state = S_INT;
+                transitions[S_S1]++;
+            }
+            else if(c=='.'){
+                state = S_FLOAT;
+                transitions[S_S1]++;
+            }
+            else{
+                state = S_INVALID;
+                transitions[S_S1]++;
+            }
+            break;
+        case S_INT:
+            if(c=='.'){
+                state = S_FLOAT;
+                transitions[S_INT]++;
+            }
+            else if(!is_digit(c)){
+                state = S_INVALID;
+                transitions[S_INT]++;
+            }
+            break;
+        case S_FLOAT:
+            if(c=='E' || c=='e'){
+                state = S_S2;
+                transitions[S_FLOAT]++;
+            }
+            else if(!is_digit(c)){
+                state = S_INVALID;
+                transitions[S_FLOAT]++;
+            }
+            break;
+        case S_S2:
+            if(c=='+' || c=='-'){
+                state = S_EXPONENT;
+                transitions[S_S2]++;
+            }
+            else{
+                state = S_INVALID;
+                transitions[S_S2]++;
+            }
+            break;
+        case S_EXPONENT:
+            if(is_digit(c)){
+                state = S_SCIENTIFIC;
+                transitions[S_EXPONENT]++;
+            }
+            else{
+                state = S_INVALID;
+                transitions[S_EXPONENT]++;
+            }
+            break;
+        case S_SCIENTIFIC:
+            if(!is_digit(c)){
+                state = S_INVALID;
+                transitions[S_INVALID]++;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    *instr = str;
+    return state;
+}
+
+static uint16_t bench_state(uint16_t crc){
+    uint32_t final_counts[NUM_STATES], transitions[NUM_STATES];
+    const char *p = state_input;
+    uint32_t i;
+
+    for(i=0;i<NUM_STATES;i++){
+        final_counts[i] = transitions[i] = 0;
+    }
+    while(*p!=0){
+        final_counts[state_transition(&p, transitions)]++;
+    }
+    for(i=0;i<NUM_STATES;i++){
+        crc = crc32u(final_counts[i], crc);
+        crc = crc32u(transitions[i], crc);
+    }
+    return crc;
+}
+
+
+uint32_t bench_coremark(void){
+    t_node *list;
+    uint16_t crc = 0;
+    uint32_t i;
+
+    list = list_init(0x3415);
+    state_init(0x66);
+    for(i=0;i<CM_ITERATIONS;i++){
+        crc = bench_list(list, (int16_t)(i << 4), crc);
+        crc = bench_state(crc);
+    }
+    return crc;
+}
@@ -0,0 +1,76 @@
+################################################################################
+# crt0.s -- Startup code of the benchmark suite for Ion project
+#-------------------------------------------------------------------------------
+# Sets up the stack, clears the bss and calls main. The value returned by main
+# is written to the TB result register, which ends the simulation.
+#
+# The suite does not use exceptions: any trap ends the simulation as a failure.
+#
+################################################################################
+
+    # TB registers, only available in the SW simulator and the RTL TB.
+    .set TB_RESULT,         0xffff8018
+
+    .set STATUS_INIT,       0x00400000      # Kernel mode, BEV, no interrupts.
+
+    # Reported to the TB as the error count when a trap happens.
+    .set TRAP_ERRORS,       0x100
+
+
+    .section .text.entry,"ax",@progbits
+    .align  2
+    .globl  entry
+    .ent    entry
+
+    #---------------------------------------------------------------------------
+    # Reset vector.
+
+entry:
+    .set    noreorder
+
+    b       init
+    nop
+
+    #---------------------------------------------------------------------------
+    # Trap handler address.
+    .org    0x0180
+
+trap_vector:
+    li      $a0,TRAP_ERRORS
+    b       finish
+    nop
+
+    #---------------------------------------------------------------------------
+    # Initialization and call to main.
+
+init:
+    li      $t0,STATUS_INIT
+    mtc0    $t0,$12
+    la      $sp,_stack_top
+    move    $fp,$sp
+    move    $gp,$zero
+
+    # Clear bss, word by word (the link script aligns its end).
+    la      $t0,_bss_start
+    la      $t1,_bss_end
+bss_loop:
+    beq     $t0,$t1,bss_done
+    nop
+    sw      $zero,0($t0)
+    b       bss_loop
+    addiu   $t0,$t0,4
+bss_done:
+
+    jal     main
+    nop
+    move    $a0,$v0
+
+finish:
+    li      $t0,TB_RESULT
+    sw      $a0,0($t0)
+hang:
+    b       hang
+    nop
+
+    .set    reorder
+    .end    entry
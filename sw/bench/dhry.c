@@ -0,0 +1,231 @@
+/**
+    @file dhry.c
+    @brief Dhrystone-style kernel.
+
+    Follows the structure of the Dhrystone 2.1 main loop: record assignment
+    through pointers, string copies and compares, enumerations, small
+    procedures with by-reference parameters and global array updates.
+
+    Not Dhrystone proper, whose numbers can't be compared to those of other
+    cores anyway: the multiplication and division of the main loop are
+    replaced by shifts and the 2D array has rows of a power of 2 words, so
+    the core needs no multiplier.
+*/
+
+#include "bench.h"
+
+
+/** Iterations of the main loop */
+#define DHRY_RUNS           (500)
+/** Size of the string buffers */
+#define STR_SIZE            (32)
+
+
+typedef enum {IDENT_1, IDENT_2, IDENT_3, IDENT_4, IDENT_5} t_enum;
+
+typedef struct s_record {
+    struct s_record *ptr_comp;
+    t_enum discr;
+    t_enum enum_comp;
+    int32_t int_comp;
+    char str_comp[STR_SIZE];
+} t_record;
+
+
+static t_record rec_a, rec_b;
+static t_record *ptr_glob, *next_ptr_glob;
+static int32_t int_glob;
+static int bool_glob;
+static char char_1_glob, char_2_glob;
+static int32_t arr_1_glob[64];
+static int32_t arr_2_glob[50][64];
+
+
+static void str_copy(char *d, const char *s){
+    while((*d++ = *s++)!=0);
+}
+
+static int str_cmp(const char *a, const char *b){
+    while(*a!=0 && *a==*b){
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+static int func_3(t_enum e){
+    return e==IDENT_3;
+}
+
+static t_enum func_1(char c1, char c2){
+    if(c1!=c2){
+        return IDENT_1;
+    }
+    char_1_glob = c1;
+    return IDENT_2;
+}
+
+static int func_2(const char *s1, const char *s2){
+    int32_t i = 2;
+    char c = 0;
+
+    while(i<=2){
+        if(func_1(s1[i], s2[i+1])==IDENT_1){
+            c = 'A';
+            i++;
+        }
+    }
+    if(c>='W' && c<'Z'){
+        i = 7;
+    }
+    if(c=='R'){
+        return 1;
+    }
+    if(str_cmp(s1, s2)>0){
+        int_glob = i + 7;
+        return 1;
+    }
+    return 0;
+}
+
+static void proc_6(t_enum e, t_enum *out){
+    *out = e;
+    if(!func_3(e)){
+        *out = IDENT_4;
+    }
+    switch(e){
+    case IDENT_1: *out = IDENT_1; break;
+    case IDENT_2: *out = (int_glob>100)? IDENT_1 : IDENT_4; break;
+    case IDENT_3: *out = IDENT_2; break;
+    case IDENT_4: break;
+    case IDENT_5: *out = IDENT_3; break;
+    }
+}
+
+static void proc_7(int32_t a, int32_t b, int32_t *out){
+    *out = b + a + 2;
+}
+
+static void proc_8(int32_t *arr_1, int32_t (*arr_2)[64], int32_t a,
+                   int32_t b){
+    int32_t i, loc;
+
+    loc = a + 5;
+    arr_1[loc] = b;
+    arr_1[loc+1] = arr_1[loc];
+    arr_1[loc+30] = loc;
+    for(i=loc;i<=loc+1;i++){
+        arr_2[loc][i] = loc;
+    }
+    arr_2[loc][loc-1] += 1;
+    arr_2[loc+20][loc] = arr_1[loc];
+    int_glob = 5;
+}
+
+static void proc_3(t_record **out){
+    if(ptr_glob!=NULL){
+        *out = ptr_glob->ptr_comp;
+    }
+    proc_7(10, int_glob, &ptr_glob->int_comp);
+}
+
+static void proc_1(t_record *p){
+    t_record *next = p->ptr_comp;
+
+    *p->ptr_comp = *ptr_glob;
+    p->int_comp = 5;
+    next->int_comp = p->int_comp;
+    next->ptr_comp = p->ptr_comp;
+    proc_3(&next->ptr_comp);
+    if(next->discr==IDENT_1){
+        next->int_comp = 6;
+        proc_6(p->enum_comp, &next->enum_comp);
+        next->ptr_comp = ptr_glob->ptr_comp;
+        proc_7(next->int_comp, 10, &next->int_comp);
+    }
+    else{
+        *p = *p->ptr_comp;
+    }
+}
+
+static void proc_2(int32_t *io){
+    int32_t loc = *io + 10;
+    t_enum e = IDENT_2;
+
+    do{
+        if(char_1_glob=='A'){
+            loc -= 1;
+            *io = loc - int_glob;
+            e = IDENT_1;
+        }
+    }while(e!=IDENT_1);
+}
+
+static void proc_4(void){
+    int b = (char_1_glob=='A');
+
+    bool_glob = b | bool_glob;
+    char_2_glob = 'B';
+}
+
+static void proc_5(void){
+    char_1_glob = 'A';
+    bool_glob = 0;
+}
+
+uint32_t bench_dhry(void){
+    char str_1[STR_SIZE], str_2[STR_SIZE];
+    int32_t int_1, int_2, int_3;
+    uint32_t sum = 0, run;
+    t_enum e;
+    char c, ci;
+
+    next_ptr_glob = &rec_b;
+    ptr_glob = &rec_a;
+    ptr_glob->ptr_comp = next_ptr_glob;
+    ptr_glob->discr = IDENT_1;
+    ptr_glob->enum_comp = IDENT_3;
+    ptr_glob->int_comp = 40;
+    str_copy(ptr_glob->str_comp, "DHRYSTONE PROGRAM, SOME STRING");
+    str_copy(str_1, "DHRYSTONE PROGRAM, 1'ST STRING");
+    arr_2_glob[8][7] = 10;
+
+    for(run=1;run<=DHRY_RUNS;run++){
+        proc_5();
+        proc_4();
+        int_1 = 2;
+        int_2 = 3;
+        str_copy(str_2, "DHRYSTONE PROGRAM, 2'ND STRING");
+        e = IDENT_2;
+        bool_glob = !func_2(str_1, str_2);
+        while(int_1<int_2){
+            int_3 = (int_1 << 2) + int_1 - int_2;
+            proc_7(int_1, int_2, &int_3);
+            int_1++;
+        }
+        proc_8(arr_1_glob, arr_2_glob, int_1, int_3);
+        proc_1(ptr_glob);
+        for(ci='A';ci<=char_2_glob;ci++){
+            if(e==func_1(ci, 'C')){
+                proc_6(IDENT_1, &e);
+                str_copy(str_2, "DHRYSTONE PROGRAM, 3'RD STRING");
+                int_2 = run;
+                int_glob = run;
+            }
+        }
+        /* Was int_2 * int_1 and int_2 / int_3 */
+        int_2 = int_2 << 1;
+        int_1 = int_2 >> 2;
+        int_2 = (int_2 << 3) - int_2 - int_3;
+        c = char_1_glob;
+        proc_2(&int_1);
+
+        sum = bench_mix(sum, (uint32_t)(int_1 + int_2 + int_3));
+        sum = bench_mix(sum, (uint32_t)int_glob + (uint32_t)e + c);
+    }
+    sum = bench_mix(sum, (uint32_t)ptr_glob->int_comp);
+    sum = bench_mix(sum, (uint32_t)next_ptr_glob->int_comp);
+    sum = bench_mix(sum, (uint32_t)arr_2_glob[8][7]);
+    sum = bench_mix(sum, (uint32_t)str_cmp(str_2, ptr_glob->str_comp));
+    return sum;
+}
@@ -0,0 +1,194 @@
+/**
+    @file interp.c
+    @brief Bytecode interpreter kernel.
+
+    A small stack machine with a switch dispatch loop, the core of many
+    interpreters, running two programs: a sieve of Eratosthenes, heavy on
+    memory and branches, and an arithmetic loop.
+
+    Opcodes are one byte; 16-bit operands follow them, low byte first.
+*/
+
+#include "bench.h"
+
+
+/** Size of the data stack, in words */
+#define STACK_SIZE          (64)
+/** Number of variables */
+#define NUM_VARS            (8)
+/** Size of the byte memory of the machine; a power of 2 */
+#define VM_MEM_SIZE         (1024)
+/** Times the programs are run */
+#define INTERP_ROUNDS       (2)
+
+/** Numbers below VM_MEM_SIZE sieved, and how many are prime */
+#define SIEVE_SIZE          VM_MEM_SIZE
+#define SIEVE_PRIMES        (172)
+/** Iterations of the arithmetic loop */
+#define LOOP_COUNT          (1000)
+
+
+enum {
+    OP_HALT,        /* stop, result is top of stack */
+    OP_PUSH,        /* push 16-bit operand */
+    OP_LOAD,        /* push variable (8-bit operand) */
+    OP_STORE,       /* pop into variable (8-bit operand) */
+    OP_LOADM,       /* pop address, push memory byte */
+    OP_STOREM,      /* pop address, pop value, store byte */
+    OP_DUP,
+    OP_DROP,
+    OP_SWAP,
+    OP_ADD,
+    OP_SUB,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_LT,          /* unsigned */
+    OP_EQ,
+    OP_JMP,         /* to 16-bit operand */
+    OP_JZ,          /* pop, jump if zero */
+    OP_JNZ          /* pop, jump if not zero */
+};
+
+#define PUSH(v)     OP_PUSH, (v) & 0xff, (v) >> 8
+#define LOAD(n)     OP_LOAD, (n)
+#define STORE(n)    OP_STORE, (n)
+#define JMP(t)      OP_JMP, (t) & 0xff, (t) >> 8
+#define JZ(t)       OP_JZ, (t) & 0xff, (t) >> 8
+#define JNZ(t)      OP_JNZ, (t) & 0xff, (t) >> 8
+
+/* Variables and labels of the sieve */
+#define V_I         0
+#define V_J         1
+#define V_COUNT     2
+#define L_OUTER     5
+#define L_INNER     35
+#define L_NEXT      60
+#define L_END       71
+
+/** Count primes below SIEVE_SIZE; memory must be all zeros */
+static const uint8_t sieve_prog[] = {
+    /*  0 */ PUSH(2), STORE(V_I),
+    /*  5 */ LOAD(V_I), PUSH(SIEVE_SIZE), OP_LT, JZ(L_END),
+    /* 14 */ LOAD(V_I), OP_LOADM, JNZ(L_NEXT),
+    /* 20 */ LOAD(V_COUNT), PUSH(1), OP_ADD, STORE(V_COUNT),
+    /* 28 */ LOAD(V_I), LOAD(V_I), OP_ADD, STORE(V_J),
+    /* 35 */ LOAD(V_J), PUSH(SIEVE_SIZE), OP_LT, JZ(L_NEXT),
+    /* 44 */ PUSH(1), LOAD(V_J), OP_STOREM,
+    /* 50 */ LOAD(V_J), LOAD(V_I), OP_ADD, STORE(V_J), JMP(L_INNER),
+    /* 60 */ LOAD(V_I), PUSH(1), OP_ADD, STORE(V_I), JMP(L_OUTER),
+    /* 71 */ LOAD(V_COUNT), OP_HALT
+};
+
+/* Variables and labels of the arithmetic loop */
+#define V_A         0
+#define V_B         1
+#define V_K         2
+#define L_LOOP      15
+#define L_DONE      55
+
+/** Fibonacci-like recurrence scrambled with shifts and xors */
+static const uint8_t loop_prog[] = {
+    /*  0 */ PUSH(0), STORE(V_A), PUSH(1), STORE(V_B),
+    /* 10 */ PUSH(LOOP_COUNT), STORE(V_K),
+    /* 15 */ LOAD(V_K), JZ(L_DONE),
+    /* 20 */ LOAD(V_B), LOAD(V_A), LOAD(V_B), OP_ADD,
+    /* 27 */ OP_DUP, PUSH(3), OP_SHR, OP_XOR,
+    /* 33 */ OP_DUP, PUSH(7), OP_SHL, OP_XOR,
+    /* 39 */ OP_SWAP, STORE(V_A), STORE(V_B),
+    /* 44 */ LOAD(V_K), PUSH(1), OP_SUB, STORE(V_K), JMP(L_LOOP),
+    /* 55 */ LOAD(V_B), OP_HALT
+};
+
+
+static uint8_t vm_mem[VM_MEM_SIZE];
+
+
+/** Run a program with all variables at 0; returns the top of the stack
+    when it halts. */
+static uint32_t run(const uint8_t *prog){
+    uint32_t stack[STACK_SIZE];
+    uint32_t vars[NUM_VARS];
+    const uint8_t *pc = prog;
+    uint32_t *sp = stack;
+    uint32_t a, b;
+
+    for(a=0;a<NUM_VARS;a++){
+        vars[a] = 0;
+    }
+
+    for(;;){
+        switch(*pc++){
+        case OP_HALT:
+            return sp[-1];
+        case OP_PUSH:
+            *sp++ = pc[0] | (pc[1] << 8);
+            pc += 2;
+            break;
+        case OP_LOAD:
+            *sp++ = vars[*pc++ & (NUM_VARS-1)];
+            break;
+        case OP_STORE:
+            vars[*pc++ & (NUM_VARS-1)] = *--sp;
+            break;
+        case OP_LOADM:
+            sp[-1] = vm_mem[sp[-1] & (VM_MEM_SIZE-1)];
+            break;
+        case OP_STOREM:
+            a = *--sp;
+            b = *--sp;
+            vm_mem[a & (VM_MEM_SIZE-1)] = (uint8_t)b;
+            break;
+        case OP_DUP:
+            sp[0] = sp[-1];
+            sp++;
+            break;
+        case OP_DROP:
+            sp--;
+            break;
+        case OP_SWAP:
+            a = sp[-1];
+            sp[-1] = sp[-2];
+            sp[-2] = a;
+            break;
+        case OP_ADD: sp--; sp[-1] += sp[0]; break;
+        case OP_SUB: sp--; sp[-1] -= sp[0]; break;
+        case OP_AND: sp--; sp[-1] &= sp[0]; break;
+        case OP_OR:  sp--; sp[-1] |= sp[0]; break;
+        case OP_XOR: sp--; sp[-1] ^= sp[0]; break;
+        case OP_SHL: sp--; sp[-1] <<= sp[0] & 31; break;
+        case OP_SHR: sp--; sp[-1] >>= sp[0] & 31; break;
+        case OP_LT:  sp--; sp[-1] = sp[-1] < sp[0]; break;
+        case OP_EQ:  sp--; sp[-1] = sp[-1] == sp[0]; break;
+        case OP_JMP:
+            pc = prog + (pc[0] | (pc[1] << 8));
+            break;
+        case OP_JZ:
+            pc = (*--sp==0)? prog + (pc[0] | (pc[1] << 8)) : pc + 2;
+            break;
+        case OP_JNZ:
+            pc = (*--sp!=0)? prog + (pc[0] | (pc[1] << 8)) : pc + 2;
+            break;
+        default:
+            /* Bad opcode */
+            return 0;
+        }
+    }
+}
+
+uint32_t bench_interp(void){
+    uint32_t sum = 0, primes, round;
+
+    for(round=0;round<INTERP_ROUNDS;round++){
+        memset(vm_mem, 0, VM_MEM_SIZE);
+        primes = run(sieve_prog);
+        if(primes!=SIEVE_PRIMES){
+            return 0;
+        }
+        sum = bench_mix(sum, primes);
+        sum = bench_mix(sum, run(loop_prog));
+    }
+    return sum;
+}
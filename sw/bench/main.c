@@ -0,0 +1,76 @@
+/**
+    @file main.c
+    @brief Benchmark suite for the ION core: runs all the kernels.
+
+    Each kernel is bracketed by writes to the TB mark register: its number
+    before it starts and 0 when it's done. ion32sim prints the instruction
+    count and the RTL TBs print the clock cycle count at each mark, which is
+    all tools/bench/bench.py needs to work out the CPI of each kernel.
+
+    After each kernel one line is printed on the console:
+
+        <kernel name> <checksum in hex> OK|FAIL
+
+    The return value, written to the TB result register by the startup code,
+    is the number of kernels that failed.
+
+    The expected checksums were taken from a build of the kernels for the
+    host (any C compiler will do, the kernels are endian independent).
+*/
+
+#include "bench.h"
+
+
+/** Run a kernel between marks and check its result. No function pointers
+    here, they'd need JALR. */
+#define RUN_KERNEL(num, name, expected) do {                        \
+        uint32_t sum;                                               \
+        TB_WRITE(TB_MARK, (num));                                   \
+        sum = bench_##name();                                       \
+        TB_WRITE(TB_MARK, 0);                                       \
+        errors += report(#name, sum, (expected));                   \
+    } while(0)
+
+
+static void put_char(char c){
+    *(volatile uint8_t *)TB_UART_TX = (uint8_t)c;
+}
+
+static void put_str(const char *s){
+    while(*s!=0){
+        put_char(*s++);
+    }
+}
+
+static void put_hex(uint32_t x){
+    static const char digits[] = "0123456789abcdef";
+    int32_t i;
+
+    put_str("0x");
+    for(i=28;i>=0;i-=4){
+        put_char(digits[(x >> i) & 15]);
+    }
+}
+
+/** Print the result of a kernel; returns 1 if it's wrong. */
+static int report(const char *name, uint32_t sum, uint32_t expected){
+    put_str(name);
+    put_char(' ');
+    put_hex(sum);
+    put_str((sum==expected)? " OK\n" : " FAIL\n");
+    return sum!=expected;
+}
+
+int main(void){
+    int errors = 0;
+
+    RUN_KERNEL(1, dhry,     0xee49ddda);
+    RUN_KERNEL(2, coremark, 0x0000ef99);
+    RUN_KERNEL(3, memcpy,   0xb66940ea);
+    RUN_KERNEL(4, memset,   0x526c23dc);
+    RUN_KERNEL(5, crc32,    0x471c9f8c);
+    RUN_KERNEL(6, sort,     0xd3a28d54);
+    RUN_KERNEL(7, interp,   0xfc32cd2f);
+
+    return errors;
+}
@@ -0,0 +1,77 @@
+/**
+    @file memops.c
+    @brief memcpy and memset kernels.
+
+    Blocks of many sizes at all four alignments, from a few bytes, where the
+    call and loop overhead dominates, to whole kilobytes.
+*/
+
+#include "bench.h"
+
+
+/** Size of the buffers; blocks are copied within them */
+#define BUF_SIZE            (4096)
+/** Times the list of block sizes is gone through */
+#define MEMCPY_ROUNDS       (4)
+#define MEMSET_ROUNDS       (6)
+
+
+static uint8_t src_buf[BUF_SIZE];
+static uint8_t dst_buf[BUF_SIZE];
+
+/** Block sizes, small ones more often as in real code */
+static const uint16_t block_sizes[] = {
+    1, 2, 3, 4, 7, 8, 12, 16, 24, 31, 32, 48, 64, 100, 128, 255, 256, 512,
+    1000, 2048, 4000
+};
+
+#define NUM_SIZES (sizeof(block_sizes)/sizeof(block_sizes[0]))
+
+
+/** Checksum of a buffer, byte by byte so it's endian independent. */
+static uint32_t buf_sum(const uint8_t *buf, uint32_t n){
+    uint32_t sum = 0, i;
+
+    for(i=0;i<n;i++){
+        sum = bench_mix(sum, buf[i]);
+    }
+    return sum;
+}
+
+uint32_t bench_memcpy(void){
+    uint32_t seed = 0x1234567, sum = 0;
+    uint32_t round, i, n, so, doff;
+
+    for(i=0;i<BUF_SIZE;i++){
+        src_buf[i] = (uint8_t)bench_rand(&seed);
+    }
+    memset(dst_buf, 0, BUF_SIZE);
+
+    for(round=0;round<MEMCPY_ROUNDS;round++){
+        for(i=0;i<NUM_SIZES;i++){
+            n = block_sizes[i];
+            /* All 16 combinations of alignments, over the rounds */
+            so = (i + round) & 3;
+            doff = ((i >> 2) + round) & 3;
+            memcpy(dst_buf + doff, src_buf + so + ((round << 4) & 63), n);
+            sum = bench_mix(sum, dst_buf[doff]);
+            sum = bench_mix(sum, dst_buf[doff + n - 1]);
+        }
+    }
+    return bench_mix(sum, buf_sum(dst_buf, BUF_SIZE));
+}
+
+uint32_t bench_memset(void){
+    uint32_t sum = 0;
+    uint32_t round, i, n, off;
+
+    for(round=0;round<MEMSET_ROUNDS;round++){
+        for(i=0;i<NUM_SIZES;i++){
+            n = block_sizes[i];
+            off = (i + round) & 3;
+            memset(dst_buf + off, (int)(i + round), n);
+            sum = bench_mix(sum, dst_buf[off + (n >> 1)]);
+        }
+    }
+    return bench_mix(sum, buf_sum(dst_buf, BUF_SIZE));
+}
@@ -0,0 +1,100 @@
+/**
+    @file sort.c
+    @brief Sort kernel.
+
+    Quicksort with median of three pivots and insertion sort of the small
+    partitions, over arrays of pseudo-random words, some of them with many
+    repeated values.
+*/
+
+#include "bench.h"
+
+
+/** Number of words sorted */
+#define SORT_SIZE           (1024)
+/** Arrays sorted */
+#define SORT_ROUNDS         (3)
+/** Partitions this small are left to the insertion sort */
+#define SORT_SMALL          (12)
+
+
+static uint32_t array[SORT_SIZE];
+
+
+static void swap(uint32_t *a, uint32_t *b){
+    uint32_t t = *a;
+
+    *a = *b;
+    *b = t;
+}
+
+static void insertion_sort(uint32_t *a, int32_t n){
+    int32_t i, j;
+    uint32_t x;
+
+    for(i=1;i<n;i++){
+        x = a[i];
+        for(j=i;j>0 && a[j-1]>x;j--){
+            a[j] = a[j-1];
+        }
+        a[j] = x;
+    }
+}
+
+/** Sort a[0..n-1]; recurses on the smaller partition only. */
+static void quicksort(uint32_t *a, int32_t n){
+    int32_t i, j, mid;
+    uint32_t pivot;
+
+    while(n>SORT_SMALL){
+        /* Leave the median of first, middle and last at the middle */
+        mid = n >> 1;
+        if(a[mid]<a[0]) swap(&a[mid], &a[0]);
+        if(a[n-1]<a[0]) swap(&a[n-1], &a[0]);
+        if(a[n-1]<a[mid]) swap(&a[n-1], &a[mid]);
+        pivot = a[mid];
+
+        i = 0;
+        j = n - 1;
+        for(;;){
+            while(a[i]<pivot) i++;
+            while(a[j]>pivot) j--;
+            if(i>=j) break;
+            swap(&a[i], &a[j]);
+            i++;
+            j--;
+        }
+        /* a[0..j] <= pivot <= a[j+1..n-1] */
+        if(j + 1 < n - (j + 1)){
+            quicksort(a, j + 1);
+            a += j + 1;
+            n -= j + 1;
+        }
+        else{
+            quicksort(a + j + 1, n - (j + 1));
+            n = j + 1;
+        }
+    }
+    insertion_sort(a, n);
+}
+
+uint32_t bench_sort(void){
+    uint32_t seed = 0x5eed, sum = 0;
+    uint32_t round, i, mask;
+
+    for(round=0;round<SORT_ROUNDS;round++){
+        /* Later rounds have fewer distinct values */
+        mask = 0xffffffff >> (round << 3);
+        for(i=0;i<SORT_SIZE;i++){
+            array[i] = bench_rand(&seed) & mask;
+        }
+        quicksort(array, SORT_SIZE);
+        for(i=0;i<SORT_SIZE;i++){
+            if(i>0 && array[i-1]>array[i]){
+                return 0;
+            }
+            sum = bench_mix(sum, array[i]);
+        }
+    }
+    return sum;
+}
@@ -0,0 +1,81 @@
+/**
+    @file string.c
+    @brief memcpy and memset for the benchmark suite.
+
+    Word at a time when source and destination are equally aligned, byte at
+    a time otherwise. The core has no unaligned loads or stores (LWL, SWR...)
+    so there's no faster way for the misaligned case.
+*/
+
+#include "bench.h"
+
+
+void *memcpy(void *dst, const void *src, size_t n){
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    uint32_t *dw;
+    const uint32_t *sw;
+
+    if((((uintptr_t)d ^ (uintptr_t)s) & 3)==0){
+        /* Copy the head bytes, then words, then the tail bytes */
+        while(n>0 && ((uintptr_t)d & 3)!=0){
+            *d++ = *s++;
+            n--;
+        }
+        dw = (uint32_t *)d;
+        sw = (const uint32_t *)s;
+        while(n>=16){
+            dw[0] = sw[0];
+            dw[1] = sw[1];
+            dw[2] = sw[2];
+            dw[3] = sw[3];
+            dw += 4;
+            sw += 4;
+            n -= 16;
+        }
+        while(n>=4){
+            *dw++ = *sw++;
+            n -= 4;
+        }
+        d = (uint8_t *)dw;
+        s = (const uint8_t *)sw;
+    }
+    while(n>0){
+        *d++ = *s++;
+        n--;
+    }
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t n){
+    uint8_t *d = dst;
+    uint32_t *dw;
+    uint32_t w;
+
+    while(n>0 && ((uintptr_t)d & 3)!=0){
+        *d++ = (uint8_t)c;
+        n--;
+    }
+    w = (uint8_t)c;
+    w |= w << 8;
+    w |= w << 16;
+    dw = (uint32_t *)d;
+    while(n>=16){
+        dw[0] = w;
+        dw[1] = w;
+        dw[2] = w;
+        dw[3] = w;
+        dw += 4;
+        n -= 16;
+    }
+    while(n>=4){
+        *dw++ = w;
+        n -= 4;
+    }
+    d = (uint8_t *)dw;
+    while(n>0){
+        *d++ = (uint8_t)c;
+        n--;
+    }
+    return dst;
+}
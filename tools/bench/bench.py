@@ -0,0 +1,280 @@
+"""Benchmark suite runner: ion32sim speed and RTL cycles per kernel.
+
+Runs the benchmark suite of sw/bench on ion32sim and on the Verilator model of
+the CPU (sim/iv, 'make obj_dir/Vtb_cpu_vl') and prints, for each kernel, the
+instructions it ran on ion32sim, the clock cycles it took on the RTL and their
+ratio, the CPI of the core on that kernel.
+
+The program writes the number of each kernel to the TB mark register before
+running it and 0 after; ion32sim prints the instruction count at each mark and
+the RTL TB the cycle count, which is all we need here. Kernel names and
+results are taken from the console output of the program.
+
+ion32sim runs without execution log, as fast as it can, a few times; the best
+run gives its speed in MIPS, from the simulation time it reports itself, which
+leaves out loading and start-up. The RTL simulation runs once, without
+execution log either.
+
+Run from this directory or through 'make bench' in sim/iv.
+"""
+
+import sys
+import os
+import re
+import time
+import subprocess
+from optparse import OptionParser
+
+
+#### Project parameters.
+
+TOOLS_PATH = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SWSIM_EXEC_PATH = os.path.join(TOOLS_PATH, "ion32sim/bin/ion32sim")
+RTL_EXEC_PATH = os.path.join(TOOLS_PATH, "../sim/iv/obj_dir/Vtb_cpu_vl")
+BENCH_SW_PATH = os.path.join(TOOLS_PATH, "../sw/bench")
+
+# Memory map of the RTL test bench as seen by ion32sim: a 128KB block
+# mirrored all over the address space.
+SWSIM_REGION = "bench,0xbfc00000,0x20000,0"
+
+# Names of files in the work dir, some of them embedded in the simulators.
+SW_CONSOLE_LOG_FILE = "sw_console_log.txt"
+RTL_CONSOLE_LOG_FILE = "console_log.txt"
+
+# Marks printed by ion32sim and the RTL TBs.
+MARK_RE = re.compile(r"^Mark ([0-9a-f]{8}) at (?:instruction|cycle) (\d+)$")
+# Result line printed by the program for each kernel.
+RESULT_RE = re.compile(r"^(\S+) (0x[0-9a-f]{8}) (OK|FAIL)$")
+
+# VT100 control codes to print colored text to console.
+CC = "\033[1;33m"
+CF = "\033[0m"
+
+
+class Run:
+    """Outcome of the benchmark on one simulator."""
+
+    def __init__(self):
+        self.counts = {}        # Instructions or cycles by kernel number.
+        self.results = []       # (name, checksum, "OK" or "FAIL") by kernel.
+        self.total = 0
+        self.seconds = 0.0
+        self.error = None
+
+
+def parse_marks(output):
+    """Return a dict with the count between each pair of marks, by kernel.
+
+    A nonzero mark starts a kernel; the next mark, 0, ends it.
+    """
+
+    counts = {}
+    kernel = None
+    start = 0
+    for line in output.splitlines():
+        m = MARK_RE.match(line.strip())
+        if not m:
+            continue
+        (value, count) = (int(m.group(1), 16), int(m.group(2)))
+        if kernel is not None:
+            counts[kernel] = counts.get(kernel, 0) + count - start
+        kernel = value if value != 0 else None
+        start = count
+    return counts
+
+
+def parse_results(filename):
+    """Return the (name, checksum, outcome) kernel results in a console log."""
+
+    results = []
+    if os.path.isfile(filename):
+        with open(filename) as f:
+            for line in f:
+                m = RESULT_RE.match(line.strip())
+                if m:
+                    results.append(m.groups())
+    return results
+
+
+def count_instructions(output):
+    """Return # of simulated instructions reported by ion32sim, or 0."""
+
+    for line in output.splitlines():
+        m = re.match(r"^(\d+) instructions simulated\.", line)
+        if m:
+            return int(m.group(1))
+    return 0
+
+
+def simulation_time(output):
+    """Return the simulation time in seconds reported by ion32sim, or 0."""
+
+    for line in output.splitlines():
+        m = re.match(r"^Simulation time ([0-9.]+) s", line)
+        if m:
+            return float(m.group(1))
+    return 0.0
+
+
+def run_swsim(opts):
+    """Run the benchmark on ion32sim 'opts.runs' times; keep the best time."""
+
+    run = Run()
+    command = [SWSIM_EXEC_PATH,
+               "--region=" + SWSIM_REGION,
+               "--bram=" + os.path.join(opts.sw, "software.bin"),
+               "--noprompt",
+               "--conout=" + SW_CONSOLE_LOG_FILE,
+               # Never reached, so no execution log at all.
+               "--trigger=0"]
+    for i in range(opts.runs):
+        sp = subprocess.Popen(command, cwd=opts.work, stdout=subprocess.PIPE,
+                              stderr=subprocess.PIPE, universal_newlines=True)
+        (out, err) = sp.communicate()
+        seconds = simulation_time(err)
+        if sp.returncode != 0:
+            run.error = "ion32sim exited with code %d" % sp.returncode
+            return run
+        if i == 0 or seconds < run.seconds:
+            run.seconds = seconds
+    run.counts = parse_marks(err)
+    run.total = count_instructions(err)
+    run.results = parse_results(os.path.join(opts.work, SW_CONSOLE_LOG_FILE))
+    return run
+
+
+def run_rtlsim(opts):
+    """Run the benchmark on the Verilator model of the CPU."""
+
+    run = Run()
+    command = [os.path.abspath(opts.rtl),
+               "--waits=%d" % opts.waits,
+               "--timeout=%d" % opts.timeout,
+               "--nolog",
+               os.path.join(opts.sw, "software.hex")]
+    start = time.time()
+    sp = subprocess.Popen(command, cwd=opts.work, stdout=subprocess.PIPE,
+                          universal_newlines=True)
+    (out, err) = sp.communicate()
+    run.seconds = time.time() - start
+    if sp.returncode != 0:
+        run.error = "RTL simulation exited with code %d" % sp.returncode
+    elif "TIMEOUT" in out.splitlines():
+        run.error = "RTL simulation timed out after %d cycles" % opts.timeout
+    run.counts = parse_marks(out)
+    run.total = sum(run.counts.values())
+    run.results = parse_results(os.path.join(opts.work, RTL_CONSOLE_LOG_FILE))
+    return run
+
+
+def rate(count, seconds):
+    """Format a simulation speed in millions of whatever per second."""
+    if seconds <= 0 or count == 0:
+        return "-"
+    return "%.2f" % (count / seconds / 1e6)
+
+
+def cpi(cycles, instructions):
+    if cycles == 0 or instructions == 0:
+        return "-"
+    return "%.3f" % (float(cycles) / instructions)
+
+
+def print_report(sw, rtl, opts):
+    """Print a table with instructions, cycles and CPI of each kernel.
+
+    Returns the number of failed kernels.
+    """
+
+    failed = 0
+    print
+    print "%-10s %-6s %12s %12s %8s" % (
+        "Kernel", "Result", "Insns", "Cycles", "CPI")
+    for (k, (name, checksum, outcome)) in enumerate(sw.results):
+        insns = sw.counts.get(k + 1, 0)
+        if rtl is None:
+            cycles = 0
+        else:
+            cycles = rtl.counts.get(k + 1, 0)
+            # The RTL must compute the same as ion32sim.
+            if k >= len(rtl.results) or \
+               rtl.results[k] != (name, checksum, outcome):
+                outcome = "FAIL"
+        if outcome != "OK":
+            failed += 1
+        print "%-10s %-6s %12d %12s %8s" % (
+            name, outcome, insns, cycles if cycles else "-",
+            cpi(cycles, insns))
+    insns = sum(sw.counts.values())
+    cycles = rtl.total if rtl is not None else 0
+    print "%-10s %-6s %12d %12s %8s" % (
+        "total", "", insns, cycles if cycles else "-", cpi(cycles, insns))
+    print
+    print "ion32sim: %d instructions in %.3fs, %s MIPS (best of %d runs)" % (
+        sw.total, sw.seconds, rate(sw.total, sw.seconds), opts.runs)
+    if rtl is not None:
+        print "RTL: %d wait states, %.2fs, %s M cycles/s" % (
+            opts.waits, rtl.seconds, rate(rtl.total, rtl.seconds))
+    return failed
+
+
+def main(argv):
+    parser = OptionParser("usage: %prog [options]")
+    parser.add_option("--sw", dest="sw",
+        default=BENCH_SW_PATH,
+        help="directory of the benchmark build (default sw/bench)",
+        metavar="DIR")
+    parser.add_option("--rtl", dest="rtl",
+        default=RTL_EXEC_PATH,
+        help="Verilator model executable", metavar="FILE")
+    parser.add_option("--nortl", dest="use_rtl",
+        action="store_false", default=True,
+        help="run on ion32sim only, no cycle counts")
+    parser.add_option("--waits", dest="waits",
+        type="int", default=0,
+        help="code bus wait states of the RTL test bench", metavar="N")
+    parser.add_option("--timeout", dest="timeout",
+        type="int", default=50000000,
+        help="RTL simulation timeout in clock cycles (default 50000000)",
+        metavar="N")
+    parser.add_option("--runs", dest="runs",
+        type="int", default=3,
+        help="times ion32sim is run to time it (default 3)", metavar="N")
+    parser.add_option("--work", dest="work",
+        default="bench_work",
+        help="work directory for the simulation output files",
+        metavar="DIR")
+    (opts, args) = parser.parse_args(argv[1:])
+
+    if opts.runs < 1:
+        parser.error("--runs must be at least 1")
+    opts.sw = os.path.abspath(opts.sw)
+    for f in [SWSIM_EXEC_PATH, os.path.join(opts.sw, "software.bin")] + \
+             ([opts.rtl, os.path.join(opts.sw, "software.hex")]
+              if opts.use_rtl else []):
+        if not os.path.isfile(f):
+            print >> sys.stderr, "Error: could not find '%s'" % f
+            sys.exit(1)
+    if not os.path.isdir(opts.work):
+        os.makedirs(opts.work)
+
+    print CC+"Running benchmarks on ion32sim..."+CF
+    sw = run_swsim(opts)
+    if sw.error is not None:
+        print >> sys.stderr, "Error: " + sw.error
+        sys.exit(1)
+    rtl = None
+    if opts.use_rtl:
+        print CC+"Running benchmarks on Verilator..."+CF
+        rtl = run_rtlsim(opts)
+        if rtl.error is not None:
+            print >> sys.stderr, "Error: " + rtl.error
+
+    failed = print_report(sw, rtl, opts)
+    if failed > 0 or len(sw.results) == 0 or \
+       (rtl is not None and rtl.error is not None):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,391 @@
+"""Differential instruction fuzzer: ion32sim against the RTL.
+
+Runs random programs (see mipsgen.py) on ion32sim and on the Verilator model of
+the CPU (sim/iv, 'make obj_dir/Vtb_cpu_vl') and compares their execution logs
+with ion32log. Programs are generated, run and compared in parallel, one per
+CPU, in batches; each program comes from its own seed, so any of them can be
+run again with --seed and --count=1.
+
+When the logs of a program don't match, the program is minimized: its groups
+of instructions are dropped for as long as the logs still don't match. The
+smallest program found is saved in a directory of its own under the work
+directory, with its listing, memory images and the mismatch reported by
+ion32log.
+
+With --ref=iss the reference is ion32sim itself with predecoding and basic
+blocks disabled, which checks the fast paths of the ISS against its plain
+interpreter when there is no RTL model at hand.
+
+Run from this directory or through 'make fuzz' in sim/iv.
+"""
+
+import sys
+import os
+import time
+import shutil
+import threading
+import subprocess
+import multiprocessing
+from optparse import OptionParser
+
+import mipsgen
+
+
+#### Project parameters.
+
+TOOLS_PATH = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SWSIM_EXEC_PATH = os.path.join(TOOLS_PATH, "ion32sim/bin/ion32sim")
+LOG_TOOL_EXEC_PATH = os.path.join(TOOLS_PATH, "ion32sim/bin/ion32log")
+RTL_EXEC_PATH = os.path.join(TOOLS_PATH, "../sim/iv/obj_dir/Vtb_cpu_vl")
+
+# Memory map of the RTL test bench as seen by ion32sim: a 128KB block
+# mirrored all over the address space.
+SWSIM_REGION = "fuzz,0x%08x,0x%x,0" % (mipsgen.CODE_BASE, mipsgen.IMAGE_SIZE)
+
+# Names of files in the work dirs, some of them embedded in the simulators.
+SW_EXECUTION_LOG_FILE = "sw_sim_log.bin"
+REF_EXECUTION_LOG_FILE = "ref_sim_log.txt"
+RTL_SIM_LOG_FILE = "rtl_sim_log.txt"
+
+# RTL clock cycles allowed per instruction before the simulation times out.
+CYCLES_PER_INSN = 8
+# Wall time allowed to any simulation, in seconds.
+SIM_WALL_TIMEOUT = 60
+
+# VT100 control codes to print colored text to console.
+CC = "\033[1;33m"
+CF = "\033[0m"
+
+
+class Config:
+    """Fuzzing options, shared by all the worker processes."""
+
+    def __init__(self, opts):
+        self.length = opts.length
+        self.ref = opts.ref
+        self.rtl = os.path.abspath(opts.rtl)
+        self.waits = opts.waits
+        self.rtl_only = not opts.all_opcodes
+        self.classes = [c for c in mipsgen.CLASSES if c not in opts.exclude]
+        self.work = os.path.abspath(opts.work)
+        self.minimize = opts.minimize
+
+
+class Outcome:
+    """Result of one program: instructions run and mismatch if any."""
+
+    def __init__(self, seed):
+        self.seed = seed
+        self.passed = False
+        self.instructions = 0
+        self.reason = ""
+        self.saved_in = None
+
+
+# Options of the worker processes, set by init_worker.
+config = None
+
+
+def init_worker(cfg):
+    global config
+    config = cfg
+
+
+def run_command(command, work_dir, stdout=None):
+    """Run a command in a work dir, killing it if it runs for too long.
+
+    Returns a tuple (exit code, standard error output).
+    """
+
+    sp = subprocess.Popen(command, cwd=work_dir, stdout=stdout,
+                          stderr=subprocess.PIPE, universal_newlines=True)
+    timer = threading.Timer(SIM_WALL_TIMEOUT, sp.kill)
+    timer.start()
+    try:
+        (out, err) = sp.communicate()
+    finally:
+        timer.cancel()
+    return (sp.returncode, err)
+
+
+def count_instructions(output):
+    """Return # of simulated instructions reported by ion32sim, or 0."""
+
+    for line in output.splitlines():
+        items = line.split()
+        if len(items) >= 3 and items[1:3] == ["instructions", "simulated."]:
+            return int(items[0])
+    return 0
+
+
+def check_program(program, work_dir, report=False):
+    """Run a program on ion32sim and on the reference, compare the logs.
+
+    Returns a tuple (logs match, # of instructions run by ion32sim, message).
+    The message is the mismatch as reported by ion32log if report==True.
+    """
+
+    image = program.image()
+    f = open(os.path.join(work_dir, "software.bin"), "wb")
+    f.write(image)
+    f.close()
+
+    # LWL, LWR, SWL and SWR are only simulated with --unaligned.
+    swsim_flags = ["--region=" + SWSIM_REGION, "--bram=software.bin",
+                   "--noprompt"]
+    if not config.rtl_only:
+        swsim_flags.append("--unaligned")
+
+    devnull = open(os.devnull, "w")
+    command = [SWSIM_EXEC_PATH, "--binlog", "--stop_on_unimplemented"] + \
+              swsim_flags
+    (retcode, err) = run_command(command, work_dir, stdout=devnull)
+    instructions = count_instructions(err)
+    if retcode != 0:
+        devnull.close()
+        return (False, instructions, "ion32sim error %d" % retcode)
+
+    if config.ref == "iss":
+        command = [SWSIM_EXEC_PATH, "--nopredecode", "--noblocks",
+                   "--log=" + REF_EXECUTION_LOG_FILE] + swsim_flags
+        ref_log = REF_EXECUTION_LOG_FILE
+    else:
+        mipsgen.write_hex(image, os.path.join(work_dir, "software.hex"))
+        timeout = CYCLES_PER_INSN * (program.num_insns() + 256) * \
+                  (config.waits + 1)
+        command = [config.rtl, "--waits=%d" % config.waits,
+                   "--timeout=%d" % timeout, "software.hex"]
+        ref_log = RTL_SIM_LOG_FILE
+    (retcode, err) = run_command(command, work_dir, stdout=devnull)
+    devnull.close()
+    if retcode != 0:
+        return (False, instructions, "%s error %d" % (config.ref, retcode))
+
+    command = [LOG_TOOL_EXEC_PATH, "-c"]
+    if not report:
+        command.append("-q")
+    command += [SW_EXECUTION_LOG_FILE, ref_log]
+    sp = subprocess.Popen(command, cwd=work_dir, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    (out, err) = sp.communicate()
+    return (sp.returncode == 0, instructions, out)
+
+
+def minimize(program, work_dir):
+    """Drop groups of instructions while the logs still don't match.
+
+    First cuts the program short as much as possible, then tries dropping
+    runs of groups, halving their length down to single groups.
+    Returns the smallest failing program found.
+    """
+
+    def fails(groups):
+        return not check_program(program.subset(groups), work_dir)[0]
+
+    groups = program.groups
+
+    # Shortest failing prefix, by bisection.
+    lo, hi = 0, len(groups)
+    while lo < hi:
+        mid = (lo + hi) // 2
+        if fails(groups[:mid]):
+            hi = mid
+        else:
+            lo = mid + 1
+    groups = groups[:hi]
+
+    # Then drop runs of groups anywhere.
+    run = max(len(groups) // 2, 1)
+    while True:
+        i = 0
+        while i < len(groups):
+            candidate = groups[:i] + groups[i + run:]
+            if fails(candidate):
+                groups = candidate
+            else:
+                i += run
+        if run == 1:
+            break
+        run = max(run // 2, 1)
+
+    return program.subset(groups)
+
+
+def save_failure(original, program, work_dir, reason):
+    """Save a failing program, with its listing and mismatch, for the record.
+
+    Returns the directory it was saved to.
+    """
+
+    fail_dir = os.path.join(config.work, "fail_%d" % original.seed)
+    if os.path.isdir(fail_dir):
+        shutil.rmtree(fail_dir)
+    os.makedirs(fail_dir)
+
+    (passed, instructions, report) = check_program(program, work_dir,
+                                                   report=True)
+    if passed:
+        # Flaky, keep the original program.
+        program = original
+        (passed, instructions, report) = check_program(program, work_dir,
+                                                       report=True)
+    for name in os.listdir(work_dir):
+        shutil.copy(os.path.join(work_dir, name), fail_dir)
+    mipsgen.write_hex(program.image(), os.path.join(fail_dir, "software.hex"))
+
+    f = open(os.path.join(fail_dir, "listing.txt"), "w")
+    f.write("# seed %d, %d of %d groups left\n" % (
+        original.seed, len(program.groups), len(original.groups)))
+    f.write("# %s\n" % reason)
+    f.write(program.listing())
+    f.close()
+    f = open(os.path.join(fail_dir, "original.txt"), "w")
+    f.write(original.listing())
+    f.close()
+    f = open(os.path.join(fail_dir, "compare_log.txt"), "w")
+    f.write(report)
+    f.close()
+    return fail_dir
+
+
+def fuzz_one(seed):
+    """Generate, run and check the program of a seed. Returns an Outcome."""
+
+    res = Outcome(seed)
+    work_dir = os.path.join(config.work, "worker_%d" % os.getpid())
+    if not os.path.isdir(work_dir):
+        os.makedirs(work_dir)
+
+    gen = mipsgen.Generator(seed, classes=config.classes,
+                            rtl_only=config.rtl_only)
+    program = gen.program(config.length)
+    (res.passed, res.instructions, reason) = check_program(program, work_dir)
+    if res.passed:
+        return res
+
+    res.reason = reason.strip().splitlines()[0] if reason.strip() else \
+                 "exec log mismatch"
+    smallest = program
+    if config.minimize:
+        smallest = minimize(program, work_dir)
+    res.saved_in = save_failure(program, smallest, work_dir, res.reason)
+    return res
+
+
+def run_fuzzer(cfg, first_seed, count, jobs):
+    """Fuzz 'count' programs (forever if 0) from a seed on, in parallel.
+
+    Returns the number of failing programs.
+    """
+
+    if not os.path.isdir(cfg.work):
+        os.makedirs(cfg.work)
+
+    print (CC + "Fuzzing ion32sim against %s, %d jobs, from seed %d..." +
+           CF) % (cfg.ref, jobs, first_seed)
+
+    pool = multiprocessing.Pool(jobs, init_worker, (cfg,))
+    start = time.time()
+    seed = first_seed
+    done = 0
+    instructions = 0
+    failures = 0
+    batch = jobs * 4
+    try:
+        while count == 0 or done < count:
+            n = batch if count == 0 else min(batch, count - done)
+            for res in pool.imap_unordered(fuzz_one,
+                                           range(seed, seed + n)):
+                instructions += res.instructions
+                if not res.passed:
+                    failures += 1
+                    print >> sys.stderr, \
+                        "Seed %d \033[1;31mFAILED\033[0m: %s (see %s)" % (
+                        res.seed, res.reason, res.saved_in)
+            seed += n
+            done += n
+            elapsed = time.time() - start
+            print "%d programs, %d instructions, %.0f instructions/min, " \
+                  "%d failed" % (done, instructions,
+                                 instructions * 60.0 / max(elapsed, 1e-6),
+                                 failures)
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pool.terminate()
+        pool.join()
+        print "Interrupted; next seed would be %d." % seed
+        return failures
+    pool.close()
+    pool.join()
+    return failures
+
+
+def main(argv):
+    parser = OptionParser("usage: %prog [options]")
+    parser.add_option("--seed", dest="seed",
+        type="int", default=None,
+        help="seed of the first program (default: from the time)",
+        metavar="N")
+    parser.add_option("--count", dest="count",
+        type="int", default=0,
+        help="number of programs to run, 0 to run until interrupted",
+        metavar="N")
+    parser.add_option("--length", dest="length",
+        type="int", default=4000,
+        help="instructions per program (default 4000)", metavar="N")
+    parser.add_option("-j", "--jobs", dest="jobs",
+        type="int", default=None,
+        help="programs run at a time (default: # of CPUs)", metavar="N")
+    parser.add_option("--ref", dest="ref",
+        type="choice", choices=["rtl", "iss"], default="rtl",
+        help="reference model, the Verilator model (rtl) or ion32sim "
+             "without predecoding (iss)")
+    parser.add_option("--rtl", dest="rtl",
+        default=RTL_EXEC_PATH,
+        help="Verilator model executable", metavar="FILE")
+    parser.add_option("--waits", dest="waits",
+        type="int", default=0,
+        help="code bus wait states of the RTL test bench", metavar="N")
+    parser.add_option("--all", dest="all_opcodes",
+        action="store_true", default=False,
+        help="use all MIPS32 instructions, not only those the RTL "
+             "implements")
+    parser.add_option("--exclude", dest="exclude",
+        action="append", default=[],
+        help="don't generate instructions of class CLASS (%s)" %
+             ", ".join(mipsgen.CLASSES), metavar="CLASS")
+    parser.add_option("--work", dest="work",
+        default="fuzz_work",
+        help="work directory, where failing programs are saved",
+        metavar="DIR")
+    parser.add_option("--nominimize", dest="minimize",
+        action="store_false", default=True,
+        help="save failing programs as they are")
+    (opts, args) = parser.parse_args(argv[1:])
+
+    for cls in opts.exclude:
+        if cls not in mipsgen.CLASSES:
+            parser.error("unknown instruction class '%s'" % cls)
+    if opts.length < 1 or \
+       4 * opts.length > mipsgen.CODE_SIZE - 0x1000:
+        parser.error("--length must be 1 to %d" %
+                     ((mipsgen.CODE_SIZE - 0x1000) // 4))
+    for exe in [SWSIM_EXEC_PATH, LOG_TOOL_EXEC_PATH] + \
+               ([opts.rtl] if opts.ref == "rtl" else []):
+        if not os.path.isfile(exe):
+            print >> sys.stderr, "Error: could not find '%s'" % exe
+            sys.exit(1)
+
+    seed = opts.seed
+    if seed is None:
+        seed = int(time.time()) & 0xffffff
+    jobs = opts.jobs
+    if jobs is None or jobs < 1:
+        jobs = multiprocessing.cpu_count()
+
+    failures = run_fuzzer(Config(opts), seed, opts.count, jobs)
+    sys.exit(0 if failures == 0 else 1)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,742 @@
+"""Random MIPS32 instruction streams for differential testing.
+
+Generates random but valid MIPS32 programs, and assembles them straight into
+binary and hex images that ion32sim and the RTL test benches can run. No MIPS
+toolchain is involved.
+
+A program is made of 'groups', short sequences of instructions that only make
+sense together: a branch and its delay slot, an address computation and the
+load that uses it, the lui/ori/jr of an indirect jump, etc. Control flow only
+ever goes forward, to the start of a group, so every program terminates. Groups
+are the unit the minimizer works with: any subset of the groups of a program is
+still a valid program, with branches to dropped groups going to the next group
+still there.
+
+Program layout, which suits both the ISS and the RTL test bench (a 128KB block
+mirrored all over the address space):
+
+    0xbfc00000  Reset: jump to the prologue.
+    0xbfc00180  Trap handler: returns to the instruction after the trap.
+    0xbfc00200  Prologue: set up STATUS and all registers.
+                Body: the random groups.
+                Epilogue: stop the simulation writing to TB_STOP_SIM.
+    0xbfc10000  Data area, 64KB of random words; $28 points to its middle.
+
+Some registers have a fixed use and are never written by the body:
+
+    $26     Trap handler scratch.
+    $27     Trap counter, incremented by the trap handler.
+    $28     Base of the data area.
+
+Traps are never put in delay slots, where the trap handler could not return
+from them. Instructions are selected from a table where each has a class, and
+only those implemented by the RTL are used unless asked otherwise.
+"""
+
+import random
+import struct
+import bisect
+
+
+#### Program layout.
+
+CODE_BASE = 0xbfc00000
+TRAP_VECTOR = 0xbfc00180
+PROLOGUE_ADDR = 0xbfc00200
+# Code must fit below the data area.
+CODE_SIZE = 0x10000
+DATA_BASE = 0xbfc10000
+DATA_SIZE = 0x10000
+# $28 points to the middle of the data area so any 16-bit offset is in it.
+DATA_POINTER = DATA_BASE + DATA_SIZE // 2
+IMAGE_SIZE = CODE_SIZE + DATA_SIZE
+
+# Test bench register; writing to it ends the simulation.
+TB_STOP_SIM = 0xffff8018
+# STATUS value set by the prologue: BEV=1, kernel mode, ERL=0 so that traps
+# return through EPC, interrupts disabled.
+STATUS_INIT = 0x00400000
+
+REG_SCRATCH = 26
+REG_TRAPS = 27
+REG_BASE = 28
+REG_LINK = 31
+RESERVED_REGS = (0, REG_SCRATCH, REG_TRAPS, REG_BASE)
+FREE_REGS = [r for r in range(32) if r not in RESERVED_REGS]
+
+# COP0 registers read and written by the body: Status, Cause and EPC, which
+# both models must agree on after a trap, as the trap handler also checks.
+# Count and Compare (9, 11) are left out as they depend on timing, and
+# PRId/EBase (15) as they identify the model rather than its state.
+COP0_READ = (12, 13, 14)
+COP0_STATUS = 12
+COP0_EPC = 14
+
+
+#### Instruction table.
+#
+# name: (format, encoding, class, implemented by the RTL)
+#
+# Formats give the operands and how they are encoded; see encode(). Classes
+# are what can be excluded from the command line of the fuzzer.
+
+OPCODES = {
+    "sll":      ("sh",   0x00000000, "alu", True),
+    "srl":      ("sh",   0x00000002, "alu", True),
+    "sra":      ("sh",   0x00000003, "alu", True),
+    "sllv":     ("shv",  0x00000004, "alu", True),
+    "srlv":     ("shv",  0x00000006, "alu", True),
+    "srav":     ("shv",  0x00000007, "alu", True),
+    "add":      ("r3",   0x00000020, "alu", True),
+    "addu":     ("r3",   0x00000021, "alu", True),
+    "sub":      ("r3",   0x00000022, "alu", True),
+    "subu":     ("r3",   0x00000023, "alu", True),
+    "and":      ("r3",   0x00000024, "alu", True),
+    "or":       ("r3",   0x00000025, "alu", True),
+    "xor":      ("r3",   0x00000026, "alu", True),
+    "nor":      ("r3",   0x00000027, "alu", True),
+    "slt":      ("r3",   0x0000002a, "alu", True),
+    "sltu":     ("r3",   0x0000002b, "alu", True),
+    "movz":     ("r3",   0x0000000a, "alu", False),
+    "movn":     ("r3",   0x0000000b, "alu", False),
+    "addi":     ("i",    0x20000000, "alu", True),
+    "addiu":    ("i",    0x24000000, "alu", True),
+    "slti":     ("i",    0x28000000, "alu", True),
+    "sltiu":    ("i",    0x2c000000, "alu", True),
+    "andi":     ("iu",   0x30000000, "alu", True),
+    "ori":      ("iu",   0x34000000, "alu", True),
+    "xori":     ("iu",   0x38000000, "alu", True),
+    "lui":      ("lui",  0x3c000000, "alu", True),
+    "clz":      ("cl",   0x70000020, "alu", False),
+    "clo":      ("cl",   0x70000021, "alu", False),
+    "mul":      ("r3",   0x70000002, "muldiv", False),
+    "mult":     ("md",   0x00000018, "muldiv", False),
+    "multu":    ("md",   0x00000019, "muldiv", False),
+    "div":      ("md",   0x0000001a, "muldiv", False),
+    "divu":     ("md",   0x0000001b, "muldiv", False),
+    "madd":     ("md",   0x70000000, "muldiv", False),
+    "maddu":    ("md",   0x70000001, "muldiv", False),
+    "mfhi":     ("mfhl", 0x00000010, "muldiv", False),
+    "mthi":     ("mthl", 0x00000011, "muldiv", False),
+    "mflo":     ("mfhl", 0x00000012, "muldiv", False),
+    "mtlo":     ("mthl", 0x00000013, "muldiv", False),
+    "lb":       ("mem",  0x80000000, "load", True),
+    "lh":       ("mem",  0x84000000, "load", True),
+    "lwl":      ("mem",  0x88000000, "load", False),
+    "lw":       ("mem",  0x8c000000, "load", True),
+    "lbu":      ("mem",  0x90000000, "load", True),
+    "lhu":      ("mem",  0x94000000, "load", True),
+    "lwr":      ("mem",  0x98000000, "load", False),
+    "sb":       ("mem",  0xa0000000, "store", True),
+    "sh":       ("mem",  0xa4000000, "store", True),
+    "swl":      ("mem",  0xa8000000, "store", False),
+    "sw":       ("mem",  0xac000000, "store", True),
+    "swr":      ("mem",  0xb8000000, "store", False),
+    "beq":      ("b2",   0x10000000, "branch", True),
+    "bne":      ("b2",   0x14000000, "branch", True),
+    "blez":     ("b1",   0x18000000, "branch", True),
+    "bgtz":     ("b1",   0x1c000000, "branch", True),
+    "bltz":     ("b1",   0x04000000, "branch", True),
+    "bgez":     ("b1",   0x04010000, "branch", True),
+    "bltzal":   ("b1",   0x04100000, "branch", True),
+    "bgezal":   ("b1",   0x04110000, "branch", True),
+    "beql":     ("b2",   0x50000000, "branch", False),
+    "bnel":     ("b2",   0x54000000, "branch", False),
+    "blezl":    ("b1",   0x58000000, "branch", False),
+    "bgtzl":    ("b1",   0x5c000000, "branch", False),
+    "j":        ("j",    0x08000000, "jump", True),
+    "jal":      ("j",    0x0c000000, "jump", True),
+    "jr":       ("jr",   0x00000008, "jump", True),
+    "jalr":     ("jalr", 0x00000009, "jump", False),
+    "mfc0":     ("cop0", 0x40000000, "cop0", True),
+    "mtc0":     ("cop0", 0x40800000, "cop0", True),
+    "eret":     ("none", 0x42000018, "cop0", True),
+    "syscall":  ("code", 0x0000000c, "trap", True),
+    "break":    ("code", 0x0000000d, "trap", True),
+}
+
+# Access size of loads and stores, and whether they may be unaligned.
+MEM_SIZES = {
+    "lb": (1, False), "lbu": (1, False), "sb": (1, False),
+    "lh": (2, False), "lhu": (2, False), "sh": (2, False),
+    "lw": (4, False), "sw": (4, False),
+    "lwl": (1, True), "lwr": (1, True), "swl": (1, True), "swr": (1, True),
+}
+
+# Branches and jumps that write the link register.
+LINK_OPS = ("bltzal", "bgezal", "jal", "jalr")
+
+# Instruction classes, and the relative frequency of their groups.
+CLASSES = ("alu", "muldiv", "load", "store", "branch", "jump", "cop0", "trap")
+GROUP_WEIGHTS = {
+    "alu": 40, "muldiv": 6, "load": 16, "store": 12,
+    "branch": 12, "jump": 5, "cop0": 3, "trap": 2,
+}
+
+# Probability of a source operand being one of the last few registers written,
+# so that most instructions depend on the ones right before them.
+HAZARD_BIAS = 0.5
+HAZARD_DEPTH = 3
+# Probability of a load or store reusing a recent address.
+ADDRESS_REUSE = 0.3
+
+
+class Insn:
+    """One instruction: opcode name and operands.
+
+    Branches and jumps have a target group (by group id) instead of an offset;
+    they are encoded once the program has been laid out.
+    """
+
+    def __init__(self, name, rd=0, rs=0, rt=0, imm=0, target=None,
+                 part=None):
+        self.name = name
+        self.rd = rd
+        self.rs = rs
+        self.rt = rt
+        self.imm = imm
+        # Group id of the target of a branch, jump or lui/ori of an address.
+        self.target = target
+        # For lui/ori of a target address: "hi" or "lo".
+        self.part = part
+
+
+class Group:
+    """A sequence of instructions that stay together; id is its index."""
+
+    def __init__(self, id, kind, insns):
+        self.id = id
+        self.kind = kind
+        self.insns = insns
+
+
+def regs_written(insn):
+    """Return the registers an instruction writes, other than HI/LO."""
+
+    fmt = OPCODES[insn.name][0]
+    if fmt in ("r3", "sh", "shv", "mfhl", "cl", "jalr"):
+        return [insn.rd]
+    if fmt in ("i", "iu", "lui"):
+        return [insn.rt]
+    if fmt == "mem" and OPCODES[insn.name][2] == "load":
+        return [insn.rt]
+    if insn.name == "mfc0":
+        return [insn.rt]
+    if insn.name in LINK_OPS:
+        return [insn.rd if insn.name == "jalr" else REG_LINK]
+    return []
+
+
+def encode(insn, addr, target_addr):
+    """Encode an instruction at address addr as a 32-bit word.
+
+    target_addr is the address of the target group, if the instruction has one.
+    """
+
+    (fmt, word, cls, rtl) = OPCODES[insn.name]
+    if insn.part == "hi":
+        return word | (insn.rt << 16) | (target_addr >> 16)
+    if insn.part == "lo":
+        return (word | (insn.rs << 21) | (insn.rt << 16) |
+                (target_addr & 0xffff))
+    if fmt == "r3":
+        return word | (insn.rs << 21) | (insn.rt << 16) | (insn.rd << 11)
+    if fmt == "sh":
+        return word | (insn.rt << 16) | (insn.rd << 11) | (insn.imm << 6)
+    if fmt == "shv":
+        return word | (insn.rs << 21) | (insn.rt << 16) | (insn.rd << 11)
+    if fmt in ("i", "iu", "mem"):
+        return word | (insn.rs << 21) | (insn.rt << 16) | (insn.imm & 0xffff)
+    if fmt == "lui":
+        return word | (insn.rt << 16) | (insn.imm & 0xffff)
+    if fmt == "cl":
+        return word | (insn.rs << 21) | (insn.rd << 16) | (insn.rd << 11)
+    if fmt == "md":
+        return word | (insn.rs << 21) | (insn.rt << 16)
+    if fmt == "mfhl":
+        return word | (insn.rd << 11)
+    if fmt == "mthl":
+        return word | (insn.rs << 21)
+    if fmt in ("b2", "b1"):
+        offset = ((target_addr - (addr + 4)) >> 2) & 0xffff
+        return word | (insn.rs << 21) | (insn.rt << 16) | offset
+    if fmt == "j":
+        return word | ((target_addr >> 2) & 0x03ffffff)
+    if fmt == "jr":
+        return word | (insn.rs << 21)
+    if fmt == "jalr":
+        return word | (insn.rs << 21) | (insn.rd << 11)
+    if fmt == "cop0":
+        return word | (insn.rt << 16) | (insn.rd << 11)
+    if fmt == "code":
+        return word | ((insn.imm & 0xfffff) << 6)
+    return word
+
+
+def disassemble(insn, target_addr):
+    """Return the assembler text of an instruction, for listings."""
+
+    fmt = OPCODES[insn.name][0]
+    n = insn.name
+    if insn.part == "hi":
+        return "lui     $%d,0x%04x" % (insn.rt, target_addr >> 16)
+    if insn.part == "lo":
+        return "ori     $%d,$%d,0x%04x" % (insn.rt, insn.rs,
+                                           target_addr & 0xffff)
+    if fmt == "r3":
+        text = "$%d,$%d,$%d" % (insn.rd, insn.rs, insn.rt)
+    elif fmt == "sh":
+        text = "$%d,$%d,%d" % (insn.rd, insn.rt, insn.imm)
+    elif fmt == "shv":
+        text = "$%d,$%d,$%d" % (insn.rd, insn.rt, insn.rs)
+    elif fmt == "i":
+        text = "$%d,$%d,%d" % (insn.rt, insn.rs, insn.imm)
+    elif fmt == "iu":
+        text = "$%d,$%d,0x%04x" % (insn.rt, insn.rs, insn.imm)
+    elif fmt == "lui":
+        text = "$%d,0x%04x" % (insn.rt, insn.imm)
+    elif fmt == "mem":
+        text = "$%d,%d($%d)" % (insn.rt, insn.imm, insn.rs)
+    elif fmt == "cl":
+        text = "$%d,$%d" % (insn.rd, insn.rs)
+    elif fmt == "md":
+        text = "$%d,$%d" % (insn.rs, insn.rt)
+    elif fmt == "mfhl":
+        text = "$%d" % insn.rd
+    elif fmt == "mthl":
+        text = "$%d" % insn.rs
+    elif fmt == "b2":
+        text = "$%d,$%d,0x%08x" % (insn.rs, insn.rt, target_addr)
+    elif fmt == "b1":
+        text = "$%d,0x%08x" % (insn.rs, target_addr)
+    elif fmt == "j":
+        text = "0x%08x" % target_addr
+    elif fmt == "jr":
+        text = "$%d" % insn.rs
+    elif fmt == "jalr":
+        text = "$%d,$%d" % (insn.rd, insn.rs)
+    elif fmt == "cop0":
+        text = "$%d,$%d" % (insn.rt, insn.rd)
+    elif fmt == "code":
+        text = "0x%x" % insn.imm
+    else:
+        text = ""
+    return ("%-7s %s" % (n, text)).rstrip()
+
+
+class Program:
+    """A random program: fixed parts plus the groups of its body."""
+
+    def __init__(self, seed, groups, reg_init, data):
+        self.seed = seed
+        self.groups = groups
+        self.reg_init = reg_init
+        self.data = data
+
+    def subset(self, groups):
+        """Return a copy of the program with only the given body groups."""
+        return Program(self.seed, groups, self.reg_init, self.data)
+
+    def num_insns(self):
+        """Return the number of instructions in the body."""
+        return sum(len(g.insns) for g in self.groups)
+
+    def layout(self):
+        """Lay out the program in memory.
+
+        Returns a list of (address, instruction, target address) tuples in
+        address order, trap handler included.
+        """
+
+        code = []
+
+        # Reset vector.
+        code.append((CODE_BASE, Insn("j"), PROLOGUE_ADDR))
+        code.append((CODE_BASE + 4, Insn("sll"), None))
+
+        # Trap handler: return past the trap, count it and leave CAUSE in $26.
+        handler = [
+            Insn("mfc0", rt=REG_SCRATCH, rd=COP0_EPC),
+            Insn("addiu", rt=REG_SCRATCH, rs=REG_SCRATCH, imm=4),
+            Insn("mtc0", rt=REG_SCRATCH, rd=COP0_EPC),
+            Insn("mfc0", rt=REG_SCRATCH, rd=13),
+            Insn("addiu", rt=REG_TRAPS, rs=REG_TRAPS, imm=1),
+            Insn("sll"),
+            Insn("eret"),
+            # Never runs: ERET has no delay slot.
+            Insn("addiu", rt=REG_TRAPS, rs=REG_TRAPS, imm=0x100)]
+        addr = TRAP_VECTOR
+        for insn in handler:
+            code.append((addr, insn, None))
+            addr += 4
+
+        # Prologue: STATUS and registers.
+        prologue = [
+            Insn("lui", rt=1, imm=STATUS_INIT >> 16),
+            Insn("mtc0", rt=1, rd=COP0_STATUS),
+            Insn("sll"),
+            Insn("sll")]
+        for r in range(1, 32):
+            value = initial_value(r, self.reg_init)
+            prologue.append(Insn("lui", rt=r, imm=value >> 16))
+            prologue.append(Insn("ori", rt=r, rs=r, imm=value & 0xffff))
+        addr = PROLOGUE_ADDR
+        for insn in prologue:
+            code.append((addr, insn, None))
+            addr += 4
+
+        # Body: find the address of every group first, then encode.
+        group_addr = {}
+        ids = []
+        for g in self.groups:
+            group_addr[g.id] = addr
+            ids.append(g.id)
+            addr += 4 * len(g.insns)
+        epilogue_addr = addr
+
+        def target_of(id):
+            # Dropped groups are replaced by the next group still there.
+            i = bisect.bisect_left(ids, id)
+            if i < len(ids):
+                return group_addr[ids[i]]
+            return epilogue_addr
+
+        addr = group_addr[ids[0]] if ids else epilogue_addr
+        for g in self.groups:
+            for insn in g.insns:
+                target = None
+                if insn.target is not None:
+                    target = target_of(insn.target)
+                code.append((addr, insn, target))
+                addr += 4
+
+        # Epilogue: stop the simulation, then loop in case it does not stop.
+        epilogue = [
+            Insn("lui", rt=1, imm=TB_STOP_SIM >> 16),
+            Insn("ori", rt=1, rs=1, imm=TB_STOP_SIM & 0xffff),
+            Insn("sw", rt=0, rs=1, imm=0),
+            Insn("sll")]
+        for insn in epilogue:
+            code.append((addr, insn, None))
+            addr += 4
+        code.append((addr, Insn("beq"), addr))
+        code.append((addr + 4, Insn("sll"), None))
+
+        if addr + 8 > CODE_BASE + CODE_SIZE:
+            raise ValueError("program too long for the code area")
+        return code
+
+    def image(self):
+        """Return the memory image of the program as a string of bytes."""
+
+        words = [0] * (IMAGE_SIZE // 4)
+        for (addr, insn, target) in self.layout():
+            words[(addr - CODE_BASE) // 4] = encode(insn, addr, target)
+        base = (DATA_BASE - CODE_BASE) // 4
+        words[base:base + len(self.data)] = self.data
+        return struct.pack(">%dI" % len(words), *words)
+
+    def listing(self):
+        """Return a text listing of the program, one instruction per line."""
+
+        lines = []
+        for (addr, insn, target) in self.layout():
+            lines.append("%08x:  %08x    %s" % (
+                addr, encode(insn, addr, target), disassemble(insn, target)))
+        return "\n".join(lines) + "\n"
+
+
+def initial_value(r, reg_init):
+    """Return the value a register is given by the prologue."""
+
+    if r == REG_SCRATCH or r == REG_TRAPS:
+        return 0
+    if r == REG_BASE:
+        return DATA_POINTER
+    return reg_init[r]
+
+
+def write_hex(image, filename):
+    """Write a memory image in $readmemh format, one word per line."""
+
+    words = struct.unpack(">%dI" % (len(image) // 4), image)
+    f = open(filename, "w")
+    f.write("".join(["%08x\n" % w for w in words]))
+    f.close()
+
+
+#### Generator.
+
+class Generator:
+    """Random program generator, reproducible from its seed.
+
+    'classes' are the instruction classes used; 'rtl_only' restricts the
+    instructions to those implemented by the RTL.
+    """
+
+    def __init__(self, seed, classes=CLASSES, rtl_only=True):
+        self.rng = random.Random(seed)
+        self.seed = seed
+        self.ops = {}
+        for cls in CLASSES:
+            self.ops[cls] = sorted([name for (name, op) in OPCODES.items()
+                                    if op[2] == cls and name != "eret" and
+                                    (op[3] or not rtl_only)])
+        self.kinds = [cls for cls in classes if self.ops.get(cls)]
+        if not self.kinds:
+            raise ValueError("no instructions to generate")
+        self.recent = []
+        self.addresses = []
+
+    def program(self, length):
+        """Generate a program with about 'length' instructions in its body."""
+
+        rng = self.rng
+        reg_init = [0] + [self.value() for r in range(1, 32)]
+        data = [rng.getrandbits(32) for i in range(DATA_SIZE // 4)]
+
+        # One entry per unit of weight, for a weighted choice of group kind.
+        kinds = []
+        for kind in self.kinds:
+            kinds += [kind] * GROUP_WEIGHTS[kind]
+        groups = []
+        count = 0
+        while count < length:
+            kind = rng.choice(kinds)
+            id = len(groups)
+            insns = getattr(self, "group_" + kind)(id)
+            groups.append(Group(id, kind, insns))
+            count += len(insns)
+        return Program(self.seed, groups, reg_init, data)
+
+    #-- Operands.
+
+    def value(self):
+        """Return a random 32-bit value, biased towards corner cases."""
+
+        rng = self.rng
+        k = rng.randrange(8)
+        if k == 0:
+            return rng.choice([0, 1, 0xffffffff, 0x7fffffff, 0x80000000,
+                               0x0000ffff, 0x00008000, 0xffff8000])
+        if k == 1:
+            return rng.randrange(64)
+        if k == 2:
+            return (-rng.randrange(1, 64)) & 0xffffffff
+        return rng.getrandbits(32)
+
+    def imm16(self):
+        """Return a random 16-bit immediate, biased towards corner cases."""
+
+        rng = self.rng
+        k = rng.randrange(4)
+        if k == 0:
+            return rng.choice([0, 1, 0xffff, 0x7fff, 0x8000])
+        if k == 1:
+            return rng.randrange(16)
+        return rng.getrandbits(16)
+
+    def src(self):
+        """Return a source register, often one written just before."""
+
+        if self.recent and self.rng.random() < HAZARD_BIAS:
+            return self.rng.choice(self.recent)
+        return self.rng.randrange(32)
+
+    def dst(self, avoid=()):
+        """Return a destination register, seldom $0, never a reserved one."""
+
+        rng = self.rng
+        while True:
+            if rng.random() < 0.03:
+                r = 0
+            else:
+                r = rng.choice(FREE_REGS)
+            if r not in avoid:
+                return r
+
+    def wrote(self, insns):
+        """Track the registers written by some instructions for hazards."""
+
+        for insn in insns:
+            for r in regs_written(insn):
+                if r != 0:
+                    self.recent = (self.recent + [r])[-HAZARD_DEPTH:]
+        return insns
+
+    def forward(self, id):
+        """Return the id of a group a few groups ahead of group id."""
+        return id + 1 + self.rng.randrange(6)
+
+    #-- Single instructions.
+
+    def alu_insn(self, avoid=()):
+        """Return a random instruction of class alu (or muldiv)."""
+
+        rng = self.rng
+        kinds = ["alu"]
+        if self.ops["muldiv"] and "muldiv" in self.kinds:
+            kinds.append("muldiv")
+        name = rng.choice(self.ops[rng.choice(kinds)])
+        fmt = OPCODES[name][0]
+        if fmt in ("r3", "shv"):
+            return Insn(name, rd=self.dst(avoid), rs=self.src(), rt=self.src())
+        if fmt == "sh":
+            return Insn(name, rd=self.dst(avoid), rt=self.src(),
+                        imm=rng.randrange(32))
+        if fmt == "i":
+            imm = self.imm16()
+            if imm & 0x8000:
+                imm -= 0x10000
+            return Insn(name, rt=self.dst(avoid), rs=self.src(), imm=imm)
+        if fmt == "iu":
+            return Insn(name, rt=self.dst(avoid), rs=self.src(),
+                        imm=self.imm16())
+        if fmt == "lui":
+            return Insn(name, rt=self.dst(avoid), imm=self.imm16())
+        if fmt == "cl":
+            return Insn(name, rd=self.dst(avoid), rs=self.src())
+        if fmt == "md":
+            return Insn(name, rs=self.src(), rt=self.src())
+        if fmt == "mfhl":
+            return Insn(name, rd=self.dst(avoid))
+        return Insn(name, rs=self.src())
+
+    def mem_insn(self, name, base, offset):
+        """Return a load or store at some offset from a base register."""
+
+        if OPCODES[name][2] == "load":
+            return Insn(name, rt=self.dst(), rs=base, imm=offset)
+        return Insn(name, rt=self.src(), rs=base, imm=offset)
+
+    def data_offset(self, size, unaligned):
+        """Return an offset from $28 for an access of some size.
+
+        Recently used offsets come up again often so that loads read what
+        stores have just written.
+        """
+
+        rng = self.rng
+        if self.addresses and rng.random() < ADDRESS_REUSE:
+            offset = rng.choice(self.addresses)
+        else:
+            offset = rng.randrange(-0x8000, 0x8000)
+        if not unaligned:
+            offset &= ~(size - 1)
+        self.addresses = (self.addresses + [offset])[-8:]
+        return offset
+
+    def slot_insn(self, avoid=()):
+        """Return an instruction for a delay slot: ALU, load or store."""
+
+        rng = self.rng
+        mem = [k for k in ("load", "store") if k in self.kinds]
+        if mem and rng.random() < 0.3:
+            name = rng.choice(self.ops[rng.choice(mem)])
+            (size, unaligned) = MEM_SIZES[name]
+            insn = self.mem_insn(name, REG_BASE,
+                                 self.data_offset(size, unaligned))
+            if not (set(regs_written(insn)) & set(avoid)):
+                return insn
+        return self.alu_insn(avoid)
+
+    #-- Groups, one kind per instruction class.
+
+    def group_alu(self, id):
+        return self.wrote([self.alu_insn()])
+
+    group_muldiv = group_alu
+
+    def group_mem(self, id, kind):
+        """Load or store, with its address computed right before or not."""
+
+        rng = self.rng
+        name = rng.choice(self.ops[kind])
+        (size, unaligned) = MEM_SIZES[name]
+        offset = self.data_offset(size, unaligned)
+        if rng.random() < 0.5:
+            return self.wrote([self.mem_insn(name, REG_BASE, offset)])
+
+        # Compute a base address into some register and use it at once,
+        # maybe with an instruction in between.
+        base = rng.choice(FREE_REGS)
+        small = rng.randrange(-64, 64) & ~3
+        if not -0x8000 <= offset - small < 0x8000:
+            small = 0
+        insns = [Insn("addiu", rt=base, rs=REG_BASE, imm=offset - small)]
+        if rng.random() < 0.3:
+            insns.append(self.alu_insn(avoid=(base,)))
+        self.wrote(insns)
+        insns.append(self.mem_insn(name, base, small))
+        return self.wrote(insns)
+
+    def group_load(self, id):
+        return self.group_mem(id, "load")
+
+    def group_store(self, id):
+        return self.group_mem(id, "store")
+
+    def group_branch(self, id):
+        """Conditional branch to a group ahead, and its delay slot."""
+
+        rng = self.rng
+        name = rng.choice(self.ops["branch"])
+        rs = self.src()
+        avoid = ()
+        if name in LINK_OPS:
+            # Reading the link register in a linking branch is unpredictable.
+            while rs == REG_LINK:
+                rs = rng.randrange(32)
+            avoid = (REG_LINK,)
+        branch = Insn(name, rs=rs, target=self.forward(id))
+        if OPCODES[name][0] == "b2":
+            branch.rt = self.src()
+        return self.wrote([branch, self.slot_insn(avoid)])
+
+    def group_jump(self, id):
+        """Direct or indirect jump to a group ahead, and its delay slot."""
+
+        rng = self.rng
+        name = rng.choice(self.ops["jump"])
+        target = self.forward(id)
+        avoid = (REG_LINK,) if name in LINK_OPS else ()
+        if name in ("j", "jal"):
+            jump = Insn(name, target=target)
+            return self.wrote([jump, self.slot_insn(avoid)])
+
+        # Indirect: target address into a register, maybe an instruction in
+        # between, then the jump.
+        reg = rng.choice(FREE_REGS)
+        insns = [Insn("lui", rt=reg, target=target, part="hi"),
+                 Insn("ori", rt=reg, rs=reg, target=target, part="lo")]
+        if rng.random() < 0.5:
+            insns.append(self.alu_insn(avoid=(reg,)))
+        if name == "jalr":
+            link = self.dst(avoid=(reg,))
+            jump = Insn(name, rd=link, rs=reg)
+            avoid = (link,)
+        else:
+            jump = Insn(name, rs=reg)
+        self.wrote(insns)
+        return insns + self.wrote([jump, self.slot_insn(avoid)])
+
+    def group_cop0(self, id):
+        """Move from COP0, or move to STATUS or EPC."""
+
+        rng = self.rng
+        k = rng.randrange(4)
+        if k < 2 or "mtc0" not in self.ops["cop0"]:
+            return self.wrote([Insn("mfc0", rt=self.dst(),
+                                    rd=rng.choice(COP0_READ))])
+        if k == 2:
+            return self.wrote([Insn("mtc0", rt=self.src(), rd=COP0_EPC)])
+        # STATUS: only the interrupt mask changes; interrupts stay disabled.
+        reg = rng.choice(FREE_REGS)
+        insns = [Insn("lui", rt=reg, imm=STATUS_INIT >> 16),
+                 Insn("ori", rt=reg, rs=reg, imm=rng.randrange(256) << 8),
+                 Insn("mtc0", rt=reg, rd=COP0_STATUS)]
+        return self.wrote(insns)
+
+    def group_trap(self, id):
+        name = self.rng.choice(self.ops["trap"])
+        return [Insn(name, imm=self.rng.getrandbits(20))]
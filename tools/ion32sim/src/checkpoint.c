@@ -0,0 +1,474 @@
+/**
+    @file checkpoint.c
+    @brief Checkpoint and restore of the whole simulation state.
+
+    A checkpoint holds the CPU state (GPRs, HI/LO, COP0, COP2 stub, simulated
+    I/O registers, the trace state that the execution log depends on and the
+    pending events) and the contents of all memory blocks. Runs restored from
+    a checkpoint go on as the run that saved it would have, execution log
+    included, as long as they don't depend on state that is not saved:
+
+    - Devices: the state of plugin devices (their context) and the time of
+      their next tick.
+    - The UART: the contents of its RX and TX FIFOs, and its source.
+    - The timing model (--timing): cycle and stall counts start from 0.
+    - The cache models and the profiler, which start empty.
+
+    A checkpoint file is a t_ckp_header, a t_ckp_block per memory block and a
+    t_ckp_cpu, all in the byte order of the host that wrote them, and then
+    the contents of each memory block at a file offset aligned to
+    CKP_ALIGN. Restoring maps the memory images privately from the file,
+    so a large memory image costs nothing up front: pages are read as the
+    simulation touches them, and writes never reach the file. Pages of zeros
+    are left as holes in the file, so a large block the program barely
+    touched takes little disk space either. Saving writes a new file and
+    renames it over the old one, so a run can save its checkpoint to the
+    very file it was restored from.
+
+    Checkpoints can only be restored to the memory map they were saved from.
+*/
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "ion32sim.h"
+
+
+/** Magic string at the start of a checkpoint file (not 0-terminated) */
+#define CKP_MAGIC           "ION32CKP"
+/** Version of the checkpoint format; bump on any change to t_ckp_cpu */
+#define CKP_VERSION         (4)
+/** Value of byte_order field as written by the host */
+#define CKP_BYTE_ORDER      (0x01020304)
+/** Alignment of block contents in the file: the largest host page size
+    around, so any host can map them */
+#define CKP_ALIGN           (0x10000)
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+/** Geometry of a memory block and location of its contents in the file */
+typedef struct s_ckp_block {
+    uint32_t start;
+    uint32_t size;
+    uint32_t mask;
+    uint32_t flags;
+    uint64_t offset;        /**< file offset of block contents */
+} t_ckp_block;
+
+/** Header of checkpoint file */
+typedef struct s_ckp_header {
+    char magic[8];          /**< CKP_MAGIC */
+    uint32_t byte_order;    /**< CKP_BYTE_ORDER in writer byte order */
+    uint32_t version;       /**< CKP_VERSION */
+    uint32_t cpu_size;      /**< sizeof(t_ckp_cpu) */
+    uint32_t num_blocks;    /**< number of t_ckp_blocks that follow */
+} t_ckp_header;
+
+/** CPU state: every field of t_state that is not a host resource */
+typedef struct s_ckp_cpu {
+    uint64_t insn_count;
+    uint32_t failed_assertions;
+    uint32_t faulty_address;
+    uint64_t timer_base;
+    uint64_t count_base;
+    uint32_t timer_irq;
+    uint32_t debug_regs[16];
+    uint32_t gpio_regs[1];
+    int32_t r[32];
+    int32_t opcode;
+    int32_t pc, pc_next, epc;
+    uint32_t op_addr;
+    uint32_t hi, lo;
+    uint32_t cp0_status;
+    int32_t trap_cause;
+    uint32_t cause_ip;
+    uint32_t cp0_cause;
+    uint32_t cp0_errorpc;
+    uint32_t cp0_config0;
+    uint32_t cp0_compare;
+    uint32_t cop2[32*2];
+    int32_t delay_slot;
+    int32_t irq_status;
+    int32_t skip;
+    int32_t eret_delay_slot;
+    int32_t wakeup;
+    int32_t big_endian;
+    uint32_t sr_load_pending;
+    uint32_t sr_load_pending_value;
+    uint32_t ll_bit;
+    uint32_t ll_addr;
+    /* Trace state */
+    uint32_t buf[TRACE_BUFFER_SIZE];
+    uint32_t next;
+    int32_t log_triggered;
+    int32_t pr[32];
+    int32_t t_hi, t_lo, t_epc, t_status;
+    uint32_t irq_pending;
+    int32_t irq_trigger_inputs;
+    int32_t irq_current_inputs;
+    /* Event queue */
+    uint32_t num_events;
+    t_event events[SCHED_MAX_EVENTS];
+} t_ckp_cpu;
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/** A page of zeros, to spot the pages of memory that were never written */
+static const uint8_t zero_page[MEM_PAGE_SIZE];
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void save_cpu(t_state *s, t_ckp_cpu *c);
+static void restore_cpu(t_state *s, const t_ckp_cpu *c);
+static void write_block(FILE *f, const t_block *b);
+static int save_failed(char *tmp_name, const char *name);
+static int map_block(t_block *b, FILE *f, uint64_t offset);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Save the simulation state to a checkpoint file.
+
+    @return 0 on error, after printing a message.
+*/
+int checkpoint_save(t_state *s, const char *name){
+    t_ckp_header h;
+    t_ckp_block *b;
+    t_ckp_cpu c;
+    FILE *f;
+    char *tmp_name;
+    uint32_t i;
+    uint64_t offset;
+
+    b = calloc(s->num_blocks, sizeof(t_ckp_block));
+    if(b==NULL){
+        fprintf(stderr, "Trouble allocating memory\n");
+        return 0;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKP_MAGIC, sizeof(h.magic));
+    h.byte_order = CKP_BYTE_ORDER;
+    h.version = CKP_VERSION;
+    h.cpu_size = sizeof(t_ckp_cpu);
+    h.num_blocks = s->num_blocks;
+    offset = sizeof(t_ckp_header) + s->num_blocks*sizeof(t_ckp_block) +
+             sizeof(t_ckp_cpu);
+    for(i=0;i<s->num_blocks;i++){
+        offset = (offset + CKP_ALIGN - 1) & ~(uint64_t)(CKP_ALIGN - 1);
+        b[i].start = s->blocks[i].start;
+        b[i].size = s->blocks[i].size;
+        b[i].mask = s->blocks[i].mask;
+        b[i].flags = s->blocks[i].flags;
+        b[i].offset = offset;
+        offset += s->blocks[i].size;
+    }
+    save_cpu(s, &c);
+
+    /* The file we restored from may be mapped as our memory right now, so
+       never write it in place: write a new file and rename it over. */
+    tmp_name = malloc(strlen(name) + 5);
+    if(tmp_name==NULL){
+        fprintf(stderr, "Trouble allocating memory\n");
+        free(b);
+        return 0;
+    }
+    sprintf(tmp_name, "%s.tmp", name);
+    f = fopen(tmp_name, "wb");
+    if(f==NULL){
+        fprintf(stderr, "Error opening checkpoint file '%s'\n", tmp_name);
+        free(tmp_name);
+        free(b);
+        return 0;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(b, sizeof(t_ckp_block), s->num_blocks, f);
+    fwrite(&c, sizeof(c), 1, f);
+    for(i=0;i<s->num_blocks;i++){
+        fseek(f, b[i].offset, SEEK_SET);
+        write_block(f, &(s->blocks[i]));
+    }
+    free(b);
+#ifndef WIN32
+    /* The file may end in a hole */
+    fflush(f);
+    if(ftruncate(fileno(f), offset)!=0){
+        fclose(f);
+        return save_failed(tmp_name, name);
+    }
+#endif
+    if(ferror(f) | fclose(f)){
+        return save_failed(tmp_name, name);
+    }
+#ifdef WIN32
+    /* rename() won't replace an existing file here; nothing is mapped */
+    remove(name);
+#endif
+    if(rename(tmp_name, name)!=0){
+        return save_failed(tmp_name, name);
+    }
+    free(tmp_name);
+    fprintf(stderr, "Checkpoint saved to '%s' at pc=0x%08x after %llu "
+            "instructions.\n", name, s->pc, (unsigned long long)s->insn_count);
+    return 1;
+}
+
+/**
+    Restore the simulation state from a checkpoint file.
+    The CPU must have been set up with init_cpu and init_trace_buffer, with
+    the same memory map the checkpoint was saved from. Any decoded
+    instructions are dropped.
+
+    @return 0 on error, after printing a message; the CPU is left as it was
+            unless the memory could not be mapped.
+*/
+int checkpoint_restore(t_state *s, const char *name){
+    t_ckp_header h;
+    t_ckp_block *b = NULL;
+    t_ckp_cpu c;
+    FILE *f;
+    uint32_t i, predecode, basic_blocks;
+
+    f = fopen(name, "rb");
+    if(f==NULL){
+        fprintf(stderr, "Error opening checkpoint file '%s'\n", name);
+        return 0;
+    }
+    if(fread(&h, sizeof(h), 1, f)!=1 ||
+       memcmp(h.magic, CKP_MAGIC, sizeof(h.magic))!=0){
+        fprintf(stderr, "'%s' is not a checkpoint file\n", name);
+        fclose(f);
+        return 0;
+    }
+    if(h.byte_order!=CKP_BYTE_ORDER || h.version!=CKP_VERSION ||
+       h.cpu_size!=sizeof(t_ckp_cpu)){
+        fprintf(stderr, "Checkpoint '%s' was saved by an incompatible "
+                "simulator or host\n", name);
+        fclose(f);
+        return 0;
+    }
+    if(h.num_blocks==s->num_blocks){
+        b = calloc(s->num_blocks, sizeof(t_ckp_block));
+        if(b==NULL){
+            fprintf(stderr, "Trouble allocating memory\n");
+            fclose(f);
+            return 0;
+        }
+        if(fread(b, sizeof(t_ckp_block), h.num_blocks, f)!=h.num_blocks ||
+           fread(&c, sizeof(c), 1, f)!=1){
+            fprintf(stderr, "Error reading checkpoint file '%s'\n", name);
+            free(b);
+            fclose(f);
+            return 0;
+        }
+        for(i=0;i<s->num_blocks;i++){
+            if(b[i].start!=s->blocks[i].start ||
+               b[i].size!=s->blocks[i].size ||
+               b[i].mask!=s->blocks[i].mask ||
+               b[i].flags!=s->blocks[i].flags) break;
+        }
+    }
+    if(b==NULL || i<s->num_blocks){
+        fprintf(stderr, "Checkpoint '%s' was saved with a different "
+                "memory map\n", name);
+        free(b);
+        fclose(f);
+        return 0;
+    }
+
+    /* Replace the memory blocks and rebuild everything that points to them */
+    predecode = s->pd.enabled;
+    basic_blocks = s->pd.basic_blocks;
+    predecode_free(s);
+    mem_map_free(s);
+    for(i=0;i<s->num_blocks;i++){
+        if(!map_block(&(s->blocks[i]), f, b[i].offset)){
+            fprintf(stderr, "Error reading checkpoint file '%s'\n", name);
+            free(b);
+            fclose(f);
+            return 0;
+        }
+    }
+    free(b);
+    fclose(f);
+    predecode_init(s, predecode, basic_blocks);
+    if(!mem_map_init(s)){
+        fprintf(stderr, "Trouble allocating memory\n");
+        return 0;
+    }
+
+    restore_cpu(s, &c);
+    fprintf(stderr, "Checkpoint restored from '%s' at pc=0x%08x after %llu "
+            "instructions.\n", name, s->pc, (unsigned long long)s->insn_count);
+    return 1;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Write the contents of a block at the current file position. Pages of
+    zeros are skipped, leaving holes in the file where the host supports
+    them, so large blocks the program hardly touched take little space. */
+static void write_block(FILE *f, const t_block *b){
+    uint32_t i, n;
+
+    for(i=0;i<b->size;i+=n){
+        n = (b->size - i < MEM_PAGE_SIZE)? b->size - i : MEM_PAGE_SIZE;
+#ifndef WIN32
+        if(memcmp(b->mem + i, zero_page, n)==0){
+            fseek(f, n, SEEK_CUR);
+            continue;
+        }
+#endif
+        fwrite(b->mem + i, 1, n, f);
+    }
+}
+
+/** Drop a half-written checkpoint file; returns 0 for checkpoint_save. */
+static int save_failed(char *tmp_name, const char *name){
+    remove(tmp_name);
+    free(tmp_name);
+    fprintf(stderr, "Error writing checkpoint file '%s'\n", name);
+    return 0;
+}
+
+/** Replace the memory of a block with its contents in a checkpoint file.
+    The file is mapped copy-on-write where possible, and read otherwise. */
+static int map_block(t_block *b, FILE *f, uint64_t offset){
+#ifndef WIN32
+    void *mem;
+
+    if(b->size > 0){
+        mem = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fileno(f), offset);
+        if(mem!=MAP_FAILED){
+            free_block_memory(b);
+            b->mem = (uint8_t *)mem;
+            b->mapped = true;
+            return 1;
+        }
+    }
+#endif
+    return fseek(f, offset, SEEK_SET)==0 &&
+           fread(b->mem, 1, b->size, f)==b->size;
+}
+
+static void save_cpu(t_state *s, t_ckp_cpu *c){
+    uint32_t i;
+
+    memset(c, 0, sizeof(t_ckp_cpu));
+    c->insn_count = s->insn_count;
+    c->failed_assertions = s->failed_assertions;
+    c->faulty_address = s->faulty_address;
+    c->timer_base = s->timer_base;
+    c->count_base = s->count_base;
+    c->timer_irq = s->timer_irq;
+    memcpy(c->debug_regs, s->debug_regs, sizeof(c->debug_regs));
+    c->gpio_regs[0] = s->gpio_regs[0];
+    memcpy(c->r, s->r, sizeof(c->r));
+    c->opcode = s->opcode;
+    c->pc = s->pc;
+    c->pc_next = s->pc_next;
+    c->epc = s->epc;
+    c->op_addr = s->op_addr;
+    c->hi = s->hi;
+    c->lo = s->lo;
+    c->cp0_status = s->cp0_status;
+    c->trap_cause = s->trap_cause;
+    c->cause_ip = s->cause_ip;
+    c->cp0_cause = s->cp0_cause;
+    c->cp0_errorpc = s->cp0_errorpc;
+    c->cp0_config0 = s->cp0_config0;
+    c->cp0_compare = s->cp0_compare;
+    memcpy(c->cop2, s->cop2.r, sizeof(c->cop2));
+    c->delay_slot = s->delay_slot;
+    c->irq_status = s->irqStatus;
+    c->skip = s->skip;
+    c->eret_delay_slot = s->eret_delay_slot;
+    c->wakeup = s->wakeup;
+    c->big_endian = s->big_endian;
+    c->sr_load_pending = s->sr_load_pending;
+    c->sr_load_pending_value = s->sr_load_pending_value;
+    c->ll_bit = s->ll_bit;
+    c->ll_addr = s->ll_addr;
+
+    for(i=0;i<TRACE_BUFFER_SIZE;i++){
+        c->buf[i] = s->t.buf[i];
+    }
+    c->next = s->t.next;
+    c->log_triggered = s->t.log_triggered;
+    memcpy(c->pr, s->t.pr, sizeof(c->pr));
+    c->t_hi = s->t.hi;
+    c->t_lo = s->t.lo;
+    c->t_epc = s->t.epc;
+    c->t_status = s->t.status;
+    c->irq_pending = s->t.irq_pending;
+    c->irq_trigger_inputs = s->t.irq_trigger_inputs;
+    c->irq_current_inputs = s->t.irq_current_inputs;
+
+    c->num_events = s->sched.num_events;
+    memcpy(c->events, s->sched.events, sizeof(c->events));
+}
+
+static void restore_cpu(t_state *s, const t_ckp_cpu *c){
+    uint32_t i;
+
+    s->insn_count = c->insn_count;
+    s->failed_assertions = c->failed_assertions;
+    s->faulty_address = c->faulty_address;
+    s->timer_base = c->timer_base;
+    s->count_base = c->count_base;
+    s->timer_irq = c->timer_irq!=0;
+    memcpy(s->debug_regs, c->debug_regs, sizeof(s->debug_regs));
+    s->gpio_regs[0] = c->gpio_regs[0];
+    memcpy(s->r, c->r, sizeof(s->r));
+    s->opcode = c->opcode;
+    s->pc = c->pc;
+    s->pc_next = c->pc_next;
+    s->epc = c->epc;
+    s->op_addr = c->op_addr;
+    s->hi = c->hi;
+    s->lo = c->lo;
+    s->cp0_status = c->cp0_status;
+    s->trap_cause = c->trap_cause;
+    s->cause_ip = c->cause_ip;
+    s->cp0_cause = c->cp0_cause;
+    s->cp0_errorpc = c->cp0_errorpc;
+    s->cp0_config0 = c->cp0_config0;
+    s->cp0_compare = c->cp0_compare;
+    memcpy(s->cop2.r, c->cop2, sizeof(c->cop2));
+    s->delay_slot = c->delay_slot;
+    s->irqStatus = c->irq_status;
+    s->skip = c->skip;
+    s->eret_delay_slot = c->eret_delay_slot;
+    s->wakeup = c->wakeup;
+    s->big_endian = c->big_endian;
+    s->sr_load_pending = c->sr_load_pending;
+    s->sr_load_pending_value = c->sr_load_pending_value;
+    s->ll_bit = c->ll_bit!=0;
+    s->ll_addr = c->ll_addr;
+
+    for(i=0;i<TRACE_BUFFER_SIZE;i++){
+        s->t.buf[i] = c->buf[i];
+    }
+    s->t.next = c->next;
+    s->t.log_triggered = c->log_triggered;
+    memcpy(s->t.pr, c->pr, sizeof(s->t.pr));
+    s->t.hi = c->t_hi;
+    s->t.lo = c->t_lo;
+    s->t.epc = c->t_epc;
+    s->t.status = c->t_status;
+    s->t.irq_pending = c->irq_pending!=0;
+    s->t.irq_trigger_inputs = c->irq_trigger_inputs;
+    s->t.irq_current_inputs = c->irq_current_inputs;
+
+    s->sched.num_events = c->num_events;
+    memcpy(s->sched.events, c->events, sizeof(c->events));
+    s->sched.next = c->num_events? c->events[0].time : SCHED_NEVER;
+}
@@ -0,0 +1,178 @@
+/**
+    @file cosim.c
+    @brief Lockstep co-simulation: the simulator as an in-process golden model.
+
+    A RTL test bench passes each event it would otherwise write to its
+    execution log -- register write-back, memory read, memory write -- to
+    cosim_check as a t_log_record, through a simulator plugin such as the
+    Icarus Verilog VPI module in ../vpi. The CPU model is then stepped until
+    it produces its own next log record and the two are compared right away.
+    No log file is written on either side and a mismatch is caught at the
+    very cycle it happens.
+
+    Records are compared rendered as text, so they match exactly when the
+    corresponding lines of the two text logs would.
+
+    Each co-simulation has a CPU model of its own, so several of them can be
+    run in one process, e.g. one per core of a multi-core test bench.
+*/
+
+#include "ion32sim.h"
+
+
+/** Size of the queue of records logged by the CPU model (power of 2).
+    The model is stepped one instruction at a time and only when the queue
+    is empty, and no instruction logs anywhere near this many records. */
+#define COSIM_QUEUE_SIZE        (64)
+/** Max number of instructions the CPU model may run without logging */
+#define COSIM_MAX_SILENT_INSNS  (1 << 24)
+
+struct s_cosim {
+    t_state state;                          /**< CPU model */
+    t_log_record queue[COSIM_QUEUE_SIZE];   /**< records logged by model */
+    uint32_t head, tail;                    /**< queue indices, free running */
+    bool overflow;                          /**< queue overflowed */
+    uint64_t num_checked;                   /**< records matched so far */
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void cosim_sink(void *arg, const t_log_record *r);
+static void report_mismatch(t_cosim *c, const char *iss, const char *rtl);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Create the CPU model, load its object code and reset it.
+
+    @arg argc, argv Command line, same as for the ion32sim program. Any log
+         file options are ignored; CPU console output is discarded unless
+         option --conout is given.
+    @return Co-simulation or NULL if the CPU model could not be set up.
+*/
+t_cosim *cosim_open(int argc, char **argv){
+    t_cosim *c;
+    t_state *s;
+    t_args args;
+
+    c = calloc(1, sizeof(t_cosim));
+    if(c==NULL){
+        fprintf(stderr,"Trouble allocating memory\n");
+        return NULL;
+    }
+    s = &(c->state);
+
+    if(parse_cmd_line(argc, argv, &args)<=0){
+        free(c);
+        return NULL;
+    }
+    /* Log records go to the test bench, not to a file */
+    args.log_file_name = NULL;
+
+    if(!init_cpu(s, &args)){
+        fprintf(stderr,"Trouble allocating memory\n");
+        free(c);
+        return NULL;
+    }
+    /* On failure, this frees the CPU model itself */
+    if(!read_binary_files(s, &(s->args))){
+        free(c);
+        return NULL;
+    }
+
+    if(s->args.conout_filename!=NULL){
+        s->conout = fopen(s->args.conout_filename, "w");
+        if(s->conout==NULL){
+            fprintf(stderr,"Trouble opening console log file '%s'\n",
+                    s->args.conout_filename);
+            free_cpu(s);
+            free(c);
+            return NULL;
+        }
+    }
+
+    init_trace_buffer(s, &(s->args));
+    log_open_sink(s, cosim_sink, c);
+    reset_cpu(s);
+    /* Ready to run, as the 'go' command of the debug monitor leaves it */
+    s->pc_next = s->pc + 4;
+    s->skip = 0;
+    s->wakeup = 0;
+    return c;
+}
+
+/**
+    Check an event logged by the RTL against the next one logged by the CPU
+    model, running the model as far as needed.
+
+    @return 1 if the events match, 0 if they don't (a report is printed).
+*/
+int cosim_check(t_cosim *c, const t_log_record *rtl){
+    t_state *s = &(c->state);
+    char iss_line[EXEC_LOG_LINE_MAX], rtl_line[EXEC_LOG_LINE_MAX];
+    uint32_t n;
+
+    log_format_record(rtl_line, rtl);
+
+    for(n=0;c->head==c->tail;n++){
+        if(s->wakeup){
+            report_mismatch(c, "(stopped)\n", rtl_line);
+            return 0;
+        }
+        if(n >= COSIM_MAX_SILENT_INSNS){
+            report_mismatch(c, "(nothing logged for too long)\n", rtl_line);
+            return 0;
+        }
+        cycle(s, 0);
+    }
+    if(c->overflow){
+        report_mismatch(c, "(too many log records, bug in co-simulation)\n",
+                        rtl_line);
+        return 0;
+    }
+
+    log_format_record(iss_line,
+                      &(c->queue[c->tail++ & (COSIM_QUEUE_SIZE-1)]));
+    if(strcmp(iss_line, rtl_line)!=0){
+        report_mismatch(c, iss_line, rtl_line);
+        return 0;
+    }
+    c->num_checked++;
+    return 1;
+}
+
+/** Print a summary and free everything. */
+void cosim_close(t_cosim *c){
+    printf("Co-simulation: %llu log records checked.\n",
+           (unsigned long long)c->num_checked);
+    close_trace_buffer(&(c->state));
+    if(c->state.conout!=NULL){
+        fclose(c->state.conout);
+    }
+    free_cpu(&(c->state));
+    free(c);
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Log sink: queue records logged by the CPU model. */
+static void cosim_sink(void *arg, const t_log_record *r){
+    t_cosim *c = arg;
+
+    if(c->head - c->tail >= COSIM_QUEUE_SIZE){
+        c->overflow = true;
+        return;
+    }
+    c->queue[c->head++ & (COSIM_QUEUE_SIZE-1)] = *r;
+}
+
+static void report_mismatch(t_cosim *c, const char *iss, const char *rtl){
+    printf("\nCO-SIMULATION MISMATCH after %llu matching log records:\n",
+           (unsigned long long)c->num_checked);
+    printf("    ISS: %s", iss);
+    printf("    RTL: %s", rtl);
+    printf("    ISS PC=0x%08x\n\n", c->state.op_addr);
+}
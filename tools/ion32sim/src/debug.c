@@ -0,0 +1,291 @@
+/**
+    @file debug.c
+    @brief Breakpoints and data watchpoints.
+
+    Neither costs anything until it is hit:
+
+    - A breakpoint flags the decoded instruction at its address DEC_BREAK
+      (see debug_mark), and basic blocks end before flagged instructions, so
+      breakpoints are only looked for by cycle() when it is about to run a
+      flagged instruction. Decoded instructions are shared by mirrored
+      addresses, so mirrors of a breakpoint are flagged too and the address
+      is checked before stopping.
+    - A watchpoint flags the pages it covers PAGE_WATCH in the page table,
+      which sends all accesses to those pages down the slow path of
+      mem_read and mem_write; only there are the watchpoints looked at.
+      Code in a watched page is not predecoded, so it runs slower.
+
+    Breakpoints stop the CPU right before running the instruction, but only
+    while 'armed' (see debug_run) so that single steps always run it.
+    Watchpoints stop the CPU after the instruction that made the access,
+    which does complete. Only accesses made by the program are watched, not
+    those of the monitor or debugger.
+*/
+
+#include "ion32sim.h"
+
+
+/** Initial number of breakpoints or watchpoints, doubled when full */
+#define DEBUG_INITIAL       (16)
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static int find_break(const t_debug *d, uint32_t address, uint32_t *pos);
+static void invalidate_code(t_state *s, uint32_t address);
+static uint32_t same_word(t_state *s, uint32_t a, uint32_t b);
+static void watch_pages(t_state *s, const t_watch *w, int set);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Add a breakpoint at a word address; adding it twice does nothing.
+
+    @return 0 if the address is not aligned or out of memory.
+*/
+int debug_break_add(t_state *s, uint32_t address){
+    t_debug *d = &(s->dbg);
+    uint32_t *breaks, i, max;
+
+    if(address & 3) return 0;
+    if(find_break(d, address, &i)) return 1;
+
+    if(d->num_breaks >= d->max_breaks){
+        max = d->max_breaks? d->max_breaks*2 : DEBUG_INITIAL;
+        breaks = realloc(d->breaks, max * sizeof(uint32_t));
+        if(breaks==NULL) return 0;
+        d->breaks = breaks;
+        d->max_breaks = max;
+    }
+    memmove(&(d->breaks[i+1]), &(d->breaks[i]),
+            (d->num_breaks - i) * sizeof(uint32_t));
+    d->breaks[i] = address;
+    d->num_breaks++;
+    /* Decode it again, flagged this time */
+    invalidate_code(s, address);
+    return 1;
+}
+
+/** Remove a breakpoint; returns 0 if there was none at the address. */
+int debug_break_remove(t_state *s, uint32_t address){
+    t_debug *d = &(s->dbg);
+    uint32_t i;
+
+    if(!find_break(d, address, &i)) return 0;
+    d->num_breaks--;
+    memmove(&(d->breaks[i]), &(d->breaks[i+1]),
+            (d->num_breaks - i) * sizeof(uint32_t));
+    invalidate_code(s, address);
+    return 1;
+}
+
+/**
+    Add a watchpoint on 'size' bytes at an address for the WATCH_* kinds of
+    access given.
+
+    @return 0 if the area is empty or out of memory.
+*/
+int debug_watch_add(t_state *s, uint32_t address, uint32_t size,
+                    uint32_t kind){
+    t_debug *d = &(s->dbg);
+    t_watch *watches;
+    uint32_t max;
+
+    if(size==0 || address + (size - 1) < address || kind==0) return 0;
+
+    if(d->num_watches >= d->max_watches){
+        max = d->max_watches? d->max_watches*2 : DEBUG_INITIAL;
+        watches = realloc(d->watches, max * sizeof(t_watch));
+        if(watches==NULL) return 0;
+        d->watches = watches;
+        d->max_watches = max;
+    }
+    d->watches[d->num_watches].address = address;
+    d->watches[d->num_watches].size = size;
+    d->watches[d->num_watches].kind = kind;
+    watch_pages(s, &(d->watches[d->num_watches]), 1);
+    d->num_watches++;
+    return 1;
+}
+
+/** Remove a watchpoint; returns 0 if there was no such watchpoint. */
+int debug_watch_remove(t_state *s, uint32_t address, uint32_t size,
+                       uint32_t kind){
+    t_debug *d = &(s->dbg);
+    t_watch w;
+    uint32_t i;
+
+    for(i=0;i<d->num_watches;i++){
+        w = d->watches[i];
+        if(w.address==address && w.size==size && w.kind==kind) break;
+    }
+    if(i>=d->num_watches) return 0;
+
+    d->num_watches--;
+    d->watches[i] = d->watches[d->num_watches];
+    /* Unflag its pages unless some other watchpoint is in them */
+    watch_pages(s, &w, 0);
+    debug_map_pages(s);
+    return 1;
+}
+
+/**
+    Flag a decoded instruction if there's a breakpoint at its address or at
+    any address sharing its decoded copy. Called whenever an instruction is
+    decoded while there are breakpoints.
+*/
+void debug_mark(t_state *s, t_decoded *d, uint32_t pc){
+    uint32_t i;
+
+    for(i=0;i<s->dbg.num_breaks;i++){
+        if(same_word(s, s->dbg.breaks[i], pc)){
+            d->flags |= DEC_BREAK;
+            return;
+        }
+    }
+}
+
+/**
+    Called by cycle() before running an instruction flagged DEC_BREAK.
+
+    @return !=0 if the CPU is to stop before the instruction.
+*/
+uint32_t debug_break_hit(t_state *s){
+    uint32_t i;
+
+    if(!s->dbg.armed || !find_break(&(s->dbg), s->pc, &i)) return 0;
+    s->dbg.stop = STOP_BREAK;
+    s->wakeup = 1;
+    return 1;
+}
+
+/**
+    Called on every program access to a page flagged PAGE_WATCH; stops the
+    CPU after this instruction if the access hits a watchpoint.
+
+    @arg kind WATCH_READ or WATCH_WRITE.
+*/
+void debug_watch_hit(t_state *s, uint32_t address, uint32_t size,
+                     uint32_t kind){
+    const t_watch *w;
+    uint32_t i;
+
+    for(i=0;i<s->dbg.num_watches;i++){
+        w = &(s->dbg.watches[i]);
+        if((w->kind & kind) && address <= w->address + (w->size - 1) &&
+           w->address <= address + (size - 1)){
+            s->dbg.stop = STOP_WATCH;
+            s->dbg.stop_address = address;
+            s->dbg.stop_kind = kind;
+            s->wakeup = 1;
+            return;
+        }
+    }
+}
+
+/** Flag the pages that hold watchpoints in the page table. */
+void debug_map_pages(t_state *s){
+    uint32_t i;
+
+    for(i=0;i<s->dbg.num_watches;i++){
+        watch_pages(s, &(s->dbg.watches[i]), 1);
+    }
+}
+
+/**
+    Run until the program stops the simulation, a breakpoint or watchpoint
+    is hit, or 'max_insns' more instructions have been run. The instruction
+    at the PC is run even if it has a breakpoint, so a run can resume from
+    one. Can be called again to go on with the simulation.
+
+    @return !=0 if the CPU stopped, with the reason in s->dbg.stop; 0 if it
+            ran out of instructions.
+*/
+uint32_t debug_run(t_state *s, uint64_t max_insns){
+    uint64_t end = s->insn_count + max_insns;
+
+    if(end < s->insn_count) end = UINT64_MAX;
+    s->wakeup = 0;
+    s->dbg.stop = STOP_NONE;
+    s->dbg.exit_code = 0;
+    if(max_insns==0) return 0;
+
+    cycle(s, 0);
+    s->dbg.armed = 1;
+    while(s->wakeup==0 && s->insn_count < end){
+        /* Run whole blocks only while they can't overshoot the limit */
+        if(end - s->insn_count < BLOCK_MAX_INSNS || !run_block(s)){
+            cycle(s, 0);
+        }
+    }
+    s->dbg.armed = 0;
+    return s->wakeup!=0;
+}
+
+/** Remove all breakpoints and watchpoints. */
+void debug_free(t_state *s){
+    free(s->dbg.breaks);
+    free(s->dbg.watches);
+    s->dbg.breaks = NULL;
+    s->dbg.watches = NULL;
+    s->dbg.num_breaks = s->dbg.max_breaks = 0;
+    s->dbg.num_watches = s->dbg.max_watches = 0;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Binary search of a breakpoint; 'pos' gets its index or where it'd go. */
+static int find_break(const t_debug *d, uint32_t address, uint32_t *pos){
+    uint32_t lo = 0, hi = d->num_breaks, mid;
+
+    while(lo < hi){
+        mid = (lo + hi) / 2;
+        if(d->breaks[mid] < address) lo = mid + 1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return lo < d->num_breaks && d->breaks[lo]==address;
+}
+
+/** Drop the decoded copy of the instruction at an address, if any. */
+static void invalidate_code(t_state *s, uint32_t address){
+    t_block *b;
+
+    if(s->mem_pages==NULL) return;
+    b = mem_find_block(s, address);
+    if(b!=NULL){
+        predecode_invalidate(s, b - s->blocks,
+                             (address - b->start) % b->size, 4);
+    }
+}
+
+/** !=0 if two addresses are the same word or share its decoded copy. */
+static uint32_t same_word(t_state *s, uint32_t a, uint32_t b){
+    const t_mem_page *pa = &(s->mem_pages[a >> MEM_PAGE_SHIFT]);
+    const t_mem_page *pb = &(s->mem_pages[b >> MEM_PAGE_SHIFT]);
+
+    if(a==b) return 1;
+    return (pa->flags & pb->flags & PAGE_MAPPED) && pa->block==pb->block &&
+           pa->offset + (a & (MEM_PAGE_SIZE-1)) ==
+           pb->offset + (b & (MEM_PAGE_SIZE-1));
+}
+
+/** Flag or unflag the pages covered by a watchpoint. */
+static void watch_pages(t_state *s, const t_watch *w, int set){
+    uint32_t page, last;
+
+    if(s->mem_pages==NULL) return;
+    page = w->address >> MEM_PAGE_SHIFT;
+    last = (w->address + (w->size - 1)) >> MEM_PAGE_SHIFT;
+    for(;page<=last;page++){
+        if(set){
+            s->mem_pages[page].flags |= PAGE_WATCH;
+        }
+        else{
+            s->mem_pages[page].flags &= ~PAGE_WATCH;
+        }
+        mem_page_refresh(s, page);
+    }
+}
@@ -0,0 +1,268 @@
+/**
+    @file devices.c
+    @brief Simulated devices mapped on the memory address space.
+
+    A device is a range of addresses with read and write handlers, plus an
+    optional tick handler that is called every so many instructions. The
+    test bench registers (see load_store.c) are devices, and so is anything
+    registered with device_add by a program embedding the simulator or by a
+    shared object given with --device.
+
+    Devices are kept sorted by address and can't overlap. Every page that
+    holds some device is flagged PAGE_MMIO in the page table, along with the
+    first device in the page, so an access only looks for a device when it
+    lands in one of those pages: plain memory accesses never see them.
+
+    Ticks are run from a single EVENT_DEVICE_TICK event, always scheduled
+    for the next device due to tick.
+
+    A device shared object is loaded with "--device=<file>[,<arguments>]"
+    and must export this function, which registers its devices with
+    device_add and returns !=0 on success:
+
+        int ion32sim_device_init(t_state *s, const char *arguments);
+
+    Arguments are NULL if none were given. The ion32sim program exports its
+    functions to the shared objects, which are built along the lines of
+
+        cc -shared -fPIC -I<ion32sim>/src -o mydev.so mydev.c
+
+    Devices are shared by all the cores of a multi-core system, so they must
+    all be added before the system is set up; with --parallel their
+    handlers may be called from several threads at once.
+*/
+
+#ifndef WIN32
+#include <dlfcn.h>
+#endif
+
+#include "ion32sim.h"
+
+
+/** Initial number of devices of a CPU, doubled whenever it fills up */
+#define DEVICES_INITIAL     (16)
+/** Name of the function device shared objects must export */
+#define DEVICE_INIT_NAME    "ion32sim_device_init"
+
+/** Entry point of a device shared object */
+typedef int (*t_device_init)(t_state *s, const char *args);
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void schedule_tick(t_state *s);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Add a device to the CPU. The device record is copied.
+
+    @return 0 on error, after printing a message.
+*/
+int device_add(t_state *s, const t_device *d){
+    t_devices *t = &(s->devices);
+    const t_device *other = NULL;
+    t_device *dev;
+    uint32_t i, max;
+
+    if(d->size==0 || d->base + (d->size - 1) < d->base ||
+       (d->tick!=NULL && d->tick_period==0)){
+        fprintf(stderr,"Device '%s' has an invalid address range or "
+                "tick period\n", d->name);
+        return 0;
+    }
+
+    /* Position in the table, which must not overlap the neighbours */
+    for(i=0;i<t->num_devices && t->dev[i].base < d->base;i++);
+    if(i>0 && t->dev[i-1].base + (t->dev[i-1].size - 1) >= d->base){
+        other = &(t->dev[i-1]);
+    }
+    else if(i<t->num_devices && d->base + (d->size - 1) >= t->dev[i].base){
+        other = &(t->dev[i]);
+    }
+    if(other!=NULL){
+        fprintf(stderr,"Device '%s' overlaps device '%s'\n", d->name,
+                other->name);
+        return 0;
+    }
+
+    if(t->num_devices >= t->max_devices){
+        max = t->max_devices? t->max_devices*2 : DEVICES_INITIAL;
+        dev = realloc(t->dev, max * sizeof(t_device));
+        if(dev==NULL){
+            fprintf(stderr,"Trouble allocating memory\n");
+            return 0;
+        }
+        t->dev = dev;
+        t->max_devices = max;
+    }
+    memmove(&(t->dev[i+1]), &(t->dev[i]),
+            (t->num_devices - i) * sizeof(t_device));
+    t->dev[i] = *d;
+    t->dev[i].next_tick = s->insn_count + d->tick_period;
+    t->num_devices++;
+
+    if(s->mem_pages!=NULL){
+        device_map_pages(s);
+    }
+    if(d->tick!=NULL){
+        schedule_tick(s);
+    }
+    return 1;
+}
+
+/**
+    Load a device shared object given as "<file>[,<arguments>]" and let it
+    add its devices.
+
+    @return 0 on error, after printing a message.
+*/
+int device_load(t_state *s, const char *spec){
+#ifndef WIN32
+    t_devices *t = &(s->devices);
+    t_device_init init;
+    const char *args;
+    char *file;
+    void *h;
+
+    if(t->num_plugins >= MAX_DEVICE_PLUGINS){
+        fprintf(stderr,"Too many device shared objects\n");
+        return 0;
+    }
+    args = strchr(spec, ',');
+    file = args? strndup(spec, args - spec) : strdup(spec);
+    if(file==NULL){
+        fprintf(stderr,"Trouble allocating memory\n");
+        return 0;
+    }
+
+    h = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+    if(h==NULL){
+        fprintf(stderr,"Error loading device '%s': %s\n", file, dlerror());
+        free(file);
+        return 0;
+    }
+    init = (t_device_init)dlsym(h, DEVICE_INIT_NAME);
+    if(init==NULL){
+        fprintf(stderr,"Device '%s' has no " DEVICE_INIT_NAME "()\n", file);
+        dlclose(h);
+        free(file);
+        return 0;
+    }
+    /* Keep it loaded from now on, its devices may be in already */
+    t->plugins[t->num_plugins++] = h;
+    if(!init(s, args? args+1 : NULL)){
+        fprintf(stderr,"Device '%s' failed to initialize\n", file);
+        free(file);
+        return 0;
+    }
+    free(file);
+    return 1;
+#else
+    fprintf(stderr,"Device shared objects are not supported on this host\n");
+    return 0;
+#endif
+}
+
+/**
+    Flag the pages that hold devices in the page table, along with the
+    first device of each page.
+*/
+void device_map_pages(t_state *s){
+    t_devices *t = &(s->devices);
+    t_mem_page *p;
+    uint32_t i, page, last;
+
+    /* Backwards, so that each page ends up with its first device */
+    for(i=t->num_devices;i>0;i--){
+        page = t->dev[i-1].base >> MEM_PAGE_SHIFT;
+        last = (t->dev[i-1].base + (t->dev[i-1].size - 1)) >> MEM_PAGE_SHIFT;
+        for(;page<=last;page++){
+            p = &(s->mem_pages[page]);
+            p->flags |= PAGE_MMIO;
+            p->device = i-1;
+            p->mem = NULL;
+        }
+    }
+}
+
+/** Find the device an address belongs to, or NULL. */
+const t_device *device_find(t_state *s, uint32_t address){
+    const t_mem_page *p = &(s->mem_pages[address >> MEM_PAGE_SHIFT]);
+    const t_devices *t = &(s->devices);
+    uint32_t i;
+
+    if(!(p->flags & PAGE_MMIO)) return NULL;
+    for(i=p->device;i<t->num_devices && t->dev[i].base<=address;i++){
+        if(address - t->dev[i].base < t->dev[i].size){
+            return &(t->dev[i]);
+        }
+    }
+    return NULL;
+}
+
+/** Restart the ticks of all devices; the CPU has just been reset. */
+void devices_reset(t_state *s){
+    t_devices *t = &(s->devices);
+    uint32_t i;
+
+    for(i=0;i<t->num_devices;i++){
+        t->dev[i].next_tick = s->insn_count + t->dev[i].tick_period;
+    }
+    schedule_tick(s);
+}
+
+/** Event handler: run the ticks of the devices that are due. */
+void device_tick_event(t_state *s, uint32_t arg){
+    t_devices *t = &(s->devices);
+    t_device *d;
+    uint32_t i;
+
+    for(i=0;i<t->num_devices;i++){
+        d = &(t->dev[i]);
+        if(d->tick!=NULL && d->next_tick <= s->insn_count){
+            d->next_tick = s->insn_count + d->tick_period;
+            d->tick(s, d->ctx);
+        }
+    }
+    schedule_tick(s);
+}
+
+/** Close all devices and unload the shared objects. */
+void devices_free(t_state *s){
+    t_devices *t = &(s->devices);
+    uint32_t i;
+
+    for(i=0;i<t->num_devices;i++){
+        if(t->dev[i].close!=NULL){
+            t->dev[i].close(t->dev[i].ctx);
+        }
+    }
+    free(t->dev);
+#ifndef WIN32
+    for(i=0;i<t->num_plugins;i++){
+        dlclose(t->plugins[i]);
+    }
+#endif
+    memset(t, 0, sizeof(t_devices));
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Schedule the tick event for the next device due, if any. */
+static void schedule_tick(t_state *s){
+    t_devices *t = &(s->devices);
+    uint64_t next = SCHED_NEVER;
+    uint32_t i;
+
+    for(i=0;i<t->num_devices;i++){
+        if(t->dev[i].tick!=NULL && t->dev[i].next_tick < next){
+            next = t->dev[i].next_tick;
+        }
+    }
+    if(next!=SCHED_NEVER){
+        sched_at(s, EVENT_DEVICE_TICK, next, 0);
+    }
+}
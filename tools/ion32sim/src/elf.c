@@ -0,0 +1,343 @@
+/**
+    @file elf.c
+    @brief ELF object code loader.
+
+    Loads the PT_LOAD segments of a 32-bit big endian MIPS ELF executable
+    straight into the memory blocks, and reads its entry point and function
+    symbols.
+
+    Each segment goes to the block that holds its physical address, or its
+    virtual address if no block holds the physical one (the memory maps use
+    KSEG addresses, which bare metal programs are often linked at with
+    identical physical and virtual addresses, but not always).
+
+    Read-only segments are mapped from the file copy-on-write over the block
+    memory wherever file and block page boundaries line up, so they cost no
+    host memory until touched. Anything else is read into the block.
+
+    Only the ELF structures used here are defined, so the loader does not
+    depend on the host having <elf.h>.
+*/
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "ion32sim.h"
+
+
+/* ELF constants used by the loader */
+#define EI_NIDENT           (16)
+#define EI_CLASS            (4)
+#define EI_DATA             (5)
+#define ELFCLASS32          (1)
+#define ELFDATA2MSB         (2)
+#define ET_EXEC             (2)
+#define EM_MIPS             (8)
+#define PT_LOAD             (1)
+#define PF_W                (1 << 1)
+#define SHT_SYMTAB          (2)
+#define STT_FUNC            (2)
+
+/* Sizes of the ELF32 structures as stored in the file */
+#define EHDR_SIZE           (52)
+#define PHDR_SIZE           (32)
+#define SHDR_SIZE           (40)
+#define SYM_SIZE            (16)
+
+/** Symbol names longer than this are truncated */
+#define ELF_MAX_NAME_LEN    (256)
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+/** ELF file header, the fields the loader uses */
+typedef struct s_elf_header {
+    uint16_t type;
+    uint16_t machine;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+} t_elf_header;
+
+/** ELF program header */
+typedef struct s_elf_segment {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+} t_elf_segment;
+
+/** ELF section header, the fields the loader uses */
+typedef struct s_elf_section {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+    uint32_t entsize;
+} t_elf_section;
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static uint16_t get16(const uint8_t *p);
+static uint32_t get32(const uint8_t *p);
+static int read_at(FILE *f, uint32_t offset, void *buf, uint32_t size);
+static int read_header(FILE *f, t_elf_header *h);
+static int read_segment(FILE *f, const t_elf_header *h, uint32_t i,
+                        t_elf_segment *p);
+static int read_section(FILE *f, const t_elf_header *h, uint32_t i,
+                        t_elf_section *sh);
+static t_block *find_block(t_state *s, uint32_t address, uint32_t size,
+                           uint32_t *offset);
+static int load_segment(t_state *s, FILE *f, const t_elf_segment *p);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Load the segments of an ELF file into the memory blocks.
+
+    @arg entry Will get the entry point of the program.
+    @return Number of segments loaded, or -1 on error after printing a
+            message.
+*/
+int32_t elf_load(t_state *s, const char *name, uint32_t *entry){
+    t_elf_header h;
+    t_elf_segment p;
+    FILE *f;
+    uint32_t i;
+    int32_t loaded = 0;
+
+    f = fopen(name, "rb");
+    if(f==NULL){
+        printf("Can't open file %s, quitting!\n", name);
+        return -1;
+    }
+    if(!read_header(f, &h)){
+        printf("'%s' is not a big endian MIPS32 ELF executable\n", name);
+        fclose(f);
+        return -1;
+    }
+
+    for(i=0;i<h.phnum;i++){
+        if(!read_segment(f, &h, i, &p)){
+            printf("ERROR: truncated ELF file '%s'\n", name);
+            fclose(f);
+            return -1;
+        }
+        if(p.type!=PT_LOAD || p.memsz==0) continue;
+        if(!load_segment(s, f, &p)){
+            fclose(f);
+            return -1;
+        }
+        loaded++;
+    }
+    fclose(f);
+
+    *entry = h.entry;
+    return loaded;
+}
+
+/**
+    Add the function symbols of an ELF file to a function map. The map has
+    to be sorted afterwards.
+
+    @return Number of functions in the map or -1 if the file could not be
+            read; files without a symbol table add no functions.
+*/
+int32_t elf_read_functions(const char *name, t_map_info *map){
+    t_elf_header h;
+    t_elf_section symtab, strtab;
+    uint8_t sym[SYM_SIZE];
+    char fn_name[ELF_MAX_NAME_LEN];
+    FILE *f;
+    uint32_t i, sym_name;
+    int c, j;
+
+    f = fopen(name, "rb");
+    if(f==NULL || !read_header(f, &h)){
+        if(f!=NULL) fclose(f);
+        return -1;
+    }
+
+    /* Find the symbol table and the string table it uses */
+    for(i=0;i<h.shnum;i++){
+        if(!read_section(f, &h, i, &symtab)) break;
+        if(symtab.type==SHT_SYMTAB) break;
+    }
+    if(i>=h.shnum || symtab.entsize<SYM_SIZE ||
+       !read_section(f, &h, symtab.link, &strtab)){
+        fclose(f);
+        return map->num_functions;
+    }
+
+    for(i=0;i<symtab.size/symtab.entsize;i++){
+        if(!read_at(f, symtab.offset + i*symtab.entsize, sym, SYM_SIZE)) break;
+        if((sym[12] & 0x0f)!=STT_FUNC || get16(&sym[14])==0) continue;
+
+        sym_name = get32(&sym[0]);
+        if(fseek(f, strtab.offset + sym_name, SEEK_SET)!=0) break;
+        for(j=0;j<ELF_MAX_NAME_LEN-1;j++){
+            c = fgetc(f);
+            if(c==EOF || c==0) break;
+            fn_name[j] = (char)c;
+        }
+        fn_name[j] = '\0';
+        if(!map_add_function(map, get32(&sym[4]), get32(&sym[8]), fn_name)){
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+
+    return map->num_functions;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/* ELF fields are read as big endian, the only byte order we load. */
+
+static uint16_t get16(const uint8_t *p){
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p){
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int read_at(FILE *f, uint32_t offset, void *buf, uint32_t size){
+    return fseek(f, offset, SEEK_SET)==0 && fread(buf, 1, size, f)==size;
+}
+
+/** Read the file header and check it is an executable we can load. */
+static int read_header(FILE *f, t_elf_header *h){
+    uint8_t e[EHDR_SIZE];
+
+    if(!read_at(f, 0, e, EHDR_SIZE) ||
+       memcmp(e, "\177ELF", 4)!=0 ||
+       e[EI_CLASS]!=ELFCLASS32 || e[EI_DATA]!=ELFDATA2MSB){
+        return 0;
+    }
+    h->type = get16(&e[16]);
+    h->machine = get16(&e[18]);
+    h->entry = get32(&e[24]);
+    h->phoff = get32(&e[28]);
+    h->shoff = get32(&e[32]);
+    h->phentsize = get16(&e[42]);
+    h->phnum = get16(&e[44]);
+    h->shentsize = get16(&e[46]);
+    h->shnum = get16(&e[48]);
+
+    return h->type==ET_EXEC && h->machine==EM_MIPS &&
+           (h->phnum==0 || h->phentsize>=PHDR_SIZE) &&
+           (h->shnum==0 || h->shentsize>=SHDR_SIZE);
+}
+
+static int read_segment(FILE *f, const t_elf_header *h, uint32_t i,
+                        t_elf_segment *p){
+    uint8_t e[PHDR_SIZE];
+
+    if(!read_at(f, h->phoff + i*h->phentsize, e, PHDR_SIZE)) return 0;
+    p->type = get32(&e[0]);
+    p->offset = get32(&e[4]);
+    p->vaddr = get32(&e[8]);
+    p->paddr = get32(&e[12]);
+    p->filesz = get32(&e[16]);
+    p->memsz = get32(&e[20]);
+    p->flags = get32(&e[24]);
+    return 1;
+}
+
+static int read_section(FILE *f, const t_elf_header *h, uint32_t i,
+                        t_elf_section *sh){
+    uint8_t e[SHDR_SIZE];
+
+    if(i>=h->shnum ||
+       !read_at(f, h->shoff + i*h->shentsize, e, SHDR_SIZE)) return 0;
+    sh->type = get32(&e[4]);
+    sh->offset = get32(&e[16]);
+    sh->size = get32(&e[20]);
+    sh->link = get32(&e[24]);
+    sh->entsize = get32(&e[36]);
+    return 1;
+}
+
+/** Find the memory block that holds a whole address range, decoding the
+    address as mem_read does. */
+static t_block *find_block(t_state *s, uint32_t address, uint32_t size,
+                           uint32_t *offset){
+    t_block *b;
+    uint32_t i;
+
+    for(i=0;i<s->num_blocks;i++){
+        b = &(s->blocks[i]);
+        if(b->size==0 || (address & b->mask)!=(b->start & b->mask)) continue;
+        *offset = (address - b->start) % b->size;
+        /* Not *offset + size, which wraps for a huge segment */
+        if(size <= b->size - *offset){
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/** Copy or map a PT_LOAD segment into its memory block. */
+static int load_segment(t_state *s, FILE *f, const t_elf_segment *p){
+    t_block *b;
+    uint32_t offset, head = 0, mapped = 0;
+
+    b = find_block(s, p->paddr, p->memsz, &offset);
+    if(b==NULL){
+        b = find_block(s, p->vaddr, p->memsz, &offset);
+    }
+    if(b==NULL || p->filesz > p->memsz){
+        printf("ERROR: ELF segment at 0x%08x (%d bytes) does not fit in "
+               "any memory block\n", p->paddr, p->memsz);
+        return 0;
+    }
+
+#ifndef WIN32
+    /* Map the whole host pages within a read-only segment from the file */
+    if(b->mapped && !(p->flags & PF_W)){
+        uint32_t page = (uint32_t)sysconf(_SC_PAGESIZE);
+
+        head = (page - (offset % page)) % page;
+        if(head < p->filesz && ((p->offset + head) % page)==0){
+            mapped = ((p->filesz - head) / page) * page;
+        }
+        if(mapped > 0 &&
+           mmap(b->mem + offset + head, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fileno(f),
+                p->offset + head)==MAP_FAILED){
+            mapped = 0;
+        }
+    }
+#endif
+    if(mapped==0){
+        head = p->filesz;
+    }
+
+    /* Read whatever was not mapped and clear the rest of the segment */
+    if(!read_at(f, p->offset, b->mem + offset, head) ||
+       !read_at(f, p->offset + head + mapped,
+                b->mem + offset + head + mapped,
+                p->filesz - head - mapped)){
+        printf("ERROR: truncated ELF file\n");
+        return 0;
+    }
+    memset(b->mem + offset + p->filesz, 0, p->memsz - p->filesz);
+
+    fprintf(stderr,"%-16s [0x%08x] loaded ELF segment, %d bytes%s.\n",
+            b->area_name, p->paddr, p->filesz, mapped? " (mapped)" : "");
+    return 1;
+}
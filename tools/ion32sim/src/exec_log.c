@@ -0,0 +1,170 @@
+/**
+    @file exec_log.c
+    @brief Execution log records and their text rendering.
+
+    Shared by the simulator and by the log tools; see exec_log.h.
+    The text is formatted by hand rather than with printf: in a logged
+    simulation run this is done for every register change and memory access.
+*/
+
+#include <string.h>
+
+#include "exec_log.h"
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/** Messages for failed assertions, indexed by bit number of ASRT_* flag */
+static const char *assertion_messages[] = {
+   "Unaligned read",
+   "Unaligned write"
+};
+
+#define NUM_ASSERTION_MESSAGES \
+    (sizeof(assertion_messages)/sizeof(assertion_messages[0]))
+
+/** Suffix of the memory access lines, by record kind */
+static const char *access_suffix[NUM_LOG_KINDS] = {
+    [LOG_RD] =              " RD\n",
+    [LOG_RD_UNMAPPED] =     " RD UNMAPPED\n",
+    [LOG_WR] =              " WR\n",
+    [LOG_WR_READONLY] =     " WR READ ONLY\n",
+    [LOG_WR_UNMAPPED] =     " WR UNMAPPED\n",
+};
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Append lowercase hex number with a fixed number of digits. */
+static char *put_hex(char *p, uint32_t value, int digits){
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for(i=digits-1;i>=0;i--){
+        p[i] = hex[value & 0x0f];
+        value >>= 4;
+    }
+    return p + digits;
+}
+
+/** Reverse byte order of a 32-bit word. */
+static uint32_t swap32(uint32_t w){
+    return (w >> 24) | ((w >> 8) & 0xff00) | ((w << 8) & 0xff0000) | (w << 24);
+}
+
+/** Append string. */
+static char *put_str(char *p, const char *str){
+    while(*str){
+        *p++ = *str++;
+    }
+    return p;
+}
+
+/** Append "(pc) [address] " part common to memory access lines. */
+static char *put_access(char *p, const t_log_record *r){
+    *p++ = '(';
+    p = put_hex(p, r->pc, 8);
+    p = put_str(p, ") [");
+    p = put_hex(p, r->address, 8);
+    p = put_str(p, "] ");
+    return p;
+}
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Render a log record as a line of text, including the trailing newline.
+
+    @arg line Buffer of at least EXEC_LOG_LINE_MAX chars.
+    @return Length of the line (the buffer is also 0-terminated).
+*/
+uint32_t log_format_record(char *line, const t_log_record *r){
+    char *p = line;
+
+    switch(r->kind){
+    case LOG_REG:
+        /* "(%08x) [%02x]=%08x" */
+        *p++ = '(';
+        p = put_hex(p, r->pc, 8);
+        p = put_str(p, ") [");
+        p = put_hex(p, r->address, 2);
+        p = put_str(p, "]=");
+        p = put_hex(p, r->value, 8);
+        *p++ = '\n';
+        break;
+    case LOG_RD:
+    case LOG_RD_UNMAPPED:
+    case LOG_WR:
+        /* "(%08x) [%08x] <%1d>=%08x RD" and the like */
+        p = put_access(p, r);
+        *p++ = '<';
+        if(r->size >= 100) *p++ = '0' + r->size / 100;
+        if(r->size >= 10) *p++ = '0' + (r->size / 10) % 10;
+        *p++ = '0' + r->size % 10;
+        p = put_str(p, ">=");
+        p = put_hex(p, r->value, 8);
+        p = put_str(p, access_suffix[r->kind]);
+        break;
+    case LOG_WR_READONLY:
+    case LOG_WR_UNMAPPED:
+        /* "(%08x) [%08x] |%02x|=%08x WR READ ONLY" and the like */
+        p = put_access(p, r);
+        *p++ = '|';
+        p = put_hex(p, r->size, 2);
+        p = put_str(p, "|=");
+        p = put_hex(p, r->value, 8);
+        p = put_str(p, access_suffix[r->kind]);
+        break;
+    case LOG_ASSERTION:
+        /* "ASSERTION FAILED: [%08x] %s" */
+        p = put_str(p, "ASSERTION FAILED: [");
+        p = put_hex(p, r->address, 8);
+        p = put_str(p, "] ");
+        p = put_str(p, r->size < NUM_ASSERTION_MESSAGES?
+                       assertion_messages[r->size] : "Unknown assertion");
+        *p++ = '\n';
+        break;
+    default:
+        p = put_str(p, "BAD LOG RECORD\n");
+    }
+    *p = '\0';
+    return (uint32_t)(p - line);
+}
+
+/** Fill in the header of a binary log to be written by this host. */
+void log_init_header(t_log_header *h){
+    memset(h, 0, sizeof(t_log_header));
+    memcpy(h->magic, EXEC_LOG_MAGIC, sizeof(h->magic));
+    h->byte_order = EXEC_LOG_BYTE_ORDER;
+    h->version = EXEC_LOG_VERSION;
+    h->record_size = sizeof(t_log_record);
+}
+
+/**
+    Check the header of a binary log, converting it to host byte order.
+
+    @arg swap Set to !=0 if the records need log_swap_record.
+    @return 0 if the header is not valid for this version of the format.
+*/
+int log_check_header(t_log_header *h, int *swap){
+    if(memcmp(h->magic, EXEC_LOG_MAGIC, sizeof(h->magic))!=0){
+        return 0;
+    }
+    *swap = (h->byte_order != EXEC_LOG_BYTE_ORDER);
+    if(*swap){
+        h->byte_order = swap32(h->byte_order);
+        h->version = swap32(h->version);
+        h->record_size = swap32(h->record_size);
+    }
+    return (h->byte_order == EXEC_LOG_BYTE_ORDER) &&
+           (h->version == EXEC_LOG_VERSION) &&
+           (h->record_size == sizeof(t_log_record));
+}
+
+/** Convert a record written by a host of the opposite byte order. */
+void log_swap_record(t_log_record *r){
+    r->pc = swap32(r->pc);
+    r->address = swap32(r->address);
+    r->value = swap32(r->value);
+}
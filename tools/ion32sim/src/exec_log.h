@@ -0,0 +1,73 @@
+/**
+    @file exec_log.h
+    @brief Execution log records and their text rendering.
+
+    The execution log is a sequence of records, each of which renders to one
+    line of the text log that is compared against the RTL simulation log.
+    The simulator can write the records either already rendered as text or
+    in binary form; tools that consume the log render binary logs with the
+    same code so that both forms produce the exact same text.
+
+    A binary log is a t_log_header followed by t_log_record structures. Both
+    are stored in the byte order of the host that wrote them, which the
+    readers can tell from field 'byte_order'.
+
+    This header does not depend on the rest of the simulator so that other
+    tools can use it.
+*/
+
+#ifndef EXEC_LOG_INC
+#define EXEC_LOG_INC
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/** Magic string at the start of a binary execution log (not 0-terminated) */
+#define EXEC_LOG_MAGIC          "ION32LOG"
+/** Version of the binary log format */
+#define EXEC_LOG_VERSION        (1)
+/** Value of byte_order field as written by the host */
+#define EXEC_LOG_BYTE_ORDER     (0x01020304)
+/** Max length of a rendered log line, including newline and terminator */
+#define EXEC_LOG_LINE_MAX       (80)
+
+
+/** Kinds of log record */
+typedef enum {
+    LOG_REG = 0,            /**< GPR change; address holds register index */
+    LOG_RD,                 /**< memory read */
+    LOG_RD_UNMAPPED,        /**< read from unmapped address */
+    LOG_WR,                 /**< memory write */
+    LOG_WR_READONLY,        /**< write to read-only block; size is a mask */
+    LOG_WR_UNMAPPED,        /**< write to unmapped address; size is a mask */
+    LOG_ASSERTION,          /**< failed assertion; size is assertion index */
+    NUM_LOG_KINDS
+} t_log_kind;
+
+/** Log record: all log lines are made from these fields */
+typedef struct s_log_record {
+    uint8_t kind;           /**< one of t_log_kind */
+    uint8_t size;           /**< access size, byte mask or assertion index */
+    uint16_t reserved;      /**< zero */
+    uint32_t pc;            /**< address of instruction */
+    uint32_t address;       /**< memory address or register index */
+    uint32_t value;         /**< data */
+} t_log_record;
+
+/** Header of binary log file */
+typedef struct s_log_header {
+    char magic[8];          /**< EXEC_LOG_MAGIC */
+    uint32_t byte_order;    /**< EXEC_LOG_BYTE_ORDER in writer byte order */
+    uint32_t version;       /**< EXEC_LOG_VERSION */
+    uint32_t record_size;   /**< sizeof(t_log_record) */
+    uint32_t reserved;      /**< zero */
+} t_log_header;
+
+
+extern uint32_t log_format_record(char *line, const t_log_record *r);
+extern void log_init_header(t_log_header *h);
+extern int log_check_header(t_log_header *h, int *swap);
+extern void log_swap_record(t_log_record *r);
+
+#endif
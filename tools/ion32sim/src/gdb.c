@@ -0,0 +1,563 @@
+/**
+    @file gdb.c
+    @brief GDB remote serial protocol server.
+
+    With --gdb the simulator waits for GDB to connect on a local TCP port or
+    Unix socket, instead of starting the monitor, and lets it drive the
+    simulation until it detaches or kills the target, or the program ends:
+
+        ion32sim --bram=code.bin --gdb=1234
+        mips-elf-gdb code.elf -ex 'target remote :1234'
+
+    The program runs at full speed between stops: breakpoints and watchpoints
+    are those of debug.c, and the connection is only polled for interrupts
+    (Ctrl-C) once every GDB_POLL_INSNS instructions, through an
+    EVENT_GDB_POLL event.
+
+    Supported packets are the minimum GDB needs: ?, g, G, p, P, m, M, c, s,
+    Z0-Z4, z0-z4, k, D and a few queries. Registers are those of the MIPS
+    target of GDB without FPU: the 32 GPRs, then Status, LO, HI, BadVAddr
+    (always 0), Cause and PC, in target byte order. Memory accesses don't go
+    through device registers and don't trigger watchpoints.
+
+    When the program writes the TB stop register or hangs in an endless loop
+    GDB is told the target exited, with the error count the program reported
+    as exit status, and the server stops.
+
+    Watchpoints stop the CPU after the access, while GDB expects MIPS targets
+    to stop before it, so GDB reports them one instruction late.
+*/
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#include "ion32sim.h"
+
+
+/** Max size of a packet, payload and framing */
+#define GDB_PACKET_SIZE     (4096)
+/** Number of registers in 'g' packets */
+#define GDB_NUM_REGS        (38)
+
+#ifdef MSG_NOSIGNAL
+#define GDB_SEND_FLAGS      (MSG_NOSIGNAL)
+#else
+#define GDB_SEND_FLAGS      (0)
+#endif
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+struct s_gdb {
+    int listen_fd;                  /**< listening socket */
+    int fd;                         /**< connection or -1 */
+    char *socket_path;              /**< path of Unix socket or NULL */
+    uint8_t in[GDB_PACKET_SIZE];    /**< bytes received, not yet parsed */
+    uint32_t in_head, in_count;
+    char packet[GDB_PACKET_SIZE];   /**< payload of last packet received */
+    char reply[GDB_PACKET_SIZE];    /**< payload of reply being built */
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+#ifndef WIN32
+static int open_tcp(t_gdb *g, const char *port);
+static int open_unix(t_gdb *g, const char *path);
+static int get_byte(t_gdb *g);
+static int get_packet(t_gdb *g);
+static void put_packet(t_gdb *g, const char *payload);
+static int handle_packet(t_gdb *g, t_state *s);
+static void stop_reply(t_state *s, char *reply);
+static uint32_t get_reg(t_state *s, uint32_t n);
+static void set_reg(t_state *s, uint32_t n, uint32_t value);
+static void put_reg(t_state *s, char *text, uint32_t value);
+static uint32_t parse_reg(t_state *s, const char *text);
+static int memory_ok(t_state *s, uint32_t address);
+static int hex_digit(char c);
+#endif
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Open the server.
+
+    @arg spec "<TCP port>" to listen on localhost, or "unix:<path>".
+    @return Server waiting for GDB to connect, or NULL on error after
+            printing a message.
+*/
+t_gdb *gdb_open(const char *spec){
+#ifndef WIN32
+    t_gdb *g;
+    int ok;
+
+    g = calloc(1, sizeof(t_gdb));
+    if(g==NULL){
+        fprintf(stderr, "Trouble allocating memory for the GDB server\n");
+        return NULL;
+    }
+    g->fd = -1;
+    g->listen_fd = -1;
+    if(strncmp(spec, "unix:", 5)==0){
+        ok = open_unix(g, spec + 5);
+    }
+    else{
+        ok = open_tcp(g, spec);
+    }
+    if(!ok){
+        free(g);
+        return NULL;
+    }
+    return g;
+#else
+    fprintf(stderr, "The GDB server is not supported on this host\n");
+    return NULL;
+#endif
+}
+
+/**
+    Wait for GDB to connect and serve it until it detaches, kills the target,
+    closes the connection or the program ends.
+*/
+void gdb_serve(t_gdb *g, t_state *s){
+#ifndef WIN32
+    int one = 1;
+
+    fprintf(stderr, "Waiting for GDB to connect...\n");
+    g->fd = accept(g->listen_fd, NULL, NULL);
+    if(g->fd<0){
+        fprintf(stderr, "Error accepting GDB connection: %s\n",
+                strerror(errno));
+        return;
+    }
+    if(g->socket_path==NULL){
+        setsockopt(g->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    fprintf(stderr, "GDB connected.\n");
+
+    s->dbg.gdb = g;
+    s->dbg.stop = STOP_NONE;
+    while(get_packet(g) && handle_packet(g, s));
+    s->dbg.gdb = NULL;
+
+    close(g->fd);
+    g->fd = -1;
+    fprintf(stderr, "GDB disconnected.\n");
+#endif
+}
+
+/** Close the server and free it. */
+void gdb_close(t_gdb *g){
+    if(g==NULL) return;
+#ifndef WIN32
+    if(g->fd>=0) close(g->fd);
+    if(g->listen_fd>=0) close(g->listen_fd);
+    if(g->socket_path!=NULL) unlink(g->socket_path);
+#endif
+    free(g->socket_path);
+    free(g);
+}
+
+/**
+    Event handler: look for an interrupt from GDB while the program runs.
+    Anything else received is kept for later.
+*/
+void gdb_poll_event(t_state *s, uint32_t arg){
+#ifndef WIN32
+    t_gdb *g = s->dbg.gdb;
+    uint8_t buf[64];
+    ssize_t n, i;
+
+    if(g==NULL || g->fd<0) return;
+    n = recv(g->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if(n==0){
+        /* GDB is gone: stop and let gdb_serve find out */
+        s->dbg.stop = STOP_INTERRUPT;
+        s->wakeup = 1;
+        return;
+    }
+    for(i=0;i<n;i++){
+        if(buf[i]==0x03){
+            s->dbg.stop = STOP_INTERRUPT;
+            s->wakeup = 1;
+        }
+        else if(g->in_count < sizeof(g->in)){
+            g->in[(g->in_head + g->in_count) % sizeof(g->in)] = buf[i];
+            g->in_count++;
+        }
+    }
+    sched_at(s, EVENT_GDB_POLL, s->insn_count + GDB_POLL_INSNS, 0);
+#endif
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+#ifndef WIN32
+/** Listen on a TCP port of localhost. */
+static int open_tcp(t_gdb *g, const char *port){
+    struct sockaddr_in addr;
+    char *end;
+    long n;
+    int one = 1;
+
+    n = strtol(port, &end, 10);
+    if(*port=='\0' || *end!='\0' || n<1 || n>65535){
+        fprintf(stderr, "Invalid GDB port '%s'\n", port);
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)n);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    g->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(g->listen_fd>=0){
+        setsockopt(g->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if(g->listen_fd<0 ||
+       bind(g->listen_fd, (struct sockaddr *)&addr, sizeof(addr))!=0 ||
+       listen(g->listen_fd, 1)!=0){
+        fprintf(stderr, "Can't listen on GDB port %ld: %s\n",
+                n, strerror(errno));
+        if(g->listen_fd>=0) close(g->listen_fd);
+        return 0;
+    }
+    fprintf(stderr, "GDB server listening on port %ld\n", n);
+    return 1;
+}
+
+/** Listen on a Unix socket. */
+static int open_unix(t_gdb *g, const char *path){
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "GDB socket path too long: '%s'\n", path);
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    g->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(g->listen_fd<0 ||
+       bind(g->listen_fd, (struct sockaddr *)&addr, sizeof(addr))!=0 ||
+       listen(g->listen_fd, 1)!=0){
+        fprintf(stderr, "Can't listen on GDB socket '%s': %s\n",
+                path, strerror(errno));
+        if(g->listen_fd>=0) close(g->listen_fd);
+        return 0;
+    }
+    g->socket_path = strdup(path);
+    fprintf(stderr, "GDB server listening on '%s'\n", path);
+    return 1;
+}
+
+/** Next byte received, waiting for it; -1 if the connection is closed. */
+static int get_byte(t_gdb *g){
+    uint8_t c;
+    ssize_t n;
+
+    if(g->in_count==0){
+        n = recv(g->fd, g->in, sizeof(g->in), 0);
+        if(n<=0) return -1;
+        g->in_head = 0;
+        g->in_count = (uint32_t)n;
+    }
+    c = g->in[g->in_head];
+    g->in_head = (g->in_head + 1) % sizeof(g->in);
+    g->in_count--;
+    return c;
+}
+
+/**
+    Receive the next packet into g->packet, acknowledging it. Acks and
+    interrupts received while stopped are ignored.
+
+    @return 0 if the connection is closed.
+*/
+static int get_packet(t_gdb *g){
+    uint32_t len, sum;
+    int c, c1, c2;
+
+    for(;;){
+        do{
+            c = get_byte(g);
+            if(c<0) return 0;
+        } while(c!='$');
+
+        len = 0;
+        sum = 0;
+        while((c = get_byte(g))!='#'){
+            if(c<0) return 0;
+            if(c=='$'){
+                /* Start over, the previous packet was cut short */
+                len = 0;
+                sum = 0;
+                continue;
+            }
+            sum += c;
+            if(len < sizeof(g->packet) - 1) g->packet[len++] = (char)c;
+        }
+        c1 = get_byte(g);
+        c2 = get_byte(g);
+        if(c1<0 || c2<0) return 0;
+        g->packet[len] = '\0';
+
+        if(hex_digit(c1)*16 + hex_digit(c2) == (int)(sum & 0xff)){
+            send(g->fd, "+", 1, GDB_SEND_FLAGS);
+            return 1;
+        }
+        send(g->fd, "-", 1, GDB_SEND_FLAGS);
+    }
+}
+
+/** Send a packet; the ack GDB sends back is skipped by get_packet. */
+static void put_packet(t_gdb *g, const char *payload){
+    char frame[GDB_PACKET_SIZE + 4];
+    uint32_t len, sum = 0, i;
+
+    len = strlen(payload);
+    frame[0] = '$';
+    for(i=0;i<len;i++){
+        frame[i+1] = payload[i];
+        sum += (uint8_t)payload[i];
+    }
+    sprintf(&frame[len+1], "#%02x", sum & 0xff);
+    send(g->fd, frame, len + 4, GDB_SEND_FLAGS);
+}
+
+/**
+    Handle the packet in g->packet, sending the reply.
+
+    @return 0 if GDB is done with the target.
+*/
+static int handle_packet(t_gdb *g, t_state *s){
+    const char *p = g->packet;
+    char *r = g->reply;
+    uint32_t address, len, i, n, type, kind;
+    char *end;
+    int ok;
+
+    r[0] = '\0';
+    switch(p[0]){
+    case '?':
+        stop_reply(s, r);
+        break;
+    case 'g':
+        for(i=0;i<GDB_NUM_REGS;i++){
+            put_reg(s, &r[i*8], get_reg(s, i));
+        }
+        break;
+    case 'G':
+        for(i=0;i<GDB_NUM_REGS && strlen(&p[1+i*8])>=8;i++){
+            set_reg(s, i, parse_reg(s, &p[1+i*8]));
+        }
+        strcpy(r, "OK");
+        break;
+    case 'p':
+        n = strtoul(&p[1], NULL, 16);
+        if(n<GDB_NUM_REGS){
+            put_reg(s, r, get_reg(s, n));
+        }
+        else{
+            strcpy(r, "xxxxxxxx");
+        }
+        break;
+    case 'P':
+        n = strtoul(&p[1], &end, 16);
+        if(n<GDB_NUM_REGS && *end=='=' && strlen(end+1)>=8){
+            set_reg(s, n, parse_reg(s, end+1));
+            strcpy(r, "OK");
+        }
+        else{
+            strcpy(r, "E01");
+        }
+        break;
+    case 'm':
+        if(sscanf(&p[1], "%x,%x", &address, &len)!=2){
+            strcpy(r, "E01");
+            break;
+        }
+        if(len > (sizeof(g->reply) - 1) / 2){
+            len = (sizeof(g->reply) - 1) / 2;
+        }
+        for(i=0;i<len && memory_ok(s, address+i);i++){
+            sprintf(&r[i*2], "%02x", mem_read(s, 1, address+i, 0) & 0xff);
+        }
+        if(i==0 && len>0) strcpy(r, "E01");
+        break;
+    case 'M':
+        end = strchr(p, ':');
+        if(end==NULL || sscanf(&p[1], "%x,%x", &address, &len)!=2){
+            strcpy(r, "E01");
+            break;
+        }
+        strcpy(r, "OK");
+        for(i=0;i<len;i++){
+            if(hex_digit(end[1+i*2])<0 || hex_digit(end[2+i*2])<0 ||
+               !memory_ok(s, address+i)){
+                strcpy(r, "E01");
+                break;
+            }
+            mem_write(s, 1, address+i,
+                      hex_digit(end[1+i*2])*16 + hex_digit(end[2+i*2]), 0);
+        }
+        break;
+    case 'c':
+    case 's':
+        if(p[1]!='\0'){
+            address = strtoul(&p[1], NULL, 16);
+            s->pc = address;
+            s->pc_next = address + 4;
+        }
+        if(p[0]=='c'){
+            sched_at(s, EVENT_GDB_POLL, s->insn_count + GDB_POLL_INSNS, 0);
+            debug_run(s, UINT64_MAX);
+            sched_cancel(s, EVENT_GDB_POLL);
+        }
+        else{
+            s->wakeup = 0;
+            s->dbg.stop = STOP_NONE;
+            s->dbg.exit_code = 0;
+            cycle(s, 0);
+        }
+        stop_reply(s, r);
+        if(s->dbg.stop==STOP_EXIT){
+            /* The program is over, there's nothing left to debug */
+            put_packet(g, r);
+            return 0;
+        }
+        break;
+    case 'Z':
+    case 'z':
+        if(sscanf(&p[1], "%u,%x,%x", &type, &address, &len)!=3 || type>4){
+            break;
+        }
+        if(type<=1){
+            ok = (p[0]=='Z')? debug_break_add(s, address) :
+                              debug_break_remove(s, address);
+        }
+        else{
+            kind = (type==2)? WATCH_WRITE :
+                   (type==3)? WATCH_READ : WATCH_READ | WATCH_WRITE;
+            ok = (p[0]=='Z')? debug_watch_add(s, address, len, kind) :
+                              debug_watch_remove(s, address, len, kind);
+        }
+        strcpy(r, ok? "OK" : "E01");
+        break;
+    case 'H':
+        strcpy(r, "OK");
+        break;
+    case 'q':
+        if(strncmp(p, "qSupported", 10)==0){
+            sprintf(r, "PacketSize=%x", GDB_PACKET_SIZE - 1);
+        }
+        else if(strcmp(p, "qAttached")==0){
+            strcpy(r, "1");
+        }
+        else if(strcmp(p, "qC")==0){
+            strcpy(r, "QC1");
+        }
+        break;
+    case 'D':
+        put_packet(g, "OK");
+        return 0;
+    case 'k':
+        return 0;
+    default:
+        /* Empty reply: not supported */
+        break;
+    }
+    put_packet(g, r);
+    return 1;
+}
+
+/** Build the reply telling GDB why the CPU stopped. */
+static void stop_reply(t_state *s, char *reply){
+    switch(s->dbg.stop){
+    case STOP_WATCH:
+        sprintf(reply, "T05%swatch:%08x;",
+                s->dbg.stop_kind==WATCH_READ? "r" : "", s->dbg.stop_address);
+        break;
+    case STOP_INTERRUPT:
+        strcpy(reply, "S02");
+        break;
+    case STOP_EXIT:
+        /* The exit status is the error count, saturated to fit */
+        sprintf(reply, "W%02x",
+                s->dbg.exit_code > 0xff? 0xff : s->dbg.exit_code);
+        break;
+    default:
+        strcpy(reply, "S05");
+    }
+}
+
+/** Value of register n, numbered as in 'g' packets. */
+static uint32_t get_reg(t_state *s, uint32_t n){
+    if(n<32) return s->r[n];
+    switch(n){
+    case 32: return s->cp0_status;
+    case 33: return s->lo;
+    case 34: return s->hi;
+    case 36: return s->cp0_cause;
+    case 37: return s->pc;
+    default: return 0;
+    }
+}
+
+/** Set register n, numbered as in 'g' packets; r0 and BadVAddr are fixed. */
+static void set_reg(t_state *s, uint32_t n, uint32_t value){
+    if(n>0 && n<32){
+        s->r[n] = value;
+        return;
+    }
+    switch(n){
+    case 32: s->cp0_status = value; break;
+    case 33: s->lo = value; break;
+    case 34: s->hi = value; break;
+    case 36: s->cp0_cause = value; break;
+    case 37:
+        s->pc = value;
+        s->pc_next = value + 4;
+        break;
+    }
+}
+
+/** Write a register value as 8 hex digits in target byte order. */
+static void put_reg(t_state *s, char *text, uint32_t value){
+    sprintf(text, "%08x", s->big_endian? value : bswap32(value));
+}
+
+/** Parse 8 hex digits in target byte order. */
+static uint32_t parse_reg(t_state *s, const char *text){
+    uint32_t value = 0, i;
+
+    for(i=0;i<8;i++){
+        value = (value << 4) | (hex_digit(text[i]) & 0x0f);
+    }
+    return s->big_endian? value : bswap32(value);
+}
+
+/** !=0 if GDB can access an address: mapped memory, no device registers. */
+static int memory_ok(t_state *s, uint32_t address){
+    return mem_find_block(s, address)!=NULL && device_find(s, address)==NULL;
+}
+
+/** Value of a hex digit, or -1. */
+static int hex_digit(char c){
+    if(c>='0' && c<='9') return c - '0';
+    if(c>='a' && c<='f') return c - 'a' + 10;
+    if(c>='A' && c<='F') return c - 'A' + 10;
+    return -1;
+}
+#endif
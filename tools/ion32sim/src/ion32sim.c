@@ -31,72 +31,17 @@
 #define CAUSE_MASK      (0xb080ff7c)
 
 
-/*---- Static data -----------------------------------------------------------*/
-
-t_map memory_maps[NUM_MEM_MAPS] = {
-    {/* Experimental memory map (default) */
-        {/* Code TCM (Holds bootstrap code) */
-        {VECTOR_RESET,  0x00004000, 0xf8000000, MEM_READONLY, NULL, "Code TCM"},
-        /* Data TCM */
-        {0xa0000000,    0x00002000, 0xf8000000, 0, NULL, "Data TCM"},
-        /* main external ram block  */
-        {0x80000000,    0x00080000, 0xf8000000, 0, NULL, "Cached RAM"},
-        /* main external ram block  */
-        {0x90000000,    0x00080000, 0xf8000000, MEM_TEST, NULL, "Cached test ROM"},
-        /* external flash block */
-        {0x00000000,    0x00040000, 0xf8000000, 0, NULL, "Cached FLASH"},
-        }
-    },
-
-    {/* uClinux memory map with bootstrap BRAM, debug only, to be removed */
-        {/* Bootstrap BRAM, read only */
-        {VECTOR_RESET,  0x00008000, 0xf8000000, MEM_READONLY, NULL, "Code TCM"},
-        /* Data TCM */
-        {0x00000000,    0x00002000, 0xf8000000, 0, NULL, "Data TCM"},
-        /* main external ram block  */
-        {0x80000000,    0x00800000, 0xf8000000, 0, NULL, "XRAM0"},
-        {0x10000000,    0x00800000, 0xf8000000, 0, NULL, "XRAM1"},
-        /* external flash block */
-        {0xb0000000,    0x00100000, 0xf8000000, 0, NULL, "Flash"},
-        }
-    },
-};
-
-extern t_args cmd_line_args;
-
 /*---- OS-dependent support functions and definitions ------------------------*/
 #ifndef WIN32
 //Support for Linux
 #include <termios.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 void sim_sleep(unsigned int value){
     usleep(value * 1000);
 }
 
-int kbhit(void){
-    struct termios oldt, newt;
-    struct timeval tv;
-    fd_set read_fd;
-
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    tv.tv_sec=0;
-    tv.tv_usec=0;
-    FD_ZERO(&read_fd);
-    FD_SET(0,&read_fd);
-    if(select(1, &read_fd, NULL, NULL, &tv) == -1){
-        return 0;
-    }
-    //tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    if(FD_ISSET(0,&read_fd)){
-        return 1;
-    }
-    return 0;
-}
-
 int getch(void){
     struct termios oldt, newt;
     int ch;
@@ -106,7 +51,7 @@ int getch(void){
     newt.c_lflag &= ~(ICANON | ECHO);
     tcsetattr(STDIN_FILENO, TCSANOW, &newt);
     ch = getchar();
-    //tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
     return ch;
 }
 #else
@@ -119,13 +64,43 @@ void sim_sleep(unsigned int value){
 }
 
 #endif
-/*---- End of OS-dependent support functions and definitions -----------------*/
 
+/** Allocate zero-filled memory for a block. Where possible the memory is an
+    anonymous mapping, so its pages only take up host memory once touched. */
+int alloc_block_memory(t_block *b){
+#ifndef WIN32
+    void *mem;
+
+    if(b->size > 0){
+        mem = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem!=MAP_FAILED){
+            b->mem = (uint8_t *)mem;
+            b->mapped = true;
+            return 1;
+        }
+    }
+#endif
+    b->mem = (uint8_t *)calloc(1, b->size);
+    b->mapped = false;
+    return b->mem!=NULL;
+}
 
-char *assertion_messages[2] = {
-   "Unaligned read",
-   "Unaligned write"
-};
+/** Free the memory of a block, be it allocated or mapped. */
+void free_block_memory(t_block *b){
+#ifndef WIN32
+    if(b->mapped){
+        munmap(b->mem, b->size);
+    }
+    else
+#endif
+    {
+        free(b->mem);
+    }
+    b->mem = NULL;
+    b->mapped = false;
+}
+/*---- End of OS-dependent support functions and definitions -----------------*/
 
 
 static char *reg_names[]={
@@ -170,12 +145,9 @@ static char *regimm_string[]={
 uint32_t log_cycle(t_state *s);
 void log_read(t_state *s, int full_address, int word_value, int size, int log);
 void log_failed_assertions(t_state *s);
-uint32_t log_enabled(t_state *s);
 void trigger_log(t_state *s);
 void print_opcode_fields(uint32_t opcode);
 void reserved_opcode(uint32_t pc, uint32_t opcode, t_state* s);
-void log_call(uint32_t to, uint32_t from);
-void log_ret(uint32_t to, uint32_t from);
 
 void unimplemented(t_state *s, const char *txt);
 void reverse_endianess(uint8_t *data, uint32_t bytes);
@@ -190,6 +162,7 @@ static void cop2_set_reg(t_state *s,uint32_t rcop, uint32_t sel, bool ctrl, uint
 
 uint32_t start_load(t_state *s, uint32_t addr, int rt, int data, int size);
 uint32_t simulate_hw_irqs(t_state *s);
+static void schedule_timer(t_state *s);
 
 
 
@@ -205,8 +178,7 @@ void log_read(t_state *s, int full_address, int word_value, int size, int log){
     // FIXME refactor
     //if(log_enabled(s) && log!=0 && !(s->cp0_status & 0x00010000)){
     if(log_enabled(s) && log!=0){
-        fprintf(s->t.log, "(%08x) [%08x] <%1d>=%08x RD\n",
-              s->op_addr, full_address, size, word_value);
+        log_entry(s, LOG_RD, s->op_addr, full_address, size, word_value);
     }
 }
 
@@ -269,11 +241,10 @@ void mem_swr(t_state *s, uint32_t address, uint32_t value, uint32_t log){
     address = (address & (~0x03));
     data = value;
 
-    while(offset>=0){
+    do{
         mem_write(s,1,address+offset,data & 0xff,0);
         data = data >> 8;
-        offset--;
-    }
+    }while(offset--!=0);
 }
 
 void mem_lwr(t_state *s, uint32_t address, uint32_t reg_index, uint32_t log){
@@ -360,6 +331,219 @@ uint32_t ins_bitfield(uint32_t target, uint32_t src, uint32_t opcode){
 
 /*---- Optional MMU and cache implementation ---------------------------------*/
 
+#ifdef ENABLE_CACHE
+/*
+ Cache models.
+ Only the tags are simulated: memory always holds the current data, so the
+ caches never change what the program sees, and the execution log is the
+ same with or without them. Each cache counts hits, misses and write-backs
+ of dirty lines so that cache geometries can be compared on real code.
+
+ Only accesses to blocks flagged MEM_CACHED go through the caches. Lines are
+ replaced LRU. Write-back caches allocate lines on write misses; write-through
+ caches don't, and never have dirty lines.
+*/
+
+/* Line state bits in t_cache.state. */
+#define CACHE_VALID     (1<<0)
+#define CACHE_DIRTY     (1<<1)
+
+/* CACHE opcode operations, bits 4..2 of the op field. */
+#define CACHE_OP_INDEX_INVALIDATE   (0)
+#define CACHE_OP_INDEX_STORE_TAG    (2)
+#define CACHE_OP_HIT_INVALIDATE     (4)
+#define CACHE_OP_FILL_HIT_WB_INV    (5)
+#define CACHE_OP_HIT_WRITEBACK      (6)
+#define CACHE_OP_FETCH_LOCK         (7)
+
+/** Allocate an empty cache; caches of size 0 are left disabled. */
+int cache_init(t_cache *c, const t_cache_config *cfg){
+    uint32_t lines;
+
+    memset(c, 0, sizeof(t_cache));
+    c->cfg = *cfg;
+    if(cfg->size==0) return 1;
+
+    lines = cfg->size / cfg->line_size;
+    c->sets = lines / cfg->ways;
+    for(c->line_shift=0;(1u << c->line_shift)<cfg->line_size;c->line_shift++);
+    c->tags = calloc(lines, sizeof(uint32_t));
+    c->stamps = calloc(lines, sizeof(uint32_t));
+    c->state = calloc(lines, sizeof(uint8_t));
+    if(c->tags==NULL || c->stamps==NULL || c->state==NULL){
+        cache_free(c);
+        return 0;
+    }
+    return 1;
+}
+
+void cache_free(t_cache *c){
+    free(c->tags);
+    free(c->stamps);
+    free(c->state);
+    c->tags = NULL;
+    c->stamps = NULL;
+    c->state = NULL;
+}
+
+/** Index of the line holding an address, or -1 on a miss. */
+static int32_t cache_lookup(t_cache *c, uint32_t address){
+    uint32_t tag = address >> c->line_shift;
+    uint32_t i, line = (tag & (c->sets - 1)) * c->cfg.ways;
+
+    for(i=0;i<c->cfg.ways;i++, line++){
+        if((c->state[line] & CACHE_VALID) && c->tags[line]==tag){
+            return line;
+        }
+    }
+    return -1;
+}
+
+/** Load the line holding an address, evicting the LRU line of its set. */
+static int32_t cache_fill(t_cache *c, uint32_t address){
+    uint32_t tag = address >> c->line_shift;
+    uint32_t i, line = (tag & (c->sets - 1)) * c->cfg.ways;
+    uint32_t victim = line;
+
+    for(i=0;i<c->cfg.ways;i++, line++){
+        if(!(c->state[line] & CACHE_VALID)){
+            victim = line;
+            break;
+        }
+        if(c->stamps[line] < c->stamps[victim]){
+            victim = line;
+        }
+    }
+    if(c->state[victim] & CACHE_DIRTY){
+        c->writebacks++;
+    }
+    c->tags[victim] = tag;
+    c->state[victim] = CACHE_VALID;
+    return victim;
+}
+
+/** Simulate a read or write access to the cache. */
+void cache_access(t_cache *c, uint32_t address, int write){
+    int32_t line;
+
+    line = cache_lookup(c, address);
+    if(line>=0){
+        if(write) c->write_hits++; else c->read_hits++;
+    }
+    else{
+        if(write) c->write_misses++; else c->read_misses++;
+        if(write && !c->cfg.write_back) return;
+        line = cache_fill(c, address);
+    }
+    c->stamps[line] = ++c->clock;
+    if(write && c->cfg.write_back){
+        c->state[line] |= CACHE_DIRTY;
+    }
+}
+
+/** Code fetch from an address, through the I-cache if it is cacheable. */
+void cache_fetch(t_state *s, uint32_t address){
+    if(s->icache.tags!=NULL &&
+       (s->mem_pages[address >> MEM_PAGE_SHIFT].flags & MEM_CACHED)){
+        cache_access(&(s->icache), address, 0);
+    }
+}
+
+/** Load or store, through the D-cache if the address is cacheable. */
+void cache_data(t_state *s, uint32_t address, int write){
+    if(s->dcache.tags!=NULL &&
+       (s->mem_pages[address >> MEM_PAGE_SHIFT].flags & MEM_CACHED)){
+        cache_access(&(s->dcache), address, write);
+    }
+}
+
+/**
+    Execute a CACHE opcode.
+    The index operations select the set with the address bits above the line
+    offset, and the way with the bits above those. Index Store Tag stores an
+    invalid tag, as TagLo is not implemented and is assumed to be zero; Index
+    Load Tag does nothing. Fetch and Lock just fetches.
+
+    @arg op Op field of the opcode (rt): cache in bits 1..0, operation in
+            bits 4..2.
+*/
+void cache_op(t_state *s, uint32_t op, uint32_t address){
+    t_cache *c;
+    int32_t line;
+    uint32_t tag;
+
+    switch(op & 0x03){
+    case 0: c = &(s->icache); break;
+    case 1: c = &(s->dcache); break;
+    default: return;    /* no secondary or tertiary caches */
+    }
+    if(c->tags==NULL) return;
+    c->ops++;
+
+    switch(op >> 2){
+    case CACHE_OP_INDEX_INVALIDATE:
+    case CACHE_OP_INDEX_STORE_TAG:
+        tag = address >> c->line_shift;
+        line = (tag & (c->sets - 1)) * c->cfg.ways +
+               ((tag / c->sets) % c->cfg.ways);
+        if((op>>2)==CACHE_OP_INDEX_INVALIDATE &&
+           (c->state[line] & CACHE_DIRTY)){
+            c->writebacks++;
+        }
+        c->state[line] = 0;
+        break;
+    case CACHE_OP_HIT_INVALIDATE:
+        line = cache_lookup(c, address);
+        if(line>=0) c->state[line] = 0;
+        break;
+    case CACHE_OP_FILL_HIT_WB_INV:
+    case CACHE_OP_HIT_WRITEBACK:
+        line = cache_lookup(c, address);
+        if(c==&(s->icache)){
+            /* Fill */
+            if(line<0) line = cache_fill(c, address);
+            c->stamps[line] = ++c->clock;
+            break;
+        }
+        if(line<0) break;
+        if(c->state[line] & CACHE_DIRTY){
+            c->writebacks++;
+        }
+        c->state[line] = ((op>>2)==CACHE_OP_HIT_WRITEBACK)? CACHE_VALID : 0;
+        break;
+    case CACHE_OP_FETCH_LOCK:
+        if(cache_lookup(c, address)<0){
+            line = cache_fill(c, address);
+            c->stamps[line] = ++c->clock;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/** Print the statistics of a cache, if it is enabled. */
+void cache_report(FILE *f, const char *name, const t_cache *c){
+    uint64_t reads = c->read_hits + c->read_misses;
+    uint64_t writes = c->write_hits + c->write_misses;
+
+    if(c->tags==NULL) return;
+    fprintf(f, "%s: %u bytes, %u-way, %u-byte lines\n", name,
+            c->cfg.size, c->cfg.ways, c->cfg.line_size);
+    fprintf(f, "    reads  %14llu, misses %14llu (%6.2f%%)\n",
+            (unsigned long long)reads, (unsigned long long)c->read_misses,
+            reads? 100.0 * c->read_misses / reads : 0.0);
+    if(writes > 0){
+        fprintf(f, "    writes %14llu, misses %14llu (%6.2f%%), %s\n",
+                (unsigned long long)writes,
+                (unsigned long long)c->write_misses,
+                100.0 * c->write_misses / writes,
+                c->cfg.write_back? "write-back" : "write-through");
+    }
+    fprintf(f, "    %llu lines written back, %llu CACHE operations\n",
+            (unsigned long long)c->writebacks, (unsigned long long)c->ops);
+}
+#endif
 
 /*---- End optional cache implementation -------------------------------------*/
 
@@ -459,7 +643,7 @@ void process_traps(t_state *s, uint32_t epc, uint32_t rSave, uint32_t rt){
     }
     else{
         /* If there's any hardware interrupt pending, deal with it */
-        if(s->t.irq_trigger_countdown==0){
+        if(s->t.irq_pending){
             uint32_t mask;
             // FIXME should delay if victim instruction is in delay slot
             /* trigger interrupt IF it is not masked... */
@@ -474,10 +658,13 @@ void process_traps(t_state *s, uint32_t epc, uint32_t rSave, uint32_t rt){
                 s->cause_ip = s->t.irq_current_inputs & 0x3f;
                 //printf("IP = %02x\n", s->cause_ip);
             }
-            s->t.irq_trigger_countdown--;
+            s->t.irq_pending = false;
         }
-        else if (s->t.irq_trigger_countdown>0){
-            s->t.irq_trigger_countdown--;
+        /* The timer interrupt is a level: it stays pending until serviced */
+        if(s->timer_irq && (s->cp0_status & CAUSE_IP_TIMER) &&
+           (s->cp0_status & (SR_EXL | SR_ERL | 0x01))==0x01){
+            cause = 0;
+            s->cause_ip |= (CAUSE_IP_TIMER >> 10);
         }
     }
 
@@ -508,51 +695,526 @@ void process_traps(t_state *s, uint32_t epc, uint32_t rSave, uint32_t rt){
     }
 }
 
+/** Event handler: COP0 Count has reached Compare. */
+void timer_event(t_state *s, uint32_t arg){
+    s->timer_irq = true;
+    /* Count will match Compare again when it wraps around */
+    sched_at(s, EVENT_TIMER, s->insn_count + ((uint64_t)1 << 32), 0);
+}
+
+/** Schedule the timer event for the instruction that will find Count equal
+    to Compare, after a write to either. */
+static void schedule_timer(t_state *s){
+    uint32_t count = (uint32_t)(s->insn_count - s->count_base);
+    uint64_t delta = (uint32_t)(s->cp0_compare - count);
+
+    if(delta==0) delta = (uint64_t)1 << 32;
+    sched_at(s, EVENT_TIMER, s->insn_count + delta - 1, 0);
+}
+
+/*---- Instruction handlers --------------------------------------------------*/
+
+/*
+ These functions execute a single decoded instruction each. They are selected
+ by decode_opcode() and called from cycle(), and they return a combination of
+ EXEC_* flags that tells cycle() how the instruction affects the PC.
+ Argument ptr is the effective address for load and store opcodes.
+*/
+
+/** Declare an instruction handler; all share the t_handler prototype. */
+#define HANDLER(name) \
+    static uint32_t name(t_state *s, const t_decoded *d, uint32_t ptr)
+
+/* Register bank as unsigned, as used by the unsigned opcodes. */
+#define UREG(i) (((unsigned int *)s->r)[i])
+
+/*-- SPECIAL --*/
+HANDLER(op_sll)   { s->r[d->rd]=s->r[d->rt]<<d->re;           return 0; }
+HANDLER(op_srl)   { s->r[d->rd]=UREG(d->rt)>>d->re;           return 0; }
+HANDLER(op_sra)   { s->r[d->rd]=s->r[d->rt]>>d->re;           return 0; }
+HANDLER(op_sllv)  { s->r[d->rd]=s->r[d->rt]<<s->r[d->rs];     return 0; }
+HANDLER(op_srlv)  { s->r[d->rd]=UREG(d->rt)>>s->r[d->rs];     return 0; }
+HANDLER(op_srav)  { s->r[d->rd]=s->r[d->rt]>>s->r[d->rs];     return 0; }
+HANDLER(op_jr){
+    if(d->rs==31) log_ret(s, s->r[d->rs], s->op_addr);
+    s->pc_next=s->r[d->rs];
+    return EXEC_JUMP;
+}
+HANDLER(op_jalr){
+    s->r[d->rd]=s->pc_next;
+    s->pc_next=s->r[d->rs];
+    log_call(s, s->pc_next, s->op_addr);
+    return EXEC_JUMP;
+}
+HANDLER(op_movz){
+    if(s->args.emulate_some_mips32){   /*IV*/
+        if(!s->r[d->rt]) s->r[d->rd]=s->r[d->rs];
+    }
+    return 0;
+}
+HANDLER(op_movn){
+    if(s->args.emulate_some_mips32){   /*IV*/
+        if(s->r[d->rt]) s->r[d->rd]=s->r[d->rs];
+    }
+    return 0;
+}
+HANDLER(op_syscall){
+    s->trap_cause = 8;
+    //FIXME enable when running uClinux
+    //printf("SYSCALL (%08x)\n", s->pc);
+    return 0;
+}
+HANDLER(op_break){
+    s->trap_cause = 9;
+    //FIXME enable when running uClinux
+    //printf("BREAK (%08x)\n", s->pc);
+    return 0;
+}
+HANDLER(op_sync)  { s->wakeup=1;                              return 0; }
+HANDLER(op_mfhi)  { s->r[d->rd]=s->hi;                        return 0; }
+HANDLER(op_mthi)  { s->hi=s->r[d->rs];                        return 0; }
+HANDLER(op_mflo)  { s->r[d->rd]=s->lo;                        return 0; }
+HANDLER(op_mtlo)  { s->lo=s->r[d->rs];                        return 0; }
+HANDLER(op_mult){
+    mult_big_signed(s->r[d->rs],s->r[d->rt],&s->hi,&s->lo,0);
+    return 0;
+}
+HANDLER(op_multu){
+    mult_big(s->r[d->rs],s->r[d->rt],&s->hi,&s->lo,0);
+    return 0;
+}
+HANDLER(op_div){
+    /* Results are unpredictable when dividing by zero: leave HI and LO
+       alone rather than crash the host. Same for divu. */
+    if(s->r[d->rt]==0) return 0;
+    if(s->r[d->rs]==INT32_MIN && s->r[d->rt]==-1){
+        /* Overflows in C */
+        s->lo=INT32_MIN;
+        s->hi=0;
+        return 0;
+    }
+    s->lo=s->r[d->rs]/s->r[d->rt];
+    s->hi=signed_rem(s->r[d->rs],s->r[d->rt]);
+    return 0;
+}
+HANDLER(op_divu){
+    if(UREG(d->rt)==0) return 0;
+    s->lo=UREG(d->rs)/UREG(d->rt);
+    s->hi=UREG(d->rs)%UREG(d->rt);
+    return 0;
+}
+HANDLER(op_add)   { s->r[d->rd]=s->r[d->rs]+s->r[d->rt];      return 0; }
+HANDLER(op_sub)   { s->r[d->rd]=s->r[d->rs]-s->r[d->rt];      return 0; }
+HANDLER(op_and)   { s->r[d->rd]=s->r[d->rs]&s->r[d->rt];      return 0; }
+HANDLER(op_or)    { s->r[d->rd]=s->r[d->rs]|s->r[d->rt];      return 0; }
+HANDLER(op_xor)   { s->r[d->rd]=s->r[d->rs]^s->r[d->rt];      return 0; }
+HANDLER(op_nor)   { s->r[d->rd]=~(s->r[d->rs]|s->r[d->rt]);   return 0; }
+HANDLER(op_slt)   { s->r[d->rd]=s->r[d->rs]<s->r[d->rt];      return 0; }
+HANDLER(op_sltu)  { s->r[d->rd]=UREG(d->rs)<UREG(d->rt);      return 0; }
+HANDLER(op_daddu) { s->r[d->rd]=s->r[d->rs]+UREG(d->rt);      return 0; }
+HANDLER(op_nop)   {                                           return 0; }
+HANDLER(op_special_reserved){
+    reserved_opcode(s->op_addr, d->opcode, s);
+    return 0;
+}
+
+/*-- REGIMM --*/
+HANDLER(op_bltz)  { return s->r[d->rs]<0? EXEC_BRANCH : 0; }
+HANDLER(op_bgez)  { return s->r[d->rs]>=0? EXEC_BRANCH : 0; }
+HANDLER(op_bltzal){
+    s->r[31]=s->pc_next;
+    return EXEC_LINK | (s->r[d->rs]<0? EXEC_BRANCH : 0);
+}
+HANDLER(op_bgezal){
+    s->r[31]=s->pc_next;
+    return EXEC_LINK | (s->r[d->rs]>=0? EXEC_BRANCH : 0);
+}
+HANDLER(op_regimm_error){
+    printf("ERROR1\n");
+    s->wakeup=1;
+    return 0;
+}
+
+/*-- Jumps and branches --*/
+HANDLER(op_j){
+    s->pc_next=(s->pc&0xf0000000)|d->target;
+    return EXEC_JUMP;
+}
+HANDLER(op_jal){
+    s->r[31]=s->pc_next;
+    log_call(s, ((s->pc&0xf0000000)|d->target), s->op_addr);
+    s->pc_next=(s->pc&0xf0000000)|d->target;
+    return EXEC_JUMP;
+}
+HANDLER(op_beq)   { return s->r[d->rs]==s->r[d->rt]? EXEC_BRANCH : 0; }
+HANDLER(op_bne)   { return s->r[d->rs]!=s->r[d->rt]? EXEC_BRANCH : 0; }
+HANDLER(op_blez)  { return s->r[d->rs]<=0? EXEC_BRANCH : 0; }
+HANDLER(op_bgtz)  { return s->r[d->rs]>0? EXEC_BRANCH : 0; }
+
+/*-- Immediate ALU opcodes --*/
+HANDLER(op_addi)  { s->r[d->rt]=s->r[d->rs]+(short)d->imm;    return 0; }
+HANDLER(op_addiu) { UREG(d->rt)=UREG(d->rs)+(short)d->imm;    return 0; }
+HANDLER(op_slti)  { s->r[d->rt]=s->r[d->rs]<(int)(short)d->imm; return 0; }
+HANDLER(op_sltiu) { UREG(d->rt)=UREG(d->rs)<(d->imm & 0x0000ffff); return 0; }
+HANDLER(op_andi)  { s->r[d->rt]=s->r[d->rs]&d->imm;           return 0; }
+HANDLER(op_ori)   { s->r[d->rt]=s->r[d->rs]|d->imm;           return 0; }
+HANDLER(op_xori)  { s->r[d->rt]=s->r[d->rs]^d->imm;           return 0; }
+HANDLER(op_lui)   { s->r[d->rt]=(d->imm<<16);                 return 0; }
+
+/*-- Coprocessors --*/
+HANDLER(op_cop0){
+    int *r = s->r;
+    uint32_t opcode = d->opcode;
+    uint32_t rs = d->rs, rt = d->rt, rd = d->rd, func = d->func;
+    uint32_t epc = s->op_addr;
+
+    if(KERNEL_MODE){
+        //fprintf(s->t.log, "STATUS = %08x\n", s->cp0_status);
+        if(opcode==0x42000010){  // rfe -- not MIPS32 really.
+            unimplemented(s,"RFE");
+        }
+        if(opcode==0x42000018){  // eret
+            s->skip = 0;
+            s->eret_delay_slot = 1;
+            s->pc_next = s->epc;
+            smp_unlink(s);
+            //printf("ERET to %08xh, STATUS = %08x\n", s->pc_next, s->cp0_status);
+            /* Now, if ERL is set... */
+            if (s->cp0_status & SR_ERL) {
+                s->cp0_status &= (~SR_ERL); /* ...clear ERL... */
+            }
+            else {
+                s->cp0_status &= (~SR_EXL); /* ...otherwise clear EXL */
+            }
+            //printf("ERET :: STATUS = %08x\n", s->cp0_status);
+        }
+        else if((opcode & (1<<23)) == 0){  //move from CP0 (mfc0)
+            switch(rd){
+                case 8: r[rt] = 0; break; // FIXME BadVAddr
+                case 9: r[rt] = (uint32_t)(s->insn_count - s->count_base);
+                        break;
+                case 11: r[rt] = s->cp0_compare; break;
+                case 12: r[rt]=(s->cp0_status & STATUS_MASK); break;
+                case 13: r[rt]=((s->cp0_cause |
+                                 (s->timer_irq? CAUSE_IP_TIMER : 0)) &
+                                CAUSE_MASK);
+                         break;
+                case 14: r[rt]=s->epc; break;
+                case 15:
+                    if ((func&0x07)==1) {
+                        r[rt] = CP0_EBASE | s->core_id;
+                    } else {
+                        r[rt] = CPU_ID;
+                    }; break;
+                case 16:
+                        if ((func&0x07)==0) {
+                            r[rt]=s->cp0_config0;
+                        } else {
+                            r[rt] = 0;
+                        }; break;
+                case 17: r[rt] = s->ll_addr >> 4; break; // LLAddr
+                case 30: r[rt] = s->epc;
+                default:
+                    /* FIXME log access to unimplemented CP0 register */
+                    printf("mfc0 [%02d]->%02d @ [0x%08x]\n", rd, rt,s->pc);
+                    break;
+            }
+        }
+        else{                         //move to CP0 (mtc0)
+            switch (rd){
+                case 9: s->count_base = s->insn_count - (uint32_t)r[rt];
+                        schedule_timer(s);
+                        break;
+                case 11: s->cp0_compare = r[rt];
+                         /* Writing Compare acknowledges the timer irq */
+                         s->timer_irq = false;
+                         schedule_timer(s);
+                         break;
+                case 12: s->sr_load_pending_value = r[rt];
+                         s->sr_load_pending = true;
+                         if(log_is_open(s)){
+                             log_entry(s, LOG_REG, 0x0 /* log_pc */, 1, 0,
+                                       r[rt] & STATUS_MASK);
+                         }
+                         break;
+                case 13: s->cp0_cause = r[rt] & CAUSE_MASK; break;
+                case 14: s->epc = r[rt];
+                         if(log_is_open(s)){
+                             log_entry(s, LOG_REG, 0x0 /* log_pc */, 3, 0,
+                                       r[rt]);
+                         }
+                         break;
+                case 16:
+                    if ((func&0x07)==0) {
+                        s->cp0_config0 = r[rt] & 0x00030000;
+                    }
+                    else {
+                        printf("mtc0 [%2d.%2d]=0x%08x @ [0x%08x] IGNORED\n",
+                               rd, rs, r[rt], epc);
+                    }; break;
+                default:
+                    /* Move to unimplemented/RO register: display warning */
+                    /* FIXME should log ignored move */
+                    printf("mtc0 [%2d]=0x%08x @ [0x%08x] IGNORED\n",
+                            rd, r[rt], epc);
+            }
+        }
+    }
+    else{
+        /* tried to execute mtc* or mfc* in user mode: trap */
+        s->trap_cause = 11; /* unavailable coprocessor */
+    }
+    return 0;
+}
+HANDLER(op_cop1)  { unimplemented(s,"COP1");                  return 0; }
+HANDLER(op_cop2)  { cop2(s,d->opcode);                        return 0; }
+HANDLER(op_cop3)  { unimplemented(s,"COP3");                  return 0; }
+
+/*-- Branch likely (delay slot nullification not simulated) --*/
+HANDLER(op_beql)  { return s->r[d->rs]==s->r[d->rt]? EXEC_BRANCH : 0; }
+HANDLER(op_bnel)  { return s->r[d->rs]!=s->r[d->rt]? EXEC_BRANCH : 0; }
+HANDLER(op_blezl) { return s->r[d->rs]<=0? EXEC_BRANCH : 0; }
+HANDLER(op_bgtzl) { return s->r[d->rs]>0? EXEC_BRANCH : 0; }
+
+/*-- MIPS32 extensions --*/
+HANDLER(op_special2){
+    int *r = s->r;
+    uint32_t rs = d->rs, rt = d->rt, rd = d->rd;
+
+    /* MIPS32r1 opcodes implemented, r2 unimplemented. */
+    switch(d->func){
+        case 0x00: /* MADD */ mult_big_signed(r[rs],r[rt],&s->hi,&s->lo,1); break;
+        case 0x01: /* MADDU */ mult_big(r[rs],r[rt],&s->hi,&s->lo,1); break;
+        case 0x20: /* CLZ */ r[rt] = count_leading(0, r[rs]); break;
+        case 0x21: /* CLO */ r[rt] = count_leading(1, r[rs]); break;
+        case 0x02: /* MUL */ r[rd] = mult_gpr(r[rs], r[rt]); break;
+        default:
+            reserved_opcode(s->op_addr, d->opcode, s);
+            unimplemented(s, "SPECIAL2");
+    }
+    return 0;
+}
+HANDLER(op_special3){
+    int *r = s->r;
+
+    if(s->args.emulate_some_mips32){
+        switch(d->func){
+            case 0x00: /* EXT */ r[d->rt] = ext_bitfield(r[d->rs], d->opcode); break;
+            case 0x04: /* INS */ r[d->rt] = ins_bitfield(r[d->rt], r[d->rs], d->opcode); break;
+            default:
+                reserved_opcode(s->op_addr, d->opcode, s);
+                unimplemented(s, "SPECIAL3");
+        }
+    }
+    else{
+        reserved_opcode(s->op_addr, d->opcode, s);
+    }
+    return 0;
+}
+
+/*-- Loads and stores --*/
+HANDLER(op_lb){
+    start_load(s, ptr, d->rt, (signed char)mem_read(s,1,ptr,1), 1);
+    return 0;
+}
+HANDLER(op_lh){
+    start_load(s, ptr, d->rt, (signed short)mem_read(s,2,ptr,1), 2);
+    return 0;
+}
+HANDLER(op_lwl)   { mem_lwl(s, ptr, d->rt, 1);                return 0; }
+HANDLER(op_lw){
+    start_load(s, ptr, d->rt, mem_read(s,4,ptr,1), 4);
+    return 0;
+}
+HANDLER(op_lbu){
+    start_load(s, ptr, d->rt, (unsigned char)mem_read(s,1,ptr,1), 1);
+    return 0;
+}
+HANDLER(op_lhu){
+    start_load(s, ptr, d->rt, (unsigned short)mem_read(s,2,ptr,1), 2);
+    return 0;
+}
+HANDLER(op_lwr)   { mem_lwr(s, ptr, d->rt, 1);                return 0; }
+HANDLER(op_sb)    { mem_write(s,1,ptr,s->r[d->rt],1);         return 0; }
+HANDLER(op_sh)    { mem_write(s,2,ptr,s->r[d->rt],1);         return 0; }
+HANDLER(op_swl)   { mem_swl(s, ptr, s->r[d->rt], 1);          return 0; }
+HANDLER(op_sw)    { mem_write(s,4,ptr,s->r[d->rt],1);         return 0; }
+HANDLER(op_swr)   { mem_swr(s, ptr, s->r[d->rt], 1);          return 0; }
+HANDLER(op_cache){
+#ifdef ENABLE_CACHE
+    cache_op(s, d->rt, ptr);
+#else
+    /* Since we don´t simulate the caches, the cache instruction will be
+       ignored. It is implemented as a NOP. */
+#endif
+    return 0;
+}
+HANDLER(op_ll){
+    smp_link(s, ptr);
+    start_load(s, ptr, d->rt, mem_read(s,4,ptr,1), 4);
+    return 0;
+}
+HANDLER(op_lwc2){
+    uint32_t aux;
+
+    aux = start_load(s, ptr, -1, mem_read(s,4,ptr,1), 4);
+    cop2_set_reg(s, d->rt, 0, 0, aux);
+    return 0;
+}
+HANDLER(op_sc){
+    s->r[d->rt] = smp_store_conditional(s, ptr, s->r[d->rt]);
+    return 0;
+}
+HANDLER(op_swc2){
+    uint32_t aux;
+
+    aux = cop2_get_reg(s, d->rt, 0, 0);
+    mem_write(s,4,ptr,aux,1);
+    return 0;
+}
+HANDLER(op_reserved){
+    /* unimplemented opcode */
+    reserved_opcode(s->op_addr, d->opcode, s);
+    unimplemented(s, "???");
+    return 0;
+}
+
+#undef UREG
+
+/** Handlers for primary opcode field; NULL for reserved opcodes. */
+static const t_handler op_handlers[64] = {
+    [0x02] = op_j,        [0x03] = op_jal,      [0x04] = op_beq,
+    [0x05] = op_bne,      [0x06] = op_blez,     [0x07] = op_bgtz,
+    [0x08] = op_addi,     [0x09] = op_addiu,    [0x0a] = op_slti,
+    [0x0b] = op_sltiu,    [0x0c] = op_andi,     [0x0d] = op_ori,
+    [0x0e] = op_xori,     [0x0f] = op_lui,      [0x10] = op_cop0,
+    [0x11] = op_cop1,     [0x12] = op_cop2,     [0x13] = op_cop3,
+    [0x14] = op_beql,     [0x15] = op_bnel,     [0x16] = op_blezl,
+    [0x17] = op_bgtzl,    [0x1c] = op_special2, [0x1f] = op_special3,
+    [0x20] = op_lb,       [0x21] = op_lh,       [0x22] = op_lwl,
+    [0x23] = op_lw,       [0x24] = op_lbu,      [0x25] = op_lhu,
+    [0x26] = op_lwr,      [0x28] = op_sb,       [0x29] = op_sh,
+    [0x2a] = op_swl,      [0x2b] = op_sw,       [0x2e] = op_swr,
+    [0x2f] = op_cache,    [0x30] = op_ll,       [0x32] = op_lwc2,
+    [0x38] = op_sc,       [0x3a] = op_swc2,
+};
+
+/** Handlers for SPECIAL opcodes, by function field; NULL for reserved. */
+static const t_handler special_handlers[64] = {
+    [0x00] = op_sll,      [0x02] = op_srl,      [0x03] = op_sra,
+    [0x04] = op_sllv,     [0x06] = op_srlv,     [0x07] = op_srav,
+    [0x08] = op_jr,       [0x09] = op_jalr,     [0x0a] = op_movz,
+    [0x0b] = op_movn,     [0x0c] = op_syscall,  [0x0d] = op_break,
+    [0x0f] = op_sync,     [0x10] = op_mfhi,     [0x11] = op_mthi,
+    [0x12] = op_mflo,     [0x13] = op_mtlo,     [0x18] = op_mult,
+    [0x19] = op_multu,    [0x1a] = op_div,      [0x1b] = op_divu,
+    [0x20] = op_add,      [0x21] = op_add,      [0x22] = op_sub,
+    [0x23] = op_sub,      [0x24] = op_and,      [0x25] = op_or,
+    [0x26] = op_xor,      [0x27] = op_nor,      [0x2a] = op_slt,
+    [0x2b] = op_sltu,     [0x2d] = op_daddu,    [0x31] = op_nop, /*TGEU*/
+    [0x32] = op_nop,/*TLT*/ [0x33] = op_nop,/*TLTU*/ [0x34] = op_nop,/*TEQ*/
+    [0x36] = op_nop, /*TNE*/
+};
+
+/** Handlers for REGIMM opcodes, by rt field; NULL for reserved. */
+static const t_handler regimm_handlers[32] = {
+    [0x00] = op_bltz,     [0x01] = op_bgez,     [0x02] = op_bltz, /*BLTZL*/
+    [0x03] = op_bgez, /*BGEZL*/                 [0x10] = op_bltzal,
+    [0x11] = op_bgezal,   [0x12] = op_bltzal, /*BLTZALL*/
+    [0x13] = op_bgezal, /*BGEZALL*/
+};
+
+/** Decode opcode into its fields and select its handler */
+void decode_opcode(t_decoded *d, uint32_t opcode){
+    t_handler handler;
+
+    d->opcode = opcode;
+    d->op = (opcode >> 26) & 0x3f;
+    d->rs = (opcode >> 21) & 0x1f;
+    d->rt = (opcode >> 16) & 0x1f;
+    d->rd = (opcode >> 11) & 0x1f;
+    d->re = (opcode >> 6) & 0x1f;
+    d->func = opcode & 0x3f;
+    d->imm = opcode & 0xffff;
+    d->imm_shift = (((int)(short)d->imm) << 2) - 4;
+    d->target = (opcode << 6) >> 4;
+
+    switch(d->op){
+    case 0x00:/*SPECIAL*/
+        handler = special_handlers[d->func];
+        if(handler==NULL) handler = op_special_reserved;
+        break;
+    case 0x01:/*REGIMM*/
+        handler = regimm_handlers[d->rt];
+        if(handler==NULL) handler = op_regimm_error;
+        break;
+    default:
+        handler = op_handlers[d->op];
+        if(handler==NULL) handler = op_reserved;
+    }
+    d->handler = handler;
+
+    /* Classify the opcode for the block engine */
+    d->flags = 0;
+    if(handler==op_j || handler==op_jal || handler==op_jr ||
+       handler==op_jalr || handler==op_beq || handler==op_bne ||
+       handler==op_blez || handler==op_bgtz || handler==op_beql ||
+       handler==op_bnel || handler==op_blezl || handler==op_bgtzl ||
+       handler==op_bltz || handler==op_bgez || handler==op_bltzal ||
+       handler==op_bgezal){
+        d->flags |= DEC_BRANCH;
+    }
+    if(handler==op_cop0 || handler==op_cop1 || handler==op_cop3 ||
+       handler==op_syscall || handler==op_break || handler==op_sync ||
+       handler==op_reserved || handler==op_special_reserved ||
+       handler==op_regimm_error){
+        d->flags |= DEC_SLOW;
+    }
+    if(handler==op_lb || handler==op_lh || handler==op_lwl ||
+       handler==op_lw || handler==op_lbu || handler==op_lhu ||
+       handler==op_lwr || handler==op_ll){
+        d->flags |= DEC_LOAD;
+    }
+    if(handler==op_sb || handler==op_sh || handler==op_swl ||
+       handler==op_sw || handler==op_swr || handler==op_sc ||
+       handler==op_swc2){
+        d->flags |= DEC_STORE;
+    }
+}
+
 /** Execute one cycle of the CPU (including any interlock stall cycles) */
 void cycle(t_state *s, int show_mode){
+    t_decoded fetched, *d;
     unsigned int opcode;
-    int delay_slot = 0; /* 1 of this instruction is a branch */
-    unsigned int op, rs, rt, rd, re, func, imm, target;
-    int imm_shift, branch=0, lbranch=2;
-    int link=0; /* !=0 if this is a 'branch-and-link' opcode */
+    unsigned int op, rs, rt, rd, re, func, imm;
     int *r=s->r;
-    unsigned int *u=(unsigned int*)s->r;
     unsigned int ptr, epc, rSave;
     char format;
-    uint32_t aux;
+    uint32_t aux, flags;
     uint32_t target_offset16;
     uint32_t target_long;
 
-    /* Update cycle counter (we implement an instruction counter actually )*/
-    s->inst_ctr_prescaler++;
-    if(s->inst_ctr_prescaler == (cmd_line_args.timer_prescaler-1)){
-        s->inst_ctr_prescaler = 0;
-        s->instruction_ctr++;
-    }
     /* No traps pending for this instruction (yet) */
     s->trap_cause = -1;
     s->cause_ip = 0;
 
-    /* fetch and decode instruction */
-    opcode = mem_read(s, 4, s->pc, 0);
-
-    op = (opcode >> 26) & 0x3f;
-    rs = (opcode >> 21) & 0x1f;
-    rt = (opcode >> 16) & 0x1f;
-    rd = (opcode >> 11) & 0x1f;
-    re = (opcode >> 6) & 0x1f;
-    func = opcode & 0x3f;
-    imm = opcode & 0xffff;
-    imm_shift = (((int)(short)imm) << 2) - 4;
-    target = (opcode << 6) >> 4;
+    /* fetch and decode instruction, from the predecode cache if possible */
+    d = s->pd.enabled? predecode_fetch(s, s->pc) : NULL;
+    if(d==NULL){
+        decode_opcode(&fetched, mem_read(s, 4, s->pc, 0));
+        if(s->dbg.num_breaks!=0) debug_mark(s, &fetched, s->pc);
+        d = &fetched;
+    }
+    opcode = d->opcode;
+    op = d->op;
+    rs = d->rs;
+    rt = d->rt;
+    rd = d->rd;
+    re = d->re;
+    func = d->func;
+    imm = d->imm;
     ptr = (short)imm + r[rs];
     r[0] = 0;
-    target_offset16 = opcode & 0xffff;
-    if(target_offset16 & 0x8000){
-        target_offset16 |= 0xffff0000;
-    }
-    target_long = (opcode & 0x03ffffff)<<2;
-    target_long |= (s->pc & 0xf0000000);
 
     /* Trigger log if we fetch from trigger address */
     if(s->pc == s->t.log_trigger_address){
@@ -561,6 +1223,13 @@ void cycle(t_state *s, int show_mode){
 
     /* if we are priting state to console, do it now */
     if(show_mode){
+        target_offset16 = opcode & 0xffff;
+        if(target_offset16 & 0x8000){
+            target_offset16 |= 0xffff0000;
+        }
+        target_long = (opcode & 0x03ffffff)<<2;
+        target_long |= (s->pc & 0xf0000000);
+
         printf("%8.8x %8.8x ", s->pc, opcode);
         if(op == 0){
             printf("  %-6s ", &(special_string[func][1]));
@@ -655,6 +1324,23 @@ void cycle(t_state *s, int show_mode){
         return;
     }
 
+    /* Stop before an instruction with a breakpoint (see debug.c) */
+    if((d->flags & DEC_BREAK) && debug_break_hit(s)){
+        return;
+    }
+
+    /* Run the events due before this instruction */
+    if(s->insn_count >= s->sched.next){
+        sched_run(s);
+    }
+    s->insn_count++;
+    if(s->prof!=NULL){
+        profile_insns(s->prof, s->pc, 1, profile_node(s->prof));
+    }
+#ifdef ENABLE_CACHE
+    cache_fetch(s, s->pc);
+#endif
+
     /* epc will point to the victim instruction */
     epc = s->pc;
 
@@ -662,6 +1348,7 @@ void cycle(t_state *s, int show_mode){
        end of the program and quit. */
     if(s->pc == s->pc_next+4){
         printf("\n\nEndless loop at 0x%08x\n\n", s->pc-4);
+        s->dbg.stop = STOP_EXIT;
         s->wakeup = 1;
     }
     s->op_addr = s->pc;
@@ -671,283 +1358,32 @@ void cycle(t_state *s, int show_mode){
     // Instructions in the delay slot of ERET will NOT be executed.
     if (s->eret_delay_slot) {
         s->eret_delay_slot = 0;
+        if(s->timing.enabled) timing_bubble(&(s->timing), STALL_ERET);
         return;
     }
 
     if(s->skip){
         s->skip = 0;
+        if(s->timing.enabled) timing_bubble(&(s->timing), STALL_TRAP);
         return;
     }
     rSave = r[rt];
     //printf("PC = %08x\n", s->op_addr);
-    switch(op){
-    case 0x00:/*SPECIAL*/
-        switch(func){
-        case 0x00:/*SLL*/  r[rd]=r[rt]<<re;          break;
-        case 0x02:/*SRL*/  r[rd]=u[rt]>>re;          break;
-        case 0x03:/*SRA*/  r[rd]=r[rt]>>re;          break;
-        case 0x04:/*SLLV*/ r[rd]=r[rt]<<r[rs];       break;
-        case 0x06:/*SRLV*/ r[rd]=u[rt]>>r[rs];       break;
-        case 0x07:/*SRAV*/ r[rd]=r[rt]>>r[rs];       break;
-        case 0x08:/*JR*/   if(rs==31) log_ret(r[rs],epc);
-                           delay_slot=1;
-                           s->pc_next=r[rs];         break;
-        case 0x09:/*JALR*/ delay_slot=1;
-                           r[rd]=s->pc_next;
-                           s->pc_next=r[rs];
-                           log_call(s->pc_next, epc); break;
-        case 0x0a:/*MOVZ*/  if(cmd_line_args.emulate_some_mips32){   /*IV*/
-                                if(!r[rt]) r[rd]=r[rs];
-                            };
-                            break;
-        case 0x0b:/*MOVN*/  if(cmd_line_args.emulate_some_mips32){    /*IV*/
-                                if(r[rt]) r[rd]=r[rs];
-                            };
-                            break;
-        case 0x0c:/*SYSCALL*/ s->trap_cause = 8;
-                              //FIXME enable when running uClinux
-                              //printf("SYSCALL (%08x)\n", s->pc);
-
-                              break;
-        case 0x0d:/*BREAK*/   s->trap_cause = 9;
-                              //FIXME enable when running uClinux
-                              //printf("BREAK (%08x)\n", s->pc);
-                              break;
-        case 0x0f:/*SYNC*/ s->wakeup=1;              break;
-        case 0x10:/*MFHI*/ r[rd]=s->hi;              break;
-        case 0x11:/*FTHI*/ s->hi=r[rs];              break;
-        case 0x12:/*MFLO*/ r[rd]=s->lo;              break;
-        case 0x13:/*MTLO*/ s->lo=r[rs];              break;
-        case 0x18:/*MULT*/ mult_big_signed(r[rs],r[rt],&s->hi,&s->lo,0); break;
-        case 0x19:/*MULTU*/ mult_big(r[rs],r[rt],&s->hi,&s->lo,0); break;
-        case 0x1a:/*DIV*/  s->lo=r[rs]/r[rt]; s->hi=signed_rem(r[rs],r[rt]); break;
-        case 0x1b:/*DIVU*/ s->lo=u[rs]/u[rt]; s->hi=u[rs]%u[rt]; break;
-        case 0x20:/*ADD*/  r[rd]=r[rs]+r[rt];        break;
-        case 0x21:/*ADDU*/ r[rd]=r[rs]+r[rt];        break;
-        case 0x22:/*SUB*/  r[rd]=r[rs]-r[rt];        break;
-        case 0x23:/*SUBU*/ r[rd]=r[rs]-r[rt];        break;
-        case 0x24:/*AND*/  r[rd]=r[rs]&r[rt];        break;
-        case 0x25:/*OR*/   r[rd]=r[rs]|r[rt];        break;
-        case 0x26:/*XOR*/  r[rd]=r[rs]^r[rt];        break;
-        case 0x27:/*NOR*/  r[rd]=~(r[rs]|r[rt]);     break;
-        case 0x2a:/*SLT*/  r[rd]=r[rs]<r[rt];        break;
-        case 0x2b:/*SLTU*/ r[rd]=u[rs]<u[rt];        break;
-        case 0x2d:/*DADDU*/r[rd]=r[rs]+u[rt];        break;
-        case 0x31:/*TGEU*/ break;
-        case 0x32:/*TLT*/  break;
-        case 0x33:/*TLTU*/ break;
-        case 0x34:/*TEQ*/  break;
-        case 0x36:/*TNE*/  break;
-        default:
-            reserved_opcode(epc, opcode, s);
-        }
-        break;
-    case 0x01:/*REGIMM*/
-        switch(rt){
-            case 0x10:/*BLTZAL*/ r[31]=s->pc_next; link=1;
-            case 0x00:/*BLTZ*/   branch=r[rs]<0;    break;
-            case 0x11:/*BGEZAL*/ r[31]=s->pc_next; link=1;
-            case 0x01:/*BGEZ*/   branch=r[rs]>=0;   break;
-            case 0x12:/*BLTZALL*/r[31]=s->pc_next; link=1;
-            case 0x02:/*BLTZL*/  lbranch=r[rs]<0;   break;
-            case 0x13:/*BGEZALL*/r[31]=s->pc_next; link=1;
-            case 0x03:/*BGEZL*/  lbranch=r[rs]>=0;  break;
-            default: printf("ERROR1\n"); s->wakeup=1;
-        }
-        break;
-    case 0x03:/*JAL*/    r[31]=s->pc_next; log_call(((s->pc&0xf0000000)|target), epc);
-    case 0x02:/*J*/      delay_slot=1;
-                       s->pc_next=(s->pc&0xf0000000)|target; break;
-    case 0x04:/*BEQ*/    branch=r[rs]==r[rt];     break;
-    case 0x05:/*BNE*/    branch=r[rs]!=r[rt];     break;
-    case 0x06:/*BLEZ*/   branch=r[rs]<=0;         break;
-    case 0x07:/*BGTZ*/   branch=r[rs]>0;          break;
-    case 0x08:/*ADDI*/   r[rt]=r[rs]+(short)imm;  break;
-    case 0x09:/*ADDIU*/  u[rt]=u[rs]+(short)imm;  break;
-    case 0x0a:/*SLTI*/   r[rt]=r[rs]<(int)(short)imm; break;
-    case 0x0b:/*SLTIU*/  u[rt]=u[rs]<(imm & 0x0000ffff); break;
-    case 0x0c:/*ANDI*/   r[rt]=r[rs]&imm;         break;
-    case 0x0d:/*ORI*/    r[rt]=r[rs]|imm;         break;
-    case 0x0e:/*XORI*/   r[rt]=r[rs]^imm;         break;
-    case 0x0f:/*LUI*/    r[rt]=(imm<<16);         break;
-    case 0x10:/*COP0*/
-        if(KERNEL_MODE){
-            //fprintf(s->t.log, "STATUS = %08x\n", s->cp0_status);
-            if(opcode==0x42000010){  // rfe -- not MIPS32 really.
-                unimplemented(s,"RFE");
-            }
-            if(opcode==0x42000018){  // eret
-                s->skip = 0;
-                s->eret_delay_slot = 1;
-                s->pc_next = s->epc;
-                //printf("ERET to %08xh, STATUS = %08x\n", s->pc_next, s->cp0_status);
-                /* Now, if ERL is set... */
-                if (s->cp0_status & SR_ERL) {
-                    s->cp0_status &= (~SR_ERL); /* ...clear ERL... */
-                }
-                else {
-                    s->cp0_status &= (~SR_EXL); /* ...otherwise clear EXL */
-                }
-                //printf("ERET :: STATUS = %08x\n", s->cp0_status);
-            }
-            else if((opcode & (1<<23)) == 0){  //move from CP0 (mfc0)
-                switch(rd){
-                    case 8: r[rt] = 0; break; // FIXME BadVAddr
-                    case 9: r[rt] = 0; break; // FIXME Count
-                    case 11: r[rt] = 0; break; // FIXME Compare
-                    case 12: r[rt]=(s->cp0_status & STATUS_MASK); break;
-                    case 13: r[rt]=(s->cp0_cause & CAUSE_MASK); break;
-                    case 14: r[rt]=s->epc; break;
-                    case 15: r[rt]=CPU_ID; break;
-                    case 16:
-                            if ((func&0x07)==0) {
-                                r[rt]=s->cp0_config0;
-                            } else {
-                                r[rt] = 0;
-                            }; break;
-                    case 30: r[rt] = s->epc;
-                    default:
-                        /* FIXME log access to unimplemented CP0 register */
-                        printf("mfc0 [%02d]->%02d @ [0x%08x]\n", rd, rt,s->pc);
-                        break;
-                }
-            }
-            else{                         //move to CP0 (mtc0)
-                switch (rd){
-                    case 11: s->cp0_compare = r[rt]; break;
-                    case 12: s->sr_load_pending_value = r[rt];
-                             s->sr_load_pending = true;
-                             fprintf(s->t.log, "(%08x) [01]=%08x\n", 0x0 /* log_pc */, r[rt] & STATUS_MASK);
-                             break;
-                    case 13: s->cp0_cause = r[rt] & CAUSE_MASK; break;
-                    case 14: s->epc = r[rt]; 
-                             fprintf(s->t.log, "(%08x) [03]=%08x\n", 0x0 /* log_pc */, r[rt]);
-                             break;
-                    case 16:
-                        if ((func&0x07)==0) {
-                            s->cp0_config0 = r[rt] & 0x00030000;
-                        }
-                        else {
-                            printf("mtc0 [%2d.%2d]=0x%08x @ [0x%08x] IGNORED\n",
-                                   rd, rs, r[rt], epc);
-                        }; break;
-                    default:
-                        /* Move to unimplemented/RO register: display warning */
-                        /* FIXME should log ignored move */
-                        printf("mtc0 [%2d]=0x%08x @ [0x%08x] IGNORED\n",
-                                rd, r[rt], epc);
-                }
-            }
-        }
-        else{
-            /* tried to execute mtc* or mfc* in user mode: trap */
-            s->trap_cause = 11; /* unavailable coprocessor */
-        }
-        break;
-    case 0x11:/*COP1*/ unimplemented(s,"COP1");  break;
-    case 0x12:/*COP2*/ cop2(s,opcode); break;
-    case 0x13:/*COP3*/ unimplemented(s,"COP3");  break;
-    case 0x14:/*    */  lbranch=r[rs]==r[rt];    break;
-    case 0x15:/*BNEL*/  lbranch=r[rs]!=r[rt];    break;
-    case 0x16:/*BLEZL*/ lbranch=r[rs]<=0;        break;
-    case 0x17:/*BGTZL*/ lbranch=r[rs]>0;         break;
-    case 0x1c:/*SPECIAL2*/
-        /* MIPS32r1 opcodes implemented, r2 unimplemented. */
-        switch(func){
-            case 0x00: /* MADD */ mult_big_signed(r[rs],r[rt],&s->hi,&s->lo,1); break;
-            case 0x01: /* MADDU */ mult_big(r[rs],r[rt],&s->hi,&s->lo,1); break;
-            case 0x20: /* CLZ */ r[rt] = count_leading(0, r[rs]); break;
-            case 0x21: /* CLO */ r[rt] = count_leading(1, r[rs]); break;
-            case 0x02: /* MUL */ r[rd] = mult_gpr(r[rs], r[rt]); break;
-            default:
-                reserved_opcode(epc, opcode, s);
-                unimplemented(s, "SPECIAL2");
-        }
-        break;
-    case 0x1f: /* SPECIAL3 */
-        if(cmd_line_args.emulate_some_mips32){
-            switch(func){
-                case 0x00: /* EXT */ r[rt] = ext_bitfield(r[rs], opcode); break;
-                case 0x04: /* INS */ r[rt] = ins_bitfield(r[rt], r[rs], opcode); break;
-                default:
-                    reserved_opcode(epc, opcode, s);
-                    unimplemented(s, "SPECIAL3");
-            }
-        }
-        else{
-            reserved_opcode(epc, opcode, s);
-        }
-        break;
-    case 0x20:/*LB*/    //r[rt]=(signed char)mem_read(s,1,ptr,1);  break;
-                        start_load(s, ptr, rt,(signed char)mem_read(s,1,ptr,1), 1);
-                        break;
-
-    case 0x21:/*LH*/    //r[rt]=(signed short)mem_read(s,2,ptr,1); break;
-                        start_load(s, ptr, rt, (signed short)mem_read(s,2,ptr,1), 2);
-                        break;
-    case 0x22:/*LWL*/   mem_lwl(s, ptr, rt, 1);
-                        //printf("LWL\n");
-                        break;
-    case 0x23:/*LW*/    //r[rt]=mem_read(s,4,ptr,1);   break;
-                        start_load(s, ptr, rt, mem_read(s,4,ptr,1), 4);
-                        break;
-    case 0x24:/*LBU*/   //r[rt]=(unsigned char)mem_read(s,1,ptr,1); break;
-                        start_load(s, ptr, rt, (unsigned char)mem_read(s,1,ptr,1), 1);
-                        break;
-    case 0x25:/*LHU*/   //r[rt]= (unsigned short)mem_read(s,2,ptr,1);
-                        start_load(s, ptr, rt, (unsigned short)mem_read(s,2,ptr,1), 2);
-                        break;
-    case 0x26:/*LWR*/   mem_lwr(s, ptr, rt, 1);
-                        //printf("LWR\n");
-                        break;
-    case 0x28:/*SB*/    mem_write(s,1,ptr,r[rt],1);  break;
-    case 0x29:/*SH*/    mem_write(s,2,ptr,r[rt],1);  break;
-    case 0x2a:/*SWL*/   mem_swl(s, ptr, r[rt], 1);
-                        //printf("SWL\n");
-                        break;
-    case 0x2b:/*SW*/    mem_write(s,4,ptr,r[rt],1);  break;
-    case 0x2e:/*SWR*/   mem_swr(s, ptr, r[rt], 1);
-                        //printf("SWR\n");
-                        break;
-    case 0x2f:/*CACHE*/ /* Since we don´t simulate the caches, the cache
-                        instruction will be ignored. It is implemented as
-                        a NOP. */
-                        /* FIXME check operation code. */
-                        // unimplemented(s,"CACHE");
-                        break;
-    case 0x30:/*LL*/    //unimplemented(s,"LL");
-                        start_load(s, ptr, rt, mem_read(s,4,ptr,1), 4);
-                        break;
-//      case 0x31:/*LWC1*/ break;
-    case 0x32:/*LWC2*/  aux = start_load(s, ptr, -1, mem_read(s,4,ptr,1), 4);
-                        cop2_set_reg(s, rt, 0, 0, aux);
-                        break;
-//      case 0x33:/*LWC3*/ break;
-//      case 0x35:/*LDC1*/ break;
-//      case 0x36:/*LDC2*/ break;
-//      case 0x37:/*LDC3*/ break;
-//      case 0x38:/*SC*/     *(int*)ptr=r[rt]; r[rt]=1; break;
-    case 0x38:/*SC*/    mem_write(s,4,ptr,r[rt],1); r[rt]=1; break;
-//      case 0x39:/*SWC1*/ break;
-    case 0x3a:/*SWC2*/  aux = cop2_get_reg(s, rt, 0, 0);
-                        mem_write(s,4,ptr,aux,1);
-                        break;
-//      case 0x3b:/*SWC3*/ break;
-//      case 0x3d:/*SDC1*/ break;
-//      case 0x3e:/*SDC2*/ break;
-//      case 0x3f:/*SDC3*/ break;
-    default:  /* unimplemented opcode */
-        reserved_opcode(epc, opcode, s);
-        unimplemented(s, "???");
+    flags = d->handler(s, d, ptr);
+    if(s->timing.enabled) timing_insn(&(s->timing), d, flags);
+#ifdef ENABLE_CACHE
+    if(d->flags & (DEC_LOAD | DEC_STORE)){
+        cache_data(s, ptr, d->flags & DEC_STORE);
     }
+#endif
 
     /* */
-    if((branch || lbranch == 1) && link){
-        log_call(s->pc_next + imm_shift, epc);
+    if((flags & EXEC_BRANCH) && (flags & EXEC_LINK)){
+        log_call(s, s->pc_next + d->imm_shift, epc);
     }
 
     /* adjust next PC if this was a a jump instruction */
-    s->pc_next += (branch || lbranch == 1) ? imm_shift : 0;
+    s->pc_next += (flags & EXEC_BRANCH) ? d->imm_shift : 0;
     s->pc_next &= ~3;
     //s->skip = (lbranch == 0); // FIXME experiment
 
@@ -972,8 +1408,103 @@ void cycle(t_state *s, int show_mode){
 
     /* if this instruction was any kind of branch that actually jumped, then
        the next instruction will be in a delay slot. Remember it. */
-    delay_slot = ((lbranch==1) || branch || delay_slot);
-    s->delay_slot = delay_slot;
+    s->delay_slot = (flags & (EXEC_BRANCH | EXEC_JUMP)) != 0;
+}
+
+/**
+    Run the basic block starting at the current PC, if there is one.
+
+    Each instruction is executed exactly as cycle() would execute it, minus
+    the fetch and decode; the block is abandoned as soon as anything breaks
+    the straight flow of instructions (traps, end of simulation, code being
+    overwritten) or an event of the event queue is due. Blocks end before
+    instructions with breakpoints, which are left to cycle().
+
+    @return Number of instructions executed. 0 means the caller has to
+            execute the next instruction with cycle().
+*/
+uint32_t run_block(t_state *s){
+    t_basic_block *bb;
+    const t_decoded *d;
+    t_prof_node *node;
+    uint32_t i, ptr, epc, rSave, flags;
+
+    if(!s->pd.basic_blocks || s->skip || s->eret_delay_slot ||
+       s->pc_next != s->pc + 4){
+        return 0;
+    }
+    bb = predecode_block(s, s->pc);
+    if(bb==NULL || bb->count==0){
+        return 0;
+    }
+    node = (s->prof!=NULL)? profile_node(s->prof) : NULL;
+
+    /* Leave the rest of the block to cycle() once an event is due */
+    for(i=0;i<bb->count && s->insn_count < s->sched.next;){
+        d = &(bb->insn[i++]);
+
+        s->insn_count++;
+        s->trap_cause = -1;
+        s->cause_ip = 0;
+
+        ptr = (short)d->imm + s->r[d->rs];
+        s->r[0] = 0;
+
+        if(s->pc == s->t.log_trigger_address){
+            trigger_log(s);
+        }
+
+        epc = s->pc;
+#ifdef ENABLE_CACHE
+        cache_fetch(s, epc);
+#endif
+        if(s->pc == s->pc_next+4){
+            printf("\n\nEndless loop at 0x%08x\n\n", s->pc-4);
+            s->dbg.stop = STOP_EXIT;
+            s->wakeup = 1;
+        }
+        s->op_addr = s->pc;
+        s->pc = s->pc_next;
+        s->pc_next = s->pc_next + 4;
+
+        rSave = s->r[d->rt];
+        flags = d->handler(s, d, ptr);
+        if(s->timing.enabled) timing_insn(&(s->timing), d, flags);
+#ifdef ENABLE_CACHE
+        if(d->flags & (DEC_LOAD | DEC_STORE)){
+            cache_data(s, ptr, d->flags & DEC_STORE);
+        }
+#endif
+
+        if((flags & EXEC_BRANCH) && (flags & EXEC_LINK)){
+            log_call(s, s->pc_next + d->imm_shift, epc);
+        }
+        s->pc_next += (flags & EXEC_BRANCH) ? d->imm_shift : 0;
+        s->pc_next &= ~3;
+
+        if(s->failed_assertions!=0){
+            log_failed_assertions(s);
+            s->failed_assertions=0;
+        }
+
+        /* process_traps does nothing unless one of these is active */
+        if(s->trap_cause>=0 || s->t.irq_pending || s->timer_irq){
+            process_traps(s, epc, rSave, d->rt);
+        }
+
+        s->wakeup |= log_cycle(s);
+
+        s->delay_slot = (flags & (EXEC_BRANCH | EXEC_JUMP)) != 0;
+
+        /* Leave the block if the flow of instructions has been broken */
+        if(s->wakeup || s->skip || bb->gen != s->pd.gen){
+            break;
+        }
+    }
+    if(s->prof!=NULL){
+        profile_insns(s->prof, bb->start, i, node);
+    }
+    return i;
 }
 
 /** Print opcode fields for easier debugging */
@@ -996,7 +1527,7 @@ void print_opcode_fields(uint32_t opcode){
 
 /** Deal with reserved, unimplemented opcodes. Updates s->trap_cause. */
 void reserved_opcode(uint32_t pc, uint32_t opcode, t_state* s){
-    if(cmd_line_args.trap_on_reserved){
+    if(s->args.trap_on_reserved){
         s->trap_cause = 10; /* reserved instruction */
     }
     else{
@@ -1133,16 +1664,15 @@ void cop2(t_state *s, uint32_t opcode) {
 
 /** Logs last cycle's activity (changes in state and/or loads/stores) */
 uint32_t log_cycle(t_state *s){
-    static unsigned int last_pc = 0;
     int i;
     uint32_t log_pc;
 
     /* store PC in trace buffer only if there was a jump */
-    if(s->pc != (last_pc+4)){
+    if(s->pc != (s->t.last_pc+4)){
         s->t.buf[s->t.next] = s->pc;
         s->t.next = (s->t.next + 1) % TRACE_BUFFER_SIZE;
     }
-    last_pc = s->pc;
+    s->t.last_pc = s->pc;
     log_pc = s->op_addr;
 
 
@@ -1152,7 +1682,7 @@ uint32_t log_cycle(t_state *s){
         /* skip register zero which does not change */
         for(i=1;i<32;i++){
             if(s->t.pr[i] != s->r[i]){
-                fprintf(s->t.log, "(%08x) [%02x]=%08x\n", log_pc, i, s->r[i]);
+                log_entry(s, LOG_REG, log_pc, i, 0, s->r[i]);
             }
             s->t.pr[i] = s->r[i];
         }
@@ -1204,26 +1734,140 @@ uint32_t log_cycle(t_state *s){
     return 0;
 }
 
+/**
+    Open the execution log file.
+
+    @arg flags Combination of LOG_OPEN_* flags.
+    @return 0 if the file could not be opened.
+*/
+int log_open(t_state *s, const char *name, uint32_t flags){
+    t_log_header h;
+    char *cmd;
+
+    s->t.log_binary = (flags & LOG_OPEN_BINARY) != 0;
+    s->t.log_pipe = (flags & LOG_OPEN_COMPRESS) != 0;
+    s->t.writer = NULL;
+    if(s->t.log_pipe){
+        /* Let gzip write the file, from its own process */
+        if(strchr(name, '\'')!=NULL) return 0;
+        cmd = malloc(strlen(name) + 32);
+        if(cmd==NULL) return 0;
+        sprintf(cmd, "gzip -c > '%s'", name);
+        s->t.log = popen(cmd, "w");
+        free(cmd);
+    }
+    else{
+        s->t.log = fopen(name, s->t.log_binary? "wb" : "w");
+    }
+    if(s->t.log==NULL){
+        return 0;
+    }
+    setvbuf(s->t.log, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
+    if(s->t.log_binary){
+        log_init_header(&h);
+        fwrite(&h, sizeof(h), 1, s->t.log);
+    }
+    if(flags & LOG_OPEN_ASYNC){
+        s->t.writer = log_writer_start(s->t.log, s->t.log_binary);
+        if(s->t.writer==NULL){
+            fprintf(stderr, "Could not start log writer thread, "
+                    "writing log synchronously\n");
+        }
+    }
+    return 1;
+}
+
+/**
+    Send the execution log records to a function instead of a file.
+    The log is open until log_close, as if it were a file.
+*/
+void log_open_sink(t_state *s, t_log_sink sink, void *arg){
+    s->t.log_binary = true;
+    s->t.log_pipe = false;
+    s->t.writer = NULL;
+    s->t.sink = sink;
+    s->t.sink_arg = arg;
+}
+
+/** Make sure all the log entries so far are in the log file. */
+void log_flush(t_state *s){
+    if(s->t.writer!=NULL){
+        log_writer_flush(s->t.writer);
+    }
+    else if(s->t.log!=NULL){
+        fflush(s->t.log);
+    }
+}
+
+/** Close the execution log file, if open, after writing all entries. */
+void log_close(t_state *s){
+    if(s->t.writer!=NULL){
+        log_writer_stop(s->t.writer);
+        s->t.writer = NULL;
+    }
+    if(s->t.log!=NULL){
+        if(s->t.log_pipe){
+            pclose(s->t.log);
+        }
+        else{
+            fclose(s->t.log);
+        }
+        s->t.log = NULL;
+    }
+    s->t.sink = NULL;
+}
+
+/** Write an entry to the open execution log, as text or binary record. */
+void log_entry(t_state *s, t_log_kind kind, uint32_t pc,
+               uint32_t address, uint32_t size, uint32_t value){
+    t_log_record r;
+    char line[EXEC_LOG_LINE_MAX];
+    uint32_t len;
+
+    r.kind = kind;
+    r.size = size;
+    r.reserved = 0;
+    r.pc = pc;
+    r.address = address;
+    r.value = value;
+    if(s->t.sink!=NULL){
+        s->t.sink(s->t.sink_arg, &r);
+    }
+    else if(s->t.writer!=NULL){
+        log_writer_put(s->t.writer, &r);
+    }
+    else if(s->t.log_binary){
+        fwrite(&r, sizeof(r), 1, s->t.log);
+    }
+    else{
+        len = log_format_record(line, &r);
+        fwrite(line, 1, len, s->t.log);
+    }
+}
+
 /** Logs a message for each failed assertion, each in a line */
 void log_failed_assertions(t_state *s){
     unsigned bitmap = s->failed_assertions;
     int i = 0;
 
     /* This loop will crash the program if the message table is too short...*/
-    if(s->t.log != NULL){
+    if(log_is_open(s)){
         for(i=0;i<32;i++){
             if(bitmap & 0x1){
-                fprintf(s->t.log, "ASSERTION FAILED: [%08x] %s\n",
-                        s->faulty_address,
-                        assertion_messages[i]);
+                log_entry(s, LOG_ASSERTION, 0, s->faulty_address, i, 0);
             }
             bitmap = bitmap >> 1;
         }
     }
 }
 
+/** Return !=0 if there is an execution log file or sink, triggered or not. */
+uint32_t log_is_open(t_state *s){
+    return (s->t.log != NULL) || (s->t.sink != NULL);
+}
+
 uint32_t log_enabled(t_state *s){
-    return ((s->t.log != NULL) && (s->t.log_triggered!=0));
+    return (log_is_open(s) && (s->t.log_triggered!=0));
 }
 
 void trigger_log(t_state *s){
@@ -1242,12 +1886,23 @@ void trigger_log(t_state *s){
 
 
 void free_cpu(t_state *s){
-    int i;
+    uint32_t i;
 
-    for(i=0;i<NUM_MEM_BLOCKS;i++){
-        free(s->blocks[i].mem);
-        s->blocks[i].mem = NULL;
+    predecode_free(s);
+    mem_map_free(s);
+    devices_free(s);
+    debug_free(s);
+#ifdef ENABLE_CACHE
+    cache_free(&(s->icache));
+    cache_free(&(s->dcache));
+#endif
+    for(i=0;i<s->num_blocks;i++){
+        free_block_memory(&(s->blocks[i]));
     }
+    free(s->blocks);
+    s->blocks = NULL;
+    s->num_blocks = 0;
+    memmap_free(&(s->args.mem_map));
 }
 
 void reset_cpu(t_state *s){
@@ -1256,14 +1911,20 @@ void reset_cpu(t_state *s){
     s->cp0_config0 = CP0_CONFIG0;
     s->sr_load_pending = false;
 
-    s->pc = cmd_line_args.start_addr; /* reset start vector or cmd line address */
+    s->pc = s->args.start_addr; /* reset start vector or cmd line address */
     s->delay_slot = 0;
     s->eret_delay_slot = 0;
     s->failed_assertions = 0; /* no failed assertions pending */
     s->cp0_status = SR_BEV | SR_ERL;
-    s->instruction_ctr = 0;
-    s->inst_ctr_prescaler = 0;
-    s->t.irq_trigger_countdown = -1;
+    s->timer_base = s->insn_count;
+    s->count_base = s->insn_count;
+    s->timer_irq = false;
+    sched_init(&(s->sched));
+    /* Devices are shared by all cores and tick on the boot core */
+    if(s->core_id==0){
+        devices_reset(s);
+    }
+    s->t.irq_pending = false;
     s->t.irq_trigger_inputs = 0;
     s->t.irq_current_inputs = 0;
     /* init trace struct to prevent spurious logs */
@@ -1273,36 +1934,64 @@ void reset_cpu(t_state *s){
 /* FIXME redundant function, merge with reserved_opcode */
 void unimplemented(t_state *s, const char *txt){
     printf("[%08x] UNIMPLEMENTED: %s\n", s->epc, txt);
-    if(cmd_line_args.stop_on_unimplemented) exit(1);
+    if(s->args.stop_on_unimplemented) exit(1);
 }
 
+/**
+    Set up the CPU model and allocate its memory.
+    The CPU model takes over the memory map of args, which free_cpu frees.
+
+    @return 0 if out of memory or a device could not be loaded.
+*/
 int init_cpu(t_state *s, t_args *args){
-    int i, j;
-    uint32_t k = args->memory_map;
+    uint32_t i;
 
     memset(s, 0, sizeof(t_state));
+    s->args = *args;
     s->big_endian = 1;
 
     s->do_unaligned = args->do_unaligned;
-    s->breakpoint = args->breakpoint;
+    predecode_init(s, args->predecode, args->basic_blocks);
+    timing_init(&(s->timing), args->timing, args->code_wait_states,
+                args->data_wait_states);
+#ifdef ENABLE_CACHE
+    if(!cache_init(&(s->icache), &(args->icache)) ||
+       !cache_init(&(s->dcache), &(args->dcache))){
+        cache_free(&(s->icache));
+        memmap_free(&(s->args.mem_map));
+        return 0;
+    }
+#endif
 
     /* Initialize memory map */
-    for(i=0;i<NUM_MEM_BLOCKS;i++){
-        s->blocks[i].start =        memory_maps[k].blocks[i].start;
-        s->blocks[i].size =         memory_maps[k].blocks[i].size;
-        s->blocks[i].area_name =    memory_maps[k].blocks[i].area_name;
-        s->blocks[i].mask =         memory_maps[k].blocks[i].mask;
-        s->blocks[i].flags =        memory_maps[k].blocks[i].flags;
-
-        s->blocks[i].mem = (unsigned char*)malloc(s->blocks[i].size);
-
-        if(s->blocks[i].mem == NULL){
-            for(j=0;j<i;j++){
-                free(s->blocks[j].mem);
-            }
+    s->blocks = calloc(args->mem_map.num_blocks, sizeof(t_block));
+    if(s->blocks==NULL){
+        free_cpu(s);
+        return 0;
+    }
+    for(i=0;i<args->mem_map.num_blocks;i++){
+        s->blocks[i] = args->mem_map.blocks[i];
+        if(!alloc_block_memory(&(s->blocks[i]))){
+            free_cpu(s);
             return 0;
         }
-        memset(s->blocks[i].mem, 0, s->blocks[i].size);
+        s->num_blocks = i + 1;
+    }
+    if(!tb_devices_add(s) || !mem_map_init(s)){
+        free_cpu(s);
+        return 0;
+    }
+    for(i=0;i<args->num_device_specs;i++){
+        if(!device_load(s, args->device_specs[i])){
+            free_cpu(s);
+            return 0;
+        }
+    }
+    if(args->breakpoint!=0xffffffff && !debug_break_add(s, args->breakpoint)){
+        fprintf(stderr,"Invalid breakpoint address 0x%08x\n",
+                args->breakpoint);
+        free_cpu(s);
+        return 0;
     }
-    return NUM_MEM_BLOCKS;
+    return s->num_blocks;
 }
@@ -18,24 +18,44 @@
 #include <assert.h>
 #include <stdbool.h>
 
+#include "exec_log.h"
+
 /*---- Program configuration macros ------------------------------------------*/
 
 /** Length of debugging jump target queue */
 #define TRACE_BUFFER_SIZE (32)
 
-/** Function map table -- number of function entries */
-#define MAP_MAX_FUNCTIONS  (400)
-/** Function map table -- size of name field */
-#define MAP_MAX_NAME_LEN   (80)
 /** Set to !=0 to disable file logging (much faster simulation) */
 /* alternately you can just set an unreachable log trigger address */
 #define FILE_LOGGING_DISABLED (0)
-/** Define to enable cache simulation (unimplemented) */
+/** Define to enable cache simulation (tags only, see --icache/--dcache) */
 //#define ENABLE_CACHE
+/** Size in bytes of the stdio buffer of the execution log file */
+#define LOG_FILE_BUFFER_SIZE (1024*1024)
 /** Set to !=0 to display a fancier listing of register values */
 #define FANCY_REGISTER_DISPLAY (1)
-/** Number of memory blocks in memory map */
-#define NUM_MEM_BLOCKS      (5)
+/** Max number of events pending in the event queue */
+#define SCHED_MAX_EVENTS    (16)
+/** Instructions between polls of the UART source while the RX FIFO is empty */
+#define UART_POLL_INSNS     (1000)
+/** Max number of cores of a multi-core simulation */
+#define SMP_MAX_CORES       (8)
+/** Default number of instructions a core runs per turn */
+#define SMP_DEFAULT_QUANTUM (1000)
+/** Code invalidations a core can have pending from the other cores */
+#define SMP_SNOOP_QUEUE_SIZE (64)
+/** Max number of device shared objects given with --device */
+#define MAX_DEVICE_PLUGINS  (16)
+/** Instructions between polls of the GDB connection for interrupts */
+#define GDB_POLL_INSNS      (100000)
+/** log2 of the size in bytes of a page of the memory page table */
+#define MEM_PAGE_SHIFT      (12)
+#define MEM_PAGE_SIZE       (1 << MEM_PAGE_SHIFT)
+/** Number of pages in the 32-bit address space */
+#define MEM_NUM_PAGES       (1 << (32 - MEM_PAGE_SHIFT))
+/** Size in bytes of a page of the predecoded instruction cache; same as the
+    memory pages since the cache pages are located through the page table */
+#define DECODE_PAGE_SIZE    (MEM_PAGE_SIZE)
 
 /*---- HW constant macros ----------------------------------------------------*/
 
@@ -45,10 +65,16 @@
 #define CP0_CONFIG0 (0x80002400)
 /** Reset value of CP0.Config1 register */
 #define CP0_CONFIG1 (0x80984c00)
+/** Reset value of CP0.EBase register, to be ORed with the core number */
+#define CP0_EBASE (0x80000000)
 /** Number of hardware interrupt inputs (irq0 is NMI) */
 #define NUM_HW_IRQS (8)
 /** Default value for timer prescaler */
 #define DEFAULT_TIMER_PRESCALER (50)
+/** Instructions from a write to TB_HW_IRQ until the CPU samples the inputs */
+#define HW_IRQ_DELAY (3)
+/** Cause.IP bit of the COP0 timer interrupt (IP7) */
+#define CAUSE_IP_TIMER (1 << 15)
 
 #define VECTOR_RESET (0xbfc00000)
 #define VECTOR_TRAP  (0xbfc00180)
@@ -75,6 +101,8 @@
 #define TB_DEBUG_1        (0xffff8024)
 #define TB_DEBUG_2        (0xffff8028)
 #define TB_DEBUG_3        (0xffff802c)
+/** Writes print the value and the instruction count (see sw/bench) */
+#define TB_MARK           (0xffff8030)
 
 
 /*---- Utility macros --------------------------------------------------------*/
@@ -90,13 +118,65 @@
 #define MEM_READONLY        (1<<0)
 /** Block is pre-loaded with test data pattern. */
 #define MEM_TEST            (1<<1)
+/** Block is accessed through the caches, if they are simulated. */
+#define MEM_CACHED          (1<<2)
+
+/* Flags used in the page table, along with the block flags. */
+/** Page contains simulated I/O registers. */
+#define PAGE_MMIO           (1<<7)
+/** Page contains some watchpoint (see debug.c). */
+#define PAGE_WATCH          (1<<6)
+/** Page is mapped to a block; the page table is all zeros, unmapped, until
+    blocks are mapped, so its untouched host pages cost nothing. */
+#define PAGE_MAPPED         (1<<5)
+
+
+/* Byte swapping, used to access simulated memory from the host. */
+#ifdef __GNUC__
+#define bswap32(A) __builtin_bswap32(A)
+#define bswap16(A) __builtin_bswap16(A)
+#else
+#define bswap32(A) ( ((A)>>24) | (((A)&0xff0000)>>8) | (((A)&0xff00)<<8) | ((A)<<24) )
+#define bswap16(A) ( ((A)>>8) | (((A)&0xff)<<8) )
+#endif
 
+/* Host byte order; assume little endian if the compiler won't tell. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define HOST_BIG_ENDIAN (1)
+#else
+#define HOST_BIG_ENDIAN (0)
+#endif
 
-/* Endianess conversion macros. */
-#define ntohs(A) ( ((A)>>8) | (((A)&0xff)<<8) )
-#define htons(A) ntohs(A)
-#define ntohl(A) ( ((A)>>24) | (((A)&0xff0000)>>8) | (((A)&0xff00)<<8) | ((A)<<24) )
-#define htonl(A) ntohl(A)
+/* Flags for log_open(). */
+/** Write log as binary t_log_records instead of text. */
+#define LOG_OPEN_BINARY     (1<<0)
+/** Compress log by piping it through gzip. */
+#define LOG_OPEN_COMPRESS   (1<<1)
+/** Write log from a separate thread (see log_writer.c). */
+#define LOG_OPEN_ASYNC      (1<<2)
+
+/* Flags returned by the instruction handlers to cycle(). */
+/** Conditional branch taken: add branch offset to next PC. */
+#define EXEC_BRANCH         (1<<0)
+/** Branch-and-link opcode (only meaningful along with EXEC_BRANCH). */
+#define EXEC_LINK           (1<<1)
+/** Jump opcode: next instruction is in a delay slot. */
+#define EXEC_JUMP           (1<<2)
+
+/* Flags set by decode_opcode() in t_decoded.flags. */
+/** Branch or jump opcode: ends a basic block after its delay slot. */
+#define DEC_BRANCH          (1<<0)
+/** Opcode that must be run through cycle() (COP0, traps, reserved...). */
+#define DEC_SLOW            (1<<1)
+/** Load into GPR rt. */
+#define DEC_LOAD            (1<<2)
+/** Store to memory. */
+#define DEC_STORE           (1<<3)
+/** Opcode at an address with a breakpoint, or at a mirror of one. */
+#define DEC_BREAK           (1<<4)
+
+/** Max number of instructions in a basic block of the block engine */
+#define BLOCK_MAX_INSNS     (64)
 
 /* Assertion flags that will be used to notify the main cycle function of any
  * failed assertions in its subfunctions. 
@@ -134,37 +214,34 @@ typedef struct s_block {
     uint32_t flags;
     uint8_t  *mem;
     char     *area_name;
+    bool     mapped;        /**< mem is a host mapping, not malloc'd */
+    char     *file;         /**< file to load into the block or NULL */
+    uint32_t file_offset;   /**< offset into the block to load file at */
 } t_block;
 
 
-/** Definition of a memory map */
-/* FIXME i/o addresses missing, hardcoded */
-typedef struct s_map {
-    t_block blocks[NUM_MEM_BLOCKS];
-} t_map;
-
-
-/* FIXME memory areas should be refactored to account for TCMs. */
-/*  Here's where we define the memory areas (blocks) of the system.
-
-    The blocks should be defined in this order: BRAM, XRAM, FLASH
-
-    BRAM is FPGA block ram initialized with bootstrap code
-    XRAM is external SRAM
-    FLASH is external flash
+/** Entry of the memory page table.
+    Pages that are plain memory get a host pointer so that aligned accesses
+    to them take a single table lookup; anything else (I/O registers, test
+    pattern blocks, unmapped pages, blocks whose geometry does not fit in
+    whole pages) has mem==NULL and goes through the slow decoding path. */
+typedef struct s_mem_page {
+    uint8_t *mem;       /**< host address of the page or NULL */
+    uint32_t offset;    /**< offset of the page within its block */
+    uint32_t block;     /**< index of block if PAGE_MAPPED */
+    uint32_t device;    /**< first device of the page, if PAGE_MMIO */
+    uint8_t flags;      /**< block MEM_* flags plus PAGE_* flags */
+} t_mem_page;
 
-    Give any area a size of 0x0 to leave it unused.
 
-    When a binary file is specified in the cmd line for one of these areas, it
-    will be used to initialize it, checking bounds.
-
-    Memory decoding is done in the order the blocks are defined; the address
-    is anded with field .mask and then compared to field .start. If they match
-    the address modulo the field .size is used to index the memory block, giving
-    a 'mirror' effect. All of this simulates how the actual hardware works.
-    Make sure the blocks don't overlap or the scheme will fail.
-*/
+/** Memory map: any number of blocks, decoded in order (see memmap.c) */
+typedef struct s_map {
+    uint32_t num_blocks;        /**< number of blocks in the map */
+    uint32_t max_blocks;        /**< number of entries allocated */
+    t_block *blocks;
+} t_map;
 
+/** Built-in memory maps, selected with --memory=N */
 typedef enum {
     MAP_DEFAULT =       0,
     MAP_UCLINUX =       1,
@@ -173,6 +250,34 @@ typedef enum {
 
 
 
+#ifdef ENABLE_CACHE
+/** Geometry and write policy of a cache */
+typedef struct s_cache_config {
+    uint32_t size;              /**< size in bytes, 0 if there is no cache */
+    uint32_t ways;              /**< associativity */
+    uint32_t line_size;         /**< line size in bytes */
+    uint32_t write_back;        /**< !=0 for write-back, 0 for write-through */
+} t_cache_config;
+
+/** Cache model; tags and statistics only */
+typedef struct s_cache {
+    t_cache_config cfg;
+    uint32_t sets;              /**< number of sets, a power of 2 */
+    uint32_t line_shift;        /**< log2 of line size */
+    uint32_t *tags;             /**< line address, by set and way; NULL if
+                                     the cache is disabled */
+    uint32_t *stamps;           /**< time of last use, by set and way */
+    uint8_t *state;             /**< valid and dirty bits, by set and way */
+    uint32_t clock;             /**< time of last access */
+    uint64_t read_hits;
+    uint64_t read_misses;
+    uint64_t write_hits;
+    uint64_t write_misses;
+    uint64_t writebacks;        /**< dirty lines evicted or written back */
+    uint64_t ops;               /**< CACHE opcodes executed */
+} t_cache;
+#endif
+
 /** Values for the command line arguments */
 typedef struct s_args {
     /** !=0 to trap on unimplemented opcodes, 0 to print warning and NOP */
@@ -185,45 +290,130 @@ typedef struct s_args {
     uint32_t timer_prescaler;
     /** address to start execution from (by default, reset vector) */
     uint32_t start_addr;
-    /** memory map to be used */
+    /** !=0 if start_addr was given in the command line */
+    uint32_t start_addr_given;
+    /** built-in memory map to be used if none is given */
     uint32_t memory_map;
+    /** memory blocks given with --memmap or --region, or built-in map */
+    t_map mem_map;
     /** implement unaligned load/stores (don't just trap them) */
     uint32_t do_unaligned;
+    /** !=0 to use the predecoded instruction cache (0 to decode every
+        fetched opcode, like the plain interpreter does) */
+    uint32_t predecode;
+    /** !=0 to run basic blocks of predecoded instructions when possible
+        (only meaningful along with predecode) */
+    uint32_t basic_blocks;
     /** start simulation without showing monitor prompt and quit on
         end condition -- useful for batch runs */
     uint32_t no_prompt;
-    /** breakpoint address (0xffffffff if unused) */
+    /** breakpoint given with --break (0xffffffff if unused) */
     uint32_t breakpoint;
     /** a code fetch from this address starts logging */
     uint32_t log_trigger_address;
-    /** full name of log file */
+    /** full name of log file, or NULL for no log */
     char *log_file_name;
-    /** bin file to load to each area or null */
-    char *bin_filename[NUM_MEM_BLOCKS];
+    /** !=0 to write the log as binary records instead of text */
+    uint32_t log_binary;
+    /** !=0 to compress the log file with gzip */
+    uint32_t log_compress;
+    /** !=0 to write the log from a separate thread */
+    uint32_t log_async;
+    /** checkpoint file to save when a breakpoint is hit, or NULL */
+    char *checkpoint_filename;
+    /** checkpoint file to start from, or NULL */
+    char *restore_filename;
+    /** ELF file to load or NULL */
+    char *elf_filename;
     /** map file to be used for function call tracing, if any */
     char *map_filename;
+    /** !=0 to run the pipeline timing model and report cycles at exit */
+    uint32_t timing;
+    /** wait states of code fetches, for the timing model */
+    uint32_t code_wait_states;
+    /** wait states of loads and stores, for the timing model */
+    uint32_t data_wait_states;
+    /** name of file to write the profile to, or NULL to not profile */
+    char *profile_filename;
+#ifdef ENABLE_CACHE
+    /** I-cache and D-cache configuration, size 0 for no cache */
+    t_cache_config icache;
+    t_cache_config dcache;
+#endif
+    /** number of cores sharing the memory, 1 for a single core system */
+    uint32_t num_cores;
+    /** instructions each core runs at a time in a multi-core system */
+    uint32_t quantum;
+    /** !=0 to run the cores all at once instead of taking turns */
+    uint32_t parallel;
+    /** UART input, "file:<name>" or "unix:<path>", or NULL for console */
+    char *uart_source;
     /** name of file to write CPU console output to, or NULL to use stdout. */
     char *conout_filename;
-    /** offset into area (in bytes) where bin will be loaded */
-    /* only used when loading a linux kernel image */
-    uint32_t offset[NUM_MEM_BLOCKS];
+    /** name of file to write the call trace to, or NULL to use stdout */
+    char *trace_log_filename;
+    /** device shared objects, "<file>[,<arguments>]" */
+    char *device_specs[MAX_DEVICE_PLUGINS];
+    uint32_t num_device_specs;
+    /** GDB server, "<TCP port>" or "unix:<path>", or NULL for the monitor */
+    char *gdb_spec;
 } t_args;
 
-/** File to be used for simulated CPU console output. */
-extern FILE *cpuconout;
+/** Function in the function map */
+typedef struct s_map_function {
+    uint32_t address;               /**< entry address */
+    uint32_t end;                   /**< address past the end */
+    char *name;
+} t_map_function;
+
+/** Information extracted from the map file, if any (see symbols.c) */
+typedef struct {
+    uint32_t num_functions;         /**< number of functions in the table */
+    uint32_t max_functions;         /**< number of entries allocated */
+    FILE *log;                      /**< call trace file, stdout or NULL */
+    uint32_t call_depth;            /**< depth of the call trace */
+    t_map_function *fn;             /**< functions sorted by address */
+} t_map_info;
 
 /** Assorted debug & trace info */
+/** Asynchronous log writer, opaque (see log_writer.c) */
+typedef struct s_log_writer t_log_writer;
+
+/** Lockstep co-simulation, opaque (see cosim.c) */
+typedef struct s_cosim t_cosim;
+
+/** Multi-core system, opaque (see smp.c) */
+typedef struct s_smp t_smp;
+
+/** Simulated UART, opaque (see uart.c) */
+typedef struct s_uart t_uart;
+
+/** GDB remote protocol connection, opaque (see gdb.c) */
+typedef struct s_gdb t_gdb;
+
+/** Guest code profiler and its call tree nodes, opaque (see profile.c) */
+typedef struct s_profile t_profile;
+typedef struct s_prof_node t_prof_node;
+
+/** Function taking log records instead of a log file (see log_open_sink) */
+typedef void (*t_log_sink)(void *arg, const t_log_record *r);
+
 typedef struct s_trace {
    unsigned int buf[TRACE_BUFFER_SIZE];   /**< queue of last jump targets */
    unsigned int next;                     /**< internal queue head pointer */
-   FILE *log;                             /**< text log file or NULL */
+   FILE *log;                             /**< log file or NULL */
+   bool log_binary;                       /**< log holds t_log_records */
+   bool log_pipe;                         /**< log is a pipe to gzip */
+   struct s_log_writer *writer;           /**< async log writer or NULL */
+   t_log_sink sink;                       /**< record consumer or NULL */
+   void *sink_arg;                        /**< argument passed to sink */
    int log_triggered;                     /**< !=0 if log has been triggered */
    uint32_t log_trigger_address;          /**< */
    int pr[32];                            /**< last value of register bank */
    int hi, lo, epc, status;               /**< last value of internal regs */
    int disasm_ptr;                        /**< disassembly pointer */
-   /** Instruction cycles remaining to trigger, or -1 if irq inactive */
-   int32_t irq_trigger_countdown;         /**< (in instructions) */
+   uint32_t last_pc;                      /**< PC of last cycle logged */
+   bool irq_pending;                      /**< HW irq inputs to be sampled */
    int8_t irq_trigger_inputs;             /**< HW interrupt to be triggered */
    int8_t irq_current_inputs;             /**< HW interrupt inputs */
 } t_trace;
@@ -233,15 +423,188 @@ typedef struct s_cop2_stub {
     uint32_t r[32*2];      /**< Reg banks, data & control. */
 } t_cop2_stub;
 
+struct s_state;
+struct s_decoded;
+struct s_basic_block;
+
+/** Instruction handler. Returns a combination of EXEC_* flags. */
+typedef uint32_t (*t_handler)(struct s_state *s, const struct s_decoded *d,
+                              uint32_t ptr);
+
+/** Decoded instruction, as stored in the predecoded instruction cache */
+typedef struct s_decoded {
+    t_handler handler;          /**< execution function, NULL if invalid */
+    uint32_t opcode;            /**< raw opcode */
+    uint8_t op, rs, rt, rd, re, func;
+    uint32_t imm;               /**< immediate field, zero-extended */
+    int32_t imm_shift;          /**< branch offset relative to delay slot */
+    uint32_t target;            /**< J/JAL target (w/o PC segment bits) */
+    uint32_t flags;             /**< combination of DEC_* flags */
+    /** Basic block starting at this instruction or NULL; not touched by
+        decode_opcode() and only used in the predecoded instruction cache */
+    struct s_basic_block *bb;
+} t_decoded;
+
+/** Basic block: straight-line run of decoded instructions ending after the
+    delay slot of a branch, before an opcode flagged DEC_SLOW or DEC_BREAK, or
+    when BLOCK_MAX_INSNS is reached. The instructions are copied from the
+    predecoded instruction cache and are valid as long as no decoded
+    instruction is invalidated (see t_predecode.gen). */
+typedef struct s_basic_block {
+    uint32_t start;             /**< address of first instruction */
+    uint32_t gen;               /**< value of t_predecode.gen when built */
+    uint32_t count;             /**< number of instructions, may be 0 */
+    t_decoded insn[];           /**< decoded instructions */
+} t_basic_block;
+
+/** Predecoded instruction cache.
+    Decoded instructions are stored in pages of DECODE_PAGE_SIZE bytes of
+    simulated memory, allocated lazily and indexed by memory block and by
+    offset within the block, so that mirrored addresses share the entries.
+    Writes to memory invalidate the entry of the word being written. */
+typedef struct s_predecode {
+    uint32_t enabled;            /**< !=0 if the cache is to be used */
+    t_decoded ***pages;          /**< page index of each block or NULL */
+    uint32_t fetch_page;         /**< address of last page fetched from... */
+    t_decoded *fetch_base;       /**< ...and its decoded page or NULL */
+    uint32_t basic_blocks;       /**< !=0 if the block engine is to be used */
+    uint32_t gen;                /**< bumped every time code is overwritten */
+} t_predecode;
+
+/** Stall causes accounted by the timing model */
+typedef enum {
+    STALL_FILL = 0,             /**< pipeline fill after reset */
+    STALL_LOAD_USE,             /**< load-use interlock */
+    STALL_TRAP,                 /**< dropped slot and stall after a trap */
+    STALL_ERET,                 /**< dropped slot and stall after ERET */
+    STALL_CODE_WAIT,            /**< code fetch wait states */
+    STALL_DATA_WAIT,            /**< load/store wait states */
+    NUM_STALL_CAUSES
+} t_stall_cause;
+
+/** Kinds of events of the event queue; see sched.c */
+typedef enum {
+    EVENT_HW_IRQ = 0,           /**< TB_HW_IRQ inputs reach the CPU */
+    EVENT_TIMER,                /**< COP0 Count reaches Compare */
+    EVENT_UART_POLL,            /**< UART source is to be polled */
+    EVENT_DEVICE_TICK,          /**< some device is due to tick */
+    EVENT_GDB_POLL,             /**< GDB connection is to be polled */
+    NUM_EVENT_KINDS
+} t_event_kind;
+
+/** Value of t_sched.next when the queue is empty */
+#define SCHED_NEVER         (UINT64_MAX)
+
+/** Event of the event queue */
+typedef struct s_event {
+    uint64_t time;              /**< value of insn_count the event is due at */
+    uint32_t kind;              /**< t_event_kind */
+    uint32_t arg;               /**< argument of the handler */
+} t_event;
+
+/** Event queue (see sched.c) */
+typedef struct s_sched {
+    uint64_t next;              /**< time of first event or SCHED_NEVER */
+    uint32_t num_events;
+    t_event events[SCHED_MAX_EVENTS]; /**< pending events, sorted by time */
+} t_sched;
+
+/** Event handler, called with the argument the event was scheduled with */
+typedef void (*t_event_handler)(struct s_state *s, uint32_t arg);
+
+/** Cycle-approximate timing model of the ION pipeline (see timing.c) */
+typedef struct s_timing {
+    uint32_t enabled;            /**< !=0 if the model is to be run */
+    uint32_t code_wait;          /**< wait states of each code fetch */
+    uint32_t data_wait;          /**< wait states of each load and store */
+    uint32_t load_rt;            /**< target reg of load in previous slot */
+    uint64_t cycles;             /**< estimated clock cycles */
+    uint64_t insns;              /**< instructions executed */
+    uint64_t branches;           /**< taken branches and jumps */
+    uint64_t stalls[NUM_STALL_CAUSES]; /**< cycles lost, by cause */
+} t_timing;
+
+/** Device read handler; returns the value read */
+typedef uint32_t (*t_device_read)(struct s_state *s, void *ctx, int size,
+                                  uint32_t address);
+/** Device write handler */
+typedef void (*t_device_write)(struct s_state *s, void *ctx, int size,
+                               uint32_t address, uint32_t value);
+/** Device tick handler, called every tick_period instructions */
+typedef void (*t_device_tick)(struct s_state *s, void *ctx);
+
+/** Simulated device: a range of I/O addresses and its handlers (see
+    devices.c). Accesses to the range with no handler go to memory. */
+typedef struct s_device {
+    const char *name;
+    uint32_t base;              /**< first address of the device */
+    uint32_t size;              /**< size of the address range in bytes */
+    t_device_read read;         /**< read handler or NULL */
+    t_device_write write;       /**< write handler or NULL */
+    t_device_tick tick;         /**< tick handler or NULL */
+    uint32_t tick_period;       /**< instructions between ticks */
+    void (*close)(void *ctx);   /**< called when the CPU is freed, or NULL */
+    void *ctx;                  /**< passed to the handlers */
+    uint64_t next_tick;         /**< time of next tick; set by device_add */
+} t_device;
+
+/** Devices of a CPU, sorted by address */
+typedef struct s_devices {
+    uint32_t num_devices;
+    uint32_t max_devices;       /**< number of entries allocated */
+    t_device *dev;
+    uint32_t num_plugins;
+    void *plugins[MAX_DEVICE_PLUGINS]; /**< shared objects loaded */
+} t_devices;
+
+/* Kinds of access a watchpoint stops on. */
+#define WATCH_READ          (1<<0)
+#define WATCH_WRITE         (1<<1)
+
+/** Data watchpoint */
+typedef struct s_watch {
+    uint32_t address;
+    uint32_t size;              /**< size of watched area in bytes */
+    uint32_t kind;              /**< WATCH_READ and/or WATCH_WRITE */
+} t_watch;
+
+/** Why the last debug_run stopped */
+typedef enum {
+    STOP_NONE = 0,              /**< ran out of instructions */
+    STOP_BREAK,                 /**< reached a breakpoint */
+    STOP_WATCH,                 /**< accessed a watchpoint */
+    STOP_INTERRUPT,             /**< interrupted by the debugger */
+    STOP_EXIT                   /**< the program stopped the simulation or
+                                     hung in an endless loop */
+} t_stop_reason;
+
+/** Breakpoints, watchpoints and debugger state (see debug.c) */
+typedef struct s_debug {
+    uint32_t num_breaks;
+    uint32_t max_breaks;        /**< number of entries allocated */
+    uint32_t *breaks;           /**< breakpoint addresses, sorted */
+    uint32_t num_watches;
+    uint32_t max_watches;       /**< number of entries allocated */
+    t_watch *watches;
+    uint32_t armed;             /**< !=0 if breakpoints are to stop the CPU */
+    t_stop_reason stop;         /**< why the last run stopped */
+    uint32_t stop_address;      /**< address of watchpoint hit */
+    uint32_t stop_kind;         /**< WATCH_* kind of access that hit it */
+    uint32_t exit_code;         /**< error count reported on STOP_EXIT */
+    t_gdb *gdb;                 /**< GDB connection or NULL */
+} t_debug;
+
 typedef struct s_state {
+   t_args args;                           /**< configuration */
    unsigned failed_assertions;            /**< assertion bitmap */
    unsigned faulty_address;               /**< addr that failed assertion */
    uint32_t do_unaligned;                 /**< !=0 to enable unaligned L/S */
-   uint32_t breakpoint;                   /**< BP address of 0xffffffff */
 
    int delay_slot;              /**< !=0 if prev. instruction was a branch */
-   uint32_t instruction_ctr;    /**< # of instructions executed since reset */
-   uint32_t inst_ctr_prescaler; /**< Prescaler counter for instruction ctr. */
+   uint64_t insn_count;         /**< # of instructions simulated in total */
+   uint64_t timer_base;         /**< insn_count at reset, for TIMER_READ */
+   uint64_t count_base;         /**< insn_count when COP0 Count was 0 */
+   bool timer_irq;              /**< COP0 timer interrupt pending (IP7) */
    uint32_t debug_regs[16];     /**< Rd/wr debug registers */
    uint16_t gpio_regs[1];       /**< Rd/wr GPIO registers */
 
@@ -265,35 +628,245 @@ typedef struct s_state {
    int skip;
    int eret_delay_slot;
    t_trace t;
-   t_block blocks[NUM_MEM_BLOCKS];
+   t_block *blocks;             /**< Memory blocks, shared by all cores. */
+   uint32_t num_blocks;
+   t_mem_page *mem_pages;       /**< Page table, MEM_NUM_PAGES entries. */
+   t_devices devices;           /**< Devices, shared by all cores. */
+   t_predecode pd;              /**< Predecoded instruction cache. */
+   t_profile *prof;             /**< Profiler or NULL. */
+   t_timing timing;             /**< Pipeline timing model. */
+   t_uart *uart;                /**< UART or NULL if not connected. */
+   FILE *conout;                /**< Console output or NULL to discard it. */
+   t_map_info map;              /**< Function map and call trace. */
+   t_sched sched;               /**< Event queue. */
+   t_debug dbg;                 /**< Breakpoints and watchpoints. */
+#ifdef ENABLE_CACHE
+   t_cache icache;              /**< Instruction cache model. */
+   t_cache dcache;              /**< Data cache model. */
+#endif
    int wakeup;
    int big_endian;
    bool sr_load_pending;
    uint32_t sr_load_pending_value;
+   bool ll_bit;                 /**< LLbit, set by LL (see smp.c) */
+   uint32_t ll_addr;            /**< address of word linked by LL */
+   uint32_t core_id;            /**< core number, 0 for the boot core */
+   t_smp *smp;                  /**< multi-core system or NULL */
 } t_state;
 
 
-/** Information extracted from the map file, if any */
-typedef struct {
-    uint32_t num_functions;         /**< number of functions in the table */
-    FILE *log;                      /**< text log file or stdout */
-    char *log_filename;             /**< name of log file or NULL */
-    uint32_t fn_address[MAP_MAX_FUNCTIONS];
-    char fn_name[MAP_MAX_FUNCTIONS][MAP_MAX_NAME_LEN];
-} t_map_info;
+
+/*---- Simulated memory access helpers ---------------------------------------*/
+
+/*
+ Loads and stores of simulated memory words, given the host address of the
+ data (with any alignment) and the endianess of the simulated CPU.
+*/
+
+static inline uint32_t mem_load32(const uint8_t *p, int big_endian){
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (big_endian != HOST_BIG_ENDIAN)? bswap32(v) : v;
+}
+
+static inline uint16_t mem_load16(const uint8_t *p, int big_endian){
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return (big_endian != HOST_BIG_ENDIAN)? bswap16(v) : v;
+}
+
+static inline void mem_store32(uint8_t *p, uint32_t v, int big_endian){
+    v = (big_endian != HOST_BIG_ENDIAN)? bswap32(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void mem_store16(uint8_t *p, uint16_t v, int big_endian){
+    v = (big_endian != HOST_BIG_ENDIAN)? bswap16(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
 
 
 /*---- Common functions defined in files other than main ---------------------*/
 
 extern int mem_read(t_state *s, int size, unsigned int address, int log);
 extern void mem_write(t_state *s, int size, unsigned address, unsigned value, int log);
+extern int mem_map_init(t_state *s);
+extern void mem_map_free(t_state *s);
+extern t_block *mem_find_block(t_state *s, uint32_t address);
+extern void mem_page_refresh(t_state *s, uint32_t page);
 
 /* CPU model */
 extern void free_cpu(t_state *s);
 extern int init_cpu(t_state *s, t_args *args);
 extern void reset_cpu(t_state *s);
 
-extern void log_call(uint32_t to, uint32_t from);
-extern void log_ret(uint32_t to, uint32_t from);
+extern int alloc_block_memory(t_block *b);
+extern void free_block_memory(t_block *b);
+
+#ifdef ENABLE_CACHE
+extern int cache_init(t_cache *c, const t_cache_config *cfg);
+extern void cache_free(t_cache *c);
+extern void cache_access(t_cache *c, uint32_t address, int write);
+extern void cache_fetch(t_state *s, uint32_t address);
+extern void cache_data(t_state *s, uint32_t address, int write);
+extern void cache_op(t_state *s, uint32_t op, uint32_t address);
+extern void cache_report(FILE *f, const char *name, const t_cache *c);
+#endif
+
+extern void cycle(t_state *s, int show_mode);
+extern uint32_t run_block(t_state *s);
+extern void decode_opcode(t_decoded *d, uint32_t opcode);
+
+/* Execution log */
+extern int log_open(t_state *s, const char *name, uint32_t flags);
+extern void log_flush(t_state *s);
+extern void log_open_sink(t_state *s, t_log_sink sink, void *arg);
+extern void log_close(t_state *s);
+extern uint32_t log_is_open(t_state *s);
+extern uint32_t log_enabled(t_state *s);
+extern void log_entry(t_state *s, t_log_kind kind, uint32_t pc,
+                      uint32_t address, uint32_t size, uint32_t value);
+
+/* Simulation setup */
+extern int parse_cmd_line(uint32_t argc, char **argv, t_args *args);
+extern int read_binary_files(t_state *s, t_args *args);
+extern void init_trace_buffer(t_state *s, t_args *args);
+extern void close_trace_buffer(t_state *s);
+extern void dump_trace_buffer(t_state *s);
+extern void log_call(t_state *s, uint32_t to, uint32_t from);
+extern void log_ret(t_state *s, uint32_t to, uint32_t from);
+
+/* UART */
+extern t_uart *uart_open(const char *spec, FILE *conout);
+extern void uart_close(t_uart *u);
+extern void uart_console_restore(void);
+extern void uart_poll(t_uart *u);
+extern uint32_t uart_status(t_uart *u);
+extern uint8_t uart_read(t_uart *u);
+extern void uart_write(t_uart *u, uint8_t c);
+
+/* Event queue */
+extern void sched_init(t_sched *q);
+extern void sched_at(t_state *s, t_event_kind kind, uint64_t time,
+                     uint32_t arg);
+extern void sched_cancel(t_state *s, t_event_kind kind);
+extern uint32_t sched_pending(t_state *s, t_event_kind kind);
+extern void sched_run(t_state *s);
+extern void hw_irq_event(t_state *s, uint32_t arg);
+extern void timer_event(t_state *s, uint32_t arg);
+extern void uart_poll_event(t_state *s, uint32_t arg);
+extern void device_tick_event(t_state *s, uint32_t arg);
+extern void gdb_poll_event(t_state *s, uint32_t arg);
+
+/* Multi-core system and LL/SC */
+extern t_smp *smp_open(t_state *boot);
+extern void smp_run(t_smp *m);
+extern uint32_t smp_num_cores(t_smp *m);
+extern t_state *smp_core(t_smp *m, uint32_t id);
+extern void smp_close(t_smp *m);
+extern void smp_link(t_state *s, uint32_t address);
+extern void smp_unlink(t_state *s);
+extern uint32_t smp_store_conditional(t_state *s, uint32_t address,
+                                      uint32_t value);
+extern void smp_snoop(t_state *s, uint32_t address, uint32_t size);
+extern void smp_code_page(t_state *s, uint32_t block, uint32_t page);
+
+/* Devices */
+extern int tb_devices_add(t_state *s);
+extern int device_add(t_state *s, const t_device *d);
+extern int device_load(t_state *s, const char *spec);
+extern void device_map_pages(t_state *s);
+extern const t_device *device_find(t_state *s, uint32_t address);
+extern void devices_reset(t_state *s);
+extern void devices_free(t_state *s);
+
+/* Breakpoints and watchpoints */
+extern int debug_break_add(t_state *s, uint32_t address);
+extern int debug_break_remove(t_state *s, uint32_t address);
+extern int debug_watch_add(t_state *s, uint32_t address, uint32_t size,
+                           uint32_t kind);
+extern int debug_watch_remove(t_state *s, uint32_t address, uint32_t size,
+                              uint32_t kind);
+extern void debug_mark(t_state *s, t_decoded *d, uint32_t pc);
+extern uint32_t debug_break_hit(t_state *s);
+extern void debug_watch_hit(t_state *s, uint32_t address, uint32_t size,
+                            uint32_t kind);
+extern void debug_map_pages(t_state *s);
+extern uint32_t debug_run(t_state *s, uint64_t max_insns);
+extern void debug_free(t_state *s);
+
+/* GDB remote protocol server */
+extern t_gdb *gdb_open(const char *spec);
+extern void gdb_serve(t_gdb *g, t_state *s);
+extern void gdb_close(t_gdb *g);
+
+/* Memory map */
+extern int memmap_add(t_map *m, const t_block *b);
+extern int memmap_builtin(t_map *m, uint32_t n);
+extern int memmap_parse(t_map *m, const char *text);
+extern int memmap_read(t_map *m, const char *name);
+extern int memmap_set_file(t_map *m, uint32_t i, const char *name,
+                           uint32_t offset);
+extern void memmap_free(t_map *m);
+
+/* Checkpoints */
+extern int checkpoint_save(t_state *s, const char *name);
+extern int checkpoint_restore(t_state *s, const char *name);
+
+/* Function map */
+extern int map_add_function(t_map_info *map, uint32_t address, uint32_t size,
+                            const char *name);
+extern void map_sort(t_map_info *map);
+extern int32_t map_find_function(const t_map_info *map, uint32_t address);
+extern void map_free(t_map_info *map);
+
+/* Profiler */
+extern t_profile *profile_open(uint32_t start_address);
+extern void profile_insns(t_profile *p, uint32_t pc, uint32_t n,
+                          t_prof_node *node);
+extern t_prof_node *profile_node(t_profile *p);
+extern void profile_call(t_profile *p, uint32_t to);
+extern void profile_ret(t_profile *p);
+extern int profile_write(t_profile *p, const char *name,
+                         const t_map_info *map);
+extern void profile_close(t_profile *p);
+
+/* Pipeline timing model */
+extern void timing_init(t_timing *t, uint32_t enabled, uint32_t code_wait,
+                        uint32_t data_wait);
+extern void timing_insn(t_timing *t, const t_decoded *d, uint32_t flags);
+extern void timing_bubble(t_timing *t, t_stall_cause cause);
+extern void timing_report(FILE *f, const t_timing *t);
+
+/* ELF loader */
+extern int32_t elf_load(t_state *s, const char *name, uint32_t *entry);
+extern int32_t elf_read_functions(const char *name, t_map_info *map);
+
+/* Simulator instances */
+extern t_state *ion32sim_open(int argc, char **argv);
+extern uint32_t ion32sim_run(t_state *s, uint64_t max_insns);
+extern void ion32sim_close(t_state *s);
+
+/* Lockstep co-simulation */
+extern t_cosim *cosim_open(int argc, char **argv);
+extern int cosim_check(t_cosim *c, const t_log_record *rtl);
+extern void cosim_close(t_cosim *c);
+
+/* Asynchronous log writer */
+extern t_log_writer *log_writer_start(FILE *file, bool binary);
+extern void log_writer_put(t_log_writer *w, const t_log_record *r);
+extern void log_writer_flush(t_log_writer *w);
+extern void log_writer_stop(t_log_writer *w);
+
+/* Predecoded instruction cache */
+extern void predecode_init(t_state *s, uint32_t enabled,
+                           uint32_t basic_blocks);
+extern void predecode_free(t_state *s);
+extern t_decoded *predecode_fetch(t_state *s, uint32_t pc);
+extern t_basic_block *predecode_block(t_state *s, uint32_t pc);
+extern void predecode_invalidate(t_state *s, uint32_t block,
+                                 uint32_t offset, uint32_t size);
 
 #endif
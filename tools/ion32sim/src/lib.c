@@ -0,0 +1,122 @@
+/**
+    @file lib.c
+    @brief Simulator instances for programs that embed libion32sim.
+
+    A simulator instance is a t_state set up from a command line, with the
+    same options as the ion32sim program. All the configuration and state
+    of a simulation hang off its instance, so a program can run any number
+    of instances at once, each on a thread of its own, e.g. to run many
+    short test programs from a thread pool:
+
+        t_state *s = ion32sim_open(argc, argv);
+        if(s!=NULL){
+            ion32sim_run(s, 100000);
+            ... check s->r[], mem_read(s, ...) ...
+            ion32sim_close(s);
+        }
+
+    An instance must be used by only one thread at a time. Nothing is
+    shared between instances, except stdout and stderr, where the messages
+    of the simulator go.
+
+    Unlike the ion32sim program, an instance only writes the files named on
+    its command line: there's no execution log unless --log is given, the
+    CPU console output is discarded unless --conout is given, and the UART
+    is only connected to an input if --uart is given (never to the console,
+    whose mode would be changed). Instances always run in batch mode and
+    don't support --cores.
+*/
+
+#include "ion32sim.h"
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Create a simulator instance, load its object code and reset it.
+
+    @arg argc, argv Command line, same as for the ion32sim program.
+    @return Instance ready to run, or NULL on error after printing a message.
+*/
+t_state *ion32sim_open(int argc, char **argv){
+    t_state *s;
+    t_args args;
+
+    if(parse_cmd_line(argc, argv, &args)<=0){
+        return NULL;
+    }
+    if(args.num_cores>1){
+        fprintf(stderr,"--cores is not supported by simulator instances\n");
+        return NULL;
+    }
+
+    s = malloc(sizeof(t_state));
+    if(s==NULL || !init_cpu(s, &args)){
+        fprintf(stderr,"Trouble allocating memory\n");
+        free(s);
+        return NULL;
+    }
+    /* On failure, this frees the CPU model itself */
+    if(!read_binary_files(s, &(s->args))){
+        free(s);
+        return NULL;
+    }
+
+    if(s->args.conout_filename!=NULL){
+        s->conout = fopen(s->args.conout_filename, "w");
+        if(s->conout==NULL){
+            fprintf(stderr,"Trouble opening console log file '%s'\n",
+                    s->args.conout_filename);
+            free_cpu(s);
+            free(s);
+            return NULL;
+        }
+    }
+    if(s->args.uart_source!=NULL){
+        s->uart = uart_open(s->args.uart_source, s->conout);
+        if(s->uart==NULL){
+            if(s->conout!=NULL) fclose(s->conout);
+            free_cpu(s);
+            free(s);
+            return NULL;
+        }
+    }
+
+    init_trace_buffer(s, &(s->args));
+    reset_cpu(s);
+    s->pc_next = s->pc + 4;
+    s->skip = 0;
+
+    /* Fast-forward to a checkpoint saved by some previous run, if any */
+    if(s->args.restore_filename!=NULL &&
+       !checkpoint_restore(s, s->args.restore_filename)){
+        ion32sim_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+/**
+    Run the simulated program until it stops, hits a breakpoint (see --break
+    and debug_break_add) or watchpoint, or has run 'max_insns' more
+    instructions, whatever comes first. Can be called again to go on with the
+    simulation; s->dbg.stop tells why it stopped.
+
+    @return !=0 if the program stopped or hit a breakpoint or watchpoint, 0
+            if it's still running.
+*/
+uint32_t ion32sim_run(t_state *s, uint64_t max_insns){
+    return debug_run(s, max_insns);
+}
+
+/** Close the files of a simulator instance and free it. */
+void ion32sim_close(t_state *s){
+    if(s==NULL) return;
+    uart_close(s->uart);
+    close_trace_buffer(s);
+    if(s->conout!=NULL){
+        fclose(s->conout);
+    }
+    free_cpu(s);
+    free(s);
+}
@@ -8,97 +8,275 @@
 
 /*---- Local function prototypes ---------------------------------------------*/
 
+static int mem_read_slow(t_state *s, int size, unsigned int address, int log);
+static void mem_write_slow(t_state *s, int size, unsigned address,
+                           unsigned value, int log);
+static uint8_t *page_memory(const t_block *b, uint32_t offset);
+
+static void gpio_reg_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data);
+static uint32_t gpio_reg_read(t_state *s, void *ctx, int size,
+                              uint32_t address);
+static void debug_reg_write(t_state *s, void *ctx, int size, uint32_t address,
+                            uint32_t data);
+static uint32_t debug_reg_read(t_state *s, void *ctx, int size,
+                               uint32_t address);
+static uint32_t uart_rx_read(t_state *s, void *ctx, int size, uint32_t address);
+static void uart_tx_write(t_state *s, void *ctx, int size, uint32_t address,
+                          uint32_t data);
+static uint32_t uart_status_read(t_state *s, void *ctx, int size,
+                                 uint32_t address);
+static uint32_t timer_read(t_state *s, void *ctx, int size, uint32_t address);
+static uint32_t irq_mask_read(t_state *s, void *ctx, int size,
+                              uint32_t address);
+static uint32_t irq_mask_sleep_read(t_state *s, void *ctx, int size,
+                                    uint32_t address);
+static void irq_mask_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data);
+static uint32_t irq_status_read(t_state *s, void *ctx, int size,
+                                uint32_t address);
+static void irq_status_write(t_state *s, void *ctx, int size, uint32_t address,
+                             uint32_t data);
+static void hw_irq_write(t_state *s, void *ctx, int size, uint32_t address,
+                         uint32_t data);
+static void stop_sim_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data);
+static void mark_write(t_state *s, void *ctx, int size, uint32_t address,
+                       uint32_t data);
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/** Simulated I/O registers of the test bench. Reads or writes to a register
+    with no handler fall through to memory. Single registers only decode
+    their exact address, as they always have. */
+static const t_device tb_devices[] = {
+    /* Debug register block */
+    {"TB debug", TB_DEBUG & 0xfffffff0, 16, debug_reg_read, debug_reg_write},
+    /* GPIO register block */
+    /* FIXME this is actually an APPLICATION feature, should be optional! */
+    {"GPIO", IO_GPIO & 0xfffffff0, 16, gpio_reg_read, gpio_reg_write},
+    // FIXME should be enabled with command line argument
+    {"TB UART", TB_UART_RX, 1, uart_rx_read, uart_tx_write},
+    {"UART status", UART_STATUS, 1, uart_status_read, NULL},
+    {"Timer", TIMER_READ, 1, timer_read, NULL},
+    {"TB HW IRQ", TB_HW_IRQ, 1, NULL, hw_irq_write},
+    {"TB stop", TB_STOP_SIM, 1, NULL, stop_sim_write},
+    {"TB mark", TB_MARK, 1, NULL, mark_write},
+    {"IRQ mask", IRQ_MASK, 1, irq_mask_read, irq_mask_write},
+    {"IRQ sleep", IRQ_MASK + 4, 1, irq_mask_sleep_read, NULL},
+    {"IRQ status", IRQ_STATUS, 1, irq_status_read, irq_status_write},
+};
 
-void gpio_reg_write(t_state *s, uint32_t address, uint32_t data);
-uint16_t gpio_reg_read(t_state *s, int size, unsigned int address);
-void debug_reg_write(t_state *s, uint32_t address, uint32_t data);
-int debug_reg_read(t_state *s, int size, unsigned int address);
+#define NUM_TB_DEVICES (sizeof(tb_devices)/sizeof(tb_devices[0]))
 
 
 /*---- Common functions ------------------------------------------------------*/
 
-/** Read memory, optionally logging */
-int mem_read(t_state *s, int size, unsigned int address, int log){
-    unsigned int value=0, word_value=0, i, ptr;
-    unsigned int full_address = address;
-    int c;
+/**
+    Build the page table from the memory blocks.
+    Mirroring is resolved here: every page gets the block that mem_find_block
+    would find for it, and the offset it would compute. Only the pages each
+    block decodes to are visited, so this takes time in proportion to the
+    mapped address space and not to the number of blocks.
 
-    /* Handle access to debug register block */
-    if((address&0xfffffff0)==(TB_DEBUG&0xfffffff0)){
-        return debug_reg_read(s, size, address);
+    @return 0 if the table could not be allocated.
+*/
+int mem_map_init(t_state *s){
+    t_mem_page *p;
+    t_block *b;
+    uint32_t i, j, page, mask, free_bits;
+
+    s->mem_pages = calloc(MEM_NUM_PAGES, sizeof(t_mem_page));
+    if(s->mem_pages==NULL) return 0;
+
+    for(j=0;j<s->num_blocks;j++){
+        b = &(s->blocks[j]);
+        if(b->size==0) continue;
+        /* Only the page bits of the mask are checked here: blocks with
+           a finer mask will go through the slow path anyway */
+        mask = b->mask & ~(MEM_PAGE_SIZE-1);
+        free_bits = ~mask & ~(MEM_PAGE_SIZE-1);
+        /* Visit every page with the mask bits of the block start address,
+           counting through the other bits; earlier blocks take precedence */
+        i = 0;
+        do{
+            page = (b->start & mask) | i;
+            p = &(s->mem_pages[page >> MEM_PAGE_SHIFT]);
+            if(!(p->flags & PAGE_MAPPED)){
+                p->block = j;
+                p->flags = b->flags | PAGE_MAPPED;
+                p->offset = (page - b->start) % b->size;
+                p->mem = page_memory(b, p->offset);
+            }
+            i = (i - free_bits) & free_bits;
+        } while(i!=0);
     }
 
-    /* Handle access to GPIO register block */
-    /* FIXME this is actually an APPLICATION feature, should be optional! */
-    if((address&0xfffffff0)==(IO_GPIO&0xfffffff0)){
-        return gpio_reg_read(s, size, address);
+    /* Pages with devices or watchpoints always take the slow path */
+    device_map_pages(s);
+    debug_map_pages(s);
+    return 1;
+}
+
+/**
+    Update the host address of a page after its PAGE_* flags have changed:
+    only pages of plain memory with no such flags get one.
+*/
+void mem_page_refresh(t_state *s, uint32_t page){
+    t_mem_page *p = &(s->mem_pages[page]);
+
+    p->mem = NULL;
+    if((p->flags & (PAGE_MAPPED | PAGE_MMIO | PAGE_WATCH))==PAGE_MAPPED){
+        p->mem = page_memory(&(s->blocks[p->block]), p->offset);
     }
+}
 
+/** Free the page table. */
+void mem_map_free(t_state *s){
+    free(s->mem_pages);
+    s->mem_pages = NULL;
+}
 
-    s->irqStatus |= IRQ_UART_WRITE_AVAILABLE;
-    switch(address){
-    case TB_UART_RX:
-        /* FIXME Take input from text file */
-        /* Wait for incoming character */
-        while(!kbhit());
-        //s->irqStatus &= ~IRQ_UART_READ_AVAILABLE; //clear bit
-        c = getch();
-        printf("%c", c);
-        return c;
-    case UART_STATUS:
-        /* Hardcoded status bits: tx and rx available */
-        return IRQ_UART_WRITE_AVAILABLE | IRQ_UART_READ_AVAILABLE;
-    case TIMER_READ:
-        printf("TIMER = %10d\n", s->instruction_ctr);
-        return s->instruction_ctr;
-        break;
-    case IRQ_MASK:
-       return 0;
-    case IRQ_MASK + 4:
-       sim_sleep(10);
-       return 0;
-    case IRQ_STATUS:
-       /*if(kbhit())
-          s->irqStatus |= IRQ_UART_READ_AVAILABLE;
-       return s->irqStatus;
-       */
-       /* FIXME Optionally simulate UART TX delay */
-       word_value = 0x00000003; /* Ready to TX and RX */
-       //log_read(s, full_address, word_value, size, log);
-       return word_value;
+/**
+    Find the memory block an address decodes to, or NULL if unmapped.
+    The page table gives the first block that might hold the address; only
+    blocks whose mask has bits within a page need looking any further.
+*/
+t_block *mem_find_block(t_state *s, uint32_t address){
+    const t_mem_page *p = &(s->mem_pages[address >> MEM_PAGE_SHIFT]);
+    uint32_t i = p->block;
+    t_block *b;
+
+    if(!(p->flags & PAGE_MAPPED)) return NULL;
+    for(;i<s->num_blocks;i++){
+        b = &(s->blocks[i]);
+        if(b->size!=0 && (address & b->mask)==(b->start & b->mask)){
+            return b;
+        }
     }
+    return NULL;
+}
 
-    /* point ptr to the byte in the block, or NULL is the address is unmapped */
-    ptr = 0;
-    for(i=0;i<NUM_MEM_BLOCKS;i++){
-        if((address & s->blocks[i].mask) ==
-           (s->blocks[i].start & s->blocks[i].mask)){
-            ptr = (unsigned)(s->blocks[i].mem) +
-                  ((address - s->blocks[i].start) % s->blocks[i].size);
+/** Read memory, optionally logging */
+int mem_read(t_state *s, int size, unsigned int address, int log){
+    const t_mem_page *page = &(s->mem_pages[address >> MEM_PAGE_SHIFT]);
+    uint8_t *ptr;
+
+    /* Aligned reads from plain memory pages: just look up the page */
+    if(page->mem!=NULL && !(address & (size-1))){
+        ptr = page->mem + (address & (MEM_PAGE_SIZE-1));
+        switch(size){
+        case 4:
+            return mem_load32(ptr, s->big_endian);
+        case 2:
+            return mem_load16(ptr, s->big_endian);
+        case 1:
+            return *ptr;
+        }
+    }
+    return mem_read_slow(s, size, address, log);
+}
+
+/** Write to memory, including simulated i/o */
+void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
+    const t_mem_page *page = &(s->mem_pages[address >> MEM_PAGE_SHIFT]);
+    uint8_t *ptr;
+
+    /* Aligned, unlogged writes to plain memory pages: look up the page.
+       Note that read-only blocks are only protected when logging. */
+    if(page->mem!=NULL && !(address & (size-1)) && !log_enabled(s)){
+        ptr = page->mem + (address & (MEM_PAGE_SIZE-1));
+        switch(size){
+        case 4:
+            mem_store32(ptr, value, s->big_endian);
+            break;
+        case 2:
+            mem_store16(ptr, value, s->big_endian);
+            break;
+        case 1:
+            *ptr = (uint8_t)value;
+            break;
+        default:
+            mem_write_slow(s, size, address, value, log);
             break;
         }
+        /* Drop any predecoded instruction we've just overwritten */
+        predecode_invalidate(s, page->block,
+            page->offset + (address & (MEM_PAGE_SIZE-1)), size);
+    }
+    else{
+        mem_write_slow(s, size, address, value, log);
+    }
+
+    /* Other cores lose their links to the word and decoded copies of it,
+       once the write is there for them to decode again */
+    if(s->smp!=NULL){
+        smp_snoop(s, address, size);
+    }
+}
+
+/** Add the simulated I/O registers of the test bench; returns 0 on error. */
+int tb_devices_add(t_state *s){
+    uint32_t i;
+
+    for(i=0;i<NUM_TB_DEVICES;i++){
+        if(!device_add(s, &(tb_devices[i]))) return 0;
+    }
+    return 1;
+}
+
+/** Event handler: the inputs written to TB_HW_IRQ reach the CPU. */
+void hw_irq_event(t_state *s, uint32_t arg){
+    s->t.irq_pending = true;
+    s->t.irq_trigger_inputs = arg;
+}
+
+/** Event handler: poll the UART source while the program waits for data. */
+void uart_poll_event(t_state *s, uint32_t arg){
+    if(s->uart!=NULL) uart_poll(s->uart);
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Read memory decoding the address the long way, optionally logging */
+static int mem_read_slow(t_state *s, int size, unsigned int address, int log){
+    unsigned int value=0;
+    unsigned int full_address = address;
+    uint8_t *ptr;
+    const t_device *io;
+    t_block *b;
+
+    if(log && (s->mem_pages[address >> MEM_PAGE_SHIFT].flags & PAGE_WATCH)){
+        debug_watch_hit(s, address, size, WATCH_READ);
+    }
+
+    /* Handle access to simulated registers */
+    io = device_find(s, address);
+    if(io!=NULL && io->read!=NULL){
+        return io->read(s, io->ctx, size, address);
     }
-    if(!ptr){
+
+    s->irqStatus |= IRQ_UART_WRITE_AVAILABLE;
+
+    /* point ptr to the byte in the block, or NULL is the address is unmapped */
+    b = mem_find_block(s, address);
+    ptr = (b!=NULL)? b->mem + ((address - b->start) % b->size) : NULL;
+    if(ptr==NULL){
         /* address out of mapped blocks: log and return zero */
         /* if bit CP0.16==1, this is a D-Cache line invalidation access and
            the HW will not read any actual data, so skip the log (@note1) */
         // FIXME refactor
         printf("MEM RD ERROR @ 0x%08x [0x%08x]\n", s->pc, full_address);
         if(log_enabled(s) && log!=0 && !(s->cp0_status & (1<<16))){
-            fprintf(s->t.log, "(%08x) [%08x] <%1d>=%08x RD UNMAPPED\n",
-                s->pc, full_address, size, 0);
+            log_entry(s, LOG_RD_UNMAPPED, s->pc, full_address, size, 0);
         }
         return 0;
     }
 
-    if((s->blocks[i].flags & MEM_TEST)){
-        return test_pattern(s->blocks[i].start, address);
-    }
-
-    /* get the whole word */
-    word_value = *(int*)(ptr&0xfffffffc);
-    if(s->big_endian){
-        word_value = ntohl(word_value);
+    if((b->flags & MEM_TEST)){
+        return test_pattern(b->start, address);
     }
 
     switch(size){
@@ -113,10 +291,7 @@ int mem_read(t_state *s, int size, unsigned int address, int log){
             s->faulty_address = address;
             address = address & 0xfffffffc;
         }
-        value = *(int*)ptr;
-        if(s->big_endian){
-            value = ntohl(value);
-        }
+        value = mem_load32(ptr, s->big_endian);
         break;
     case 2:
         if((address & 1) != 0){
@@ -125,13 +300,10 @@ int mem_read(t_state *s, int size, unsigned int address, int log){
             s->faulty_address = address;
             address = address & 0xfffffffe;
         }
-        value = *(unsigned short*)ptr;
-        if(s->big_endian){
-            value = ntohs((unsigned short)value);
-        }
+        value = mem_load16(ptr, s->big_endian);
         break;
     case 1:
-        value = *(unsigned char*)ptr;
+        value = *ptr;
         break;
     default:
         /* This is a bug, display warning */
@@ -142,10 +314,18 @@ int mem_read(t_state *s, int size, unsigned int address, int log){
     return(value);
 }
 
-
-/** Write to memory, including simulated i/o */
-void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
-    unsigned int i, ptr, mask, dvalue, b0, b1, b2, b3;
+/** Write to memory decoding the address the long way, including simulated
+    i/o */
+static void mem_write_slow(t_state *s, int size, unsigned address,
+                           unsigned value, int log){
+    unsigned int mask, dvalue, b0, b1, b2, b3;
+    const t_device *io;
+    t_block *b;
+    uint8_t *ptr;
+
+    if(log && (s->mem_pages[address >> MEM_PAGE_SHIFT].flags & PAGE_WATCH)){
+        debug_watch_hit(s, address, size, WATCH_WRITE);
+    }
 
     if(log_enabled(s)){
         b0 = value & 0x000000ff;
@@ -188,85 +368,45 @@ void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
             exit(2);
         }
 
-        fprintf(s->t.log, "(%08x) [%08x] <%1d>=%08x WR\n",
+        log_entry(s, LOG_WR,
                 //s->op_addr, address&0xfffffffc, mask, dvalue);
                 s->op_addr, address, size, dvalue);
     }
 
-    /* Handle accesses to debug registers */
-    if((address&0xfffffff0)==(TB_DEBUG&0xfffffff0)){
-        debug_reg_write(s, address, value);
+    /* Handle accesses to simulated registers */
+    io = device_find(s, address);
+    if(io!=NULL && io->write!=NULL){
+        io->write(s, io->ctx, size, address, value);
         return;
     }
 
-    /* Handle accesses to GPIO registers */
-    /* FIXME Application feature, not CPU's, should be optional! */
-    if((address&0xfffffff0)==(IO_GPIO&0xfffffff0)){
-        gpio_reg_write(s, address, value);
-        return;
-    }
-
-    // Capture accesses to simulated registers.
-    // FIXME should be enabled with command line argument
-    switch(address){
-    case TB_UART_TX:
-        fprintf(cpuconout,"%c",value&0x0ff);
-        fflush(cpuconout);
-        return;
-    case TB_HW_IRQ:
-        /* HW interrupt trigger register */
-        s->t.irq_trigger_countdown = 3;
-        s->t.irq_trigger_inputs = value;
-        return;
-    case TB_STOP_SIM:
-        /* Simulation stop: writing anything here stops the simulation.
-        The value being written is, by convention, the number of errors
-        detected in a test bench program and will be displayed as such.
-        */
-        fprintf(stderr, "Simulation terminated by program command.\n\n");
-        if (value>0) {
-            fprintf(stderr, "Program reports FAILURE -- %d errors.\n", value);
-        }
-        else {
-            fprintf(stderr, "Program reports SUCCESS -- no errors.\n");
-        }
-        fprintf(stderr, "\n");
-        s->wakeup = 1;
-        return;
-    case IRQ_MASK:
-        return;
-    case IRQ_STATUS:
-        s->irqStatus = value;
-        return;
-    }
+    b = mem_find_block(s, address);
+    ptr = NULL;
+    if(b!=NULL){
+        ptr = b->mem + ((address - b->start) % b->size);
 
-    ptr = 0;
-    for(i=0;i<NUM_MEM_BLOCKS;i++){
-        if((address & s->blocks[i].mask) ==
-                  (s->blocks[i].start & s->blocks[i].mask)){
-            ptr = (unsigned)(s->blocks[i].mem) +
-                            ((address - s->blocks[i].start) % s->blocks[i].size);
-
-            if(s->blocks[i].flags & MEM_READONLY){
-                if(log_enabled(s) && log!=0){
-                    fprintf(s->t.log, "(%08x) [%08x] |%02x|=%08x WR READ ONLY\n",
-                    s->op_addr, address, mask, dvalue);
-                    return;
-                }
+        if(b->flags & MEM_READONLY){
+            if(log_enabled(s) && log!=0){
+                log_entry(s, LOG_WR_READONLY,
+                s->op_addr, address, mask, dvalue);
+                return;
             }
-            break;
         }
     }
-    if(!ptr){
+    if(ptr==NULL){
         /* address out of mapped blocks: log and return zero */
         printf("MEM WR ERROR @ 0x%08x [0x%08x]\n", s->pc, address);
         if(log_enabled(s) && log!=0){
-            fprintf(s->t.log, "(%08x) [%08x] |%02x|=%08x WR UNMAPPED\n",
+            log_entry(s, LOG_WR_UNMAPPED,
                 s->op_addr, address, mask, dvalue);
         }
         return;
     }
 
+    /* Drop any predecoded instruction we're about to overwrite */
+    predecode_invalidate(s, b - s->blocks,
+        (address - b->start) % b->size, size);
+
     switch(size){
     case 4:
         if((address & 3) != 0){
@@ -275,10 +415,7 @@ void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
             s->faulty_address = address;
             address = address & (~0x03);
         }
-        if(s->big_endian){
-            value = htonl(value);
-        }
-        *(int*)ptr = value;
+        mem_store32(ptr, value, s->big_endian);
         break;
     case 2:
         if((address & 1) != 0){
@@ -287,13 +424,10 @@ void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
             s->faulty_address = address;
             address = address & (~0x01);
         }
-        if(s->big_endian){
-            value = htons((unsigned short)value);
-        }
-        *(short*)ptr = (unsigned short)value;
+        mem_store16(ptr, value, s->big_endian);
         break;
     case 1:
-        *(char*)ptr = (unsigned char)value;
+        *ptr = (uint8_t)value;
         break;
     default:
         /* This is a bug, display warning */
@@ -301,33 +435,158 @@ void mem_write(t_state *s, int size, unsigned address, unsigned value, int log){
     }
 }
 
-
-
-/*---- Local functions -------------------------------------------------------*/
+/** Host address of the page at an offset of a block, if the block can be
+    accessed a whole page at a time; NULL otherwise. */
+static uint8_t *page_memory(const t_block *b, uint32_t offset){
+    if(!(b->mask & (MEM_PAGE_SIZE-1)) &&
+       !(b->size & (MEM_PAGE_SIZE-1)) &&
+       !(offset & (MEM_PAGE_SIZE-1)) &&
+       !(b->flags & MEM_TEST)){
+        return b->mem + offset;
+    }
+    return NULL;
+}
 
 /** Read from GPIO register (HW register simplified for TB). */
-uint16_t gpio_reg_read(t_state *s, int size, unsigned int address){
+static uint32_t gpio_reg_read(t_state *s, void *ctx, int size,
+                              uint32_t address){
     /* A single 16 bit register available */
     return (s->gpio_regs[0] + 0x02901) & 0xffff;
 }
 
 
 /** Write to debug register */
-void gpio_reg_write(t_state *s, uint32_t address, uint32_t data){
+static void gpio_reg_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data){
     //printf("GPIO REG[%1d]=%08x\n", (address >> 2)&0x03, data);
     s->gpio_regs[0] = data & 0xffff;
 }
 
 /** Read from debug register (TB only feature). */
-int debug_reg_read(t_state *s, int size, unsigned int address){
+static uint32_t debug_reg_read(t_state *s, void *ctx, int size,
+                               uint32_t address){
     /* Four 32 bit registers available */
     return s->debug_regs[(address >> 2)&0x03];
 }
 
 /** Write to debug register */
-void debug_reg_write(t_state *s, uint32_t address, uint32_t data){
+static void debug_reg_write(t_state *s, void *ctx, int size, uint32_t address,
+                            uint32_t data){
     /* all other registers are used for display (like LEDs) */
     //printf("DEBUG REG[%1d]=%08x\n", (address >> 2)&0x03, data);
     s->debug_regs[(address >> 2)&0x03] = data;
 }
 
+/** Read from UART: waits for input if there's none yet */
+static uint32_t uart_rx_read(t_state *s, void *ctx, int size, uint32_t address){
+    if(s->uart==NULL) return 0;
+    return uart_read(s->uart);
+}
+
+/** Write to UART: output to console */
+static void uart_tx_write(t_state *s, void *ctx, int size, uint32_t address,
+                          uint32_t data){
+    if(s->uart==NULL){
+        if(s->conout!=NULL){
+            fprintf(s->conout,"%c",data&0x0ff);
+            fflush(s->conout);
+        }
+        return;
+    }
+    uart_write(s->uart, data & 0x0ff);
+}
+
+/** Read UART status register */
+static uint32_t uart_status_read(t_state *s, void *ctx, int size,
+                                 uint32_t address){
+    uint32_t status;
+
+    if(s->uart==NULL) return IRQ_UART_WRITE_AVAILABLE;
+    status = uart_status(s->uart);
+    /* Program waiting for data: poll the source a while later */
+    if(!(status & IRQ_UART_READ_AVAILABLE) &&
+       !sched_pending(s, EVENT_UART_POLL)){
+        sched_at(s, EVENT_UART_POLL, s->insn_count + UART_POLL_INSNS, 0);
+    }
+    return status;
+}
+
+/** Read timer register (actually the prescaled instruction counter) */
+static uint32_t timer_read(t_state *s, void *ctx, int size, uint32_t address){
+    uint32_t prescaler = s->args.timer_prescaler - 1;
+    uint32_t ctr;
+
+    ctr = prescaler? (uint32_t)((s->insn_count - s->timer_base) / prescaler)
+                   : 0;
+    printf("TIMER = %10d\n", ctr);
+    return ctr;
+}
+
+/** Read IRQ mask register (unimplemented) */
+static uint32_t irq_mask_read(t_state *s, void *ctx, int size,
+                              uint32_t address){
+    return 0;
+}
+
+/** Read register next to IRQ mask: stalls the simulation for a while */
+static uint32_t irq_mask_sleep_read(t_state *s, void *ctx, int size,
+                                    uint32_t address){
+    sim_sleep(10);
+    return 0;
+}
+
+/** Write IRQ mask register (unimplemented) */
+static void irq_mask_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data){
+}
+
+/** Read IRQ status register */
+static uint32_t irq_status_read(t_state *s, void *ctx, int size,
+                                uint32_t address){
+    /* FIXME Optionally simulate UART TX delay */
+    return 0x00000003; /* Ready to TX and RX */
+}
+
+/** Write IRQ status register */
+static void irq_status_write(t_state *s, void *ctx, int size, uint32_t address,
+                             uint32_t data){
+    s->irqStatus = data;
+}
+
+/** Write HW interrupt trigger register (TB only feature) */
+static void hw_irq_write(t_state *s, void *ctx, int size, uint32_t address,
+                         uint32_t data){
+    /* The inputs are sampled by the HW_IRQ_DELAY-th instruction from here */
+    sched_at(s, EVENT_HW_IRQ, s->insn_count + HW_IRQ_DELAY - 1, data);
+}
+
+/** Write simulation stop register (TB only feature) */
+static void stop_sim_write(t_state *s, void *ctx, int size, uint32_t address,
+                           uint32_t data){
+    /* Simulation stop: writing anything here stops the simulation.
+    The value being written is, by convention, the number of errors
+    detected in a test bench program and will be displayed as such.
+    */
+    fprintf(stderr, "Simulation terminated by program command.\n\n");
+    if (data>0) {
+        fprintf(stderr, "Program reports FAILURE -- %d errors.\n", data);
+    }
+    else {
+        fprintf(stderr, "Program reports SUCCESS -- no errors.\n");
+    }
+    fprintf(stderr, "\n");
+    s->dbg.stop = STOP_EXIT;
+    s->dbg.exit_code = data;
+    s->wakeup = 1;
+    /* The log must be complete as soon as the simulation stops */
+    log_flush(s);
+}
+
+/** Write to mark register: print value and instruction count.
+    The RTL TBs print the clock cycle count instead, so that the program can
+    delimit the stretches of code it wants both counts of. */
+static void mark_write(t_state *s, void *ctx, int size, uint32_t address,
+                       uint32_t data){
+    fprintf(stderr, "Mark %08x at instruction %llu\n", data,
+            (unsigned long long)s->insn_count);
+}
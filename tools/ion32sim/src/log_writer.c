@@ -0,0 +1,174 @@
+/**
+    @file log_writer.c
+    @brief Asynchronous execution log writer.
+
+    When enabled, log records are not written to the log file by the
+    simulation thread. They are put into a single-producer, single-consumer
+    ring buffer instead, and a writer thread takes them out in batches,
+    renders them if the log is a text log and writes them to file.
+
+    The ring indices grow freely and are masked on access. The simulation
+    thread only ever writes 'head' and the writer thread only ever writes
+    'tail', so no locks are needed: each side publishes its index with a
+    release store after it's done with the records it covers.
+
+    If the ring fills up the simulation waits for the writer, so records are
+    never dropped and always reach the file in order.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "ion32sim.h"
+
+
+/** Number of records in the ring buffer (power of 2) */
+#define LOG_WRITER_RING_SIZE    (1 << 18)
+/** Max number of records rendered and written at a time */
+#define LOG_WRITER_BATCH        (4096)
+/** Time the writer thread sleeps when there is nothing to write */
+#define LOG_WRITER_IDLE_US      (200)
+
+
+struct s_log_writer {
+    FILE *file;                 /**< log file, owned by the caller */
+    bool binary;                /**< write records instead of text */
+    t_log_record *ring;         /**< ring buffer of records */
+    atomic_uint head;           /**< next record to be put by simulation */
+    atomic_uint tail;           /**< next record to be taken by writer */
+    uint32_t cached_tail;       /**< last value of tail seen by simulation */
+    atomic_bool stop;           /**< set to make the writer thread quit */
+    pthread_t thread;           /**< writer thread */
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void *writer_thread(void *arg);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Start a writer thread for an open log file.
+
+    @return Writer or NULL if it could not be started.
+*/
+t_log_writer *log_writer_start(FILE *file, bool binary){
+    t_log_writer *w;
+
+    w = calloc(1, sizeof(t_log_writer));
+    if(w==NULL) return NULL;
+    w->ring = malloc(LOG_WRITER_RING_SIZE * sizeof(t_log_record));
+    if(w->ring==NULL){
+        free(w);
+        return NULL;
+    }
+    w->file = file;
+    w->binary = binary;
+    atomic_init(&w->head, 0);
+    atomic_init(&w->tail, 0);
+    atomic_init(&w->stop, false);
+    w->cached_tail = 0;
+
+    if(pthread_create(&w->thread, NULL, writer_thread, w)!=0){
+        free(w->ring);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/** Put a record into the ring, waiting for room if necessary. */
+void log_writer_put(t_log_writer *w, const t_log_record *r){
+    uint32_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+
+    while(head - w->cached_tail >= LOG_WRITER_RING_SIZE){
+        w->cached_tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+        if(head - w->cached_tail >= LOG_WRITER_RING_SIZE){
+            sched_yield();
+        }
+    }
+    w->ring[head & (LOG_WRITER_RING_SIZE-1)] = *r;
+    atomic_store_explicit(&w->head, head + 1, memory_order_release);
+}
+
+/** Wait until all records put so far are in the file, and flush it. */
+void log_writer_flush(t_log_writer *w){
+    uint32_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+
+    while(atomic_load_explicit(&w->tail, memory_order_acquire) != head){
+        sched_yield();
+    }
+    fflush(w->file);
+}
+
+/** Write all pending records, stop the writer thread and free it. The log
+    file is left open. */
+void log_writer_stop(t_log_writer *w){
+    atomic_store_explicit(&w->stop, true, memory_order_release);
+    pthread_join(w->thread, NULL);
+    fflush(w->file);
+    free(w->ring);
+    free(w);
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Writer thread: drain the ring until told to stop and the ring is empty. */
+static void *writer_thread(void *arg){
+    t_log_writer *w = arg;
+    t_log_record *r;
+    char *text, *p, line[EXEC_LOG_LINE_MAX];
+    uint32_t head, tail, n, i;
+    bool stop;
+
+    /* If this fails text lines will be written one at a time */
+    text = malloc(LOG_WRITER_BATCH * EXEC_LOG_LINE_MAX);
+
+    tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    for(;;){
+        /* Check stop flag before head so that we see all the last records */
+        stop = atomic_load_explicit(&w->stop, memory_order_acquire);
+        head = atomic_load_explicit(&w->head, memory_order_acquire);
+        if(head==tail){
+            if(stop) break;
+            usleep(LOG_WRITER_IDLE_US);
+            continue;
+        }
+
+        /* Take a batch of contiguous records from the ring */
+        n = head - tail;
+        if(n > LOG_WRITER_RING_SIZE - (tail & (LOG_WRITER_RING_SIZE-1))){
+            n = LOG_WRITER_RING_SIZE - (tail & (LOG_WRITER_RING_SIZE-1));
+        }
+        if(n > LOG_WRITER_BATCH){
+            n = LOG_WRITER_BATCH;
+        }
+        r = &(w->ring[tail & (LOG_WRITER_RING_SIZE-1)]);
+
+        if(w->binary){
+            fwrite(r, sizeof(t_log_record), n, w->file);
+        }
+        else if(text!=NULL){
+            for(i=0, p=text;i<n;i++){
+                p += log_format_record(p, &r[i]);
+            }
+            fwrite(text, 1, p - text, w->file);
+        }
+        else{
+            for(i=0;i<n;i++){
+                fwrite(line, 1, log_format_record(line, &r[i]), w->file);
+            }
+        }
+
+        tail += n;
+        atomic_store_explicit(&w->tail, tail, memory_order_release);
+    }
+
+    free(text);
+    return NULL;
+}
@@ -0,0 +1,295 @@
+/**
+    @file memmap.c
+    @brief Memory map: the list of memory blocks of the simulated system.
+
+    A memory map is a list of any number of blocks, each with a start address,
+    a size, a decoding mask, some MEM_* flags and optionally a file to load
+    into the block. The map comes from a config file (--memmap), from the
+    command line (--region), or else from one of the built-in maps (--memory).
+
+    Addresses are decoded in the order the blocks are listed: the address is
+    ANDed with the mask and compared to the start address also ANDed with
+    the mask. If they match, the address modulo the size indexes the block,
+    giving a 'mirror' effect. The simulator resolves all this once per page
+    when the page table is built (see mem_map_init) so decoding takes
+    constant time however many blocks there are.
+
+    Memory map files have a block per line, with these fields separated by
+    blanks; '#' starts a comment:
+
+        <name> <start> <size> [<mask> [<flags> [<file> [<file offset>]]]]
+
+    Numbers can be decimal or 0x-prefixed hex. The mask defaults to the
+    address bits above the size rounded up to a power of 2, i.e. no mirrors;
+    give it as '-' to use the default along with flags or a file.
+    Flags are any of 'r' (read only), 'c' (cached) and 't' (test pattern),
+    or '-' for none. E.g.:
+
+        # name    start       size        mask        flags   file
+        code_tcm  0xbfc00000  0x00004000  0xf8000000  r       boot.bin
+        data_tcm  0xa0000000  0x00002000  0xf8000000  -
+        ddr       0x00000000  0x10000000  0xf0000000  c
+
+    Block memory is mapped lazily by the host (see alloc_block_memory), so a
+    large block costs nothing until the simulated program touches it.
+*/
+
+#include "ion32sim.h"
+
+
+/** Initial number of blocks of a map, doubled whenever it fills up */
+#define MAP_INITIAL_BLOCKS  (8)
+/** Max length of a line of a memory map file */
+#define MAP_LINE_LEN        (1024)
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/* FIXME memory areas should be refactored to account for TCMs. */
+/*  Built-in memory maps, selected with --memory=N.
+
+    The blocks are defined in this order: BRAM, XRAM, (test ROM), FLASH,
+    which is where --bram, --xram and --flash load their files.
+
+    BRAM is FPGA block ram initialized with bootstrap code
+    XRAM is external SRAM
+    FLASH is external flash
+*/
+
+/** Experimental memory map (default) */
+static const t_block default_map[] = {
+    /* Code TCM (Holds bootstrap code) */
+    {VECTOR_RESET,  0x00004000, 0xf8000000, MEM_READONLY, NULL, "Code TCM"},
+    /* Data TCM */
+    {0xa0000000,    0x00002000, 0xf8000000, 0, NULL, "Data TCM"},
+    /* main external ram block  */
+    {0x80000000,    0x00080000, 0xf8000000, MEM_CACHED, NULL, "Cached RAM"},
+    /* main external ram block  */
+    {0x90000000,    0x00080000, 0xf8000000, MEM_TEST | MEM_CACHED, NULL, "Cached test ROM"},
+    /* external flash block */
+    {0x00000000,    0x00040000, 0xf8000000, MEM_CACHED, NULL, "Cached FLASH"},
+};
+
+/** uClinux memory map with bootstrap BRAM, debug only, to be removed */
+static const t_block uclinux_map[] = {
+    /* Bootstrap BRAM, read only */
+    {VECTOR_RESET,  0x00008000, 0xf8000000, MEM_READONLY, NULL, "Code TCM"},
+    /* Data TCM */
+    {0x00000000,    0x00002000, 0xf8000000, 0, NULL, "Data TCM"},
+    /* main external ram block  */
+    {0x80000000,    0x00800000, 0xf8000000, MEM_CACHED, NULL, "XRAM0"},
+    {0x10000000,    0x00800000, 0xf8000000, MEM_CACHED, NULL, "XRAM1"},
+    /* external flash block */
+    {0xb0000000,    0x00100000, 0xf8000000, 0, NULL, "Flash"},
+};
+
+static const struct {
+    const t_block *blocks;
+    uint32_t num_blocks;
+} builtin_maps[NUM_MEM_MAPS] = {
+    {default_map, sizeof(default_map)/sizeof(default_map[0])},
+    {uclinux_map, sizeof(uclinux_map)/sizeof(uclinux_map[0])},
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static int parse_number(const char *text, uint32_t *value);
+static int parse_flags(const char *text, uint32_t *flags);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Add a copy of a block to the map; its memory is not copied.
+
+    @return 0 if out of memory.
+*/
+int memmap_add(t_map *m, const t_block *b){
+    t_block *blocks, *nb;
+    uint32_t max;
+
+    if(m->num_blocks >= m->max_blocks){
+        max = m->max_blocks? m->max_blocks*2 : MAP_INITIAL_BLOCKS;
+        blocks = realloc(m->blocks, max * sizeof(t_block));
+        if(blocks==NULL) return 0;
+        m->blocks = blocks;
+        m->max_blocks = max;
+    }
+
+    nb = &(m->blocks[m->num_blocks]);
+    *nb = *b;
+    nb->mem = NULL;
+    nb->mapped = false;
+    nb->area_name = strdup(b->area_name!=NULL? b->area_name : "");
+    nb->file = (b->file!=NULL)? strdup(b->file) : NULL;
+    if(nb->area_name==NULL || (b->file!=NULL && nb->file==NULL)){
+        free(nb->area_name);
+        free(nb->file);
+        return 0;
+    }
+    m->num_blocks++;
+    return 1;
+}
+
+/**
+    Add the blocks of built-in memory map number n to the map.
+
+    @return 0 on error, after printing a message.
+*/
+int memmap_builtin(t_map *m, uint32_t n){
+    uint32_t i;
+
+    if(n>=NUM_MEM_MAPS){
+        fprintf(stderr,"--memory must be 0 to %d\n", NUM_MEM_MAPS-1);
+        return 0;
+    }
+    for(i=0;i<builtin_maps[n].num_blocks;i++){
+        if(!memmap_add(m, &(builtin_maps[n].blocks[i]))){
+            fprintf(stderr,"Trouble allocating memory\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+    Add a block given as "<name> <start> <size> [<mask> [<flags> [<file>
+    [<file offset>]]]]" to the map. Fields are separated by blanks or commas.
+
+    @return 0 on error, after printing a message.
+*/
+int memmap_parse(t_map *m, const char *text){
+    char field[7][MAP_LINE_LEN];
+    char *copy, *p;
+    t_block b;
+    uint32_t bits;
+    int n, ok;
+
+    copy = strdup(text);
+    if(copy==NULL) return 0;
+    for(p=copy;*p;p++){
+        if(*p==',') *p = ' ';
+    }
+    n = sscanf(copy, "%1023s %1023s %1023s %1023s %1023s %1023s %1023s",
+               field[0], field[1], field[2], field[3], field[4], field[5],
+               field[6]);
+    free(copy);
+
+    memset(&b, 0, sizeof(b));
+    ok = (n>=3) &&
+         parse_number(field[1], &(b.start)) &&
+         parse_number(field[2], &(b.size)) && b.size>0 &&
+         (n<4 || strcmp(field[3], "-")==0 ||
+          parse_number(field[3], &(b.mask))) &&
+         (n<5 || parse_flags(field[4], &(b.flags))) &&
+         (n<7 || parse_number(field[6], &(b.file_offset)));
+    if(!ok || b.file_offset>=b.size){
+        fprintf(stderr,"invalid memory block '%s'\n", text);
+        return 0;
+    }
+    if(n<4 || strcmp(field[3], "-")==0){
+        /* No mirrors: decode all the bits above the block */
+        for(bits=0;bits<32 && (1ULL << bits) < b.size;bits++);
+        b.mask = (bits<32)? ~((1U << bits) - 1) : 0;
+    }
+    b.area_name = field[0];
+    b.file = (n>=6)? field[5] : NULL;
+
+    if(!memmap_add(m, &b)){
+        fprintf(stderr,"Trouble allocating memory\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+    Add the blocks listed in a memory map file to the map.
+
+    @return 0 on error, after printing a message.
+*/
+int memmap_read(t_map *m, const char *name){
+    char line[MAP_LINE_LEN];
+    char *p;
+    FILE *f;
+    uint32_t num = 0;
+
+    f = fopen(name, "r");
+    if(f==NULL){
+        fprintf(stderr,"Error opening memory map file '%s'\n", name);
+        return 0;
+    }
+    while(fgets(line, sizeof(line), f)!=NULL){
+        num++;
+        p = strpbrk(line, "#\r\n");
+        if(p!=NULL) *p = '\0';
+        for(p=line;isspace((unsigned char)*p);p++);
+        if(*p=='\0') continue;
+        if(!memmap_parse(m, p)){
+            fprintf(stderr,"  at %s:%u\n", name, num);
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+/**
+    Set the file to be loaded into block i of the map, at a given offset.
+
+    @return 0 if there's no such block or out of memory.
+*/
+int memmap_set_file(t_map *m, uint32_t i, const char *name, uint32_t offset){
+    char *file;
+
+    if(i>=m->num_blocks || offset>=m->blocks[i].size) return 0;
+    file = strdup(name);
+    if(file==NULL) return 0;
+    free(m->blocks[i].file);
+    m->blocks[i].file = file;
+    m->blocks[i].file_offset = offset;
+    return 1;
+}
+
+/** Free the blocks of the map, but not their memory. */
+void memmap_free(t_map *m){
+    uint32_t i;
+
+    for(i=0;i<m->num_blocks;i++){
+        free(m->blocks[i].area_name);
+        free(m->blocks[i].file);
+    }
+    free(m->blocks);
+    memset(m, 0, sizeof(t_map));
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Parse a decimal or 0x-prefixed hex number; returns 0 if invalid. */
+static int parse_number(const char *text, uint32_t *value){
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(text, &end, 0);
+    if(*text=='\0' || *end!='\0' || errno!=0 || v>0xffffffffUL) return 0;
+    *value = (uint32_t)v;
+    return 1;
+}
+
+/** Parse block flags "-" or any of "rct"; returns 0 if invalid. */
+static int parse_flags(const char *text, uint32_t *flags){
+    *flags = 0;
+    if(strcmp(text, "-")==0) return 1;
+    for(;*text;text++){
+        switch(*text){
+        case 'r': *flags |= MEM_READONLY; break;
+        case 'c': *flags |= MEM_CACHED; break;
+        case 't': *flags |= MEM_TEST; break;
+        default: return 0;
+        }
+    }
+    return 1;
+}
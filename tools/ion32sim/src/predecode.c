@@ -0,0 +1,194 @@
+/**
+    @file predecode.c
+    @brief Predecoded instruction cache.
+
+    Every opcode fetched from a memory block is decoded once into a t_decoded
+    record (fields plus handler function) and kept until the memory word that
+    holds it is written to. Records are kept in pages of DECODE_PAGE_SIZE bytes
+    of simulated memory which are allocated the first time code is fetched
+    from them.
+
+    Pages are located through the memory page table; fetches from pages that
+    are not plain memory (unmapped, I/O, test pattern blocks, odd block
+    geometries) are left to the caller, which will fetch and decode the
+    opcode through mem_read as the plain interpreter does.
+
+    The page index of a memory block is only allocated once code is fetched
+    from the block, so large data-only blocks cost nothing here.
+
+    Decoded instructions are also strung together into basic blocks for the
+    block engine (see run_block). A block is attached to the decoded entry of
+    its first instruction and is rebuilt whenever any decoded instruction has
+    been invalidated since it was built.
+*/
+
+#include "ion32sim.h"
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static t_decoded *predecode_page(t_state *s, uint32_t page);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/** Initialize an empty cache. Pages will be allocated on demand. */
+void predecode_init(t_state *s, uint32_t enabled, uint32_t basic_blocks){
+    memset(&(s->pd), 0, sizeof(t_predecode));
+    s->pd.enabled = enabled;
+    s->pd.basic_blocks = enabled && basic_blocks;
+    s->pd.fetch_base = NULL;
+}
+
+/** Free all the pages of the cache and their basic blocks. */
+void predecode_free(t_state *s){
+    uint32_t i, j, k;
+
+    if(s->pd.pages==NULL) return;
+    for(i=0;i<s->num_blocks;i++){
+        if(s->pd.pages[i]!=NULL){
+            for(j=0;j<s->blocks[i].size/DECODE_PAGE_SIZE;j++){
+                if(s->pd.pages[i][j]==NULL) continue;
+                for(k=0;k<DECODE_PAGE_SIZE/4;k++){
+                    free(s->pd.pages[i][j][k].bb);
+                }
+                free(s->pd.pages[i][j]);
+            }
+            free(s->pd.pages[i]);
+        }
+    }
+    free(s->pd.pages);
+    s->pd.pages = NULL;
+    s->pd.fetch_base = NULL;
+}
+
+/**
+    Get the decoded instruction at address pc, decoding it if necessary.
+
+    @return Pointer to decoded instruction or NULL if the address can't be
+            cached and must be fetched with mem_read.
+*/
+t_decoded *predecode_fetch(t_state *s, uint32_t pc){
+    uint32_t page = pc & ~(DECODE_PAGE_SIZE-1);
+    t_decoded *d;
+
+    if(page != s->pd.fetch_page || s->pd.fetch_base==NULL){
+        s->pd.fetch_base = predecode_page(s, page);
+        s->pd.fetch_page = page;
+    }
+    if(s->pd.fetch_base==NULL || (pc & 3)){
+        return NULL;
+    }
+
+    d = &(s->pd.fetch_base[(pc & (DECODE_PAGE_SIZE-1)) >> 2]);
+    if(d->handler==NULL){
+        decode_opcode(d, mem_read(s, 4, pc, 0));
+        if(s->dbg.num_breaks!=0) debug_mark(s, d, pc);
+    }
+    return d;
+}
+
+/**
+    Invalidate any decoded instructions overlapping a memory write.
+
+    @arg block Index of block being written to.
+    @arg offset Offset of write within the block.
+    @arg size Size of write in bytes.
+*/
+void predecode_invalidate(t_state *s, uint32_t block,
+                          uint32_t offset, uint32_t size){
+    t_decoded **pages;
+    t_decoded *p;
+    uint32_t w;
+
+    if(s->pd.pages==NULL) return;
+    pages = s->pd.pages[block];
+    if(pages==NULL) return;
+
+    for(w = offset >> 2; w <= ((offset + size - 1) >> 2); w++){
+        if(w*4 >= s->blocks[block].size) break;
+        p = pages[(w*4) / DECODE_PAGE_SIZE];
+        if(p!=NULL && p[w % (DECODE_PAGE_SIZE/4)].handler!=NULL){
+            p[w % (DECODE_PAGE_SIZE/4)].handler = NULL;
+            /* Any basic block might contain this instruction */
+            s->pd.gen++;
+        }
+    }
+}
+
+/**
+    Get the basic block starting at address pc, building it if necessary.
+
+    @return Pointer to basic block (which may be empty) or NULL if the
+            address can't be cached.
+*/
+t_basic_block *predecode_block(t_state *s, uint32_t pc){
+    t_decoded insn[BLOCK_MAX_INSNS];
+    t_decoded *first, *d;
+    t_basic_block *bb;
+    uint32_t n;
+
+    first = predecode_fetch(s, pc);
+    if(first==NULL) return NULL;
+    if(first->bb!=NULL && first->bb->gen==s->pd.gen){
+        return first->bb;
+    }
+
+    for(n=0;n<BLOCK_MAX_INSNS;n++){
+        d = predecode_fetch(s, pc + n*4);
+        /* Breakpoints are left to cycle(), even at the start of the block */
+        if(d==NULL || (d->flags & (DEC_SLOW | DEC_BREAK))) break;
+        if(n>0 && (insn[n-1].flags & DEC_BRANCH)){
+            /* Delay slot closes the block; a branch in it is left to cycle */
+            if(!(d->flags & DEC_BRANCH)){
+                insn[n++] = *d;
+            }
+            break;
+        }
+        insn[n] = *d;
+    }
+    /* Don't leave a branch without its delay slot at the end of the block */
+    if(n>0 && (insn[n-1].flags & DEC_BRANCH)){
+        n--;
+    }
+
+    bb = realloc(first->bb, sizeof(t_basic_block) + n*sizeof(t_decoded));
+    if(bb==NULL) return NULL;
+    bb->start = pc;
+    bb->gen = s->pd.gen;
+    bb->count = n;
+    memcpy(bb->insn, insn, n*sizeof(t_decoded));
+    first->bb = bb;
+    return bb;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Return decoded page for a given address page, or NULL if not cacheable. */
+static t_decoded *predecode_page(t_state *s, uint32_t page){
+    const t_mem_page *p = &(s->mem_pages[page >> MEM_PAGE_SHIFT]);
+    uint32_t j;
+
+    /* Only plain memory pages can be cached; mirrors share the entries */
+    if(p->mem==NULL){
+        return NULL;
+    }
+
+    if(s->pd.pages==NULL){
+        s->pd.pages = calloc(s->num_blocks, sizeof(t_decoded**));
+        if(s->pd.pages==NULL) return NULL;
+    }
+    if(s->pd.pages[p->block]==NULL){
+        s->pd.pages[p->block] = calloc(s->blocks[p->block].size / DECODE_PAGE_SIZE,
+                                       sizeof(t_decoded*));
+        if(s->pd.pages[p->block]==NULL) return NULL;
+    }
+    j = p->offset / DECODE_PAGE_SIZE;
+    if(s->pd.pages[p->block][j]==NULL){
+        s->pd.pages[p->block][j] = calloc(DECODE_PAGE_SIZE/4, sizeof(t_decoded));
+        /* From now on other cores must tell us about their writes to it */
+        if(s->smp!=NULL) smp_code_page(s, p->block, j);
+    }
+    return s->pd.pages[p->block][j];
+}
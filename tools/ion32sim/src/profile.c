@@ -0,0 +1,354 @@
+/**
+    @file profile.c
+    @brief Guest code profiler.
+
+    Counts the instructions executed at each address and the instructions
+    executed under each distinct call stack, without touching the simulated
+    program. Collection is just counter increments so it can be left on for
+    whole regression runs; everything else is done when the profile is
+    written at the end of the simulation.
+
+    Counts per address are kept in pages allocated the first time code runs
+    from them, located through a table indexed by address page.
+
+    The call stacks are kept as a tree of t_prof_node, one node per distinct
+    stack, and the profiler keeps track of the node of the current stack.
+    log_call and log_ret move it down to a child node or back up to the
+    parent, respectively, so the shadow stack follows the same calls and
+    returns as the call trace: JAL/JALR/BAL calls and 'jr ra' returns.
+    Exceptions and ERET are not calls or returns, so handler code is
+    accounted to the stack that was interrupted.
+
+    At the end of the simulation two files are written:
+
+    - A flat profile with the instructions executed in each function and the
+      hottest instructions, to the given file name.
+    - The folded stacks ("main;foo;bar 1234" lines) to the same file name
+      with ".folded" appended, ready for flamegraph.pl and the like.
+
+    Function names are looked up in the function map. Addresses with no
+    function are shown in hex.
+*/
+
+#include "ion32sim.h"
+
+
+/** Max depth of the shadow call stack; deeper calls count as the deepest */
+#define PROFILE_MAX_DEPTH   (1024)
+/** Number of entries in the list of hottest instructions */
+#define PROFILE_HOT_INSNS   (20)
+/** Counters in a page of the per-address histogram */
+#define PROFILE_PAGE_INSNS  (MEM_PAGE_SIZE / 4)
+/** Max length of a line of the folded stacks file */
+#define PROFILE_STACK_LEN   (PROFILE_MAX_DEPTH * 32)
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+/** Node of the call tree: a distinct call stack */
+struct s_prof_node {
+    uint32_t address;               /**< called address */
+    uint64_t count;                 /**< instructions run with this stack */
+    t_prof_node *parent;
+    t_prof_node *child;             /**< first of the children list */
+    t_prof_node *sibling;           /**< next in the parent's children */
+};
+
+struct s_profile {
+    uint64_t **pages;               /**< per-address counters, by page */
+    t_prof_node root;               /**< stack at the start of the run */
+    t_prof_node *node;              /**< current stack */
+    uint32_t depth;                 /**< depth of current stack */
+    uint32_t overflow;              /**< calls beyond PROFILE_MAX_DEPTH */
+};
+
+/** Instruction count of a function in the flat profile */
+typedef struct s_prof_entry {
+    uint64_t count;
+    int32_t fn;                     /**< index in function map or -1 */
+    uint32_t address;               /**< address if fn<0 */
+} t_prof_entry;
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void write_flat(t_profile *p, FILE *f, const t_map_info *map);
+static void write_folded(t_prof_node *n, FILE *f, const t_map_info *map,
+                         char *stack, size_t len);
+static size_t frame_name(char *buf, size_t size, uint32_t address,
+                         const t_map_info *map);
+static void free_nodes(t_prof_node *n);
+static int compare_entries(const void *a, const void *b);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Start profiling a run that starts at the given address.
+
+    @return Profiler or NULL if out of memory.
+*/
+t_profile *profile_open(uint32_t start_address){
+    t_profile *p;
+
+    p = calloc(1, sizeof(t_profile));
+    if(p==NULL) return NULL;
+    p->pages = calloc(MEM_NUM_PAGES, sizeof(uint64_t *));
+    if(p->pages==NULL){
+        free(p);
+        return NULL;
+    }
+    p->root.address = start_address;
+    p->node = &(p->root);
+    return p;
+}
+
+/**
+    Count a straight run of instructions starting at 'pc'.
+    If the stack changed on the way (a call or return and its delay slot
+    ended the run), all but the last instruction go to stack 'node'.
+*/
+void profile_insns(t_profile *p, uint32_t pc, uint32_t n,
+                   t_prof_node *node){
+    uint64_t *page = NULL;
+    uint32_t i;
+
+    if(n==0) return;
+    if(node!=p->node){
+        node->count += n - 1;
+        p->node->count++;
+    }
+    else{
+        node->count += n;
+    }
+
+    for(i=0;i<n;i++, pc+=4){
+        if(page==NULL || (pc & (MEM_PAGE_SIZE-1))==0){
+            page = p->pages[pc >> MEM_PAGE_SHIFT];
+            if(page==NULL){
+                page = calloc(PROFILE_PAGE_INSNS, sizeof(uint64_t));
+                if(page==NULL) return;
+                p->pages[pc >> MEM_PAGE_SHIFT] = page;
+            }
+        }
+        page[(pc & (MEM_PAGE_SIZE-1)) >> 2]++;
+    }
+}
+
+/** Current stack, to be passed to profile_insns later. */
+t_prof_node *profile_node(t_profile *p){
+    return p->node;
+}
+
+/** Push a call to 'to' on the shadow stack. */
+void profile_call(t_profile *p, uint32_t to){
+    t_prof_node *n, *prev = NULL;
+
+    if(p->depth >= PROFILE_MAX_DEPTH){
+        p->overflow++;
+        return;
+    }
+    for(n=p->node->child;n!=NULL;prev=n, n=n->sibling){
+        if(n->address==to) break;
+    }
+    if(n==NULL){
+        n = calloc(1, sizeof(t_prof_node));
+        if(n==NULL) return;
+        n->address = to;
+        n->parent = p->node;
+        n->sibling = p->node->child;
+        p->node->child = n;
+    }
+    else if(prev!=NULL){
+        /* Move to the front of the list, calls tend to repeat */
+        prev->sibling = n->sibling;
+        n->sibling = p->node->child;
+        p->node->child = n;
+    }
+    p->node = n;
+    p->depth++;
+}
+
+/** Pop the last call from the shadow stack, if any. */
+void profile_ret(t_profile *p){
+    if(p->overflow>0){
+        p->overflow--;
+    }
+    else if(p->node->parent!=NULL){
+        p->node = p->node->parent;
+        p->depth--;
+    }
+}
+
+/**
+    Write the flat profile and the folded stacks.
+
+    @return 0 if the files could not be written, after printing a message.
+*/
+int profile_write(t_profile *p, const char *name, const t_map_info *map){
+    FILE *f;
+    char *folded_name;
+    char *stack;
+    int ok = 1;
+
+    f = fopen(name, "w");
+    if(f==NULL){
+        fprintf(stderr, "Error opening profile file '%s'\n", name);
+        return 0;
+    }
+    write_flat(p, f, map);
+    fclose(f);
+
+    folded_name = malloc(strlen(name) + sizeof(".folded"));
+    stack = malloc(PROFILE_STACK_LEN);
+    if(folded_name==NULL || stack==NULL){
+        free(folded_name);
+        free(stack);
+        return 0;
+    }
+    sprintf(folded_name, "%s.folded", name);
+    f = fopen(folded_name, "w");
+    if(f==NULL){
+        fprintf(stderr, "Error opening profile file '%s'\n", folded_name);
+        ok = 0;
+    }
+    else{
+        write_folded(&(p->root), f, map, stack, 0);
+        fclose(f);
+    }
+    free(folded_name);
+    free(stack);
+    return ok;
+}
+
+/** Free the profiler. */
+void profile_close(t_profile *p){
+    uint32_t i;
+
+    if(p==NULL) return;
+    for(i=0;i<MEM_NUM_PAGES;i++){
+        free(p->pages[i]);
+    }
+    free(p->pages);
+    free_nodes(p->root.child);
+    free(p);
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+static void write_flat(t_profile *p, FILE *f, const t_map_info *map){
+    t_prof_entry *fns, hot[PROFILE_HOT_INSNS+1];
+    uint32_t i, j, k, num_fns, num_hot = 0;
+    uint64_t total = 0, count;
+    int32_t fn;
+    char name[256];
+
+    /* Per function totals; last entry is for addresses with no function */
+    num_fns = map->num_functions + 1;
+    fns = calloc(num_fns, sizeof(t_prof_entry));
+    if(fns==NULL) return;
+    for(i=0;i<num_fns;i++){
+        fns[i].fn = (i < map->num_functions)? (int32_t)i : -1;
+    }
+
+    for(i=0;i<MEM_NUM_PAGES;i++){
+        if(p->pages[i]==NULL) continue;
+        for(j=0;j<PROFILE_PAGE_INSNS;j++){
+            count = p->pages[i][j];
+            if(count==0) continue;
+            total += count;
+            fn = map_find_function(map, (i << MEM_PAGE_SHIFT) | (j << 2));
+            fns[fn>=0? (uint32_t)fn : num_fns-1].count += count;
+
+            /* Insertion into the sorted list of hottest instructions */
+            for(k=num_hot;k>0 && hot[k-1].count < count;k--){
+                hot[k] = hot[k-1];
+            }
+            if(k < PROFILE_HOT_INSNS){
+                hot[k].count = count;
+                hot[k].fn = fn;
+                hot[k].address = (i << MEM_PAGE_SHIFT) | (j << 2);
+                if(num_hot < PROFILE_HOT_INSNS) num_hot++;
+            }
+        }
+    }
+    if(total==0) total = 1;
+
+    qsort(fns, num_fns, sizeof(t_prof_entry), compare_entries);
+    fprintf(f, "Flat profile, %llu instructions:\n\n",
+            (unsigned long long)total);
+    fprintf(f, "     %%   instructions  function\n");
+    for(i=0;i<num_fns && fns[i].count>0;i++){
+        fprintf(f, "%6.2f %14llu  %s\n",
+                100.0 * fns[i].count / total,
+                (unsigned long long)fns[i].count,
+                fns[i].fn>=0? map->fn[fns[i].fn].name : "(unknown)");
+    }
+
+    fprintf(f, "\nHottest instructions:\n\n");
+    fprintf(f, "     %%   instructions  address   function\n");
+    for(i=0;i<num_hot;i++){
+        frame_name(name, sizeof(name), hot[i].address, map);
+        fprintf(f, "%6.2f %14llu  %08x  %s\n",
+                100.0 * hot[i].count / total,
+                (unsigned long long)hot[i].count, hot[i].address,
+                hot[i].fn>=0? name : "");
+    }
+    free(fns);
+}
+
+/** Write a line for every stack with instructions, depth first. */
+static void write_folded(t_prof_node *n, FILE *f, const t_map_info *map,
+                         char *stack, size_t len){
+    t_prof_node *c;
+
+    if(len > 0 && len < PROFILE_STACK_LEN - 2){
+        stack[len++] = ';';
+    }
+    len += frame_name(stack + len, PROFILE_STACK_LEN - len, n->address, map);
+    if(n->count > 0){
+        fprintf(f, "%.*s %llu\n", (int)len, stack,
+                (unsigned long long)n->count);
+    }
+    for(c=n->child;c!=NULL;c=c->sibling){
+        write_folded(c, f, map, stack, len);
+    }
+}
+
+/** Name of the function at an address, or the address in hex. */
+static size_t frame_name(char *buf, size_t size, uint32_t address,
+                         const t_map_info *map){
+    int32_t i = map_find_function(map, address);
+    int len;
+
+    if(size < 2) return 0;
+    if(i>=0){
+        len = snprintf(buf, size - 1, "%s", map->fn[i].name);
+    }
+    else{
+        len = snprintf(buf, size - 1, "0x%08x", address);
+    }
+    return (len < 0)? 0 : ((size_t)len < size - 1)? (size_t)len : size - 2;
+}
+
+static void free_nodes(t_prof_node *n){
+    t_prof_node *next;
+
+    while(n!=NULL){
+        next = n->sibling;
+        free_nodes(n->child);
+        free(n);
+        n = next;
+    }
+}
+
+/** Order by decreasing count, then by function. */
+static int compare_entries(const void *a, const void *b){
+    const t_prof_entry *ea = a, *eb = b;
+
+    if(ea->count != eb->count){
+        return (ea->count > eb->count)? -1 : 1;
+    }
+    return (ea->fn < eb->fn)? -1 : (ea->fn > eb->fn);
+}
@@ -0,0 +1,124 @@
+/**
+    @file sched.c
+    @brief Discrete-event scheduler.
+
+    Anything that has to happen at a given point of simulated time (timer
+    interrupts, HW interrupts injected through TB_HW_IRQ, polls of the UART
+    source...) is queued here as an event, instead of being counted down or
+    polled on every instruction.
+
+    Simulated time is the instruction count s->insn_count, which counts the
+    slots dropped after traps and ERET as well. An event due at time T runs
+    right before the instruction that brings insn_count to T+1 is executed.
+    cycle() runs the due events before each instruction, and run_block()
+    leaves a basic block as soon as an event is due, so the only work done
+    per instruction is a comparison with the time of the first event.
+
+    The queue is a small array kept sorted by time, so the first event is
+    always events[0]. There can be only one event of each kind pending:
+    scheduling an event replaces any pending event of the same kind. Events
+    are identified by kind rather than by a function pointer so that the
+    queue can be saved to a checkpoint.
+*/
+
+#include "ion32sim.h"
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/** Event handlers, by t_event_kind */
+static const t_event_handler handlers[NUM_EVENT_KINDS] = {
+    hw_irq_event,
+    timer_event,
+    uart_poll_event,
+    device_tick_event,
+    gdb_poll_event,
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void sched_remove(t_sched *q, uint32_t i);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/** Empty the event queue. */
+void sched_init(t_sched *q){
+    q->num_events = 0;
+    q->next = SCHED_NEVER;
+}
+
+/**
+    Schedule an event of a kind at a time, replacing any pending event of
+    the same kind.
+
+    @arg time Value of s->insn_count the event is due at.
+    @arg arg Argument passed to the event handler.
+*/
+void sched_at(t_state *s, t_event_kind kind, uint64_t time, uint32_t arg){
+    t_sched *q = &(s->sched);
+    uint32_t i;
+
+    sched_cancel(s, kind);
+    assert(q->num_events < SCHED_MAX_EVENTS);
+
+    /* Insertion into the sorted queue, after the events due at same time */
+    for(i=q->num_events;i>0 && q->events[i-1].time > time;i--){
+        q->events[i] = q->events[i-1];
+    }
+    q->events[i].time = time;
+    q->events[i].kind = kind;
+    q->events[i].arg = arg;
+    q->num_events++;
+    q->next = q->events[0].time;
+}
+
+/** Remove the pending event of a kind, if any. */
+void sched_cancel(t_state *s, t_event_kind kind){
+    t_sched *q = &(s->sched);
+    uint32_t i;
+
+    for(i=0;i<q->num_events;i++){
+        if(q->events[i].kind==kind){
+            sched_remove(q, i);
+            break;
+        }
+    }
+}
+
+/** Return !=0 if an event of the kind is pending. */
+uint32_t sched_pending(t_state *s, t_event_kind kind){
+    t_sched *q = &(s->sched);
+    uint32_t i;
+
+    for(i=0;i<q->num_events;i++){
+        if(q->events[i].kind==kind) return 1;
+    }
+    return 0;
+}
+
+/**
+    Run all the events that are due, in order. Events scheduled by the
+    handlers run too if they are due already.
+*/
+void sched_run(t_state *s){
+    t_sched *q = &(s->sched);
+    t_event e;
+
+    while(q->num_events>0 && q->events[0].time <= s->insn_count){
+        e = q->events[0];
+        sched_remove(q, 0);
+        handlers[e.kind](s, e.arg);
+    }
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+static void sched_remove(t_sched *q, uint32_t i){
+    q->num_events--;
+    memmove(&(q->events[i]), &(q->events[i+1]),
+            (q->num_events - i) * sizeof(t_event));
+    q->next = q->num_events? q->events[0].time : SCHED_NEVER;
+}
@@ -0,0 +1,736 @@
+/**
+    @file setup.c
+    @brief Simulation setup shared by the ion32sim program and libion32sim.
+
+    Command line parsing, loading of object code and map files, execution log
+    and call trace setup. Everything a program embedding the simulator needs
+    to get a CPU ready to run, other than the interactive debug monitor which
+    is in main.c.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "ion32sim.h"
+
+/*---- Local macros ----------------------------------------------------------*/
+
+/** Number of memory blocks that --bram, --xram and --flash can load */
+#define NUM_BIN_FILES       (4)
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+/* Command line */
+static void usage(FILE *f);
+static int cmd_line_error(t_args *args);
+#ifdef ENABLE_CACHE
+static int parse_cache_config(const char *arg, t_cache_config *cfg);
+#endif
+/* Function map */
+static int32_t read_map_file(char *filename, t_map_info* map);
+static void print_function(t_map_info *map, uint32_t address, int32_t i);
+/* Binary handling */
+static void reverse_endianess(uint8_t *data, uint32_t bytes);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/*-- Call & ret tracing (EARLY DRAFT) --*/
+
+/** */
+void log_call(t_state *s, uint32_t to, uint32_t from){
+    t_map_info *map = &(s->map);
+    int32_t i,j;
+
+    if(s->prof!=NULL){
+        profile_call(s->prof, to);
+    }
+
+    /* If no map file has been loaded, skip trace */
+    if((!map->num_functions) || (!map->log)) return;
+
+    i = map_find_function(map, to);
+    if(i>=0){
+        map->call_depth++;
+        fprintf(map->log, "[%08x]  ", from);
+        for(j=0;j<map->call_depth;j++){
+            fprintf(map->log, ". ");
+        }
+        print_function(map, to, i);
+        fprintf(map->log, "{\n");
+    }
+}
+
+
+void log_ret(t_state *s, uint32_t to, uint32_t from){
+    t_map_info *map = &(s->map);
+    int32_t i,j;
+
+    if(s->prof!=NULL){
+        profile_ret(s->prof);
+    }
+
+    /* If no map file has been loaded, skip trace */
+    if((!map->num_functions) || (!map->log)) return;
+
+    if(map->call_depth>0){
+        fprintf(map->log, "[%08x]  ", from);
+        for(j=0;j<map->call_depth;j++){
+            fprintf(map->log, ". ");
+        }
+        fprintf(map->log, "}\n");
+        map->call_depth--;
+    }
+    else{
+        i = map_find_function(map, to);
+        if(i>=0){
+            fprintf(map->log, "[%08x]  ", from);
+            print_function(map, to, i);
+            fprintf(map->log, "\n");
+        }
+        else{
+            fprintf(map->log, "[%08x]  %08x\n", from, to);
+        }
+    }
+}
+
+/*-- Debug helps --*/
+
+
+void init_trace_buffer(t_state *s, t_args *args){
+    int i;
+
+    /* setup misc info related to the monitor interface */
+    s->t.disasm_ptr = VECTOR_RESET;
+
+#if FILE_LOGGING_DISABLED
+    s->t.log = NULL;
+    s->t.log_triggered = 0;
+    s->map.log = NULL;
+    return;
+#else
+    /* clear trace buffer */
+    for(i=0;i<TRACE_BUFFER_SIZE;i++){
+        s->t.buf[i]=0xffffffff;
+    }
+    s->t.next = 0;
+
+    /* if file logging is enabled, open log file */
+    if(args->log_file_name!=NULL){
+        if(!log_open(s, args->log_file_name,
+                     (args->log_binary? LOG_OPEN_BINARY : 0) |
+                     (args->log_compress? LOG_OPEN_COMPRESS : 0) |
+                     (args->log_async? LOG_OPEN_ASYNC : 0))){
+            fprintf(stderr,"Error opening log file '%s', file logging disabled\n",
+                    args->log_file_name);
+        }
+    }
+    else{
+        s->t.log = NULL;
+    }
+
+    /* Setup log trigger */
+    s->t.log_triggered = 0;
+    s->t.log_trigger_address = args->log_trigger_address;
+
+    /* Start profiler if requested */
+    if(args->profile_filename!=NULL){
+        s->prof = profile_open(args->start_addr);
+        if(s->prof==NULL){
+            fprintf(stderr,"Trouble allocating memory, profiling disabled\n");
+        }
+    }
+
+    /* if file logging of function calls is enabled, open log file */
+    if(args->trace_log_filename!=NULL){
+        s->map.log = fopen(args->trace_log_filename, "w");
+        if(s->map.log==NULL){
+            fprintf(stderr,"Error opening log file '%s', file logging disabled\n",
+                    args->trace_log_filename);
+        }
+    }
+    else{
+        s->map.log = stdout;
+    }
+#endif
+}
+
+/** Dumps last jump targets as a chunk of hex numbers (older is left top) */
+void dump_trace_buffer(t_state *s){
+    int i, col;
+
+    for(i=0, col=0;i<TRACE_BUFFER_SIZE;i++, col++){
+        printf("%08x ", s->t.buf[s->t.next + i]);
+        if((col % 8)==7){
+            printf("\n");
+        }
+    }
+}
+
+
+/** Frees debug buffers and closes log file, writing the profile if any */
+void close_trace_buffer(t_state *s){
+    log_close(s);
+    if(s->prof!=NULL){
+        profile_write(s->prof, s->args.profile_filename, &(s->map));
+        profile_close(s->prof);
+        s->prof = NULL;
+    }
+    if(s->map.log!=NULL && s->map.log!=stdout){
+        fclose(s->map.log);
+    }
+    s->map.log = NULL;
+    map_free(&(s->map));
+}
+
+/*-- Binary file handling --*/
+
+
+/** Read binary code and data files; returns 0 on error. */
+int read_binary_files(t_state *s, t_args *args){
+    FILE *in;
+    t_block *b;
+    uint8_t *target;
+    uint32_t bytes=0, i, files_read=0, entry;
+
+    /* read map file if requested, or else the ELF symbols, if any */
+    if(args->map_filename!=NULL){
+        if(read_map_file(args->map_filename, &(s->map))<0){
+            printf("Trouble reading map file '%s', quitting!\n",
+                   args->map_filename);
+            return 0;
+        }
+        printf("Read %d functions from the map file; call trace enabled.\n\n",
+               s->map.num_functions);
+    }
+    else if(args->elf_filename!=NULL){
+        if(elf_read_functions(args->elf_filename, &(s->map))>0){
+            map_sort(&(s->map));
+            printf("Read %d functions from the ELF file; call trace enabled.\n\n",
+                   s->map.num_functions);
+        }
+    }
+
+    /* read object code binaries */
+    for(i=0;i<s->num_blocks;i++){
+        b = &(s->blocks[i]);
+        bytes = 0;
+        if(b->file!=NULL){
+
+            in = fopen(b->file, "rb");
+            if(in == NULL){
+                printf("Can't open file %s, quitting!\n", b->file);
+                free_cpu(s);
+                return(0);
+            }
+
+            /* FIXME load offset 0x2000 for linux kernel hardcoded! */
+            target = (uint8_t *)(b->mem + b->file_offset);
+            bytes = fread(target, 1, b->size - b->file_offset, in);
+            if(ferror(in)){
+                printf("ERROR: file load failed with code %d ('%s')\n",
+                    errno, strerror(errno));
+                fclose(in);
+                free_cpu(s);
+                return 0;
+            }
+            if(fgetc(in)!=EOF){
+                printf("WARNING: file %s does not fit in %s, truncated.\n",
+                       b->file, b->area_name);
+            }
+
+            fclose(in);
+
+            /* Now reverse the endianness of the data we just read, if it's
+             necessary. */
+             /* FIXME handle little-endian stuff (?) */
+            //reverse_endianess(target, bytes);
+
+            files_read++;
+        }
+        fprintf(stderr,"%-16s [size= %6dKB, start= 0x%08x] loaded %d bytes.\n",
+                b->area_name,
+                b->size/1024,
+                b->start,
+                bytes);
+    }
+
+    /* load ELF file, which may override the start address */
+    if(args->elf_filename!=NULL){
+        if(elf_load(s, args->elf_filename, &entry)<0){
+            free_cpu(s);
+            return 0;
+        }
+        if(!args->start_addr_given){
+            args->start_addr = entry;
+        }
+        files_read++;
+    }
+
+    if(!files_read && args->restore_filename==NULL){
+        free_cpu(s);
+        fprintf(stderr,"No binary object files read, quitting\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*-- Command line arguments --*/
+
+/**
+    Parse command line.
+
+    @return 1 if the simulation can go on, 0 if the usage text was asked
+            for and shown, or -1 on error after printing a message.
+*/
+int parse_cmd_line(uint32_t argc, char **argv, t_args *args){
+    /* Files given with --bram, --xram, --kernel and --flash, by block */
+    char *bin_filename[NUM_BIN_FILES] = {NULL};
+    uint32_t bin_offset[NUM_BIN_FILES] = {0};
+    uint32_t i;
+
+    /* fill cmd line args with default values */
+    args->memory_map = MAP_DEFAULT;
+    args->trap_on_reserved = 0;
+    args->stop_on_unimplemented = 0;
+    args->emulate_some_mips32 = 1;
+    args->timer_prescaler = DEFAULT_TIMER_PRESCALER;
+    args->start_addr = VECTOR_RESET;
+    args->start_addr_given = 0;
+    args->elf_filename = NULL;
+    args->do_unaligned = 0;
+    args->no_prompt = 0;
+    args->predecode = 1;
+    args->basic_blocks = 1;
+    args->breakpoint = 0xffffffff;
+    args->log_file_name = NULL;
+    args->checkpoint_filename = NULL;
+    args->restore_filename = NULL;
+    args->log_binary = 0;
+    args->log_compress = 0;
+    args->log_async = 0;
+    args->log_trigger_address = VECTOR_RESET;
+    args->map_filename = NULL;
+    args->trace_log_filename = NULL;
+    args->conout_filename = NULL;
+    args->uart_source = NULL;
+    args->gdb_spec = NULL;
+    args->profile_filename = NULL;
+    args->timing = 0;
+    args->code_wait_states = 0;
+    args->data_wait_states = 0;
+    args->num_cores = 1;
+    args->quantum = SMP_DEFAULT_QUANTUM;
+    args->parallel = 0;
+#ifdef ENABLE_CACHE
+    memset(&(args->icache), 0, sizeof(t_cache_config));
+    memset(&(args->dcache), 0, sizeof(t_cache_config));
+#endif
+    memset(&(args->mem_map), 0, sizeof(t_map));
+    args->num_device_specs = 0;
+
+    /* parse actual cmd line args */
+    for(i=1;i<argc;i++){
+        if(strncmp(argv[i],"--memory=", strlen("--memory="))==0){
+            args->memory_map = atoi(&(argv[i][strlen("--memory=")]));
+            /* FIXME selecting uClinux enables unaligned L/S emulation */
+            if (args->memory_map == MAP_UCLINUX){
+                args->do_unaligned = 1;
+            }
+        }
+        else if(strcmp(argv[i],"--unaligned")==0){
+            args->do_unaligned = 1;
+        }
+        else if(strcmp(argv[i],"--noprompt")==0){
+            args->no_prompt = 1;
+        }
+        else if(strcmp(argv[i],"--nopredecode")==0){
+            args->predecode = 0;
+        }
+        else if(strcmp(argv[i],"--noblocks")==0){
+            args->basic_blocks = 0;
+        }
+        else if(strcmp(argv[i],"--stop_on_unimplemented")==0){
+            args->stop_on_unimplemented = 1;
+        }
+        else if(strcmp(argv[i],"--notrap")==0){
+            args->trap_on_reserved = 0;
+        }
+        else if(strcmp(argv[i],"--nomips32")==0){
+            args->emulate_some_mips32 = 0;
+        }
+        // FIXME simplify object code file options
+        else if(strncmp(argv[i],"--bram=", strlen("--bram="))==0){
+            bin_filename[0] = &(argv[i][strlen("--bram=")]);
+        }
+        else if(strncmp(argv[i],"--flash=", strlen("--flash="))==0){
+            bin_filename[3] = &(argv[i][strlen("--flash=")]);
+        }
+        else if(strncmp(argv[i],"--xram=", strlen("--xram="))==0){
+            bin_filename[1] = &(argv[i][strlen("--xram=")]);
+        }
+        else if(strncmp(argv[i],"--memmap=", strlen("--memmap="))==0){
+            if(!memmap_read(&(args->mem_map),
+                            &(argv[i][strlen("--memmap=")]))){
+                return cmd_line_error(args);
+            }
+        }
+        else if(strncmp(argv[i],"--region=", strlen("--region="))==0){
+            if(!memmap_parse(&(args->mem_map),
+                             &(argv[i][strlen("--region=")]))){
+                return cmd_line_error(args);
+            }
+        }
+        else if(strncmp(argv[i],"--device=", strlen("--device="))==0){
+            if(args->num_device_specs >= MAX_DEVICE_PLUGINS){
+                fprintf(stderr,"No more than %d --device options\n",
+                        MAX_DEVICE_PLUGINS);
+                return cmd_line_error(args);
+            }
+            args->device_specs[args->num_device_specs++] =
+                &(argv[i][strlen("--device=")]);
+        }
+        else if(strncmp(argv[i],"--elf=", strlen("--elf="))==0){
+            args->elf_filename = &(argv[i][strlen("--elf=")]);
+        }
+        else if(strncmp(argv[i],"--map=", strlen("--map="))==0){
+            args->map_filename = &(argv[i][strlen("--map=")]);
+        }
+        else if(strncmp(argv[i],"--trace_log=", strlen("--trace_log="))==0){
+            args->trace_log_filename = &(argv[i][strlen("--trace_log=")]);
+        }
+        else if(strncmp(argv[i],"--log=", strlen("--log="))==0){
+            args->log_file_name = &(argv[i][strlen("--log=")]);
+        }
+        else if(strcmp(argv[i],"--binlog")==0){
+            args->log_binary = 1;
+        }
+        else if(strcmp(argv[i],"--gzlog")==0){
+            args->log_compress = 1;
+        }
+        else if(strcmp(argv[i],"--async_log")==0){
+            args->log_async = 1;
+        }
+        else if(strncmp(argv[i],"--uart=", strlen("--uart="))==0){
+            args->uart_source = &(argv[i][strlen("--uart=")]);
+            if(strcmp(args->uart_source, "console")==0){
+                args->uart_source = NULL;
+            }
+        }
+        else if(strncmp(argv[i],"--gdb=", strlen("--gdb="))==0){
+            args->gdb_spec = &(argv[i][strlen("--gdb=")]);
+        }
+        else if(strncmp(argv[i],"--conout=", strlen("--flash="))==0){
+            args->conout_filename = &(argv[i][strlen("--conout=")]);
+        }
+        else if(strncmp(argv[i],"--start=", strlen("--start="))==0){
+            sscanf(&(argv[i][strlen("--start=")]), "%x", &(args->start_addr));
+            args->start_addr_given = 1;
+        }
+        else if(strncmp(argv[i],"--kernel=", strlen("--kernel="))==0){
+            bin_filename[1] = &(argv[i][strlen("--kernel=")]);
+            /* FIXME uClinux kernel 'offset' hardcoded */
+            bin_offset[1] = 0x2000;
+        }
+        else if(strncmp(argv[i],"--trigger=", strlen("--trigger="))==0){
+            sscanf(&(argv[i][strlen("--trigger=")]), "%x", &(args->log_trigger_address));
+        }
+        else if(strncmp(argv[i],"--break=", strlen("--break="))==0){
+            sscanf(&(argv[i][strlen("--break=")]), "%x", &(args->breakpoint));
+        }
+        else if(strncmp(argv[i],"--breakpoint=", strlen("--breakpoint="))==0){
+            sscanf(&(argv[i][strlen("--breakpoint=")]), "%x", &(args->breakpoint));
+        }
+        else if(strcmp(argv[i],"--timing")==0){
+            args->timing = 1;
+        }
+        else if(strncmp(argv[i],"--wait_states=", strlen("--wait_states="))==0){
+            sscanf(&(argv[i][strlen("--wait_states=")]), "%u,%u",
+                   &(args->code_wait_states), &(args->data_wait_states));
+            args->timing = 1;
+        }
+#ifdef ENABLE_CACHE
+        else if(strncmp(argv[i],"--icache=", strlen("--icache="))==0){
+            if(!parse_cache_config(&(argv[i][strlen("--icache=")]),
+                                   &(args->icache))){
+                return cmd_line_error(args);
+            }
+        }
+        else if(strncmp(argv[i],"--dcache=", strlen("--dcache="))==0){
+            if(!parse_cache_config(&(argv[i][strlen("--dcache=")]),
+                                   &(args->dcache))){
+                return cmd_line_error(args);
+            }
+        }
+#endif
+        else if(strncmp(argv[i],"--cores=", strlen("--cores="))==0){
+            args->num_cores = atoi(&(argv[i][strlen("--cores=")]));
+            if(args->num_cores<1 || args->num_cores>SMP_MAX_CORES){
+                fprintf(stderr,"--cores must be 1 to %d\n", SMP_MAX_CORES);
+                return cmd_line_error(args);
+            }
+        }
+        else if(strncmp(argv[i],"--quantum=", strlen("--quantum="))==0){
+            args->quantum = atoi(&(argv[i][strlen("--quantum=")]));
+            if(args->quantum<1) args->quantum = 1;
+        }
+        else if(strcmp(argv[i],"--parallel")==0){
+            args->parallel = 1;
+        }
+        else if(strncmp(argv[i],"--profile=", strlen("--profile="))==0){
+            args->profile_filename = &(argv[i][strlen("--profile=")]);
+        }
+        else if(strncmp(argv[i],"--checkpoint=", strlen("--checkpoint="))==0){
+            args->checkpoint_filename = &(argv[i][strlen("--checkpoint=")]);
+        }
+        else if(strncmp(argv[i],"--restore=", strlen("--restore="))==0){
+            args->restore_filename = &(argv[i][strlen("--restore=")]);
+        }
+        else if((strcmp(argv[i],"--help")==0)||(strcmp(argv[i],"-h")==0)){
+            usage(stdout);
+            memmap_free(&(args->mem_map));
+            return 0;
+        }
+        else{
+            fprintf(stderr,"unknown argument '%s'\n\n",argv[i]);
+            usage(stderr);
+            return cmd_line_error(args);
+        }
+    }
+
+    if(args->num_cores>1 &&
+       (args->checkpoint_filename!=NULL || args->restore_filename!=NULL)){
+        fprintf(stderr,"Checkpoints are not supported with --cores\n");
+        return cmd_line_error(args);
+    }
+    if(args->num_cores>1 && args->gdb_spec!=NULL){
+        fprintf(stderr,"--gdb is not supported with --cores\n");
+        return cmd_line_error(args);
+    }
+
+    /* Use the built-in memory map unless one was given */
+    if(args->mem_map.num_blocks==0 &&
+       !memmap_builtin(&(args->mem_map), args->memory_map)){
+        return cmd_line_error(args);
+    }
+    for(i=0;i<NUM_BIN_FILES;i++){
+        if(bin_filename[i]!=NULL &&
+           !memmap_set_file(&(args->mem_map), i, bin_filename[i],
+                            bin_offset[i])){
+            fprintf(stderr,"No memory block %u to load '%s' into\n",
+                    i, bin_filename[i]);
+            return cmd_line_error(args);
+        }
+    }
+    return 1;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+static void usage(FILE *out){
+    fprintf(out,"Usage:");
+    fprintf(out,"    ion32sim file.exe [arguments]\n");
+    fprintf(out,"Arguments:\n");
+    fprintf(out,"--bram=<file name>      : BRAM initialization file\n");
+    fprintf(out,"--xram=<file name>      : XRAM initialization file\n");
+    fprintf(out,"--kernel=<file name>    : XRAM initialization file for uClinux kernel\n");
+    fprintf(out,"                          (loads at block offset 0x2000)\n");
+    fprintf(out,"--flash=<file name>     : FLASH initialization file\n");
+    fprintf(out,"--elf=<file name>       : ELF executable, loaded at the physical\n");
+    fprintf(out,"                          address of each segment; starts at its\n");
+    fprintf(out,"                          entry point and supplies the symbols\n");
+    fprintf(out,"                          for tracing if there's no map file\n");
+    fprintf(out,"--map=<file name>       : Map file to be used for tracing, if any\n");
+    fprintf(out,"--trace_log=<file name> : Log file used for tracing, if any\n");
+    fprintf(out,"--log=<file name>       : Execution log file (default sw_sim_log.txt)\n");
+    fprintf(out,"--binlog                : Write execution log as binary records\n");
+    fprintf(out,"                          (default file sw_sim_log.bin), to be\n");
+    fprintf(out,"                          rendered as text with ion32log\n");
+    fprintf(out,"--gzlog                 : Compress execution log with gzip\n");
+    fprintf(out,"                          (default file name gets '.gz' appended)\n");
+    fprintf(out,"--async_log             : Write execution log from a separate thread\n");
+    fprintf(out,"--uart=<source>         : UART input: 'console' (default),\n");
+    fprintf(out,"                          'file:<file name>' or 'unix:<socket path>'\n");
+    fprintf(out,"--trigger=<hex number>  : Log trigger address\n");
+    fprintf(out,"--break=<hex number>    : Breakpoint address; more can be set from\n");
+    fprintf(out,"                          the monitor or GDB\n");
+    fprintf(out,"--gdb=<port>|unix:<path>: Wait for GDB to connect on a local TCP\n");
+    fprintf(out,"                          port or Unix socket, instead of starting\n");
+    fprintf(out,"                          the monitor (use 'target remote')\n");
+    fprintf(out,"--start=<hex number>    : Start here instead of at reset vector\n");
+    fprintf(out,"--timing                : Estimate clock cycles of the RTL pipeline\n");
+    fprintf(out,"                          and report them with CPI and stalls\n");
+    fprintf(out,"--wait_states=<n>[,<m>] : Code (n) and data (m, default 0) wait\n");
+    fprintf(out,"                          states for --timing, which it implies\n");
+#ifdef ENABLE_CACHE
+    fprintf(out,"--icache=<size>[,<ways>[,<line size>]]\n");
+    fprintf(out,"                        : Simulate I-cache (bytes; default\n");
+    fprintf(out,"                          direct mapped, 32-byte lines)\n");
+    fprintf(out,"--dcache=<size>[,<ways>[,<line size>[,wt]]]\n");
+    fprintf(out,"                        : Simulate D-cache, write-back unless 'wt'\n");
+#endif
+    fprintf(out,"--device=<file>[,<arguments>]\n");
+    fprintf(out,"                        : Load simulated devices from a shared\n");
+    fprintf(out,"                          object (see devices.c)\n");
+    fprintf(out,"--cores=<n>             : Simulate n cores sharing the memory,\n");
+    fprintf(out,"                          taking turns, in batch mode. Core k>0\n");
+    fprintf(out,"                          writes its log and console output to\n");
+    fprintf(out,"                          <name>.core<k>.<ext> after the --log and\n");
+    fprintf(out,"                          --conout names (default conout.txt)\n");
+    fprintf(out,"--quantum=<n>           : Instructions each core runs per turn\n");
+    fprintf(out,"                          (default %d)\n", SMP_DEFAULT_QUANTUM);
+    fprintf(out,"--parallel              : Run all cores at once, not in turns\n");
+    fprintf(out,"--profile=<file name>   : Write flat profile of guest code to file,\n");
+    fprintf(out,"                          and folded call stacks to <file>.folded\n");
+    fprintf(out,"--checkpoint=<file name>: Save CPU state and memory to file when\n");
+    fprintf(out,"                          a breakpoint is hit\n");
+    fprintf(out,"--restore=<file name>   : Start from a checkpoint saved with\n");
+    fprintf(out,"                          --checkpoint (same memory map)\n");
+    fprintf(out,"--notrap                : Reserved opcodes are NOPs and don't trap\n");
+    fprintf(out,"--nomips32              : Do not emulate any mips32 opcodes\n");
+    fprintf(out,"--memory=<dec number>   : Select emulated memory map\n");
+    fprintf(out,"    N=0 -- Development memory map (DEFAULT):\n");
+    fprintf(out,"        Code TCM at     0xbfc00000 (64KB)\n");
+    fprintf(out,"        Cached RAM at   0x80000000 (512KB)\n");
+    fprintf(out,"        Cached ROM at   0x90000000 (512KB) (dummy hardwired data)\n");
+    fprintf(out,"        Cached FLASH at 0xa0000000 (256KB)\n");
+    fprintf(out,"    N=1 -- Experimental uClinux map (under construction, do not use)\n");
+    fprintf(out,"--memmap=<file name>    : Read memory blocks from file, replacing the\n");
+    fprintf(out,"                          --memory map; one block per line:\n");
+    fprintf(out,"                          <name> <start> <size> [<mask> [<flags>\n");
+    fprintf(out,"                          [<file> [<file offset>]]]], flags any\n");
+    fprintf(out,"                          of r(ead only), c(ached), t(est) or '-'\n");
+    fprintf(out,"--region=<name>,<start>,<size>[,<mask>[,<flags>[,<file>[,<offset>]]]]\n");
+    fprintf(out,"                        : Add a memory block, as in --memmap files\n");
+    fprintf(out,"                          (blocks decode in command line order)\n");
+    fprintf(out,"--unaligned             : Implement unaligned load/store instructions\n");
+    fprintf(out,"--noprompt              : Run in batch mode\n");
+    fprintf(out,"--nopredecode           : Don't cache decoded instructions (decode\n");
+    fprintf(out,"                          every opcode as it is fetched)\n");
+    fprintf(out,"--noblocks              : Run one instruction at a time instead of\n");
+    fprintf(out,"                          whole basic blocks of cached instructions\n");
+    fprintf(out,"--stop_at_zero          : Stop simulation when fetching from address 0x0\n");
+    fprintf(out,"--stop_on_unimplemented : Stop simulation when executing unimplemented opcode\n");
+    fprintf(out,"--help, -h              : Show this usage text\n");
+}
+
+
+/** Free whatever parse_cmd_line has allocated; returns -1. */
+static int cmd_line_error(t_args *args){
+    memmap_free(&(args->mem_map));
+    return -1;
+}
+
+
+#ifdef ENABLE_CACHE
+/** Parse "<size>[,<ways>[,<line size>[,wt|wb]]]"; returns 0 if invalid. */
+static int parse_cache_config(const char *arg, t_cache_config *cfg){
+    char policy[3] = "wb";
+    uint32_t lines;
+
+    cfg->ways = 1;
+    cfg->line_size = 32;
+    sscanf(arg, "%u,%u,%u,%2s", &(cfg->size), &(cfg->ways),
+           &(cfg->line_size), policy);
+    cfg->write_back = (strcmp(policy, "wt")!=0);
+
+    lines = (cfg->line_size>=4 && cfg->ways>0)? cfg->size / cfg->line_size : 0;
+    if(cfg->size==0 || (cfg->size & (cfg->size-1))!=0 ||
+       (cfg->line_size & (cfg->line_size-1))!=0 ||
+       lines==0 || lines % cfg->ways!=0 ||
+       ((lines / cfg->ways) & (lines / cfg->ways - 1))!=0 ||
+       (strcmp(policy, "wt")!=0 && strcmp(policy, "wb")!=0)){
+        fprintf(stderr,"invalid cache configuration '%s'\n\n", arg);
+        usage(stderr);
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+
+/*-- Function map --*/
+
+/** Print function name to call trace log, plus the offset into it if any. */
+static void print_function(t_map_info *map, uint32_t address, int32_t i){
+    fprintf(map->log, "%s", map->fn[i].name);
+    if(address!=map->fn[i].address){
+        fprintf(map->log, "+0x%x", address - map->fn[i].address);
+    }
+}
+
+static int32_t read_map_file(char *filename, t_map_info* map){
+    FILE *f;
+    uint32_t address, size, i;
+    uint32_t segment_text = 0, text_end = 0;
+    char line[256];
+    char name[256];
+
+    f = fopen (filename, "rt");  /* open the file for reading */
+
+    if(!f){
+        return -1;
+    }
+
+   while(fgets(line, sizeof(line)-1, f) != NULL){
+       if(!strncmp(line, ".text", 5)){
+           segment_text = 1;
+           if(sscanf(line, ".text %x %x", &address, &size)==2){
+               text_end = address + size;
+           }
+       }
+       else if(line[0]==' ' && segment_text){
+            /* may be a function address */
+            for(i=0;(i<sizeof(line)-1) && (line[i]==' '); i++);
+            if(line[i]=='0'){
+                sscanf(line, "%*[ \n\t]%x%*[ \n\t]%s", &address, &(name[0]));
+
+                if(!map_add_function(map, address, 0, name)){
+                    fclose(f);
+                    return -1;
+                }
+            }
+       }
+       else if(line[0]=='.' && segment_text){
+           break;
+       }
+    }
+    fclose(f);
+
+    /* The last function in the map ends with the .text section */
+    map_sort(map);
+    if(map->num_functions>0 &&
+       text_end > map->fn[map->num_functions-1].address){
+        map->fn[map->num_functions-1].end = text_end;
+    }
+
+#if 0
+    for(i=0;i<map->num_functions;i++){
+        printf("--> %08x %s\n", map->fn[i].address, map->fn[i].name);
+    }
+#endif
+
+    return map->num_functions;
+}
+
+static void reverse_endianess(uint8_t *data, uint32_t bytes){
+    uint8_t w[4];
+    uint32_t i, j;
+
+    for(i=0;i<bytes;i=i+4){
+        for(j=0;j<4;j++){
+            w[3-j] = data[i+j];
+        }
+        for(j=0;j<4;j++){
+            data[i+j] = w[j];
+        }
+    }
+}
@@ -0,0 +1,518 @@
+/**
+    @file smp.c
+    @brief Multi-core simulation and LL/SC reservations.
+
+    With --cores=<n> the simulator runs n ION cores that share the memory
+    blocks and the page table of the boot core (core 0). Each core has its
+    own registers, COP0 state, event queue, predecoded instruction cache,
+    timing and cache models, execution log and console output, and runs on
+    a host thread of its own. Software tells the cores apart by the CPUNum
+    field of COP0 EBase; all cores start at the same address.
+
+    Cores run in quanta of a given number of instructions (rounded up to a
+    whole basic block). There are two ways to interleave them:
+
+    - Deterministic (default): the cores take turns, one quantum each in
+      core order, so that only one of them runs at any time. Runs are
+      reproducible, execution logs included.
+    - Free-running (--parallel): all cores run at once. The quantum is only
+      how often each core checks whether the simulation is over.
+
+    The simulation ends when the boot core stops, or when all cores have
+    stopped. The simulated I/O registers are per core, and only the boot core
+    is connected to the UART; the others write their console output to a
+    file each.
+
+    LL/SC: LL sets the LLbit of the core and links the word it loads from;
+    SC only stores, and returns 1, if the LLbit is still set. The LLbit is
+    cleared by SC and ERET, and by any store of another core to the linked
+    word.
+
+    Stores also drop the predecoded copies of the word of the other cores.
+    In deterministic mode the other cores are not running, so the store does
+    it right away. In free-running mode a core only ever touches its own
+    decoded code: stores to pages another core has decoded code from are
+    posted to a queue of that core, which applies them itself before each
+    basic block it runs. Code written by one core is thus seen by the others
+    from their next basic block on.
+
+    In free-running mode reservations are checked under a lock, so LL/SC
+    sequences are atomic among themselves. A plain store of another core
+    that lands while a LL is in progress may go unnoticed, though; programs
+    that need exact results there should use the deterministic mode.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ion32sim.h"
+
+
+/** Core number in t_smp.turn when no core is left to run */
+#define SMP_NO_CORE         (0xffffffff)
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+/** Writes to the decoded code of a core, posted by the other cores for it
+    to apply (free-running mode only) */
+typedef struct s_snoop_queue {
+    pthread_mutex_t lock;
+    atomic_bool pending;            /**< set when there's anything to apply */
+    uint32_t count;
+    bool overflow;                  /**< writes were lost, drop all code */
+    struct {
+        uint32_t block, offset, size;
+    } write[SMP_SNOOP_QUEUE_SIZE];
+} t_snoop_queue;
+
+struct s_smp {
+    uint32_t num_cores;
+    uint32_t quantum;               /**< instructions per turn */
+    uint32_t parallel;              /**< !=0 for free-running mode */
+    t_state *core[SMP_MAX_CORES];   /**< core 0 is the boot core */
+    pthread_t thread[SMP_MAX_CORES];
+    pthread_mutex_t lock;           /**< reservations and turns (recursive) */
+    pthread_cond_t turn_changed;
+    uint32_t turn;                  /**< core whose turn it is */
+    atomic_uint links;              /**< number of cores with LLbit set */
+    atomic_bool stop;               /**< set when the simulation is over */
+    /* Free-running mode only */
+    atomic_uint **code_cores;       /**< by block and decode page, mask of
+                                         the cores with decoded code there */
+    t_snoop_queue snoops[SMP_MAX_CORES];
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static int init_core(t_smp *m, t_state *s, uint32_t id);
+static char *core_file_name(const char *name, uint32_t id);
+static void *core_thread(void *arg);
+static void run_quantum(t_state *s, uint32_t quantum);
+static void pass_turn(t_smp *m);
+static void clear_links(t_smp *m, t_state *s, uint32_t address);
+static int init_snoops(t_smp *m);
+static void post_write(t_snoop_queue *q, uint32_t block, uint32_t offset,
+                       uint32_t size);
+static void apply_writes(t_smp *m, t_state *s);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Set up the secondary cores, sharing the memory and the command line
+    arguments of the boot core. The boot core must be ready to run; the
+    secondary cores are reset.
+
+    @return Multi-core system or NULL on error, after printing a message.
+*/
+t_smp *smp_open(t_state *boot){
+    const t_args *args = &(boot->args);
+    pthread_mutexattr_t attr;
+    t_smp *m;
+    uint32_t i;
+
+    m = calloc(1, sizeof(t_smp));
+    if(m==NULL){
+        fprintf(stderr, "Trouble allocating memory for the cores\n");
+        return NULL;
+    }
+    m->num_cores = args->num_cores;
+    m->quantum = args->quantum;
+    m->parallel = args->parallel;
+    atomic_init(&m->links, 0);
+    atomic_init(&m->stop, false);
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&m->turn_changed, NULL);
+
+    m->core[0] = boot;
+    boot->smp = m;
+    if(m->parallel && !init_snoops(m)){
+        fprintf(stderr, "Trouble allocating memory for the cores\n");
+        smp_close(m);
+        return NULL;
+    }
+    for(i=1;i<m->num_cores;i++){
+        m->core[i] = calloc(1, sizeof(t_state));
+        if(m->core[i]==NULL || !init_core(m, m->core[i], i)){
+            fprintf(stderr, "Trouble setting up core %u\n", i);
+            m->num_cores = i + (m->core[i]!=NULL);
+            smp_close(m);
+            return NULL;
+        }
+    }
+    return m;
+}
+
+/** Run all the cores until the simulation is over. */
+void smp_run(t_smp *m){
+    uint32_t i;
+
+    m->turn = 0;
+    for(i=0;i<m->num_cores;i++){
+        m->core[i]->wakeup = 0;
+        if(pthread_create(&m->thread[i], NULL, core_thread, m->core[i])!=0){
+            fprintf(stderr, "Trouble starting thread of core %u\n", i);
+            pthread_mutex_lock(&m->lock);
+            atomic_store(&m->stop, true);
+            pthread_cond_broadcast(&m->turn_changed);
+            pthread_mutex_unlock(&m->lock);
+            break;
+        }
+    }
+    while(i>0){
+        pthread_join(m->thread[--i], NULL);
+    }
+}
+
+/** Number of cores of the system. */
+uint32_t smp_num_cores(t_smp *m){
+    return m->num_cores;
+}
+
+/** Core 'id' of the system. */
+t_state *smp_core(t_smp *m, uint32_t id){
+    return m->core[id];
+}
+
+/** Free the secondary cores and detach the boot core. */
+void smp_close(t_smp *m){
+    t_state *s;
+    uint32_t i;
+
+    if(m==NULL) return;
+    for(i=1;i<m->num_cores;i++){
+        s = m->core[i];
+        if(s==NULL) continue;
+        log_close(s);
+        if(s->conout!=NULL) fclose(s->conout);
+        predecode_free(s);
+#ifdef ENABLE_CACHE
+        cache_free(&(s->icache));
+        cache_free(&(s->dcache));
+#endif
+        free(s);
+    }
+    m->core[0]->smp = NULL;
+    if(m->code_cores!=NULL){
+        for(i=0;i<m->core[0]->num_blocks;i++){
+            free(m->code_cores[i]);
+        }
+        free(m->code_cores);
+        for(i=0;i<SMP_MAX_CORES;i++){
+            pthread_mutex_destroy(&m->snoops[i].lock);
+        }
+    }
+    pthread_cond_destroy(&m->turn_changed);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
+/*-- LL/SC --*/
+
+/** LL: set the LLbit and link the word at 'address'. */
+void smp_link(t_state *s, uint32_t address){
+    t_smp *m = s->smp;
+
+    if(m!=NULL) pthread_mutex_lock(&m->lock);
+    if(!s->ll_bit && m!=NULL) atomic_fetch_add(&m->links, 1);
+    s->ll_bit = true;
+    s->ll_addr = address & ~3;
+    if(m!=NULL) pthread_mutex_unlock(&m->lock);
+}
+
+/** Clear the LLbit, as ERET does. */
+void smp_unlink(t_state *s){
+    t_smp *m = s->smp;
+
+    /* Other cores clear our LLbit under the lock, so only look at it there */
+    if(m!=NULL) pthread_mutex_lock(&m->lock);
+    if(s->ll_bit && m!=NULL) atomic_fetch_sub(&m->links, 1);
+    s->ll_bit = false;
+    if(m!=NULL) pthread_mutex_unlock(&m->lock);
+}
+
+/**
+    SC: store 'value' at 'address' if the LLbit is set, and clear it.
+
+    @return 1 if the store was done, 0 otherwise.
+*/
+uint32_t smp_store_conditional(t_state *s, uint32_t address, uint32_t value){
+    t_smp *m = s->smp;
+    uint32_t done;
+
+    if(m!=NULL) pthread_mutex_lock(&m->lock);
+    done = s->ll_bit;
+    smp_unlink(s);
+    if(done){
+        /* mem_write breaks the links of the other cores to the word */
+        mem_write(s, 4, address, value, 1);
+    }
+    if(m!=NULL) pthread_mutex_unlock(&m->lock);
+    return done;
+}
+
+/**
+    Let the other cores know about a store: clear their links to the word
+    and drop their predecoded copies of it. Called by mem_write.
+*/
+void smp_snoop(t_state *s, uint32_t address, uint32_t size){
+    t_smp *m = s->smp;
+    const t_mem_page *page = &(s->mem_pages[address >> MEM_PAGE_SHIFT]);
+    uint32_t i, offset, cores;
+
+    if(atomic_load(&m->links)>0){
+        pthread_mutex_lock(&m->lock);
+        clear_links(m, s, address);
+        pthread_mutex_unlock(&m->lock);
+    }
+    if(!(page->flags & PAGE_MAPPED)) return;
+    offset = page->offset + (address & (MEM_PAGE_SIZE-1));
+    if(!m->parallel){
+        for(i=0;i<m->num_cores;i++){
+            if(m->core[i]!=s){
+                predecode_invalidate(m->core[i], page->block, offset, size);
+            }
+        }
+        return;
+    }
+    /* Either we see the bit of a core that is about to decode code from
+       this page, or it reads what we've just written (see smp_code_page) */
+    atomic_thread_fence(memory_order_seq_cst);
+    cores = atomic_load(&m->code_cores[page->block][offset / DECODE_PAGE_SIZE]);
+    for(i=0;i<m->num_cores;i++){
+        if(m->core[i]!=s && (cores & (1u << i))){
+            post_write(&m->snoops[i], page->block, offset, size);
+        }
+    }
+}
+
+/**
+    Called when a core first decodes code from a page of a memory block,
+    before it reads any of it: from now on, the stores of the other cores to
+    that page are posted to it (free-running mode only).
+*/
+void smp_code_page(t_state *s, uint32_t block, uint32_t page){
+    t_smp *m = s->smp;
+
+    if(m->code_cores==NULL) return;
+    atomic_fetch_or(&m->code_cores[block][page], 1u << s->core_id);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Set up a secondary core sharing the memory of the boot core. */
+static int init_core(t_smp *m, t_state *s, uint32_t id){
+    const t_state *boot = m->core[0];
+    const t_args *args = &(boot->args);
+    char *name;
+
+    s->args = boot->args;
+    s->core_id = id;
+    s->smp = m;
+    s->big_endian = boot->big_endian;
+    s->do_unaligned = boot->do_unaligned;
+    s->blocks = boot->blocks;
+    s->num_blocks = boot->num_blocks;
+    s->mem_pages = boot->mem_pages;
+    s->devices = boot->devices;
+    predecode_init(s, args->predecode, args->basic_blocks);
+    timing_init(&(s->timing), args->timing, args->code_wait_states,
+                args->data_wait_states);
+#ifdef ENABLE_CACHE
+    if(!cache_init(&(s->icache), &(args->icache)) ||
+       !cache_init(&(s->dcache), &(args->dcache))){
+        return 0;
+    }
+#endif
+
+    /* Execution log and console output of its own */
+    memset(s->t.buf, 0xff, sizeof(s->t.buf));
+    s->t.disasm_ptr = VECTOR_RESET;
+    s->t.log_trigger_address = args->log_trigger_address;
+    if(args->log_file_name!=NULL){
+        name = core_file_name(args->log_file_name, id);
+        if(name==NULL || !log_open(s, name,
+                     (args->log_binary? LOG_OPEN_BINARY : 0) |
+                     (args->log_compress? LOG_OPEN_COMPRESS : 0) |
+                     (args->log_async? LOG_OPEN_ASYNC : 0))){
+            fprintf(stderr,"Error opening log file '%s', file logging disabled\n",
+                    name!=NULL? name : args->log_file_name);
+        }
+        free(name);
+    }
+    name = core_file_name(args->conout_filename!=NULL?
+                          args->conout_filename : "conout.txt", id);
+    s->conout = (name!=NULL)? fopen(name, "w") : NULL;
+    if(s->conout==NULL){
+        fprintf(stderr,"Trouble opening console log file '%s'\n",
+                name!=NULL? name : "");
+        free(name);
+        return 0;
+    }
+    free(name);
+
+    reset_cpu(s);
+    s->pc_next = s->pc + 4;
+    s->skip = 0;
+    return 1;
+}
+
+/** "log.txt" -> "log.core<id>.txt"; NULL if out of memory. */
+static char *core_file_name(const char *name, uint32_t id){
+    const char *ext, *base;
+    char *core_name;
+    size_t len;
+
+    base = strrchr(name, '/');
+    ext = strchr(base!=NULL? base : name, '.');
+    len = (ext!=NULL)? (size_t)(ext - name) : strlen(name);
+    core_name = malloc(strlen(name) + 16);
+    if(core_name!=NULL){
+        sprintf(core_name, "%.*s.core%u%s", (int)len, name, id,
+                ext!=NULL? ext : "");
+    }
+    return core_name;
+}
+
+/** Host thread of a core. */
+static void *core_thread(void *arg){
+    t_state *s = arg;
+    t_smp *m = s->smp;
+
+    for(;;){
+        if(!m->parallel){
+            pthread_mutex_lock(&m->lock);
+            while(m->turn!=s->core_id && !atomic_load(&m->stop)){
+                pthread_cond_wait(&m->turn_changed, &m->lock);
+            }
+            pthread_mutex_unlock(&m->lock);
+        }
+        if(atomic_load(&m->stop)) break;
+
+        run_quantum(s, m->quantum);
+
+        /* The simulation is over when the boot core stops */
+        if(s->wakeup && s->core_id==0){
+            atomic_store(&m->stop, true);
+        }
+        if(!m->parallel){
+            pthread_mutex_lock(&m->lock);
+            pass_turn(m);
+            pthread_mutex_unlock(&m->lock);
+        }
+        if(s->wakeup) break;
+    }
+    log_flush(s);
+    return NULL;
+}
+
+/** Run about 'quantum' instructions, less if the core stops. */
+static void run_quantum(t_state *s, uint32_t quantum){
+    t_smp *m = s->smp;
+    uint64_t end = s->insn_count + quantum;
+
+    while(s->wakeup==0 && s->insn_count < end){
+        if(m->parallel && atomic_load(&m->snoops[s->core_id].pending)){
+            apply_writes(m, s);
+        }
+        if(!run_block(s)){
+            cycle(s, 0);
+        }
+    }
+}
+
+/** Give the turn to the next core that has not stopped. Lock held. */
+static void pass_turn(t_smp *m){
+    uint32_t i, next = SMP_NO_CORE;
+
+    for(i=1;i<=m->num_cores;i++){
+        if(!m->core[(m->turn + i) % m->num_cores]->wakeup){
+            next = (m->turn + i) % m->num_cores;
+            break;
+        }
+    }
+    if(next==SMP_NO_CORE){
+        atomic_store(&m->stop, true);
+    }
+    m->turn = next;
+    pthread_cond_broadcast(&m->turn_changed);
+}
+
+/** Clear the LLbit of the cores other than 's' linked to a word. Lock held. */
+static void clear_links(t_smp *m, t_state *s, uint32_t address){
+    uint32_t i;
+
+    for(i=0;i<m->num_cores;i++){
+        if(m->core[i]!=s && m->core[i]->ll_bit &&
+           m->core[i]->ll_addr==(address & ~3)){
+            m->core[i]->ll_bit = false;
+            atomic_fetch_sub(&m->links, 1);
+        }
+    }
+}
+
+/** Set up the queues of posted writes and the code page masks. */
+static int init_snoops(t_smp *m){
+    const t_state *boot = m->core[0];
+    uint32_t i;
+
+    m->code_cores = calloc(boot->num_blocks, sizeof(atomic_uint *));
+    if(m->code_cores==NULL) return 0;
+    for(i=0;i<SMP_MAX_CORES;i++){
+        pthread_mutex_init(&m->snoops[i].lock, NULL);
+        atomic_init(&m->snoops[i].pending, false);
+    }
+    for(i=0;i<boot->num_blocks;i++){
+        m->code_cores[i] = calloc(boot->blocks[i].size / DECODE_PAGE_SIZE + 1,
+                                  sizeof(atomic_uint));
+        if(m->code_cores[i]==NULL) return 0;
+    }
+    /* Code the boot core decoded so far was never registered */
+    predecode_free(m->core[0]);
+    return 1;
+}
+
+/** Post a write to the decoded code of a core. */
+static void post_write(t_snoop_queue *q, uint32_t block, uint32_t offset,
+                       uint32_t size){
+    pthread_mutex_lock(&q->lock);
+    if(q->count<SMP_SNOOP_QUEUE_SIZE){
+        q->write[q->count].block = block;
+        q->write[q->count].offset = offset;
+        q->write[q->count].size = size;
+        q->count++;
+    }
+    else{
+        q->overflow = true;
+    }
+    atomic_store(&q->pending, true);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/** Apply the writes the other cores posted to the decoded code of 's'. */
+static void apply_writes(t_smp *m, t_state *s){
+    t_snoop_queue *q = &m->snoops[s->core_id];
+    uint32_t i;
+
+    pthread_mutex_lock(&q->lock);
+    if(q->overflow){
+        predecode_free(s);
+    }
+    else{
+        for(i=0;i<q->count;i++){
+            predecode_invalidate(s, q->write[i].block, q->write[i].offset,
+                                 q->write[i].size);
+        }
+    }
+    q->count = 0;
+    q->overflow = false;
+    atomic_store(&q->pending, false);
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,136 @@
+/**
+    @file symbols.c
+    @brief Function map used for call tracing.
+
+    The function map is a table of functions sorted by address, so that any
+    address can be resolved to the function that holds it with a binary
+    search. It grows as needed and is filled from a GNU ld map file or from
+    the symbol table of an ELF file; see read_map_file and elf_read_functions.
+
+    Functions are added in any order and map_sort must be called once they
+    are all in, before any lookup. Functions of unknown size are taken to
+    extend up to the next one.
+*/
+
+#include "ion32sim.h"
+
+
+/** Initial number of entries of the table, doubled whenever it fills up */
+#define MAP_INITIAL_FUNCTIONS   (256)
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static int compare_functions(const void *a, const void *b);
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Add a function to the map. Size can be 0 if unknown.
+
+    @return 0 if out of memory.
+*/
+int map_add_function(t_map_info *map, uint32_t address, uint32_t size,
+                     const char *name){
+    t_map_function *fn;
+    uint32_t max;
+
+    if(map->num_functions >= map->max_functions){
+        max = map->max_functions? map->max_functions*2 : MAP_INITIAL_FUNCTIONS;
+        fn = realloc(map->fn, max * sizeof(t_map_function));
+        if(fn==NULL) return 0;
+        map->fn = fn;
+        map->max_functions = max;
+    }
+
+    fn = &(map->fn[map->num_functions]);
+    fn->name = strdup(name);
+    if(fn->name==NULL) return 0;
+    fn->address = address;
+    fn->end = address + size;
+    map->num_functions++;
+    return 1;
+}
+
+/**
+    Sort the map by address, drop duplicate addresses and work out where
+    functions of unknown size end. The last function, if its size is unknown,
+    only covers its entry address.
+*/
+void map_sort(t_map_info *map){
+    uint32_t i, j;
+
+    if(map->num_functions==0) return;
+    qsort(map->fn, map->num_functions, sizeof(t_map_function),
+          compare_functions);
+
+    for(i=1, j=0;i<map->num_functions;i++){
+        if(map->fn[i].address==map->fn[j].address){
+            free(map->fn[i].name);
+        }
+        else{
+            map->fn[++j] = map->fn[i];
+        }
+    }
+    map->num_functions = j + 1;
+
+    for(i=0;i<map->num_functions;i++){
+        if(map->fn[i].end <= map->fn[i].address){
+            map->fn[i].end = (i+1 < map->num_functions)?
+                             map->fn[i+1].address : map->fn[i].address + 1;
+        }
+    }
+}
+
+/**
+    Find the function that holds an address.
+
+    @return Index of the function in the map or -1 if not found.
+*/
+int32_t map_find_function(const t_map_info *map, uint32_t address){
+    int32_t lo = 0, hi = (int32_t)map->num_functions - 1, mid;
+
+    /* Find last function starting at or below the address... */
+    while(lo <= hi){
+        mid = lo + (hi - lo)/2;
+        if(map->fn[mid].address <= address){
+            lo = mid + 1;
+        }
+        else{
+            hi = mid - 1;
+        }
+    }
+    /* ...and see if the address is within it */
+    if(hi >= 0 && address < map->fn[hi].end){
+        return hi;
+    }
+    return -1;
+}
+
+/** Free all the functions in the map. */
+void map_free(t_map_info *map){
+    uint32_t i;
+
+    for(i=0;i<map->num_functions;i++){
+        free(map->fn[i].name);
+    }
+    free(map->fn);
+    map->fn = NULL;
+    map->num_functions = 0;
+    map->max_functions = 0;
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Order by address, then by name so that the pick among aliases of the
+    same function does not depend on the order they were added in. */
+static int compare_functions(const void *a, const void *b){
+    const t_map_function *fa = a, *fb = b;
+
+    if(fa->address != fb->address){
+        return (fa->address < fb->address)? -1 : 1;
+    }
+    return strcmp(fa->name, fb->name);
+}
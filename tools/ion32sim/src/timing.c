@@ -0,0 +1,122 @@
+/**
+    @file timing.c
+    @brief Cycle-approximate timing model of the ION pipeline.
+
+    Estimates the clock cycles the 5-stage pipeline of cpu.v would take to
+    run the simulated program, by adding to the single cycle each
+    instruction takes the stalls the RTL implements:
+
+    - Load-use interlock: an instruction whose rs or rt field names the
+      target of a load in the previous slot stalls stages 0..2 one cycle
+      (co_s2_stall_load). As in the RTL the raw opcode fields are compared,
+      whether or not the instruction actually reads those registers.
+    - Traps and ERET: the sequential instruction after the trap or ERET is
+      fetched and dropped, and stages 0..2 are stalled one more cycle until
+      the trap or ERET reaches stage 4 (co_s2_stall_trap,
+      co_s012_stall_eret). The simulator runs the dropped slot through
+      cycle() too (s->skip, s->eret_delay_slot) and accounts it here.
+    - Wait states: every code fetch and every load or store take the given
+      number of extra cycles, like tb_cpu.v with WAIT_STATES.
+    - Pipeline fill: the first instruction takes 4 extra cycles to get
+      through the pipeline after reset.
+
+    Branches have no penalty: the target is fetched while the delay slot is
+    decoded, and the delay slot is always executed. Taken branches are only
+    counted for the report.
+
+    Stalls that overlap in the RTL are simply added up here, so with wait
+    states the estimate is a bit pessimistic.
+*/
+
+#include "ion32sim.h"
+
+
+/** Cycles the first instruction takes to reach the last pipeline stage */
+#define TIMING_FILL_CYCLES      (4)
+/** Cycles lost to a trap or ERET: dropped slot plus stall, w/o wait states */
+#define TIMING_BUBBLE_CYCLES    (2)
+/** Value of load_rt when the previous slot was not a load */
+#define TIMING_NO_LOAD          (0xff)
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+/** Names of the stall causes in the report, by t_stall_cause */
+static const char *stall_names[NUM_STALL_CAUSES] = {
+    "pipeline fill",
+    "load-use interlock",
+    "trap bubble",
+    "ERET bubble",
+    "code wait states",
+    "data wait states",
+};
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/** Reset the timing model, enabling it if 'enabled' is !=0. */
+void timing_init(t_timing *t, uint32_t enabled, uint32_t code_wait,
+                 uint32_t data_wait){
+    memset(t, 0, sizeof(t_timing));
+    t->enabled = enabled;
+    t->code_wait = code_wait;
+    t->data_wait = data_wait;
+    t->load_rt = TIMING_NO_LOAD;
+    t->cycles = TIMING_FILL_CYCLES;
+    t->stalls[STALL_FILL] = TIMING_FILL_CYCLES;
+}
+
+/**
+    Account an instruction that has just been executed.
+
+    @arg flags EXEC_* flags returned by the instruction handler.
+*/
+void timing_insn(t_timing *t, const t_decoded *d, uint32_t flags){
+    uint64_t c = 1 + t->code_wait;
+
+    t->stalls[STALL_CODE_WAIT] += t->code_wait;
+    if(d->rs==t->load_rt || d->rt==t->load_rt){
+        t->stalls[STALL_LOAD_USE]++;
+        c++;
+    }
+    if(d->flags & (DEC_LOAD | DEC_STORE)){
+        t->stalls[STALL_DATA_WAIT] += t->data_wait;
+        c += t->data_wait;
+    }
+    t->load_rt = (d->flags & DEC_LOAD)? d->rt : TIMING_NO_LOAD;
+    if(flags & (EXEC_BRANCH | EXEC_JUMP)){
+        t->branches++;
+    }
+    t->insns++;
+    t->cycles += c;
+}
+
+/**
+    Account a slot dropped after a trap or ERET.
+
+    @arg cause STALL_TRAP or STALL_ERET.
+*/
+void timing_bubble(t_timing *t, t_stall_cause cause){
+    t->stalls[cause] += TIMING_BUBBLE_CYCLES;
+    t->stalls[STALL_CODE_WAIT] += t->code_wait;
+    t->cycles += TIMING_BUBBLE_CYCLES + t->code_wait;
+    t->load_rt = TIMING_NO_LOAD;
+}
+
+/** Print cycle count, CPI and the stall breakdown. */
+void timing_report(FILE *f, const t_timing *t){
+    uint32_t i;
+
+    fprintf(f, "Timing model (%u code, %u data wait states):\n",
+            t->code_wait, t->data_wait);
+    fprintf(f, "    %llu cycles, %llu instructions, CPI %.3f\n",
+            (unsigned long long)t->cycles, (unsigned long long)t->insns,
+            t->insns? (double)t->cycles / t->insns : 0.0);
+    fprintf(f, "    %llu taken branches and jumps (no penalty)\n",
+            (unsigned long long)t->branches);
+    for(i=0;i<NUM_STALL_CAUSES;i++){
+        fprintf(f, "    %-20s %14llu cycles %6.2f%%\n", stall_names[i],
+                (unsigned long long)t->stalls[i],
+                100.0 * t->stalls[i] / t->cycles);
+    }
+}
@@ -0,0 +1,376 @@
+/**
+    @file uart.c
+    @brief Simulated UART with RX/TX FIFOs.
+
+    The UART receives from one of these sources:
+
+    - The console (default): stdin in raw mode, echoing what is received to
+      the console output, as the simulator always did. The console is only put in raw mode when the
+      program first polls it, and goes back to its mode when the monitor
+      prompts the user (uart_console_restore), the UART is closed, the
+      simulator exits or is killed by SIGINT or SIGTERM.
+    - A script file: its bytes are received in order, then the RX FIFO stays
+      empty for good.
+    - A local Unix socket: the simulator listens on the given path and
+      connects the UART to whatever client connects, one at a time. What the
+      program transmits goes to the client as well as to the console.
+
+    The source is polled without blocking, in batches, only to refill the RX
+    FIFO: when the program reads the status register with the RX FIFO empty
+    an EVENT_UART_POLL is scheduled UART_POLL_INSNS instructions later, so a
+    program spinning on the status register polls the source about once
+    every UART_POLL_INSNS instructions. Transmitted bytes are written
+    through to the console output file right away, so they keep their order
+    with the rest of the simulator output, and flushed at the end of each
+    line or poll.
+
+    A read of the RX register with the RX FIFO empty blocks on the source
+    (without spinning) until something is received, as the console version
+    of the simulator did; once the source is exhausted it reads 0.
+*/
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#else
+#include <conio.h>
+#endif
+
+#include "ion32sim.h"
+
+
+/** Size of the RX and TX FIFOs in bytes */
+#define UART_FIFO_SIZE      (16)
+
+#ifdef MSG_NOSIGNAL
+#define UART_SEND_FLAGS     (MSG_NOSIGNAL)
+#else
+#define UART_SEND_FLAGS     (0)
+#endif
+
+
+/*---- Local data types ------------------------------------------------------*/
+
+typedef enum {
+    UART_CONSOLE,
+    UART_FILE,
+    UART_SOCKET
+} t_uart_source;
+
+struct s_uart {
+    t_uart_source source;
+    int fd;                         /**< RX source or -1 when exhausted */
+    int listen_fd;                  /**< listening socket or -1 */
+    char *socket_path;              /**< path of listening socket or NULL */
+    uint8_t rx[UART_FIFO_SIZE];     /**< RX FIFO, a ring */
+    uint32_t rx_head, rx_count;
+    uint8_t tx[UART_FIFO_SIZE];     /**< bytes to send to socket client */
+    uint32_t tx_count;
+    FILE *conout;                   /**< console output or NULL */
+};
+
+
+/*---- Local function prototypes ---------------------------------------------*/
+
+static void uart_refill(t_uart *u, int wait);
+static void uart_flush_tx(t_uart *u);
+#ifndef WIN32
+static int open_socket(t_uart *u, const char *path);
+static void accept_client(t_uart *u, int wait);
+static void console_raw(void);
+static void console_exit(void);
+static void console_signal(int sig);
+#endif
+
+
+/*---- Local data ------------------------------------------------------------*/
+
+#ifndef WIN32
+/** Mode of the console before it was put in raw mode. There is only one
+    console, whatever the number of UARTs reading from it. */
+static struct termios console_mode;
+/** !=0 while the console is in raw mode */
+static volatile sig_atomic_t console_is_raw = 0;
+/** !=0 once the exit and signal handlers are installed */
+static int console_handlers = 0;
+#endif
+
+
+/*---- Common functions ------------------------------------------------------*/
+
+/**
+    Open the UART.
+
+    @arg spec NULL for the console, "file:<name>" for a script file or
+              "unix:<path>" for a Unix socket.
+    @arg conout Console output file, or NULL to discard transmitted bytes.
+    @return UART or NULL on error, after printing a message.
+*/
+t_uart *uart_open(const char *spec, FILE *conout){
+    t_uart *u;
+
+    u = calloc(1, sizeof(t_uart));
+    if(u==NULL){
+        fprintf(stderr, "Trouble allocating memory for the UART\n");
+        return NULL;
+    }
+    u->fd = -1;
+    u->listen_fd = -1;
+    u->conout = conout;
+
+    if(spec==NULL){
+        u->source = UART_CONSOLE;
+        u->fd = 0;
+    }
+    else if(strncmp(spec, "file:", 5)==0){
+        u->source = UART_FILE;
+#ifndef WIN32
+        u->fd = open(spec + 5, O_RDONLY);
+#endif
+        if(u->fd<0){
+            fprintf(stderr, "Can't open UART input file '%s'\n", spec + 5);
+            free(u);
+            return NULL;
+        }
+    }
+#ifndef WIN32
+    else if(strncmp(spec, "unix:", 5)==0){
+        u->source = UART_SOCKET;
+        if(!open_socket(u, spec + 5)){
+            free(u);
+            return NULL;
+        }
+    }
+#endif
+    else{
+        fprintf(stderr, "Unsupported UART source '%s'\n", spec);
+        free(u);
+        return NULL;
+    }
+    return u;
+}
+
+/** Flush the output, close the source and free the UART. */
+void uart_close(t_uart *u){
+    if(u==NULL) return;
+    uart_flush_tx(u);
+    if(u->conout!=NULL) fflush(u->conout);
+#ifndef WIN32
+    if(u->source==UART_CONSOLE){
+        uart_console_restore();
+    }
+    if(u->source!=UART_CONSOLE && u->fd>=0){
+        close(u->fd);
+    }
+    if(u->listen_fd>=0){
+        close(u->listen_fd);
+        unlink(u->socket_path);
+    }
+#endif
+    free(u->socket_path);
+    free(u);
+}
+
+/**
+    Put the console back in the mode it was in before the UART put it in raw
+    mode, if it did. It goes raw again when the program next polls it.
+*/
+void uart_console_restore(void){
+#ifndef WIN32
+    if(console_is_raw){
+        tcsetattr(0, TCSANOW, &console_mode);
+        console_is_raw = 0;
+    }
+#endif
+}
+
+/**
+    Refill the RX FIFO from the source and send pending output, without
+    blocking.
+*/
+void uart_poll(t_uart *u){
+    uart_refill(u, 0);
+    uart_flush_tx(u);
+    if(u->conout!=NULL) fflush(u->conout);
+}
+
+/**
+    Value of the status register: IRQ_UART_READ_AVAILABLE if the RX FIFO is
+    not empty, and IRQ_UART_WRITE_AVAILABLE since the TX FIFO never fills
+    up.
+*/
+uint32_t uart_status(t_uart *u){
+    return IRQ_UART_WRITE_AVAILABLE |
+           (u->rx_count? IRQ_UART_READ_AVAILABLE : 0);
+}
+
+/** Pop a byte from the RX FIFO, waiting for the source if it is empty. */
+uint8_t uart_read(t_uart *u){
+    uint8_t c;
+
+    if(u->rx_count==0){
+        uart_flush_tx(u);
+        if(u->conout!=NULL) fflush(u->conout);
+        uart_refill(u, 1);
+        if(u->rx_count==0) return 0;
+    }
+    c = u->rx[u->rx_head];
+    u->rx_head = (u->rx_head + 1) % UART_FIFO_SIZE;
+    u->rx_count--;
+    if(u->source==UART_CONSOLE && u->conout!=NULL){
+        fputc(c, u->conout);
+    }
+    return c;
+}
+
+/** Transmit a byte. */
+void uart_write(t_uart *u, uint8_t c){
+    if(u->conout!=NULL) fputc(c, u->conout);
+    if(u->listen_fd>=0){
+        u->tx[u->tx_count++] = c;
+        if(u->tx_count==UART_FIFO_SIZE) uart_flush_tx(u);
+    }
+    if(c=='\n'){
+        uart_flush_tx(u);
+        if(u->conout!=NULL) fflush(u->conout);
+    }
+}
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Read as much as fits in the RX FIFO, waiting for data if 'wait'. */
+static void uart_refill(t_uart *u, int wait){
+#ifndef WIN32
+    uint8_t buf[UART_FIFO_SIZE];
+    uint32_t i, tail;
+    ssize_t n;
+    fd_set fds;
+    struct timeval tv = {0, 0};
+
+    if(u->source==UART_SOCKET && u->fd<0){
+        accept_client(u, wait);
+    }
+    if(u->fd<0 || u->rx_count==UART_FIFO_SIZE) return;
+    if(u->source==UART_CONSOLE) console_raw();
+
+    /* Files are always readable, no need to wait for them */
+    if(u->source!=UART_FILE){
+        FD_ZERO(&fds);
+        FD_SET(u->fd, &fds);
+        if(select(u->fd + 1, &fds, NULL, NULL, wait? NULL : &tv) <= 0){
+            return;
+        }
+    }
+    n = read(u->fd, buf, UART_FIFO_SIZE - u->rx_count);
+    if(n<=0){
+        /* Source exhausted; a socket can take another client */
+        if(u->source!=UART_CONSOLE) close(u->fd);
+        u->fd = -1;
+        if(u->source==UART_SOCKET && wait) uart_refill(u, wait);
+        return;
+    }
+    for(i=0;i<(uint32_t)n;i++){
+        tail = (u->rx_head + u->rx_count) % UART_FIFO_SIZE;
+        u->rx[tail] = buf[i];
+        u->rx_count++;
+    }
+#else
+    if(u->source==UART_CONSOLE && u->rx_count<UART_FIFO_SIZE &&
+       (wait || kbhit())){
+        u->rx[(u->rx_head + u->rx_count) % UART_FIFO_SIZE] = getch();
+        u->rx_count++;
+    }
+#endif
+}
+
+/** Send the bytes queued for the socket client, if any. */
+static void uart_flush_tx(t_uart *u){
+#ifndef WIN32
+    if(u->tx_count>0 && u->source==UART_SOCKET && u->fd>=0){
+        /* A client that went away must not kill us with SIGPIPE */
+        if(send(u->fd, u->tx, u->tx_count, UART_SEND_FLAGS)<0){
+            close(u->fd);
+            u->fd = -1;
+        }
+    }
+#endif
+    u->tx_count = 0;
+}
+
+#ifndef WIN32
+/** Create the listening socket. */
+static int open_socket(t_uart *u, const char *path){
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "UART socket path too long: '%s'\n", path);
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    u->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if(u->listen_fd<0 ||
+       bind(u->listen_fd, (struct sockaddr *)&addr, sizeof(addr))!=0 ||
+       listen(u->listen_fd, 1)!=0){
+        fprintf(stderr, "Can't listen on UART socket '%s': %s\n",
+                path, strerror(errno));
+        if(u->listen_fd>=0) close(u->listen_fd);
+        return 0;
+    }
+    u->socket_path = strdup(path);
+    fprintf(stderr, "UART listening on '%s'\n", path);
+    return 1;
+}
+
+/** Take a pending client connection, waiting for one if 'wait'. */
+static void accept_client(t_uart *u, int wait){
+    fd_set fds;
+    struct timeval tv = {0, 0};
+
+    FD_ZERO(&fds);
+    FD_SET(u->listen_fd, &fds);
+    if(select(u->listen_fd + 1, &fds, NULL, NULL, wait? NULL : &tv) > 0){
+        u->fd = accept(u->listen_fd, NULL, NULL);
+    }
+}
+
+/** Put the console in raw mode, if it's a terminal and isn't raw yet. */
+static void console_raw(void){
+    struct termios raw;
+
+    if(console_is_raw || !isatty(0) || tcgetattr(0, &console_mode)!=0){
+        return;
+    }
+    /* Whatever way we go, don't leave the user's terminal without echo */
+    if(!console_handlers){
+        console_handlers = 1;
+        atexit(console_exit);
+        if(signal(SIGINT, console_signal)==SIG_IGN) signal(SIGINT, SIG_IGN);
+        if(signal(SIGTERM, console_signal)==SIG_IGN) signal(SIGTERM, SIG_IGN);
+    }
+    raw = console_mode;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(0, TCSANOW, &raw);
+    console_is_raw = 1;
+}
+
+static void console_exit(void){
+    uart_console_restore();
+}
+
+/** Restore the console and die of the signal as we would have anyway. */
+static void console_signal(int sig){
+    uart_console_restore();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
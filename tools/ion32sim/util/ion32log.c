@@ -0,0 +1,358 @@
+/**
+    @file ion32log.c
+    @brief Execution log tool for ion32sim.
+
+    Renders an execution log written by ion32sim as text, exactly as ion32sim
+    would have written it in text mode, or compares two execution logs.
+
+    Binary logs are recognized by their header; any other file is assumed to
+    be a text log, so that scripts can use this tool on either form of log.
+    Logs compressed with gzip (ion32sim --gzlog) are decompressed on the fly.
+
+    Logs are read as streams, in constant memory. In compare mode the two
+    logs are read one line at a time from each and the comparison stops at
+    the first mismatch, so the logs may be named pipes being written by
+    simulations still running (e.g. ion32sim and the RTL test bench).
+
+    Usage:
+        ion32log [-o <output file>] <log file>
+        ion32log -c [-p] [-q] [-n <lines>] <log file A> <log file B>
+    Log files may be '-' for stdin.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../src/exec_log.h"
+
+
+/** Number of records read from file at a time */
+#define READ_BUFFER_RECORDS (64*1024)
+/** Max length of a text line; longer lines are handled in chunks */
+#define MAX_LINE_LEN        (256)
+/** Default number of lines of context shown before a mismatch */
+#define DEFAULT_CONTEXT     (8)
+/** Max number of lines of context */
+#define MAX_CONTEXT         (64)
+
+
+/** Log being read, text or binary */
+typedef struct s_log_reader {
+    const char *name;               /**< file name for messages */
+    FILE *f;                        /**< file or pipe being read */
+    int is_pipe;                    /**< f was opened with popen */
+    int binary;                     /**< log is made of t_log_records */
+    int swap;                       /**< records need byte swapping */
+    /** Bytes read while identifying a text log, to be read again */
+    char prefix[sizeof(t_log_header)];
+    size_t prefix_len, prefix_pos;
+    t_log_record *records;          /**< record buffer for binary logs */
+    size_t num_records, next_record;
+} t_log_reader;
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+static void usage(FILE *out){
+    fprintf(out,"Usage:\n");
+    fprintf(out,"    ion32log [-o <output file>] <log file>\n");
+    fprintf(out,"    ion32log -c [-p] [-q] [-n <lines>] <log file A> <log file B>\n");
+    fprintf(out,"Renders an ion32sim execution log as text (binary logs are\n");
+    fprintf(out,"rendered, text logs copied as they are), or with -c compares two\n");
+    fprintf(out,"logs of any format up to the first mismatch. Use '-' for stdin.\n");
+    fprintf(out,"Options:\n");
+    fprintf(out,"-c          : Compare logs; exit code is 0 if they match, 1 if not\n");
+    fprintf(out,"-p          : Logs match if one is a prefix of the other\n");
+    fprintf(out,"-q          : Don't print anything if the logs match\n");
+    fprintf(out,"-n <lines>  : Lines of context shown before a mismatch (default %d)\n",
+            DEFAULT_CONTEXT);
+}
+
+/** Open a pipe from gzip decompressing a file, or return NULL. */
+static FILE *open_gzip(const char *name){
+    char *cmd;
+    FILE *in;
+
+    if(strchr(name, '\'')!=NULL) return NULL;
+    cmd = malloc(strlen(name) + 32);
+    if(cmd==NULL) return NULL;
+    sprintf(cmd, "gzip -dc < '%s'", name);
+    in = popen(cmd, "r");
+    free(cmd);
+    return in;
+}
+
+/**
+    Open a log and find out its format.
+    Non-seekable files (pipes) are not checked for gzip compression.
+
+    @return 0 if the log could not be opened or is not supported.
+*/
+static int open_log(t_log_reader *r, const char *name){
+    t_log_header h;
+    size_t len;
+
+    memset(r, 0, sizeof(t_log_reader));
+    r->name = name;
+    r->f = (strcmp(name, "-")==0)? stdin : fopen(name, "rb");
+    if(r->f==NULL){
+        fprintf(stderr, "Error opening log file '%s'\n", name);
+        return 0;
+    }
+
+    len = fread(&h, 1, sizeof(h), r->f);
+    if(len>=2 && (uint8_t)h.magic[0]==0x1f && (uint8_t)h.magic[1]==0x8b &&
+       r->f!=stdin && fseek(r->f, 0, SEEK_SET)==0){
+        fclose(r->f);
+        r->f = open_gzip(name);
+        r->is_pipe = 1;
+        if(r->f==NULL){
+            fprintf(stderr, "Error decompressing log file '%s'\n", name);
+            return 0;
+        }
+        len = fread(&h, 1, sizeof(h), r->f);
+    }
+
+    if(len==sizeof(h) && log_check_header(&h, &r->swap)){
+        r->binary = 1;
+        r->records = malloc(READ_BUFFER_RECORDS * sizeof(t_log_record));
+        if(r->records==NULL){
+            fprintf(stderr, "Out of memory\n");
+            return 0;
+        }
+    }
+    else if(len>=sizeof(h.magic) &&
+            memcmp(h.magic, EXEC_LOG_MAGIC, sizeof(h.magic))==0){
+        fprintf(stderr, "Unsupported binary log format in '%s'\n", name);
+        return 0;
+    }
+    else{
+        memcpy(r->prefix, &h, len);
+        r->prefix_len = len;
+    }
+    return 1;
+}
+
+static void close_log(t_log_reader *r){
+    if(r->f!=NULL){
+        if(r->is_pipe) pclose(r->f);
+        else if(r->f!=stdin) fclose(r->f);
+    }
+    free(r->records);
+}
+
+/** Read next character of a text log. */
+static int text_getc(t_log_reader *r){
+    if(r->prefix_pos < r->prefix_len){
+        return (unsigned char)r->prefix[r->prefix_pos++];
+    }
+    return getc(r->f);
+}
+
+/**
+    Read next line of a log as text, including the newline if any.
+
+    @arg line Buffer of MAX_LINE_LEN chars at least.
+    @return Length of line, 0 at end of log.
+*/
+static size_t read_line(t_log_reader *r, char *line){
+    size_t len = 0;
+    int c;
+
+    if(r->binary){
+        if(r->next_record >= r->num_records){
+            r->num_records = fread(r->records, sizeof(t_log_record),
+                                   READ_BUFFER_RECORDS, r->f);
+            r->next_record = 0;
+            if(r->num_records==0) return 0;
+        }
+        if(r->swap) log_swap_record(&r->records[r->next_record]);
+        return log_format_record(line, &r->records[r->next_record++]);
+    }
+
+    while(len < MAX_LINE_LEN-1 && (c = text_getc(r))!=EOF){
+        line[len++] = c;
+        if(c=='\n') break;
+    }
+    line[len] = '\0';
+    return len;
+}
+
+/** Copy a log to output, rendered as text. */
+static int render_log(t_log_reader *r, FILE *out){
+    char buf[64*1024];
+    size_t n;
+
+    if(!r->binary){
+        /* Plain copy, much faster than line by line */
+        fwrite(r->prefix, 1, r->prefix_len, out);
+        while((n = fread(buf, 1, sizeof(buf), r->f)) > 0){
+            fwrite(buf, 1, n, out);
+        }
+    }
+    else{
+        while((n = read_line(r, buf)) > 0){
+            fwrite(buf, 1, n, out);
+        }
+    }
+    return ferror(r->f)? 2 : 0;
+}
+
+/** Remove leading and trailing whitespace from a line, in place. */
+static char *strip(char *line){
+    size_t len;
+
+    while(isspace((unsigned char)*line)) line++;
+    len = strlen(line);
+    while(len>0 && isspace((unsigned char)line[len-1])) line[--len] = '\0';
+    return line;
+}
+
+/** Get PC from a log line "(xxxxxxxx) ...". Returns 0 if not a PC line. */
+static int line_pc(const char *line, unsigned long *pc){
+    char *end;
+
+    if(line[0]!='(') return 0;
+    *pc = strtoul(line+1, &end, 16);
+    return (end==line+9) && (*end==')');
+}
+
+/**
+    Compare two logs line by line up to the first mismatch.
+    Lines are compared without leading or trailing whitespace.
+
+    @arg prefix If !=0, logs also match if one ends before the other.
+    @return 0 if the logs match, 1 otherwise.
+*/
+static int compare_logs(t_log_reader *a, t_log_reader *b, int prefix,
+                        int quiet, int context){
+    static char ctx[MAX_CONTEXT][MAX_LINE_LEN];
+    char la[MAX_LINE_LEN], lb[MAX_LINE_LEN];
+    char *sa, *sb;
+    size_t na, nb;
+    unsigned long line_num = 0, pc, last_pc = 0;
+    int have_pc = 0, i, first;
+
+    for(;;){
+        na = read_line(a, la);
+        nb = read_line(b, lb);
+        if(na==0 || nb==0) break;
+        line_num++;
+        sa = strip(la);
+        sb = strip(lb);
+        if(strcmp(sa, sb)!=0) break;
+
+        /* Remember the last few lines, and the last nonzero PC */
+        if(context > 0){
+            strcpy(ctx[line_num % context], sa);
+        }
+        if(line_pc(sa, &pc) && pc!=0){
+            last_pc = pc;
+            have_pc = 1;
+        }
+    }
+
+    if(na==0 && nb==0){
+        if(!quiet) printf("Execution logs match (%lu lines)\n", line_num);
+        return 0;
+    }
+    if(na==0 || nb==0){
+        if(prefix){
+            if(!quiet) printf("Execution logs match for %lu lines\n", line_num);
+            return 0;
+        }
+        printf("Execution log '%s' ends at line %lu, '%s' goes on\n",
+               (na==0)? a->name : b->name, line_num,
+               (na==0)? b->name : a->name);
+        return 1;
+    }
+
+    /* Report the PC of the offending line, or the last one we know of */
+    if((line_pc(sa, &pc) && pc!=0) || (line_pc(sb, &pc) && pc!=0)){
+        last_pc = pc;
+        have_pc = 1;
+    }
+    printf("Execution logs differ at line %lu", line_num);
+    if(have_pc) printf(", PC=0x%08lx", last_pc);
+    printf(":\n");
+    first = (line_num-1 > (unsigned long)context)? (int)(line_num-1-context) : 0;
+    for(i=first;i<(int)(line_num-1);i++){
+        printf("    %s\n", ctx[(i+1) % context]);
+    }
+    printf("<   %s    (%s)\n", sa, a->name);
+    printf(">   %s    (%s)\n", sb, b->name);
+    return 1;
+}
+
+
+/*---- Main function ---------------------------------------------------------*/
+
+int main(int argc, char **argv){
+    const char *names[2] = {NULL, NULL}, *out_name = NULL;
+    t_log_reader logs[2];
+    FILE *out;
+    int i, num_names = 0, compare = 0, prefix = 0, quiet = 0;
+    int context = DEFAULT_CONTEXT, retval;
+
+    for(i=1;i<argc;i++){
+        if(strcmp(argv[i],"-o")==0 && (i+1)<argc){
+            out_name = argv[++i];
+        }
+        else if(strcmp(argv[i],"-n")==0 && (i+1)<argc){
+            context = atoi(argv[++i]);
+            if(context < 0) context = 0;
+            if(context > MAX_CONTEXT) context = MAX_CONTEXT;
+        }
+        else if(strcmp(argv[i],"-c")==0){
+            compare = 1;
+        }
+        else if(strcmp(argv[i],"-p")==0){
+            prefix = 1;
+        }
+        else if(strcmp(argv[i],"-q")==0){
+            quiet = 1;
+        }
+        else if((strcmp(argv[i],"--help")==0)||(strcmp(argv[i],"-h")==0)){
+            usage(stdout);
+            exit(0);
+        }
+        else if(num_names < 2 && (argv[i][0]!='-' || argv[i][1]=='\0')){
+            names[num_names++] = argv[i];
+        }
+        else{
+            fprintf(stderr,"unknown argument '%s'\n\n",argv[i]);
+            usage(stderr);
+            exit(64);
+        }
+    }
+    if(num_names != (compare? 2 : 1)){
+        usage(stderr);
+        exit(64);
+    }
+
+    for(i=0;i<num_names;i++){
+        if(!open_log(&logs[i], names[i])){
+            exit(2);
+        }
+    }
+
+    if(compare){
+        retval = compare_logs(&logs[0], &logs[1], prefix, quiet, context);
+    }
+    else{
+        out = (out_name==NULL)? stdout : fopen(out_name, "w");
+        if(out==NULL){
+            fprintf(stderr, "Error opening output file '%s'\n", out_name);
+            exit(2);
+        }
+        retval = render_log(&logs[0], out);
+        if(out!=stdout) fclose(out);
+    }
+
+    for(i=0;i<num_names;i++){
+        close_log(&logs[i]);
+    }
+    return retval;
+}
@@ -0,0 +1,170 @@
+/**
+    @file ion32sim_vpi.c
+    @brief VPI module for lockstep co-simulation of the RTL against ion32sim.
+
+    Gives a Verilog test bench access to the co-simulation API of libion32sim
+    (see src/cosim.c) through these system functions:
+
+        $ion32sim_init(args)
+            Set up the CPU model. 'args' is a string with the ion32sim command
+            line options, separated by spaces. Returns 1 on success, 0 if the
+            CPU model could not be set up.
+
+        $ion32sim_check(kind, pc, address, size, value)
+            Check an event that would go in the RTL execution log against the
+            next one logged by the CPU model. Arguments are the fields of a
+            t_log_record (see src/exec_log.h). Returns 1 if they match, 0 if
+            they don't; in that case a report has already been printed.
+
+    The CPU model is freed and a summary printed at the end of simulation.
+
+    Built with Icarus Verilog's iverilog-vpi (see sim/iv/Makefile) and loaded
+    with 'vvp -M<dir> -mion32sim'. Only IEEE 1364 VPI routines are used.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vpi_user.h>
+
+#include "ion32sim.h"
+
+
+/** Max number of options in the argument of $ion32sim_init */
+#define MAX_ARGS        (64)
+
+
+/** Co-simulation being run, if any */
+static t_cosim *cosim = NULL;
+/** Copy of the argument of $ion32sim_init; argv points into it */
+static char *init_args = NULL;
+
+
+/*---- Local functions -------------------------------------------------------*/
+
+/** Return the value of a system function argument as an integer. */
+static PLI_INT32 arg_int(vpiHandle arg){
+    s_vpi_value v;
+
+    v.format = vpiIntVal;
+    vpi_get_value(arg, &v);
+    return v.value.integer;
+}
+
+/** Set the return value of a system function call. */
+static void return_int(vpiHandle call, PLI_INT32 value){
+    s_vpi_value v;
+
+    v.format = vpiIntVal;
+    v.value.integer = value;
+    vpi_put_value(call, &v, NULL, vpiNoDelay);
+}
+
+/** End of simulation callback: print summary and free the CPU model. */
+static PLI_INT32 end_of_sim(p_cb_data data){
+    if(cosim!=NULL){
+        cosim_close(cosim);
+        cosim = NULL;
+    }
+    free(init_args);
+    init_args = NULL;
+    return 0;
+}
+
+static PLI_INT32 init_calltf(PLI_BYTE8 *user_data){
+    vpiHandle call, args, arg;
+    s_vpi_value v;
+    s_cb_data cb;
+    char *argv[MAX_ARGS], *p;
+    int argc = 0;
+
+    call = vpi_handle(vpiSysTfCall, NULL);
+    args = vpi_iterate(vpiArgument, call);
+    arg = (args!=NULL)? vpi_scan(args) : NULL;
+    if(arg==NULL || cosim!=NULL){
+        vpi_printf("$ion32sim_init: needs one argument, to be called once\n");
+        return_int(call, 0);
+        return 0;
+    }
+    vpi_free_object(args);
+
+    v.format = vpiStringVal;
+    vpi_get_value(arg, &v);
+    init_args = strdup(v.value.str);
+    if(init_args==NULL){
+        return_int(call, 0);
+        return 0;
+    }
+
+    /* Split argument into an ion32sim command line */
+    argv[argc++] = "ion32sim";
+    for(p = strtok(init_args, " \t"); p!=NULL && argc < MAX_ARGS;
+        p = strtok(NULL, " \t")){
+        argv[argc++] = p;
+    }
+
+    cosim = cosim_open(argc, argv);
+    if(cosim!=NULL){
+        memset(&cb, 0, sizeof(cb));
+        cb.reason = cbEndOfSimulation;
+        cb.cb_rtn = end_of_sim;
+        vpi_register_cb(&cb);
+    }
+    return_int(call, cosim!=NULL);
+    return 0;
+}
+
+static PLI_INT32 check_calltf(PLI_BYTE8 *user_data){
+    vpiHandle call, args, arg;
+    PLI_INT32 fields[5];
+    t_log_record r;
+    int i;
+
+    call = vpi_handle(vpiSysTfCall, NULL);
+    args = vpi_iterate(vpiArgument, call);
+    for(i=0;i<5;i++){
+        arg = (args!=NULL)? vpi_scan(args) : NULL;
+        if(arg==NULL) break;
+        fields[i] = arg_int(arg);
+    }
+    if(arg!=NULL && args!=NULL){
+        vpi_free_object(args);
+    }
+    if(i<5 || cosim==NULL){
+        vpi_printf("$ion32sim_check: needs 5 arguments and $ion32sim_init\n");
+        return_int(call, 0);
+        return 0;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.kind = fields[0];
+    r.pc = fields[1];
+    r.address = fields[2];
+    r.size = fields[3];
+    r.value = fields[4];
+    return_int(call, cosim_check(cosim, &r));
+    return 0;
+}
+
+static void register_tasks(void){
+    s_vpi_systf_data tf;
+
+    memset(&tf, 0, sizeof(tf));
+    tf.type = vpiSysFunc;
+    tf.sysfunctype = vpiIntFunc;
+    tf.tfname = "$ion32sim_init";
+    tf.calltf = init_calltf;
+    vpi_register_systf(&tf);
+
+    tf.tfname = "$ion32sim_check";
+    tf.calltf = check_calltf;
+    vpi_register_systf(&tf);
+}
+
+
+/*---- VPI entry point -------------------------------------------------------*/
+
+void (*vlog_startup_routines[])(void) = {
+    register_tasks,
+    0
+};
@@ -9,3 +9,5 @@ MODELSIM_EXEC_PATH = "D:/dev/FPGA/Modelsim-ASE/modelsim_ase/win32aloem/vsim.exe"
 # Software simulator executable, relative path (with extension if in win32).
 SWSIM_EXEC_PATH = "../../tools/ion32sim/bin/ion32sim.exe"
 
+# Execution log tool (renders binary ISS logs), relative path.
+LOG_TOOL_EXEC_PATH = "../../tools/ion32sim/bin/ion32log.exe"
@@ -15,7 +15,7 @@ def usage(progname, to_stdout=False):
     else:
         file = sys.stdout
     
-    print >> file, "usage: %s {[-t testname] | [-r --regression]} [options]"
+    print >> file, "usage: %s {[-t testname] | [--regression [testname...]]} [options]"
     
 def help():
     """Print a bit of help text longer than the usage message."""
@@ -24,13 +24,25 @@ def help():
 def main(argv):
     """ """
 
-    parser = OptionParser("usage: %prog [options] testname")
+    parser = OptionParser("usage: %prog [options] testname\n"
+                          "       %prog --regression [options] [testname...]")
     parser.add_option("--tb", dest="tbname",
         default="ion_core",
         help="use RTL testbench NAME", metavar="NAME")
     parser.add_option("--regression", dest="regression",
-        default=None,
-        help="execute regression list in FILE", metavar="FILE")
+        action="store_true", default=False,
+        help="run the given tests, or all tests in ../../sw, in parallel")
+    parser.add_option("-j", "--jobs", dest="jobs",
+        type="int", default=None,
+        help="run up to N regression tests at a time (default: # of CPUs)", 
+        metavar="N")
+    parser.add_option("--rtlsim", dest="rtlsim",
+        type="choice", choices=["iverilog", "verilator"], default="iverilog",
+        help="RTL simulator for regression runs, iverilog or verilator")
+    parser.add_option("--timeout", dest="timeout",
+        type="int", default=80000,
+        help="RTL simulation timeout in clock cycles for regression runs", 
+        metavar="CYCLES")
     parser.add_option("-q", "--quiet",
         action="store_true", dest="quiet", default=False,
         help="don't print build and simulation output to console")
@@ -43,10 +55,22 @@ def main(argv):
     parser.add_option("-s", "--sw",
         action="store_true", dest="only_sw", default=False,
         help="run only software simulation")
+    parser.add_option("-b", "--binlog",
+        action="store_true", dest="binary_log", default=False,
+        help="make the software simulator write a binary execution log")
     (opts, args) = parser.parse_args()
     
-    if not opts.regression and len(args) != 1:
-        print >> sys.stderr, "Error: Must specify a test name or a regression list file.\n"
+    if opts.regression:
+        passed = test.run_regression(args, 
+            jobs=opts.jobs,
+            rtlsim=opts.rtlsim,
+            check_output=opts.check_exit,
+            timeout=opts.timeout,
+            quiet=opts.quiet)
+        sys.exit(0 if passed else 1)
+    
+    if len(args) != 1:
+        print >> sys.stderr, "Error: Must specify a test name or --regression.\n"
         parser.print_help()
         sys.exit(1)
         
@@ -54,7 +78,8 @@ def main(argv):
         hw=not opts.only_sw,
         sw=not opts.only_rtl,
         quiet=opts.quiet, 
-        check_output=opts.check_exit)
+        check_output=opts.check_exit,
+        binary_log=opts.binary_log)
     
     
 if __name__ == "__main__":
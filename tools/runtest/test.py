@@ -12,6 +12,10 @@ import os
 import getopt
 import subprocess
 import difflib
+import re
+import time
+import threading
+import multiprocessing
 from config import *
 
 
@@ -22,11 +26,22 @@ from config import *
 MODELSIM_WORK_PATH = "../../sim/modelsim"
 # Root directory for the software test cases.
 TEST_ROOT_PATH = "../../sw"
+# Directories under TEST_ROOT_PATH that have a Makefile but are no test
+# cases: the benchmark suite runs for millions of cycles (see 'make bench').
+NON_TEST_DIRS = ["bench"]
+# Root directory for the per-test work directories of regression runs.
+REGRESSION_WORK_PATH = "../../sim/regression"
+# Directory of the RTL sources and of the iverilog/Verilator makefile.
+RTL_ROOT_PATH = "../../src"
+RTL_MAKE_PATH = "../../sim/iv"
 
 # Names of log files, embedded into the RTL, makefiles and/or sw simulator source.
+RTL_SIM_LOG_FILE = "rtl_sim_log.txt"
+RTL_SIM_CONSOLE_LOG_FILE = "console_log.txt"
 RTL_CONSOLE_LOG_FILE = "hw_sim_console_log.txt" 
 RTL_EXECUTION_LOG_FILE = "hw_sim_log.txt"
 SW_EXECUTION_LOG_FILE = "sw_sim_log.txt"
+SW_BINARY_EXECUTION_LOG_FILE = "sw_sim_log.bin"
 SW_CONSOLE_LOG_FILE = "console_log.txt" 
 
 
@@ -36,26 +51,69 @@ SW_CONSOLE_LOG_FILE = "console_log.txt"
 CC = "\033[1;33m"
 CF = "\033[0m"
 
+# Magic string at the start of binary execution logs (see exec_log.h).
+BINARY_LOG_MAGIC = "ION32LOG"
+# Magic number at the start of gzip-compressed logs.
+GZIP_MAGIC = "\x1f\x8b"
 
 
-def eval_exec_log(filename):
-    """Parse execution log looking for memory stores on TB register TB_MSG_REG.
-    Return value written by SW on register TB_MSG_REG or -1 if there was no write.
+
+def exec_log_lines(filename):
+    """Iterate over the lines of an execution log, text or binary.
+    
+    Binary or compressed logs written by ion32sim are rendered as text with 
+    the log tool. The log is read as a stream, never as a whole.
     """
     
-    file = open(filename, 'r')
-    lines = file.readlines()
+    file = open(filename, 'rb')
+    magic = file.read(len(BINARY_LOG_MAGIC))
     file.close()
     
-    for i in reversed(range(len(lines))):
-        line = lines[i].strip()
+    if (magic == BINARY_LOG_MAGIC or 
+        magic[:2] == GZIP_MAGIC):
+        sp = subprocess.Popen([LOG_TOOL_EXEC_PATH, filename],
+            stdout=subprocess.PIPE, universal_newlines=True)
+        for line in sp.stdout:
+            yield line
+        sp.stdout.close()
+        if sp.wait() != 0:
+            print "Could not render binary log '%s'." % filename
+    else:
+        file = open(filename, 'r')
+        for line in file:
+            yield line
+        file.close()
+
+
+def find_sw_exec_log(test_case_dir):
+    """Return the name of the ISS execution log in a test case directory.
+    
+    That's the binary log if there is one, or the text log otherwise.
+    """
+    binary_log_file = test_case_dir + "/" + SW_BINARY_EXECUTION_LOG_FILE
+    if os.path.exists(binary_log_file):
+        return binary_log_file
+    return test_case_dir + "/" + SW_EXECUTION_LOG_FILE
+
+
+def eval_exec_log(filename):
+    """Parse execution log looking for memory stores on TB register TB_MSG_REG.
+    Return last value written by SW on register TB_MSG_REG or -1 if there was 
+    no write.
+    """
+    
+    num_errors = -1
+    for line in exec_log_lines(filename):
+        line = line.strip()
         if line.endswith("WR"):
             items = line.split()
-            if len(items)>=3 and items[1]=="[FFFF8018]":
+            if len(items)>=3 and items[1].upper()=="[FFFF8018]":
                 fields = items[2].split('=')
                 if len(fields)==2:
                     num_errors = int("0x"+fields[1],0)
-                    return num_errors
+    
+    if num_errors >= 0:
+        return num_errors
     
     # Could find no write to the TB_MSG_REG register, so the test failed.
     return -1
@@ -201,11 +259,12 @@ def sw_build(tbname, progname, quiet=False):
         
         
 
-def sw_sim(tbname, progname, quiet=False, check_output=True):
+def sw_sim(tbname, progname, quiet=False, check_output=True, binary_log=False):
     """Run some test program on the SW simulator.
     
     The execution log will conditionally be used to determine the 
-    pass/fail outcome of the test.
+    pass/fail outcome of the test. If binary_log==True, the simulator will 
+    write a binary execution log instead of a text one.
     
     Returns True for pass or False for fail.
     """
@@ -214,11 +273,16 @@ def sw_sim(tbname, progname, quiet=False, check_output=True):
     
     # Build the path and file names.
     test_case_dir = TEST_ROOT_PATH + "/" + progname 
-    exec_log_file = test_case_dir + "/" + SW_EXECUTION_LOG_FILE
+    if binary_log:
+        exec_log_file = test_case_dir + "/" + SW_BINARY_EXECUTION_LOG_FILE
+    else:
+        exec_log_file = test_case_dir + "/" + SW_EXECUTION_LOG_FILE
     console_log_file = test_case_dir + "/" + SW_CONSOLE_LOG_FILE
     
-    # Delete log files if they exist.
+    # Delete log files if they exist, including a log of the other format.
     delete_log_files(exec_log_file, console_log_file)
+    delete_log_files(test_case_dir + "/" + SW_EXECUTION_LOG_FILE,
+                     test_case_dir + "/" + SW_BINARY_EXECUTION_LOG_FILE)
     
     if not quiet:
         redir_stderr = None
@@ -236,6 +300,7 @@ def sw_sim(tbname, progname, quiet=False, check_output=True):
         "--map=%s.map" % progname, 
         "--trace_log=trace_log.txt"]
     if quiet: command.append("--conout=console_log.txt")
+    if binary_log: command.append("--binlog")
     out = ""
     err = ""
     try:
@@ -261,39 +326,35 @@ def sw_sim(tbname, progname, quiet=False, check_output=True):
     return outcome
 
 def compare_exec_logs(tbname, progname, match_sizes=True):
-    """ """
+    """Compare SW and RTL execution logs with the log tool.
+    
+    The logs are streamed and compared up to the first mismatch, which the log
+    tool reports along with a few lines of context and the offending PC.
+    If match_sizes==False, the logs match if one is a prefix of the other.
+    
+    Returns True if the logs match.
+    """
     
     # Build the log file names.
     test_case_dir = TEST_ROOT_PATH + "/" + progname 
-    sw_exec_log_file = test_case_dir + "/" + SW_EXECUTION_LOG_FILE
+    sw_exec_log_file = find_sw_exec_log(test_case_dir)
     testbench_work_dir = MODELSIM_WORK_PATH + "/" + tbname 
     hw_exec_log_file = testbench_work_dir + "/" + RTL_EXECUTION_LOG_FILE
     
-    error = None
+    command = [LOG_TOOL_EXEC_PATH, "-c", "-q"]
+    if not match_sizes:
+        command.append("-p")
+    command += [hw_exec_log_file, sw_exec_log_file]
     
     try:
-        file = open(hw_exec_log_file, 'r')
-        hw_lines = file.readlines()
-        file.close()
-        file = open(sw_exec_log_file, 'r')
-        sw_lines = file.readlines()
-        file.close() 
-        
-        if (len(hw_lines) != len(sw_lines)) and match_sizes:
-            error = "Different number of lines."
-        else:
-            for i in range(len(hw_lines)):
-                if hw_lines[i].strip() != sw_lines[i].strip():
-                    error = "@%d: %s != %s" % (i, hw_lines[i].strip(), sw_lines[i].strip())
-                    break
-        
+        retcode = subprocess.call(command)
     except Exception as e:
         raise e
 
-    if error:
-        print "Exec log mismatch -- %s\033[0m" % error
+    if retcode != 0:
+        print "Exec log mismatch\033[0m"
             
-    return error==None
+    return retcode==0
     
 def print_outcome(tbname, progname, passed):
     """Print pass/fail message to stderr."""
@@ -317,7 +378,8 @@ def testbench_exists(tbname):
     return os.path.exists(testbench_work_dir)
     
     
-def run(tbname, progname, quiet=False, check_output=True, hw=True, sw=True):
+def run(tbname, progname, quiet=False, check_output=True, hw=True, sw=True,
+        binary_log=False):
     """Run a test on SW simulator AND on RTL simulator, compare logs. 
     
     This function will do the following:
@@ -332,6 +394,7 @@ def run(tbname, progname, quiet=False, check_output=True, hw=True, sw=True):
     The program 'exit code' is the last value written on register 0xffff8018.
     It is assumed to be an error count so it must be zero for the test to pass.
     If check_output==False, then the program exit code is not checked.
+    If binary_log==True, the SW simulator writes a binary execution log.
     
     The function will print relevant progfress and outcome messages, plus the
     entire simulation output if quiet==False.
@@ -353,7 +416,8 @@ def run(tbname, progname, quiet=False, check_output=True, hw=True, sw=True):
     if not passed:
         return False
     if sw:
-        passed &= sw_sim(tbname, progname, quiet=quiet, check_output=check_output)
+        passed &= sw_sim(tbname, progname, quiet=quiet, check_output=check_output,
+                         binary_log=binary_log)
         if not passed:
             return False
     if hw:
@@ -367,3 +431,253 @@ def run(tbname, progname, quiet=False, check_output=True, hw=True, sw=True):
     print_outcome(tbname, progname, passed)
     
     return passed
+
+
+#### Regression runner.
+#
+# Runs every test case found under TEST_ROOT_PATH, or a given list of them, on 
+# the SW simulator and on iverilog or Verilator, several test cases at a time. 
+# Each test runs in its own work dir under REGRESSION_WORK_PATH so that logs 
+# don't clash. The Modelsim flow is not supported here: its TB work dirs are 
+# fixed and shared by all test cases.
+
+
+class TestResult:
+    """Outcome and statistics of one test case in a regression run."""
+    
+    def __init__(self, progname):
+        self.progname = progname
+        self.passed = False
+        self.reason = "not run"
+        self.sw_time = 0.0
+        self.hw_time = 0.0
+        self.instructions = 0
+
+
+def discover_tests():
+    """Return the sorted names of all test cases under TEST_ROOT_PATH.
+    
+    A test case is any directory with a Makefile in it, except those in
+    NON_TEST_DIRS.
+    """
+    tests = []
+    for name in os.listdir(TEST_ROOT_PATH):
+        if name in NON_TEST_DIRS:
+            continue
+        if os.path.isfile(os.path.join(TEST_ROOT_PATH, name, "Makefile")):
+            tests.append(name)
+    return sorted(tests)
+
+
+def run_logged(command, work_dir, log_name):
+    """Run a command within a work dir, output to a file in the same dir.
+    
+    Returns a tuple (exit code, wall time in seconds).
+    """
+    
+    log = open(os.path.join(work_dir, log_name), "w")
+    start = time.time()
+    try:
+        retcode = subprocess.call(command, cwd=work_dir, 
+                                  stdout=log, stderr=subprocess.STDOUT)
+    except OSError as e:
+        print >> log, "Could not run '%s': %s" % (command[0], e)
+        retcode = -1
+    elapsed = time.time() - start
+    log.close()
+    return (retcode, elapsed)
+
+
+def count_instructions(work_dir, log_name):
+    """Return # of simulated instructions reported by ion32sim, or 0."""
+    
+    count = 0
+    for line in open(os.path.join(work_dir, log_name)):
+        m = re.match(r"(\d+) instructions simulated", line)
+        if m:
+            count = int(m.group(1))
+    return count
+
+
+def build_verilator_model(quiet=False):
+    """Build the Verilator model once for all test cases of a regression.
+    
+    Returns the absolute path of the model executable, or None on error.
+    """
+    
+    exe = os.path.abspath(RTL_MAKE_PATH + "/obj_dir/Vtb_cpu_vl")
+    if quiet:
+        redir = open(os.devnull, "w")
+    else:
+        redir = None
+    retcode = subprocess.call(["make", "obj_dir/Vtb_cpu_vl"], 
+                              cwd=RTL_MAKE_PATH, stdout=redir, stderr=redir)
+    if retcode != 0:
+        print >> sys.stderr, "Verilator model build failed."
+        return None
+    return exe
+
+
+def regression_test(progname, rtlsim, rtl_exe, check_output=True, 
+                    timeout=80000):
+    """Build and run a test case on SW and RTL simulators in its own work dir.
+    
+    All output goes to files in the work dir. Returns a TestResult.
+    """
+    
+    res = TestResult(progname)
+    test_case_dir = os.path.abspath(TEST_ROOT_PATH + "/" + progname)
+    work_dir = os.path.abspath(REGRESSION_WORK_PATH + "/" + progname)
+    if not os.path.isdir(work_dir):
+        os.makedirs(work_dir)
+    
+    # Build the test program.
+    (retcode, t) = run_logged(["make", "-C", test_case_dir, "all"], 
+                              work_dir, "build_log.txt")
+    if retcode != 0:
+        res.reason = "build failed"
+        return res
+    
+    # Run on the SW simulator.
+    command = [
+        os.path.abspath(SWSIM_EXEC_PATH), 
+        "--bram=%s/software.bin" % test_case_dir, 
+        "--noprompt",
+        "--conout=sw_" + RTL_SIM_CONSOLE_LOG_FILE]
+    (retcode, res.sw_time) = run_logged(command, work_dir, "sw_sim_output.txt")
+    res.instructions = count_instructions(work_dir, "sw_sim_output.txt")
+    if retcode != 0:
+        res.reason = "SW simulation error %d" % retcode
+        return res
+    
+    # Run on the RTL simulator.
+    if rtlsim == "verilator":
+        command = [rtl_exe, "--timeout=%d" % timeout, 
+                   test_case_dir + "/software.hex"]
+    else:
+        command = [
+            "iverilog", "-g2005", "-o", "testbench.exe",
+            "-DTEST=%s" % progname,
+            "-DSWDIR=\"%s/\"" % os.path.abspath(TEST_ROOT_PATH),
+            "-DTIMEOUT=%d" % timeout,
+            os.path.abspath(RTL_ROOT_PATH + "/testbench/tb_cpu.v"),
+            os.path.abspath(RTL_ROOT_PATH + "/rtl/cpu.v")]
+        (retcode, t) = run_logged(command, work_dir, "rtl_build_log.txt")
+        if retcode != 0:
+            res.reason = "RTL build failed"
+            return res
+        command = ["vvp", "-N", "testbench.exe"]
+    (retcode, res.hw_time) = run_logged(command, work_dir, "rtl_sim_output.txt")
+    if retcode != 0:
+        res.reason = "RTL simulation error %d" % retcode
+        return res
+    
+    # Compare execution logs and check the program exit code.
+    sw_log = work_dir + "/" + SW_EXECUTION_LOG_FILE
+    hw_log = work_dir + "/" + RTL_SIM_LOG_FILE
+    command = [os.path.abspath(LOG_TOOL_EXEC_PATH), "-c", hw_log, sw_log]
+    (retcode, t) = run_logged(command, work_dir, "compare_log.txt")
+    if retcode != 0:
+        res.reason = "exec log mismatch"
+        return res
+    if check_output:
+        num_errors = eval_exec_log(hw_log)
+        if num_errors < 0:
+            res.reason = "no exit code, crash suspected"
+            return res
+        elif num_errors > 0:
+            res.reason = "SW reported %d errors" % num_errors
+            return res
+    
+    res.passed = True
+    res.reason = ""
+    return res
+
+
+def ips(instructions, seconds):
+    """Format a simulation speed in instructions per second."""
+    if seconds <= 0 or instructions == 0:
+        return "-"
+    return "%.0f" % (instructions / seconds)
+
+
+def print_regression_summary(results, wall_time):
+    """Print a table with the outcome and speed of each test case."""
+    
+    print
+    print "%-16s %-6s %9s %9s %12s %12s %12s" % (
+        "Test", "Result", "SW time", "RTL time", "Insns", "SW IPS", "RTL IPS")
+    for res in results:
+        print "%-16s %-6s %8.2fs %8.2fs %12d %12s %12s" % (
+            res.progname, 
+            "PASS" if res.passed else "FAIL",
+            res.sw_time, res.hw_time, res.instructions, 
+            ips(res.instructions, res.sw_time), 
+            ips(res.instructions, res.hw_time))
+        if not res.passed:
+            print "    %s (see %s/%s)" % (
+                res.reason, REGRESSION_WORK_PATH, res.progname)
+    failed = len([res for res in results if not res.passed])
+    print
+    print "%d tests, %d failed, %.2fs wall time." % (
+        len(results), failed, wall_time)
+
+
+def run_regression(tests=None, jobs=None, rtlsim="iverilog", 
+                   check_output=True, timeout=80000, quiet=False):
+    """Run a list of test cases (all of them if None) in parallel.
+    
+    Up to 'jobs' test cases are run at the same time, one per CPU by default.
+    Each test is built, run on the SW simulator and on the RTL simulator 
+    'rtlsim' ("iverilog" or "verilator") and the execution logs compared, as 
+    in run().
+    
+    Returns True if all test cases passed.
+    """
+    
+    if tests is None or len(tests) == 0:
+        tests = discover_tests()
+    for progname in tests:
+        if not test_case_exists(progname):
+            print >> sys.stderr, "Error: could not find test program '%s'" % progname
+            sys.exit(1)
+    if jobs is None or jobs < 1:
+        jobs = multiprocessing.cpu_count()
+    
+    rtl_exe = None
+    if rtlsim == "verilator":
+        rtl_exe = build_verilator_model(quiet=quiet)
+        if rtl_exe is None:
+            return False
+    
+    print (CC+"Running %d test cases, %d at a time, on ion32sim and %s..."+CF) % (
+        len(tests), jobs, rtlsim)
+    
+    start = time.time()
+    pending = list(tests)
+    results = {}
+    lock = threading.Lock()
+    
+    def worker():
+        while True:
+            with lock:
+                if not pending:
+                    return
+                progname = pending.pop(0)
+            res = regression_test(progname, rtlsim, rtl_exe, 
+                                  check_output=check_output, timeout=timeout)
+            with lock:
+                results[progname] = res
+                print_outcome(None, progname, res.passed)
+    
+    threads = [threading.Thread(target=worker) 
+               for i in range(min(jobs, len(tests)))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    
+    results = [results[progname] for progname in tests]
+    print_regression_summary(results, time.time() - start)
+    
+    return all(res.passed for res in results)